@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "../core/event.h"
+
+/*
+ * The event backends on a frame loop: a timer ticks every -i us, every
+ * tick reads a block of a file through event_read() and a thread writes
+ * timestamps into a pipe every -p us. Reported are the syscalls per frame,
+ * counting the reads done by the handlers, and the latency from the pipe
+ * write to its handler.
+ */
+
+#define BENCH_READ_LEN 4096
+
+struct bench {
+  int frames;
+  int timer_id;
+  int read_id;
+  int file_fd;
+  int pipe_fds[2];
+  uint64_t pipe_interval_ns;
+  char buf[BENCH_READ_LEN];
+  /* results */
+  int frame_count;
+  uint64_t bytes_read;
+  uint64_t handler_syscalls;
+  uint64_t wakeups;
+  uint64_t latency_ns;
+  uint64_t latency_max_ns;
+  /* states */
+  bool stop;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *bench_producer(void *data) {
+  struct bench *b = (struct bench *)data;
+  struct timespec ts = {
+    .tv_sec = b->pipe_interval_ns / 1000000000ull,
+    .tv_nsec = b->pipe_interval_ns % 1000000000ull,
+  };
+  while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+    uint64_t stamp = now_ns();
+    if (write(b->pipe_fds[1], &stamp, sizeof(stamp)) != sizeof(stamp))
+      break;
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+static int bench_frame(struct event_dispatcher *ed, struct event *ev,
+                       void *data) {
+  struct bench *b = (struct bench *)data;
+  (void)ev;
+  b->frame_count++;
+  if (b->frame_count >= b->frames) {
+    event_dispatcher_quit(ed);
+    return 0;
+  }
+  event_read(ed, b->read_id, b->file_fd, b->buf, BENCH_READ_LEN, 0);
+  return 0;
+}
+
+static int bench_read_done(struct event_dispatcher *ed, struct event *ev,
+                           void *data) {
+  struct bench *b = (struct bench *)data;
+  (void)ed;
+  if (!(ev->revents & EPOLLERR))
+    b->bytes_read += ev->value;
+  return 0;
+}
+
+static int bench_pipe(struct event_dispatcher *ed, struct event *ev,
+                      void *data) {
+  struct bench *b = (struct bench *)data;
+  uint64_t stamps[64];
+  uint64_t now;
+  ssize_t ret;
+
+  (void)ed;
+  (void)ev;
+  b->handler_syscalls++;
+  ret = read(b->pipe_fds[0], stamps, sizeof(stamps));
+  if (ret <= 0)
+    return 0;
+  now = now_ns();
+  for (size_t i = 0; i < (size_t)ret / sizeof(uint64_t); i++) {
+    uint64_t latency = now - stamps[i];
+    b->latency_ns += latency;
+    if (latency > b->latency_max_ns)
+      b->latency_max_ns = latency;
+    b->wakeups++;
+  }
+  return 0;
+}
+
+static int bench_backend(enum event_backend backend, int frames,
+                         uint64_t interval_ns, uint64_t pipe_interval_ns,
+                         const char *path) {
+  struct event_dispatcher *ed = NULL;
+  struct event_dispatcher_stats stats;
+  struct bench b = {
+    .frames = frames,
+    .file_fd = -1,
+    .pipe_fds = {-1, -1},
+    .pipe_interval_ns = pipe_interval_ns,
+  };
+  pthread_t producer;
+  uint64_t start;
+  int pipe_id;
+  int ret = 1;
+
+  ed = event_dispatcher_make_backend(backend);
+  if (!ed)
+    return 1;
+  b.file_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (b.file_fd < 0) {
+    err_log("%s: failed to open %s\n", __func__, path);
+    goto out;
+  }
+  if (pipe2(b.pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    err_log("%s: failed to create a pipe\n", __func__);
+    goto out;
+  }
+  b.timer_id = event_provide_timer(ed, interval_ns, interval_ns);
+  b.read_id = event_provide(ed, EVENT_TYPE_READ);
+  pipe_id = event_provide_fd(ed, b.pipe_fds[0], EPOLLIN);
+  if (b.timer_id < 0 || b.read_id < 0 || pipe_id < 0 ||
+      subscribe_event_source(ed, b.timer_id, bench_frame, &b) ||
+      subscribe_event_source(ed, b.read_id, bench_read_done, &b) ||
+      subscribe_event_source(ed, pipe_id, bench_pipe, &b))
+    goto out;
+
+  if (pthread_create(&producer, NULL, bench_producer, &b)) {
+    err_log("%s: failed to start the producer\n", __func__);
+    goto out;
+  }
+  start = now_ns();
+  while (!event_dispatcher_should_quit(ed))
+    event_dispatcher_run_once(ed, -1);
+  start = now_ns() - start;
+  __atomic_store_n(&b.stop, true, __ATOMIC_RELEASE);
+  pthread_join(producer, NULL);
+
+  event_dispatcher_get_stats(ed, &stats);
+  log("%s: frames: %d, %.2f ms, syscalls/frame: %.2f, waits/frame: %.2f, "
+      "read: %lu KiB, wakeups: %lu, latency avg: %.1f us, max: %.1f us\n",
+      event_dispatcher_backend_name(ed), b.frame_count, start / 1e6,
+      (double)(stats.syscalls + b.handler_syscalls) / b.frame_count,
+      (double)stats.waits / b.frame_count, (unsigned long)(b.bytes_read >> 10),
+      (unsigned long)b.wakeups,
+      b.wakeups ? b.latency_ns / 1e3 / b.wakeups : 0.0,
+      b.latency_max_ns / 1e3);
+  ret = 0;
+out:
+  event_dispatcher_free(&ed);
+  if (b.pipe_fds[0] >= 0) {
+    close(b.pipe_fds[0]);
+    close(b.pipe_fds[1]);
+  }
+  if (b.file_fd >= 0)
+    close(b.file_fd);
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  int frames = 500;
+  uint64_t interval_us = 1000;
+  uint64_t pipe_interval_us = 3000;
+  int opt;
+  int ret = 0;
+
+  while ((opt = getopt(argc, argv, "f:i:p:")) != -1) {
+    switch (opt) {
+    case 'f':
+      frames = atoi(optarg);
+      break;
+    case 'i':
+      interval_us = strtoull(optarg, NULL, 10);
+      break;
+    case 'p':
+      pipe_interval_us = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      err_log("usage: %s [-f frames] [-i frame us] [-p pipe write us]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (frames < 1 || interval_us < 1 || pipe_interval_us < 1) {
+    err_log("%s: invalid arguments\n", __func__);
+    return 1;
+  }
+
+  /* the binary itself is the file read every frame */
+  ret |= bench_backend(EVENT_BACKEND_EPOLL, frames, interval_us * 1000,
+                       pipe_interval_us * 1000, "/proc/self/exe");
+  if (bench_backend(EVENT_BACKEND_IO_URING, frames, interval_us * 1000,
+                    pipe_interval_us * 1000, "/proc/self/exe"))
+    log("io_uring: not available\n");
+  return ret;
+}
@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "../core/job.h"
+
+/*
+ * How the job system scales: a compute bound parallel_for and a flood
+ * of tiny jobs, for every power of two threads up to -t (the online cpus
+ * by default). The best of -r runs is reported.
+ */
+
+#define BENCH_ITEMS (1 << 18)
+#define BENCH_GRAIN 256
+#define BENCH_ROUNDS 64 // xorshift rounds per item
+#define BENCH_TINY_JOBS 100000
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_range(void *data, int begin, int end) {
+  uint32_t *out = (uint32_t *)data;
+  for (int i = begin; i < end; i++) {
+    uint32_t x = i + 1;
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+    }
+    out[i] = x;
+  }
+}
+
+static void bench_tiny(struct job_system *js, void *data) {
+  (void)js;
+  __atomic_add_fetch((int *)data, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t bench_checksum(const uint32_t *out) {
+  uint32_t sum = 0;
+  for (int i = 0; i < BENCH_ITEMS; i++)
+    sum += out[i];
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = cpus > 0 ? (int)cpus : 1;
+  int runs = 5;
+  uint32_t *out = NULL;
+  uint32_t expected = 0;
+  double base_ms = 0.0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:r:")) != -1) {
+    switch (opt) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    default:
+      err_log("usage: %s [-t max threads] [-r runs]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (max_threads < 1 || runs < 1) {
+    err_log("%s: invalid arguments\n", __func__);
+    return 1;
+  }
+
+  out = malloc(BENCH_ITEMS * sizeof(uint32_t));
+  if (!out) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  bench_range(out, 0, BENCH_ITEMS);
+  expected = bench_checksum(out);
+
+  log("cpus: %ld, items: %d, grain: %d, tiny jobs: %d\n", cpus, BENCH_ITEMS,
+      BENCH_GRAIN, BENCH_TINY_JOBS);
+  for (int threads = 1;; threads *= 2) {
+    struct job_system_config cfg = {
+      .thread_count = threads,
+    };
+    struct job_system *js = NULL;
+    struct job_system_stats stats;
+    uint64_t best_for = UINT64_MAX;
+    uint64_t best_tiny = UINT64_MAX;
+
+    if (threads > max_threads) {
+      threads = max_threads;
+      cfg.thread_count = threads;
+    }
+    js = job_system_make(&cfg);
+    if (!js)
+      break;
+    for (int run = 0; run < runs; run++) {
+      struct job_counter counter = JOB_COUNTER_INIT;
+      int done = 0;
+      uint64_t start = now_ns();
+
+      job_parallel_for(js, BENCH_ITEMS, BENCH_GRAIN, bench_range, out);
+      start = now_ns() - start;
+      if (start < best_for)
+        best_for = start;
+      if (bench_checksum(out) != expected) {
+        err_log("%s: wrong result with %d threads\n", __func__, threads);
+        job_system_free(&js);
+        free(out);
+        return 1;
+      }
+
+      start = now_ns();
+      for (int i = 0; i < BENCH_TINY_JOBS; i++)
+        job_run(js, bench_tiny, &done, &counter);
+      job_wait(js, &counter);
+      start = now_ns() - start;
+      if (start < best_tiny)
+        best_tiny = start;
+      if (done != BENCH_TINY_JOBS) {
+        err_log("%s: %d of %d tiny jobs ran\n", __func__, done,
+                BENCH_TINY_JOBS);
+        job_system_free(&js);
+        free(out);
+        return 1;
+      }
+    }
+    job_system_get_stats(js, &stats);
+    if (threads == 1)
+      base_ms = best_for / 1e6;
+    log("threads: %d, parallel_for: %.3f ms, speedup: %.2f, "
+        "tiny jobs: %.0f ns/job, stolen: %lu, sleeps: %lu\n",
+        threads, best_for / 1e6, base_ms / (best_for / 1e6),
+        (double)best_tiny / BENCH_TINY_JOBS, (unsigned long)stats.stolen,
+        (unsigned long)stats.sleeps);
+    job_system_free(&js);
+    if (threads == max_threads)
+      break;
+  }
+  free(out);
+  return 0;
+}
@@ -0,0 +1,1340 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "../platform/display.h"
+#include "../platform/linux/shm.h"
+#include "../platform/linux/window-headless.h"
+#include "../render/blend.h"
+#include "../render/blit.h"
+#include "../render/cpu.h"
+#include "../render/display-list.h"
+#include "../render/scene.h"
+#include "../render/stroke.h"
+#include "../render/draw.h"
+#include "../render/fill.h"
+#include "../render/path.h"
+#include "../render/text.h"
+#include "../render/tile.h"
+
+/*
+ * The pixel paths a frame goes through: full frame fills, rect blits, a
+ * shm buffer being allocated, mapped and touched the first time, and the
+ * whole render to commit cycle on the headless backend. Every case runs
+ * long enough for the clock to matter, the best of -r runs is kept and
+ * printed as one line of key=value pairs:
+ *
+ *   case=fill size=1920x1080 iters=.. ns_per_frame=.. mpix_s=.. gb_s=..
+ *
+ * The shm cases print the page faults drawing into the buffer took
+ * instead of the span kernel, with and without prefaulting it.
+ *
+ * The draw cases time one primitive per iteration, of about the size
+ * printed, and print ns_per_prim and mprim_s instead of the frame rates.
+ *
+ * The blend cases run every compositing op over a whole frame, once per
+ * kernel the cpu has, scalar included, as op.kernel names in kernel=.
+ *
+ * The scale cases stretch an image over a whole frame, from half and from
+ * twice its size, as filter.format.kernel in kernel=.
+ *
+ * The list cases draw a frame of BENCH_DRAW_SPOTS primitives, straight
+ * or recorded into a display list and replayed by tile, also with only a
+ * corner damaged, and print ns_per_prim next to the frame time.
+ *
+ * The scene cases render a retained scene of BENCH_DRAW_SPOTS nodes where
+ * one thing changes per frame: the backdrop under everything, a small
+ * node, or a cached panel that moves, and print the damage of a frame.
+ *
+ * The path cases fill a star of BENCH_PATH_POINTS crossing lines over most
+ * of a frame, with each resolve kernel and both fill rules, and against
+ * it the naive way: 4 x 4 samples a pixel, every row of samples crossing
+ * every line. The icon case fills BENCH_DRAW_SPOTS small rounded rects,
+ * building their paths too, and prints ns_per_prim.
+ *
+ * The stroke cases draw a chart line of BENCH_STROKE_SEGMENTS segments
+ * across a frame: as a hairline, wide with round or miter joins, dashed,
+ * and the way it would be done without a stroker, a dot stamped on every
+ * pixel along it. They print ns_per_segment. Round joins are still about
+ * 1.4 times slower than the stamp: most turns of the chart are sharp, each
+ * a few short edges of the join polygon, and the exact filler pays for
+ * every one of them.
+ *
+ * The text cases draw lines of text from the font DRAW_ENGINE_FONT names,
+ * out of a warm glyph atlas and out of one cleared every frame, and print
+ * ns_per_glyph. Without a font they draw the two glyphs of a small one
+ * made in memory, the square and rounded square of test_app.c.
+ *
+ * -c runs only the cases of one group: fill, blit, shm, present, draw,
+ * blend, scale, list, scene, path, stroke or text.
+ *
+ * Every case prints one key=value line to stdout, anything else goes to
+ * stderr. The bench is built with LOG_LEVEL_ERROR so the log() lines of
+ * the backends it drives stay out of the results.
+ */
+
+#define BENCH_RUN_NS 20000000ull // a run lasts at least this long
+#define BENCH_CHECKER_CELL 8
+#define BENCH_DRAW_SPOTS 1024 // where the primitives land, walked in turn
+#define BENCH_LIST_PRIM_SIZE 32
+#define BENCH_PATH_POINTS 31
+#define BENCH_PATH_SAMPLES 4 // a side of the grid of samples of a pixel
+#define BENCH_STROKE_SEGMENTS 100000
+#define BENCH_TEXT_SIZE 16
+#define BENCH_TEXT_LINES 32
+
+struct bench_size {
+  int width;
+  int height;
+};
+
+static const struct bench_size bench_sizes[] = {
+  {800, 600},
+  {1920, 1080},
+  {2560, 1440},
+};
+
+#define BENCH_SIZE_COUNT (int)(sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+struct bench_case {
+  const char *name;
+  int width; // of the area each iteration covers
+  int height;
+  int bytes_per_pixel; // moved per pixel, reads and writes
+  void (*run)(struct bench_case *c, int iter);
+  /* states */
+  uint32_t *dst;
+  uint32_t *src;
+  int stride;
+  int rect_width; // the blit rect
+  int rect_height;
+  size_t size; // of the shm buffer
+  struct shm_config shm;
+  long faults; // taken drawing into the last shm buffer
+  struct win_ctx_ops *ops;
+  void *ctx;
+  struct tile_renderer *tiles;
+  struct draw_surface *surf;
+  int spots[BENCH_DRAW_SPOTS][2];
+  enum blend_op op;
+  const uint8_t *mask; // of the blend_solid case
+  const char *kernel; // printed instead of the span kernels
+  const struct blit_image *image;
+  enum blit_filter filter;
+  int prims; // drawn per iteration by the list cases
+  struct display_list *dl; // NULL draws straight
+  const struct damage_region *damage;
+  struct scene *scene;
+  struct scene_node *changed; // each frame by the scene cases
+  int change; // 0 recolors, 1 moves
+  int frames;
+  struct path *path;
+  enum path_fill_rule rule;
+  const float *poly; // the points of the path, for supersampling
+  uint8_t *samples; // a row of sample counts
+  const float *points; // of the stroke cases
+  int segments;
+  const struct stroke_style *style; // NULL stamps dots
+  struct font *font;
+  struct text_cache *cache;
+  const char *text;
+  int glyphs; // drawn per iteration by the text cases
+  bool cold; // the atlas is cleared every iteration
+};
+
+/* the headless backend registers here instead of in a display */
+static struct win_ctx_ops *bench_ops;
+
+void win_ctx_ops_register(struct win_ctx_ops *ops) {
+  bench_ops = ops;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_fill(struct bench_case *c, int iter) {
+  pixels_fill_rect(c->dst, c->stride, 0, 0, c->width, c->height,
+                   0xFF000000 | iter);
+}
+
+static void bench_checker(struct bench_case *c, int iter) {
+  pixels_fill_checker(c->dst, c->stride, c->width, c->height,
+                      BENCH_CHECKER_CELL, 0xFF000000 | iter, 0xFFFFFFFF);
+}
+
+/* rects walk the frame so the cache does not hold all of them */
+static void bench_blit(struct bench_case *c, int iter) {
+  int cols = c->width / c->rect_width;
+  int rows = c->height / c->rect_height;
+  int x = iter % cols * c->rect_width;
+  int y = iter / cols % rows * c->rect_height;
+  pixels_copy_rect(c->dst, c->src, c->stride, x, y, c->rect_width,
+                   c->rect_height);
+}
+
+/* a new buffer every iteration, as when a window is resized */
+static void bench_shm(struct bench_case *c, int iter) {
+  long page = sysconf(_SC_PAGESIZE);
+  uint8_t *data;
+  long faults;
+  int fd = shm_file_make(c->size, &c->shm, NULL);
+
+  if (fd < 0) {
+    err_log("%s: failed to alloc shm file\n", __func__);
+    exit(1);
+  }
+  data = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    err_log("%s: failed to mmap %zu\n", __func__, c->size);
+    exit(1);
+  }
+  shm_prepare(data, c->size, &c->shm);
+  faults = shm_page_faults();
+  for (size_t off = 0; off < c->size; off += page)
+    data[off] = (uint8_t)iter;
+  c->faults = shm_page_faults() - faults;
+  munmap(data, c->size);
+  close(fd);
+}
+
+struct bench_checker {
+  uint32_t color;
+  enum pixel_format format;
+};
+
+static void bench_checker_tile(void *data, uint32_t *pixels, int stride, int x,
+                               int y, int width, int height) {
+  struct bench_checker *checker = (struct bench_checker *)data;
+  pixels_fill_checker_rect_format(pixels, stride, checker->format, 1, x, y,
+                                  width, height, BENCH_CHECKER_CELL,
+                                  checker->color, 0xFFFFFFFF);
+}
+
+/* what a frame of the display costs, the tick stands in for the vblank */
+static void bench_present(struct bench_case *c, int iter) {
+  struct bench_checker checker = {
+    .color = 0xFF000000 | iter,
+    .format = c->ops->get_pixel_format(c->ctx),
+  };
+  uint32_t *pixels = c->ops->get_pixel_buffer_ptr(c->ctx);
+
+  tile_renderer_run(c->tiles, pixels, c->width, c->height,
+                    c->ops->get_stride(c->ctx), NULL, bench_checker_tile,
+                    &checker);
+  c->ops->damage_buffer(c->ctx, 0, 0, c->width, c->height);
+  c->ops->attach_buffer(c->ctx, 0, 0);
+  c->ops->commit_buffer(c->ctx);
+  c->ops->poll_events(c->ctx);
+}
+
+static void bench_draw_rect(struct bench_case *c, int iter) {
+  const int *spot = c->spots[iter % BENCH_DRAW_SPOTS];
+  draw_fill_rect(c->surf, spot[0], spot[1], c->width, c->height,
+                 0xFF000000 | iter);
+}
+
+static void bench_draw_line(struct bench_case *c, int iter) {
+  const int *spot = c->spots[iter % BENCH_DRAW_SPOTS];
+  /* a different slope every time */
+  draw_line(c->surf, spot[0], spot[1], spot[0] + c->width - 1,
+            spot[1] + iter % c->height, 0xFF000000 | iter);
+}
+
+static void bench_draw_circle(struct bench_case *c, int iter) {
+  const int *spot = c->spots[iter % BENCH_DRAW_SPOTS];
+  draw_fill_circle(c->surf, spot[0] + c->width / 2, spot[1] + c->height / 2,
+                   c->width / 2, 0xFF000000 | iter);
+}
+
+static void bench_draw_triangle(struct bench_case *c, int iter) {
+  const int *spot = c->spots[iter % BENCH_DRAW_SPOTS];
+  draw_fill_triangle(c->surf, spot[0], spot[1], spot[0] + c->width,
+                     spot[1] + c->height / 2, spot[0] + iter % c->width,
+                     spot[1] + c->height, 0xFF000000 | iter);
+}
+
+static void bench_blend(struct bench_case *c, int iter) {
+  (void)iter;
+  for (int row = 0; row < c->height; row++)
+    blend_span(c->op, c->dst + (size_t)row * c->width,
+               c->src + (size_t)row * c->width, c->width);
+}
+
+static void bench_blend_solid(struct bench_case *c, int iter) {
+  uint32_t color = 0x80000000 | (iter & 0x7F7F7F);
+
+  for (int row = 0; row < c->height; row++)
+    blend_span_solid(c->op, c->dst + (size_t)row * c->width, color,
+                     c->mask + (size_t)row * c->width, c->width);
+}
+
+static void bench_scale(struct bench_case *c, int iter) {
+  (void)iter;
+  blit_image(c->surf, 0, 0, c->width, c->height, c->image, 0, 0,
+             c->image->width, c->image->height, c->filter, BLEND_OP_SRC);
+}
+
+/* a primitive of the list cases, i picks the kind and the spot */
+static void bench_list_prim(struct bench_case *c, int i, int iter) {
+  const int *s = c->spots[i];
+  uint32_t color = 0xFF000000 | (iter * 31 + i);
+  int size = BENCH_LIST_PRIM_SIZE;
+
+  switch (i % 4) {
+  case 0:
+    if (c->dl)
+      display_list_fill_rect(c->dl, s[0], s[1], size, size, color);
+    else
+      draw_fill_rect(c->surf, s[0], s[1], size, size, color);
+    break;
+  case 1:
+    if (c->dl)
+      display_list_fill_circle(c->dl, s[0], s[1], size / 2, color);
+    else
+      draw_fill_circle(c->surf, s[0], s[1], size / 2, color);
+    break;
+  case 2:
+    if (c->dl)
+      display_list_fill_triangle(c->dl, s[0], s[1], s[0] + size,
+                                 s[1] + size / 2, s[0], s[1] + size, color);
+    else
+      draw_fill_triangle(c->surf, s[0], s[1], s[0] + size, s[1] + size / 2,
+                         s[0], s[1] + size, color);
+    break;
+  case 3:
+    if (c->dl)
+      display_list_line(c->dl, s[0], s[1], s[0] + size, s[1] + size, color);
+    else
+      draw_line(c->surf, s[0], s[1], s[0] + size, s[1] + size, color);
+    break;
+  }
+}
+
+static void bench_list(struct bench_case *c, int iter) {
+  if (c->dl)
+    display_list_reset(c->dl);
+  for (int i = 0; i < c->prims; i++)
+    bench_list_prim(c, i, iter);
+  if (c->dl)
+    display_list_replay(c->dl, c->tiles, c->surf, c->damage);
+}
+
+static void bench_scene(struct bench_case *c, int iter) {
+  struct damage_region damage;
+  int frame = c->frames++;
+
+  (void)iter;
+  if (c->change)
+    scene_node_set_position(c->changed, 64 + frame % 512, 64);
+  else
+    scene_node_set_checker(c->changed, c->width, c->height, 8,
+                           0xFF000000 | (frame % 256), 0xFFFFFFFF);
+  damage_region_init(&damage, c->width, c->height);
+  scene_render(c->scene, c->tiles, c->surf, &damage);
+}
+
+static void bench_path(struct bench_case *c, int iter) {
+  path_fill(c->surf, c->path, c->rule, 0xFF000000 | iter);
+}
+
+static void bench_path_icons(struct bench_case *c, int iter) {
+  int size = BENCH_LIST_PRIM_SIZE;
+
+  for (int i = 0; i < c->prims; i++) {
+    path_reset(c->path);
+    path_add_rect(c->path, c->spots[i][0] + 0.5f, c->spots[i][1], size, size,
+                  size / 4);
+    path_fill(c->surf, c->path, PATH_FILL_NONZERO, 0xFF000000 | (iter + i));
+  }
+}
+
+/* the first sample at or right of x, samples sit in the middle of their
+ * cell */
+static int bench_path_sample(float x, int width) {
+  float v;
+  int k;
+
+  x = x < 0 ? 0 : x > width ? width : x;
+  v = x * BENCH_PATH_SAMPLES - 0.5f;
+  k = (int)v;
+  return k + (k < v);
+}
+
+static void bench_path_supersample(struct bench_case *c, int iter) {
+  uint32_t color = 0xFF000000 | iter;
+  float xs[BENCH_PATH_POINTS];
+  int dirs[BENCH_PATH_POINTS];
+
+  for (int y = 0; y < c->height; y++) {
+    uint32_t *row = c->surf->pixels + (size_t)y * c->width;
+    int x_min = c->width, x_max = 0;
+    for (int sy = 0; sy < BENCH_PATH_SAMPLES; sy++) {
+      float fy = y + (sy + 0.5f) / BENCH_PATH_SAMPLES;
+      int n = 0, winding = 0;
+      /* the crossings of the row of samples, sorted */
+      for (int i = 0; i < BENCH_PATH_POINTS; i++) {
+        const float *a = c->poly + i * 2;
+        const float *b = c->poly + (i + 1) % BENCH_PATH_POINTS * 2;
+        float x;
+        int k;
+        if ((a[1] <= fy) == (b[1] <= fy))
+          continue;
+        x = a[0] + (fy - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+        for (k = n; k > 0 && xs[k - 1] > x; k--) {
+          xs[k] = xs[k - 1];
+          dirs[k] = dirs[k - 1];
+        }
+        xs[k] = x;
+        dirs[k] = a[1] < b[1] ? 1 : -1;
+        n++;
+      }
+      for (int i = 0; i + 1 < n; i++) {
+        int s0, s1;
+        winding += dirs[i];
+        if (!winding)
+          continue;
+        s0 = bench_path_sample(xs[i], c->width);
+        s1 = bench_path_sample(xs[i + 1], c->width);
+        for (int k = s0; k < s1; k++)
+          c->samples[k / BENCH_PATH_SAMPLES]++;
+        if (s0 < s1) {
+          x_min = s0 / BENCH_PATH_SAMPLES < x_min ? s0 / BENCH_PATH_SAMPLES
+                                                  : x_min;
+          x_max = (s1 - 1) / BENCH_PATH_SAMPLES + 1 > x_max
+                    ? (s1 - 1) / BENCH_PATH_SAMPLES + 1
+                    : x_max;
+        }
+      }
+    }
+    if (x_min >= x_max)
+      continue;
+    for (int x = x_min; x < x_max; x++)
+      c->samples[x] = (uint8_t)(c->samples[x] * 255 /
+                                (BENCH_PATH_SAMPLES * BENCH_PATH_SAMPLES));
+    blend_span_solid(BLEND_OP_SRC_OVER, row + x_min, color,
+                     c->samples + x_min, x_max - x_min);
+    memset(c->samples + x_min, 0, x_max - x_min);
+  }
+}
+
+static void bench_stroke(struct bench_case *c, int iter) {
+  stroke_draw(c->surf, c->path, c->points, c->segments + 1, false, c->style,
+              0xFF000000 | iter);
+}
+
+/* a dot of the width every pixel along the line */
+static void bench_stroke_stamp(struct bench_case *c, int iter) {
+  uint32_t color = 0xFF000000 | iter;
+
+  for (int i = 0; i < c->segments; i++) {
+    const float *p = c->points + i * 2;
+    float dx = p[2] - p[0], dy = p[3] - p[1];
+    int steps = (int)((dx < 0 ? -dx : dx) > (dy < 0 ? -dy : dy)
+                        ? (dx < 0 ? -dx : dx)
+                        : (dy < 0 ? -dy : dy)) + 1;
+    for (int k = 0; k < steps; k++)
+      draw_fill_circle(c->surf, (int)(p[0] + dx * k / steps),
+                       (int)(p[1] + dy * k / steps), 1, color);
+  }
+}
+
+/* the pen lands between pixels, every subpixel step gets used */
+static void bench_text(struct bench_case *c, int iter) {
+  if (c->cold)
+    text_cache_clear(c->cache);
+  for (int line = 0; line < BENCH_TEXT_LINES; line++)
+    text_draw(c->cache, c->surf, c->font, BENCH_TEXT_SIZE,
+              8 + (float)((iter + line) % 4) / 4,
+              (line + 1) * BENCH_TEXT_SIZE * 5 / 4, c->text, 0xFF202020);
+}
+
+static void bench_report(struct bench_case *c, int iters, uint64_t best_ns) {
+  double ns = (double)best_ns / iters;
+  double pixels = (double)c->width * c->height;
+
+  if (c->segments) {
+    printf("case=%s size=%dx%d iters=%d ns_per_frame=%.0f ns_per_segment=%.1f "
+           "segments=%d\n", c->name, c->width, c->height, iters, ns,
+           ns / c->segments, c->segments);
+    return;
+  }
+  if (c->font) {
+    struct text_cache_stats stats;
+    text_cache_get_stats(c->cache, &stats);
+    printf("case=%s size=%d iters=%d ns_per_frame=%.0f ns_per_glyph=%.1f "
+           "glyphs=%d hit_rate=%.3f\n", c->name, BENCH_TEXT_SIZE, iters, ns,
+           ns / c->glyphs, c->glyphs,
+           stats.lookups ? (double)stats.hits / stats.lookups : 0);
+    return;
+  }
+  if (c->scene) {
+    struct scene_stats stats;
+    scene_get_stats(c->scene, &stats);
+    printf("case=%s size=%dx%d iters=%d ns_per_frame=%.0f damaged_px=%lu "
+           "layers_drawn=%d\n", c->name, c->width, c->height, iters, ns,
+           (unsigned long)stats.damage_area, stats.layers_drawn);
+    return;
+  }
+  if (c->prims) {
+    printf("case=%s size=%dx%d iters=%d ns_per_frame=%.0f ns_per_prim=%.1f "
+           "prims=%d\n", c->name, c->width, c->height, iters, ns,
+           ns / c->prims, c->prims);
+    return;
+  }
+  if (c->surf && !c->image && !c->kernel) {
+    printf("case=%s size=%dx%d iters=%d ns_per_prim=%.1f mprim_s=%.2f "
+           "kernel=%s\n", c->name, c->width, c->height, iters, ns, 1e3 / ns,
+           span_kernels_name());
+    return;
+  }
+  if (c->size) {
+    printf("case=%s size=%dx%d iters=%d ns_per_frame=%.0f mpix_s=%.1f "
+           "gb_s=%.2f faults=%ld\n", c->name, c->width, c->height, iters, ns,
+           pixels / ns * 1e3, pixels * c->bytes_per_pixel / ns, c->faults);
+    return;
+  }
+  printf("case=%s size=%dx%d iters=%d ns_per_frame=%.0f mpix_s=%.1f "
+         "gb_s=%.2f kernel=%s\n", c->name, c->width, c->height, iters, ns,
+         pixels / ns * 1e3, pixels * c->bytes_per_pixel / ns,
+         c->kernel ? c->kernel : span_kernels_name());
+}
+
+static void bench_case_run(struct bench_case *c, int runs) {
+  uint64_t best = UINT64_MAX;
+  uint64_t start;
+  int iters = 1;
+
+  /* warm up and find how many iterations fill a run */
+  for (;;) {
+    start = now_ns();
+    for (int i = 0; i < iters; i++)
+      c->run(c, i);
+    start = now_ns() - start;
+    if (start >= BENCH_RUN_NS)
+      break;
+    iters *= 2;
+  }
+  for (int run = 0; run < runs; run++) {
+    start = now_ns();
+    for (int i = 0; i < iters; i++)
+      c->run(c, i);
+    start = now_ns() - start;
+    if (start < best)
+      best = start;
+  }
+  bench_report(c, iters, best);
+}
+
+static int bench_fills(int runs) {
+  const struct bench_size *max = &bench_sizes[BENCH_SIZE_COUNT - 1];
+  uint32_t *pixels = malloc((size_t)max->width * max->height * 4);
+
+  if (!pixels) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  for (int i = 0; i < BENCH_SIZE_COUNT; i++) {
+    struct bench_case c = {
+      .name = "fill",
+      .width = bench_sizes[i].width,
+      .height = bench_sizes[i].height,
+      .bytes_per_pixel = 4,
+      .run = bench_fill,
+      .dst = pixels,
+      .stride = bench_sizes[i].width * 4,
+    };
+    bench_case_run(&c, runs);
+    c.name = "checker";
+    c.run = bench_checker;
+    bench_case_run(&c, runs);
+  }
+  free(pixels);
+  return 0;
+}
+
+static int bench_blits(int runs) {
+  const struct bench_size *size = &bench_sizes[1];
+  static const int rects[] = {16, 64, 256};
+  size_t len = (size_t)size->width * size->height * 4;
+  uint32_t *dst = malloc(len);
+  uint32_t *src = malloc(len);
+
+  if (!dst || !src) {
+    err_log("%s: no enough memory\n", __func__);
+    free(dst);
+    free(src);
+    return 1;
+  }
+  pixels_fill_checker(src, size->width * 4, size->width, size->height,
+                      BENCH_CHECKER_CELL, 0xFF336699, 0xFFFFFFFF);
+  memset(dst, 0, len);
+  for (int i = 0; i < (int)(sizeof(rects) / sizeof(rects[0])); i++) {
+    struct bench_case c = {
+      .name = "blit",
+      .width = rects[i],
+      .height = rects[i],
+      .bytes_per_pixel = 8,
+      .run = bench_blit,
+      .dst = dst,
+      .src = src,
+      .stride = size->width * 4,
+      .rect_width = rects[i],
+      .rect_height = rects[i],
+    };
+    bench_case_run(&c, runs);
+  }
+  /* a whole frame, as the first frame after a buffer swap */
+  {
+    struct bench_case c = {
+      .name = "blit",
+      .width = size->width,
+      .height = size->height,
+      .bytes_per_pixel = 8,
+      .run = bench_blit,
+      .dst = dst,
+      .src = src,
+      .stride = size->width * 4,
+      .rect_width = size->width,
+      .rect_height = size->height,
+    };
+    bench_case_run(&c, runs);
+  }
+  free(dst);
+  free(src);
+  return 0;
+}
+
+static int bench_shms(int runs) {
+  for (int i = 0; i < BENCH_SIZE_COUNT; i++) {
+    struct bench_case c = {
+      .name = "shm",
+      .width = bench_sizes[i].width,
+      .height = bench_sizes[i].height,
+      .bytes_per_pixel = 4,
+      .run = bench_shm,
+      .size = (size_t)bench_sizes[i].width * bench_sizes[i].height * 4,
+      .shm = {SHM_HUGEPAGES_NONE, SHM_PREFAULT_NONE},
+    };
+    bench_case_run(&c, runs);
+    /* the faults move out of the drawing, the time is the whole of it */
+    c.name = "shm-prefault";
+    c.shm.prefault = SHM_PREFAULT_SYNC;
+    bench_case_run(&c, runs);
+  }
+  return 0;
+}
+
+static int bench_presents(int runs) {
+  /* the backend takes its format from the environment */
+  static const struct {
+    const char *name;
+    const char *format;
+    int bytes_per_pixel;
+  } formats[] = {
+    {"present", "xrgb8888", 4},
+    {"present-rgb565", "rgb565", 2},
+  };
+  struct tile_renderer *tiles = tile_renderer_default();
+  const char *env = getenv("DRAW_ENGINE_WINDOW_FORMAT");
+  char *saved = env ? strdup(env) : NULL;
+  int ret = 0;
+
+  if (!tiles)
+    return 1;
+  window_headless_init();
+  for (int f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])) && !ret;
+       f++) {
+    setenv("DRAW_ENGINE_WINDOW_FORMAT", formats[f].format, 1);
+    for (int i = 0; i < BENCH_SIZE_COUNT && !ret; i++) {
+      struct bench_case c = {
+        .name = formats[f].name,
+        .width = bench_sizes[i].width,
+        .height = bench_sizes[i].height,
+        .bytes_per_pixel = formats[f].bytes_per_pixel,
+        .run = bench_present,
+        .stride = bench_sizes[i].width * 4,
+        .ops = bench_ops,
+        .tiles = tiles,
+      };
+      c.ctx = c.ops->ctx_make();
+      if (!c.ctx) {
+        ret = 1;
+        break;
+      }
+      if (c.ops->create_window(c.ctx, "render-bench", c.height, c.width,
+                               c.stride)) {
+        c.ops->ctx_free(&c.ctx);
+        ret = 1;
+        break;
+      }
+      bench_case_run(&c, runs);
+      c.ops->close_window(c.ctx);
+      c.ops->ctx_free(&c.ctx);
+    }
+  }
+  if (saved)
+    setenv("DRAW_ENGINE_WINDOW_FORMAT", saved, 1);
+  else
+    unsetenv("DRAW_ENGINE_WINDOW_FORMAT");
+  free(saved);
+  return ret;
+}
+
+static int bench_draws(int runs) {
+  static const int sizes[] = {8, 32, 128};
+  static const struct {
+    const char *name;
+    void (*run)(struct bench_case *c, int iter);
+  } prims[] = {
+    {"rect", bench_draw_rect},
+    {"line", bench_draw_line},
+    {"circle", bench_draw_circle},
+    {"triangle", bench_draw_triangle},
+  };
+  const struct bench_size *size = &bench_sizes[1];
+  uint32_t *pixels = malloc((size_t)size->width * size->height * 4);
+  struct draw_surface surf;
+
+  if (!pixels) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  memset(pixels, 0, (size_t)size->width * size->height * 4);
+  draw_surface_init(&surf, pixels, size->width * 4, size->width,
+                    size->height);
+  for (int p = 0; p < (int)(sizeof(prims) / sizeof(prims[0])); p++) {
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+      struct bench_case c = {
+        .name = prims[p].name,
+        .width = sizes[i],
+        .height = sizes[i],
+        .bytes_per_pixel = 4,
+        .run = prims[p].run,
+        .surf = &surf,
+      };
+      /* some of them hang over the edges and get clipped */
+      srand(1);
+      for (int s = 0; s < BENCH_DRAW_SPOTS; s++) {
+        c.spots[s][0] = rand() % (size->width + sizes[i]) - sizes[i] / 2;
+        c.spots[s][1] = rand() % (size->height + sizes[i]) - sizes[i] / 2;
+      }
+      bench_case_run(&c, runs);
+    }
+  }
+  free(pixels);
+  return 0;
+}
+
+static int bench_blends(int runs) {
+  static const unsigned int levels[] = {
+    0, CPU_FEATURE_SSE2 | CPU_FEATURE_SSE41, CPU_FEATURE_AVX2,
+  };
+  const struct bench_size *size = &bench_sizes[1];
+  size_t count = (size_t)size->width * size->height;
+  uint32_t *dst = malloc(count * 4);
+  uint32_t *src = malloc(count * 4);
+  uint8_t *mask = malloc(count);
+  char kernel[64];
+
+  if (!dst || !src || !mask) {
+    err_log("%s: no enough memory\n", __func__);
+    free(dst);
+    free(src);
+    free(mask);
+    return 1;
+  }
+  /* a translucent checker over an opaque one, a ramp of coverage */
+  pixels_fill_checker(src, size->width * 4, size->width, size->height,
+                      BENCH_CHECKER_CELL, blend_premultiply(0x80336699),
+                      blend_premultiply(0xC0FFFFFF));
+  pixels_fill_checker(dst, size->width * 4, size->width, size->height,
+                      BENCH_CHECKER_CELL * 3, 0xFF102030, 0xFFF0E0D0);
+  for (size_t i = 0; i < count; i++)
+    mask[i] = (uint8_t)(i % size->width);
+  for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++) {
+    if ((levels[l] & cpu_features()) != levels[l])
+      continue;
+    blend_kernels_select(levels[l]);
+    for (int op = BLEND_OP_SRC; op <= BLEND_OP_ADD; op++) {
+      struct bench_case c = {
+        .name = "blend",
+        .width = size->width,
+        .height = size->height,
+        .bytes_per_pixel = 12,
+        .run = bench_blend,
+        .dst = dst,
+        .src = src,
+        .op = op,
+        .mask = mask,
+        .kernel = kernel,
+      };
+      snprintf(kernel, sizeof(kernel), "%s.%s", blend_op_name(op),
+               blend_kernels_name());
+      bench_case_run(&c, runs);
+      c.name = "blend_solid";
+      c.bytes_per_pixel = 9;
+      c.run = bench_blend_solid;
+      bench_case_run(&c, runs);
+    }
+  }
+  blend_kernels_select(cpu_features());
+  free(dst);
+  free(src);
+  free(mask);
+  return 0;
+}
+
+static int bench_scales(int runs) {
+  static const unsigned int levels[] = {
+    0, CPU_FEATURE_SSE2, CPU_FEATURE_AVX2,
+  };
+  static const enum pixel_format formats[] = {
+    PIXEL_FORMAT_XRGB8888, PIXEL_FORMAT_ARGB8888, PIXEL_FORMAT_RGB565,
+    PIXEL_FORMAT_RGBA8888,
+  };
+  const struct bench_size *size = &bench_sizes[1];
+  size_t len = (size_t)size->width * size->height * 4;
+  /* big enough for twice the frame, any format */
+  uint32_t *src = malloc(len * 4);
+  uint32_t *dst = malloc(len);
+  struct draw_surface surf;
+  char kernel[64];
+
+  if (!src || !dst) {
+    err_log("%s: no enough memory\n", __func__);
+    free(src);
+    free(dst);
+    return 1;
+  }
+  pixels_fill_checker(src, size->width * 8, size->width * 2,
+                      size->height * 2, BENCH_CHECKER_CELL,
+                      blend_premultiply(0xC0336699), 0xFFFFFFFF);
+  draw_surface_init(&surf, dst, size->width * 4, size->width, size->height);
+  for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++) {
+    if ((levels[l] & cpu_features()) != levels[l])
+      continue;
+    blit_kernels_select(levels[l]);
+    for (int f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++) {
+      for (int half = 0; half < 2; half++) {
+        int scale = half ? 1 : 2;
+        int bpp = formats[f] == PIXEL_FORMAT_RGB565 ? 2 : 4;
+        struct blit_image image = {
+          .pixels = src,
+          .width = half ? size->width / 2 : size->width * 2,
+          .height = half ? size->height / 2 : size->height * 2,
+          .format = formats[f],
+        };
+        struct bench_case c = {
+          .name = half ? "scale_up" : "scale_down",
+          .width = size->width,
+          .height = size->height,
+          .bytes_per_pixel = 4 + bpp * scale * scale,
+          .run = bench_scale,
+          .surf = &surf,
+          .kernel = kernel,
+          .image = &image,
+        };
+        image.stride = image.width * bpp;
+        for (int filter = BLIT_FILTER_NEAREST; filter <= BLIT_FILTER_BILINEAR;
+             filter++) {
+          /* nearest has no vector loops, once is enough */
+          if (filter == BLIT_FILTER_NEAREST && l)
+            continue;
+          c.filter = filter;
+          snprintf(kernel, sizeof(kernel), "%s.%s.%s",
+                   filter == BLIT_FILTER_NEAREST ? "nearest" : "bilinear",
+                   pixel_format_name(formats[f]), blit_kernels_name());
+          bench_case_run(&c, runs);
+        }
+      }
+    }
+  }
+  blit_kernels_select(cpu_features());
+  free(src);
+  free(dst);
+  return 0;
+}
+
+static int bench_lists(int runs) {
+  static const char *names[] = {"list-direct", "list-replay",
+                                "list-replay-damage"};
+  const struct bench_size *size = &bench_sizes[1];
+  uint32_t *pixels = malloc((size_t)size->width * size->height * 4);
+  struct display_list *dl = display_list_make();
+  struct tile_renderer *tiles = tile_renderer_default();
+  struct damage_region damage;
+  struct draw_surface surf;
+
+  if (!pixels || !dl || !tiles) {
+    err_log("%s: no enough memory\n", __func__);
+    free(pixels);
+    display_list_free(&dl);
+    return 1;
+  }
+  memset(pixels, 0, (size_t)size->width * size->height * 4);
+  draw_surface_init(&surf, pixels, size->width * 4, size->width,
+                    size->height);
+  /* what a cursor or a small widget would damage */
+  damage_region_init(&damage, size->width, size->height);
+  damage_region_add(&damage, 0, 0, 256, 256);
+  for (int n = 0; n < 3; n++) {
+    struct bench_case c = {
+      .name = names[n],
+      .width = size->width,
+      .height = size->height,
+      .bytes_per_pixel = 4,
+      .run = bench_list,
+      .tiles = tiles,
+      .surf = &surf,
+      .prims = BENCH_DRAW_SPOTS,
+      .dl = n ? dl : NULL,
+      .damage = n == 2 ? &damage : NULL,
+    };
+    srand(1);
+    for (int s = 0; s < BENCH_DRAW_SPOTS; s++) {
+      c.spots[s][0] = rand() % size->width - BENCH_LIST_PRIM_SIZE / 2;
+      c.spots[s][1] = rand() % size->height - BENCH_LIST_PRIM_SIZE / 2;
+    }
+    bench_case_run(&c, runs);
+    if (c.dl) {
+      struct display_list_stats stats;
+      display_list_get_stats(dl, &stats);
+      fprintf(stderr, "%s: %d commands, %lu bytes, %lu tile refs\n",
+              names[n], stats.commands, (unsigned long)stats.bytes,
+              (unsigned long)stats.refs);
+    }
+  }
+  display_list_free(&dl);
+  free(pixels);
+  return 0;
+}
+
+/* primitives like the list cases as nodes over a checker, a cached panel
+ * of 16 rects and a dot on top */
+static int bench_scene_build(struct scene *scene, const struct bench_size *size,
+                             struct scene_node **checker,
+                             struct scene_node **panel,
+                             struct scene_node **dot) {
+  struct scene_node *node;
+
+  *checker = scene_node_make(scene, NULL);
+  if (!*checker)
+    return 1;
+  scene_node_set_checker(*checker, size->width, size->height, 8, 0xFF000000,
+                         0xFFFFFFFF);
+  srand(1);
+  for (int i = 0; i < BENCH_DRAW_SPOTS; i++) {
+    node = scene_node_make(scene, NULL);
+    if (!node)
+      return 1;
+    scene_node_set_position(node, rand() % size->width,
+                            rand() % size->height);
+    if (i % 2)
+      scene_node_set_circle(node, BENCH_LIST_PRIM_SIZE / 2,
+                            0xFF000000 | (uint32_t)i * 2654435761u);
+    else
+      scene_node_set_rect(node, BENCH_LIST_PRIM_SIZE, BENCH_LIST_PRIM_SIZE,
+                          0xFF000000 | (uint32_t)i * 2654435761u);
+  }
+  *panel = scene_node_make(scene, NULL);
+  if (!*panel)
+    return 1;
+  scene_node_set_rect(*panel, 384, 256, 0xFF303040);
+  for (int i = 0; i < 16; i++) {
+    node = scene_node_make(scene, *panel);
+    if (!node)
+      return 1;
+    scene_node_set_position(node, 16 + i % 4 * 88, 16 + i / 4 * 60);
+    scene_node_set_rect(node, 80, 52, 0xFF5060A0 + i * 0x0A0000);
+  }
+  scene_node_set_cached(*panel, true);
+  *dot = scene_node_make(scene, NULL);
+  if (!*dot)
+    return 1;
+  scene_node_set_circle(*dot, BENCH_LIST_PRIM_SIZE / 2, 0xFFE0A030);
+  return 0;
+}
+
+static int bench_scenes(int runs) {
+  static const char *names[] = {"scene-backdrop", "scene-node",
+                                "scene-layer"};
+  const struct bench_size *size = &bench_sizes[1];
+  uint32_t *pixels = malloc((size_t)size->width * size->height * 4);
+  struct scene *scene = scene_make(0xFFFFFFFF);
+  struct tile_renderer *tiles = tile_renderer_default();
+  struct scene_node *changed[3];
+  struct damage_region damage;
+  struct draw_surface surf;
+  int ret = 0;
+
+  if (!pixels || !scene || !tiles ||
+      bench_scene_build(scene, size, &changed[0], &changed[2], &changed[1])) {
+    err_log("%s: no enough memory\n", __func__);
+    ret = 1;
+    goto out;
+  }
+  draw_surface_init(&surf, pixels, size->width * 4, size->width,
+                    size->height);
+  /* the first frame draws everything */
+  damage_region_init(&damage, size->width, size->height);
+  scene_render(scene, tiles, &surf, &damage);
+  for (int n = 0; n < 3; n++) {
+    struct bench_case c = {
+      .name = names[n],
+      .width = size->width,
+      .height = size->height,
+      .bytes_per_pixel = 4,
+      .run = bench_scene,
+      .tiles = tiles,
+      .surf = &surf,
+      .scene = scene,
+      .changed = changed[n],
+      .change = n > 0,
+    };
+    bench_case_run(&c, runs);
+  }
+out:
+  scene_free(&scene);
+  free(pixels);
+  return ret;
+}
+
+static int bench_paths(int runs) {
+  static const unsigned int levels[] = {
+    0, CPU_FEATURE_SSE2, CPU_FEATURE_AVX2,
+  };
+  const struct bench_size *size = &bench_sizes[1];
+  uint32_t *pixels = malloc((size_t)size->width * size->height * 4);
+  uint8_t *samples = calloc(size->width, 1);
+  struct path *path = path_make();
+  float poly[BENCH_PATH_POINTS * 2];
+  /* a turn of 2 pi / BENCH_PATH_POINTS, cos and sin by their series */
+  float a = 6.2831853f / BENCH_PATH_POINTS;
+  float cs = 1 - a * a / 2 + a * a * a * a / 24;
+  float sn = a - a * a * a / 6 + a * a * a * a * a / 120;
+  float px = 0, py = -1;
+  struct draw_surface surf;
+  char kernel[64];
+  int ret = 0;
+
+  if (!pixels || !samples || !path) {
+    err_log("%s: no enough memory\n", __func__);
+    ret = 1;
+    goto out;
+  }
+  memset(pixels, 0, (size_t)size->width * size->height * 4);
+  draw_surface_init(&surf, pixels, size->width * 4, size->width,
+                    size->height);
+  /* every 12th point of a circle, the lines cross each other */
+  for (int i = 0; i < BENCH_PATH_POINTS; i++) {
+    poly[i * 2] = size->width / 2 + px * 520;
+    poly[i * 2 + 1] = size->height / 2 + py * 520;
+    for (int k = 0; k < 12; k++) {
+      float t = px * cs - py * sn;
+      py = px * sn + py * cs;
+      px = t;
+    }
+    if (i ? path_line_to(path, poly[i * 2], poly[i * 2 + 1])
+          : path_move_to(path, poly[0], poly[1])) {
+      ret = 1;
+      goto out;
+    }
+  }
+  path_close(path);
+  for (int l = 0; l < (int)(sizeof(levels) / sizeof(levels[0])); l++) {
+    if ((levels[l] & cpu_features()) != levels[l])
+      continue;
+    path_kernels_select(levels[l]);
+    for (int rule = PATH_FILL_NONZERO; rule <= PATH_FILL_EVEN_ODD; rule++) {
+      struct bench_case c = {
+        .name = rule ? "path-star-evenodd" : "path-star",
+        .width = size->width,
+        .height = size->height,
+        .bytes_per_pixel = 4,
+        .run = bench_path,
+        .path = path,
+        .rule = rule,
+        .surf = &surf,
+        .kernel = kernel,
+      };
+      snprintf(kernel, sizeof(kernel), "%s", path_kernels_name());
+      bench_case_run(&c, runs);
+    }
+  }
+  path_kernels_select(cpu_features());
+  {
+    struct bench_case c = {
+      .name = "path-supersample",
+      .width = size->width,
+      .height = size->height,
+      .bytes_per_pixel = 4,
+      .run = bench_path_supersample,
+      .poly = poly,
+      .samples = samples,
+      .surf = &surf,
+      .kernel = "4x4",
+    };
+    bench_case_run(&c, runs);
+  }
+  {
+    struct bench_case c = {
+      .name = "path-icons",
+      .width = size->width,
+      .height = size->height,
+      .bytes_per_pixel = 4,
+      .run = bench_path_icons,
+      .path = path,
+      .surf = &surf,
+      .prims = BENCH_DRAW_SPOTS,
+    };
+    srand(1);
+    for (int s = 0; s < BENCH_DRAW_SPOTS; s++) {
+      c.spots[s][0] = rand() % size->width - BENCH_LIST_PRIM_SIZE / 2;
+      c.spots[s][1] = rand() % size->height - BENCH_LIST_PRIM_SIZE / 2;
+    }
+    bench_case_run(&c, runs);
+  }
+out:
+  path_free(&path);
+  free(samples);
+  free(pixels);
+  return ret;
+}
+
+static int bench_strokes(int runs) {
+  static const char *names[] = {"stroke-hairline", "stroke-round",
+                                "stroke-miter", "stroke-dashed"};
+  const struct bench_size *size = &bench_sizes[1];
+  uint32_t *pixels = malloc((size_t)size->width * size->height * 4);
+  float *points = malloc((BENCH_STROKE_SEGMENTS + 1) * 2 * sizeof(float));
+  struct path *path = path_make();
+  struct stroke_style styles[4];
+  struct draw_surface surf;
+  float y = size->height / 2;
+  int ret = 0;
+
+  if (!pixels || !points || !path) {
+    err_log("%s: no enough memory\n", __func__);
+    ret = 1;
+    goto out;
+  }
+  memset(pixels, 0, (size_t)size->width * size->height * 4);
+  draw_surface_init(&surf, pixels, size->width * 4, size->width,
+                    size->height);
+  /* a random walk, 50 samples a pixel column */
+  srand(1);
+  for (int i = 0; i <= BENCH_STROKE_SEGMENTS; i++) {
+    y += rand() % 9 - 4;
+    if (y < 32 || y > size->height - 32)
+      y = size->height / 2;
+    points[i * 2] = (float)i * size->width / BENCH_STROKE_SEGMENTS;
+    points[i * 2 + 1] = y;
+  }
+  stroke_style_init(&styles[0], 1);
+  stroke_style_init(&styles[1], 3);
+  styles[1].join = STROKE_JOIN_ROUND;
+  stroke_style_init(&styles[2], 3);
+  stroke_style_init(&styles[3], 2);
+  styles[3].dash_count = 2;
+  styles[3].dashes[0] = 6;
+  styles[3].dashes[1] = 4;
+  for (int n = 0; n <= 4; n++) {
+    struct bench_case c = {
+      .name = n < 4 ? names[n] : "stroke-stamp",
+      .width = size->width,
+      .height = size->height,
+      .run = n < 4 ? bench_stroke : bench_stroke_stamp,
+      .surf = &surf,
+      .path = path,
+      .points = points,
+      .segments = BENCH_STROKE_SEGMENTS,
+      .style = n < 4 ? &styles[n] : NULL,
+    };
+    bench_case_run(&c, runs);
+  }
+out:
+  path_free(&path);
+  free(points);
+  free(pixels);
+  return ret;
+}
+
+static void bench_put16(uint8_t *p, int v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+/*
+ * The font of test_app.c: 64 units per em, 'A' a 48 unit square and 'B'
+ * the same corners off the curve. Returns the size of the file.
+ */
+static size_t bench_make_font(uint8_t *font) {
+  static const char *tags[] = {"cmap", "glyf", "head", "hhea", "hmtx",
+                               "loca", "maxp"};
+  static const int corners[4][2] = {{8, 0}, {8, 48}, {56, 48}, {56, 0}};
+  uint8_t tables[7][80];
+  size_t lengths[7] = {44, 72, 54, 36, 12, 8, 6};
+  size_t off = 12 + 7 * 16;
+
+  memset(tables, 0, sizeof(tables));
+  /* cmap: a format 4 subtable mapping 'A' and 'B' to glyphs 1 and 2 */
+  bench_put16(tables[0] + 2, 1);
+  bench_put16(tables[0] + 4, 3);
+  bench_put16(tables[0] + 6, 1);
+  tables[0][11] = 12;
+  bench_put16(tables[0] + 12, 4);
+  bench_put16(tables[0] + 14, 32);
+  bench_put16(tables[0] + 18, 4); // two segments
+  bench_put16(tables[0] + 26, 'B');
+  bench_put16(tables[0] + 28, 0xFFFF);
+  bench_put16(tables[0] + 32, 'A');
+  bench_put16(tables[0] + 34, 0xFFFF);
+  bench_put16(tables[0] + 36, 1 - 'A');
+  bench_put16(tables[0] + 38, 1);
+  /* glyf: one contour of four points each */
+  for (int g = 0; g < 2; g++) {
+    uint8_t *p = tables[1] + g * 36;
+    bench_put16(p, 1);
+    bench_put16(p + 2, 8);
+    bench_put16(p + 6, 56);
+    bench_put16(p + 8, 48);
+    bench_put16(p + 10, 3);
+    for (int i = 0; i < 4; i++) {
+      p[14 + i] = g == 0; // on the curve
+      bench_put16(p + 18 + i * 2, corners[i][0] - (i ? corners[i - 1][0] : 0));
+      bench_put16(p + 26 + i * 2, corners[i][1] - (i ? corners[i - 1][1] : 0));
+    }
+  }
+  bench_put16(tables[2] + 18, 64); // units per em
+  bench_put16(tables[3] + 4, 56); // ascent
+  bench_put16(tables[3] + 6, -8);
+  bench_put16(tables[3] + 34, 3);
+  for (int g = 0; g < 3; g++)
+    bench_put16(tables[4] + g * 4, 64);
+  bench_put16(tables[5] + 4, 18);
+  bench_put16(tables[5] + 6, 36);
+  bench_put16(tables[6] + 4, 3);
+
+  memset(font, 0, 12);
+  font[1] = 1; // version 1.0
+  bench_put16(font + 4, 7);
+  for (int t = 0; t < 7; t++) {
+    uint8_t *rec = font + 12 + t * 16;
+    memcpy(rec, tags[t], 4);
+    memset(rec + 4, 0, 12);
+    bench_put16(rec + 10, (int)off);
+    bench_put16(rec + 14, (int)lengths[t]);
+    memcpy(font + off, tables[t], lengths[t]);
+    off += (lengths[t] + 3) & ~(size_t)3;
+  }
+  return off;
+}
+
+static int bench_texts(int runs) {
+  static const char *names[] = {"text-cached", "text-cold"};
+  static uint8_t data[512];
+  const char *path = getenv("DRAW_ENGINE_FONT");
+  const struct bench_size *size = &bench_sizes[1];
+  uint32_t *pixels = NULL;
+  struct font *font = NULL;
+  struct text_cache *cache = NULL;
+  struct draw_surface surf;
+  int ret = 0;
+
+  font = path ? font_load(path) : font_make(data, bench_make_font(data));
+  pixels = malloc((size_t)size->width * size->height * 4);
+  cache = text_cache_make(512, 512);
+  if (!font || !pixels || !cache) {
+    err_log("%s: no font or memory\n", __func__);
+    ret = 1;
+    goto out;
+  }
+  draw_surface_init(&surf, pixels, size->width * 4, size->width,
+                    size->height);
+  pixels_fill_rect(pixels, size->width * 4, 0, 0, size->width, size->height,
+                   0xFFFFFFFF);
+  for (int n = 0; n < 2; n++) {
+    struct bench_case c = {
+      .name = names[n],
+      .width = size->width,
+      .height = size->height,
+      .run = bench_text,
+      .surf = &surf,
+      .font = font,
+      .cache = cache,
+      .text = path ? "The quick brown fox jumps over the lazy dog, 0123456789 "
+                     "times."
+                   : "ABBA BAAB ABAB BABA AABB BBAA ABBA BAAB ABAB BABA AABB",
+      .cold = n > 0,
+    };
+    c.glyphs = (int)strlen(c.text) * BENCH_TEXT_LINES;
+    text_cache_clear(cache);
+    bench_case_run(&c, runs);
+  }
+out:
+  text_cache_free(&cache);
+  font_free(&font);
+  free(pixels);
+  return ret;
+}
+
+static const struct {
+  const char *name;
+  int (*run)(int runs);
+} bench_groups[] = {
+  {"fill", bench_fills},
+  {"blit", bench_blits},
+  {"shm", bench_shms},
+  {"present", bench_presents},
+  {"draw", bench_draws},
+  {"blend", bench_blends},
+  {"scale", bench_scales},
+  {"list", bench_lists},
+  {"scene", bench_scenes},
+  {"path", bench_paths},
+  {"stroke", bench_strokes},
+  {"text", bench_texts},
+};
+
+int main(int argc, char **argv) {
+  const char *only = NULL;
+  int runs = 5;
+  int opt;
+  int ret = 0;
+
+  while ((opt = getopt(argc, argv, "c:r:")) != -1) {
+    switch (opt) {
+    case 'c':
+      only = optarg;
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    default:
+      err_log("usage: %s [-c fill|blit|shm|present|draw|blend|scale|list|scene|path|stroke|text] [-r runs]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (runs < 1) {
+    err_log("%s: invalid arguments\n", __func__);
+    return 1;
+  }
+
+  for (int i = 0; i < (int)(sizeof(bench_groups) / sizeof(bench_groups[0]));
+       i++) {
+    if (only && strcmp(only, bench_groups[i].name))
+      continue;
+    ret |= bench_groups[i].run(runs);
+  }
+  return ret;
+}
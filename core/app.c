@@ -26,6 +26,8 @@ struct app* app_make(struct app_config* cfg, struct app_ops* ops)
   }
   strncpy(new->name, cfg->name, name_len + 1);
   new->ops = ops;
+  new->thread_count = cfg->thread_count;
+  new->jobs = NULL;
   return new;
 }
 
@@ -44,9 +46,23 @@ void app_free(struct app** papp)
 
 int app_run(struct app* app)
 {
-  app->ops->init_display();
-  app->ops->init_render();
-  app->ops->run_main_loop();
-  app->ops->cleanup();
+  struct job_system_config job_cfg;
+
+  /* made here so the thread running the callbacks is worker 0 */
+  job_system_config_default(&job_cfg);
+  if (app->thread_count > 0)
+    job_cfg.thread_count = app->thread_count;
+  app->jobs = job_system_make(&job_cfg);
+  if (!app->jobs) {
+    err_log("%s: failed to make the job system\n", __func__);
+    return 1;
+  }
+
+  app->ops->init_display(app);
+  app->ops->init_render(app);
+  app->ops->run_main_loop(app);
+  app->ops->cleanup(app);
+
+  job_system_free(&app->jobs);
   return 0;
 }
@@ -1,22 +1,29 @@
 #ifndef _APP_H_
 #define _APP_H_
 
+#include "job.h"
 
+struct app;
+
+/* called on the thread running app_run, app->jobs is ready to use */
 struct app_ops {
-  void (*init_render)();
-  void (*init_display)();
-  void (*run_main_loop)();
-  void (*cleanup)();
+  void (*init_render)(struct app* app);
+  void (*init_display)(struct app* app);
+  void (*run_main_loop)(struct app* app);
+  void (*cleanup)(struct app* app);
 };
 
 
 struct app_config {
   char *name;
+  int thread_count; // for the job system, 0 picks the default
 };
 
 struct app {
   char *name;
   struct app_ops* ops;
+  int thread_count;
+  struct job_system* jobs;
 };
 
 struct app* app_make(struct app_config* cfg, struct app_ops* ops);
@@ -0,0 +1,221 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/utils.h"
+#include "buddy.h"
+
+/*
+ * Everything is counted in units of the min block. A block of order o
+ * spans 1 << o units starting at a multiple of that, its buddy starts at
+ * its first unit ^ (1 << o). The free blocks of each order are kept on a
+ * doubly linked list threaded through arrays indexed by the first unit.
+ */
+struct buddy_allocator {
+  size_t min_block;
+  int min_shift;
+  int order; // the whole arena is a block of this order
+  int32_t *next;
+  int32_t *prev;
+  int8_t *free_order; // of the free block starting at the unit, -1 if none
+  int8_t *used_order; // of the allocation starting at the unit, -1 if none
+  int32_t heads[BUDDY_ORDER_MAX + 1];
+  /* statistics */
+  size_t used;
+  int allocations;
+  uint64_t splits;
+  uint64_t merges;
+};
+
+static int buddy_log2(size_t v) {
+  return 63 - __builtin_clzll(v);
+}
+
+static void buddy_push(struct buddy_allocator *ba, int32_t unit, int order) {
+  int32_t head = ba->heads[order];
+  ba->free_order[unit] = (int8_t)order;
+  ba->prev[unit] = -1;
+  ba->next[unit] = head;
+  if (head >= 0)
+    ba->prev[head] = unit;
+  ba->heads[order] = unit;
+}
+
+static void buddy_remove(struct buddy_allocator *ba, int32_t unit) {
+  int order = ba->free_order[unit];
+  if (ba->prev[unit] >= 0)
+    ba->next[ba->prev[unit]] = ba->next[unit];
+  else
+    ba->heads[order] = ba->next[unit];
+  if (ba->next[unit] >= 0)
+    ba->prev[ba->next[unit]] = ba->prev[unit];
+  ba->free_order[unit] = -1;
+}
+
+/* free a block, merging it upwards while its buddy is free */
+static void buddy_insert(struct buddy_allocator *ba, int32_t unit, int order) {
+  while (order < ba->order) {
+    int32_t buddy = unit ^ ((int32_t)1 << order);
+    if (ba->free_order[buddy] != order)
+      break;
+    buddy_remove(ba, buddy);
+    if (buddy < unit)
+      unit = buddy;
+    order++;
+    ba->merges++;
+  }
+  buddy_push(ba, unit, order);
+}
+
+/* room for units, the new entries are neither free nor used */
+static int buddy_reserve(struct buddy_allocator *ba, int32_t old_units,
+                         int32_t units) {
+  int32_t *next = realloc(ba->next, units * sizeof(int32_t));
+  int32_t *prev;
+  int8_t *free_order;
+  int8_t *used_order;
+
+  if (next)
+    ba->next = next;
+  prev = realloc(ba->prev, units * sizeof(int32_t));
+  if (prev)
+    ba->prev = prev;
+  free_order = realloc(ba->free_order, units);
+  if (free_order)
+    ba->free_order = free_order;
+  used_order = realloc(ba->used_order, units);
+  if (used_order)
+    ba->used_order = used_order;
+  if (!next || !prev || !free_order || !used_order) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  memset(ba->free_order + old_units, -1, units - old_units);
+  memset(ba->used_order + old_units, -1, units - old_units);
+  return 0;
+}
+
+struct buddy_allocator *buddy_allocator_make(size_t size, size_t min_block) {
+  struct buddy_allocator *new = NULL;
+
+  if (!min_block || (min_block & (min_block - 1)) || size < min_block ||
+      (size & (size - 1)) ||
+      buddy_log2(size) - buddy_log2(min_block) > BUDDY_ORDER_MAX) {
+    err_log("%s: invalid arena, size: %zu, min block: %zu\n", __func__, size,
+            min_block);
+    return NULL;
+  }
+  new = malloc(sizeof(struct buddy_allocator));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct buddy_allocator));
+  new->min_block = min_block;
+  new->min_shift = buddy_log2(min_block);
+  new->order = buddy_log2(size) - new->min_shift;
+  for (int i = 0; i <= BUDDY_ORDER_MAX; i++)
+    new->heads[i] = -1;
+  if (buddy_reserve(new, 0, (int32_t)1 << new->order)) {
+    buddy_allocator_free(&new);
+    return NULL;
+  }
+  buddy_push(new, 0, new->order);
+  return new;
+}
+
+void buddy_allocator_free(struct buddy_allocator **ptr) {
+  struct buddy_allocator *ba = *ptr;
+  if (ba) {
+    free(ba->next);
+    free(ba->prev);
+    free(ba->free_order);
+    free(ba->used_order);
+    free(ba);
+    *ptr = NULL;
+  }
+}
+
+long buddy_alloc(struct buddy_allocator *ba, size_t size) {
+  size_t units = (size + ba->min_block - 1) >> ba->min_shift;
+  int order = units > 1 ? buddy_log2(units - 1) + 1 : 0;
+  int found = order;
+  int32_t unit;
+
+  if (!size || order > ba->order)
+    return -1;
+  while (found <= ba->order && ba->heads[found] < 0)
+    found++;
+  if (found > ba->order)
+    return -1;
+  unit = ba->heads[found];
+  buddy_remove(ba, unit);
+  /* the upper halves go back as smaller free blocks */
+  while (found > order) {
+    found--;
+    buddy_push(ba, unit + ((int32_t)1 << found), found);
+    ba->splits++;
+  }
+  ba->used_order[unit] = (int8_t)order;
+  ba->used += ba->min_block << order;
+  ba->allocations++;
+  return (long)unit << ba->min_shift;
+}
+
+void buddy_release(struct buddy_allocator *ba, long offset) {
+  int32_t unit = (int32_t)(offset >> ba->min_shift);
+  int order;
+
+  if (offset < 0 || (offset & (ba->min_block - 1)) ||
+      unit >= ((int32_t)1 << ba->order) || ba->used_order[unit] < 0) {
+    err_log("%s: %ld is not allocated\n", __func__, offset);
+    return;
+  }
+  order = ba->used_order[unit];
+  ba->used_order[unit] = -1;
+  ba->used -= ba->min_block << order;
+  ba->allocations--;
+  buddy_insert(ba, unit, order);
+}
+
+size_t buddy_block_size(struct buddy_allocator *ba, long offset) {
+  int32_t unit = (int32_t)(offset >> ba->min_shift);
+  if (offset < 0 || (offset & (ba->min_block - 1)) ||
+      unit >= ((int32_t)1 << ba->order) || ba->used_order[unit] < 0)
+    return 0;
+  return ba->min_block << ba->used_order[unit];
+}
+
+int buddy_allocator_grow(struct buddy_allocator *ba) {
+  int32_t units = (int32_t)1 << ba->order;
+
+  if (ba->order >= BUDDY_ORDER_MAX) {
+    err_log("%s: the arena is at its largest\n", __func__);
+    return 1;
+  }
+  if (buddy_reserve(ba, units, units * 2))
+    return 1;
+  /* the new upper half merges with the old arena if that is all free */
+  ba->order++;
+  buddy_insert(ba, units, ba->order - 1);
+  return 0;
+}
+
+size_t buddy_allocator_size(struct buddy_allocator *ba) {
+  return ba->min_block << ba->order;
+}
+
+void buddy_get_stats(struct buddy_allocator *ba, struct buddy_stats *stats) {
+  stats->size = buddy_allocator_size(ba);
+  stats->used = ba->used;
+  stats->largest_free = 0;
+  for (int i = ba->order; i >= 0; i--) {
+    if (ba->heads[i] >= 0) {
+      stats->largest_free = ba->min_block << i;
+      break;
+    }
+  }
+  stats->allocations = ba->allocations;
+  stats->splits = ba->splits;
+  stats->merges = ba->merges;
+}
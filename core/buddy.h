@@ -0,0 +1,43 @@
+#ifndef _BUDDY_H_
+#define _BUDDY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A buddy allocator over a range of offsets, it hands out ranges and
+ * never touches the memory behind them. Blocks are a power of two times
+ * the min block, a freed block merges with its buddy as long as the
+ * buddy is free too, so freeing everything gives back a single block.
+ * The arena doubles with buddy_allocator_grow(), the old arena becomes
+ * its lower half and every offset stays valid.
+ */
+
+#define BUDDY_ORDER_MAX 30
+
+struct buddy_stats {
+  size_t size; // of the arena
+  size_t used; // in allocated blocks, rounding included
+  size_t largest_free; // the largest block an allocation can still get
+  int allocations;
+  uint64_t splits;
+  uint64_t merges;
+};
+
+struct buddy_allocator;
+
+/* size and min_block are powers of two, size at least min_block */
+struct buddy_allocator *buddy_allocator_make(size_t size, size_t min_block);
+void buddy_allocator_free(struct buddy_allocator **ptr);
+
+/* the offset of a block of at least size bytes, -1 if none is free */
+long buddy_alloc(struct buddy_allocator *ba, size_t size);
+void buddy_release(struct buddy_allocator *ba, long offset);
+/* the size of the block allocated at offset, 0 if none is */
+size_t buddy_block_size(struct buddy_allocator *ba, long offset);
+int buddy_allocator_grow(struct buddy_allocator *ba);
+size_t buddy_allocator_size(struct buddy_allocator *ba);
+
+void buddy_get_stats(struct buddy_allocator *ba, struct buddy_stats *stats);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _EVENT_BACKEND_H_
+#define _EVENT_BACKEND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* internal to the dispatcher, the interface every wait mechanism implements */
+
+/* the most bytes a backend reads by itself for a watched fd */
+#define EVENT_READ_MAX 128
+
+struct event_completion {
+  int id; // the source
+  uint32_t revents; // ready events of a polled fd
+  /* set if the backend already did the read, valid till the next wait */
+  const void *data;
+  int64_t res; // bytes read or -errno
+};
+
+struct event_backend_ops {
+  const char *name;
+  bool blocking_reads; // fds watched with a read_len must not be O_NONBLOCK
+  void *(*make)(void);
+  void (*free)(void *backend);
+  /*
+   * Watch fd for events. With a read_len the backend may read that much
+   * itself once the fd is ready and hand the bytes over in the completion,
+   * or leave the read to the dispatcher by completing without data.
+   */
+  int (*watch)(void *backend, int id, int fd, uint32_t events, size_t read_len);
+  /* before the fd is closed */
+  void (*unwatch)(void *backend, int id, int fd);
+  /* a one shot read into buf, completes with data set to buf */
+  int (*read)(void *backend, int id, int fd, void *buf, size_t len,
+              uint64_t offset);
+  /* fill out with up to max completions, -1 on error */
+  int (*wait)(void *backend, struct event_completion *out, int max,
+              int timeout_ms);
+  uint64_t (*syscalls)(void *backend); // made so far
+};
+
+extern const struct event_backend_ops event_epoll_ops;
+#ifdef HAVE_IO_URING
+extern const struct event_backend_ops event_uring_ops;
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "event-backend.h"
+
+/* the most fds reported by one epoll_wait */
+#define EPOLL_WAIT_MAX 32
+/* reads done on submission and not reported yet */
+#define EPOLL_READS_MAX 64
+
+/*
+ * The readiness backend: the dispatcher reads ready fds itself and reads
+ * are done right away, regular files never block on epoll anyway.
+ */
+struct event_epoll {
+  int epfd;
+  struct event_completion reads[EPOLL_READS_MAX];
+  int read_count;
+  uint64_t syscalls;
+};
+
+static void *event_epoll_make(void) {
+  struct event_epoll *new = NULL;
+  new = malloc(sizeof(struct event_epoll));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct event_epoll));
+  new->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (new->epfd < 0) {
+    err_log("%s: failed to create epoll fd\n", __func__);
+    free(new);
+    return NULL;
+  }
+  return new;
+}
+
+static void event_epoll_free(void *backend) {
+  struct event_epoll *ep = (struct event_epoll *)backend;
+  close(ep->epfd);
+  free(ep);
+}
+
+static int event_epoll_watch(void *backend, int id, int fd, uint32_t events,
+                             size_t read_len) {
+  struct event_epoll *ep = (struct event_epoll *)backend;
+  struct epoll_event ev = {
+    .events = events,
+    .data.u32 = (uint32_t)id,
+  };
+  (void)read_len;
+  ep->syscalls++;
+  if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    err_log("%s: failed to watch fd %d\n", __func__, fd);
+    return 1;
+  }
+  return 0;
+}
+
+static void event_epoll_unwatch(void *backend, int id, int fd) {
+  struct event_epoll *ep = (struct event_epoll *)backend;
+  (void)id;
+  ep->syscalls++;
+  epoll_ctl(ep->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int event_epoll_read(void *backend, int id, int fd, void *buf,
+                            size_t len, uint64_t offset) {
+  struct event_epoll *ep = (struct event_epoll *)backend;
+  struct event_completion *c;
+  ssize_t ret;
+
+  if (ep->read_count == EPOLL_READS_MAX) {
+    err_log("%s: too many reads in flight\n", __func__);
+    return 1;
+  }
+  ep->syscalls++;
+  ret = pread(fd, buf, len, offset);
+  c = &ep->reads[ep->read_count++];
+  c->id = id;
+  c->revents = 0;
+  c->data = buf;
+  c->res = ret < 0 ? -errno : ret;
+  return 0;
+}
+
+static int event_epoll_wait(void *backend, struct event_completion *out,
+                            int max, int timeout_ms) {
+  struct event_epoll *ep = (struct event_epoll *)backend;
+  struct epoll_event events[EPOLL_WAIT_MAX];
+  int count = 0;
+  int ready;
+
+  /* finished reads go first and the wait must not block on them */
+  while (count < max && count < ep->read_count) {
+    out[count] = ep->reads[count];
+    count++;
+  }
+  if (count) {
+    memmove(ep->reads, &ep->reads[count],
+            (ep->read_count - count) * sizeof(struct event_completion));
+    ep->read_count -= count;
+    timeout_ms = 0;
+  }
+  if (count == max)
+    return count;
+  if (max - count < EPOLL_WAIT_MAX)
+    ready = max - count;
+  else
+    ready = EPOLL_WAIT_MAX;
+  ep->syscalls++;
+  ready = epoll_wait(ep->epfd, events, ready, timeout_ms);
+  if (ready < 0)
+    return count ? count : -1;
+  for (int i = 0; i < ready; i++) {
+    out[count].id = (int)events[i].data.u32;
+    out[count].revents = events[i].events;
+    out[count].data = NULL;
+    out[count].res = 0;
+    count++;
+  }
+  return count;
+}
+
+static uint64_t event_epoll_syscalls(void *backend) {
+  return ((struct event_epoll *)backend)->syscalls;
+}
+
+const struct event_backend_ops event_epoll_ops = {
+  .name = "epoll",
+  .make = event_epoll_make,
+  .free = event_epoll_free,
+  .watch = event_epoll_watch,
+  .unwatch = event_epoll_unwatch,
+  .read = event_epoll_read,
+  .wait = event_epoll_wait,
+  .syscalls = event_epoll_syscalls,
+};
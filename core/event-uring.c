@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "event-backend.h"
+
+/*
+ * The completion backend on io_uring, driven through the kernel
+ * interface directly so liburing is not needed to build it.
+ *
+ * Watched fds are one shot polls, or one shot reads when the dispatcher
+ * asked for the bytes (timerfd, signalfd), re-armed before every wait.
+ * Those reads park in the kernel till there is data, so the fds must not
+ * be O_NONBLOCK or they complete with -EAGAIN right away.
+ * Re-arms, cancels, reads and the timeout of the wait all go in as SQEs
+ * and are submitted by the single io_uring_enter that also waits.
+ */
+
+#define URING_ENTRIES 64
+
+enum uring_op_kind {
+  URING_OP_POLL,
+  URING_OP_WATCH_READ,
+  URING_OP_READ,
+  URING_OP_TIMEOUT,
+  URING_OP_CANCEL,
+};
+
+struct uring_op {
+  enum uring_op_kind kind;
+  int id;
+  int fd;
+  uint32_t events;
+  size_t len;
+  bool armed; // in the kernel
+  bool removed; // freed once the kernel is done with it
+  void *buf; // of a one shot read
+  uint64_t offset;
+  struct __kernel_timespec ts;
+  struct uring_op *next; // in the watch list
+  struct uring_op *all_prev; // every live op, to free them with the ring
+  struct uring_op *all_next;
+  uint8_t data[EVENT_READ_MAX]; // of a watch read
+};
+
+struct event_uring {
+  int fd;
+  /* submission ring */
+  void *sq_ptr;
+  size_t sq_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned sq_local_tail;
+  unsigned to_submit;
+  /* completion ring */
+  void *cq_ptr;
+  size_t cq_size;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  struct uring_op *watches;
+  struct uring_op *ops;
+  uint64_t syscalls;
+};
+
+static int uring_enter(struct event_uring *ring, unsigned to_submit,
+                       unsigned min_complete, unsigned flags) {
+  int ret;
+  ring->syscalls++;
+  ret = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                     flags, NULL, 0);
+  if (ret >= 0)
+    ring->to_submit -= (unsigned)ret < ring->to_submit ? (unsigned)ret
+                                                       : ring->to_submit;
+  return ret;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct event_uring *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  struct io_uring_sqe *sqe;
+
+  if (ring->sq_local_tail - head >= URING_ENTRIES) {
+    /* full, hand what is queued to the kernel first */
+    if (uring_enter(ring, ring->to_submit, 0, 0) < 0)
+      return NULL;
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= URING_ENTRIES)
+      return NULL;
+  }
+  sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sq_array[ring->sq_local_tail & *ring->sq_mask] =
+    ring->sq_local_tail & *ring->sq_mask;
+  ring->sq_local_tail++;
+  ring->to_submit++;
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+static int uring_arm(struct event_uring *ring, struct uring_op *op) {
+  struct io_uring_sqe *sqe = uring_get_sqe(ring);
+  if (!sqe)
+    return 1;
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+  switch (op->kind) {
+  case URING_OP_POLL:
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = op->fd;
+    sqe->poll32_events = op->events;
+    break;
+  case URING_OP_WATCH_READ:
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)op->data;
+    sqe->len = (uint32_t)op->len;
+    sqe->off = (uint64_t)-1; // the current position, the only one they have
+    break;
+  case URING_OP_READ:
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)op->buf;
+    sqe->len = (uint32_t)op->len;
+    sqe->off = op->offset;
+    break;
+  case URING_OP_TIMEOUT:
+    /* done after the timeout or as soon as any other completion arrives */
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&op->ts;
+    sqe->len = 1;
+    sqe->off = 1;
+    break;
+  case URING_OP_CANCEL:
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)op->buf; // the op to cancel
+    break;
+  }
+  op->armed = true;
+  return 0;
+}
+
+static void *event_uring_make(void) {
+  struct event_uring *new = NULL;
+  struct io_uring_params p;
+  void *ptr;
+
+  new = malloc(sizeof(struct event_uring));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct event_uring));
+  memset(&p, 0, sizeof(p));
+  new->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (new->fd < 0) {
+    err_log("%s: io_uring is not available\n", __func__);
+    free(new);
+    return NULL;
+  }
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_NODROP)) {
+    err_log("%s: the kernel io_uring is too old\n", __func__);
+    close(new->fd);
+    free(new);
+    return NULL;
+  }
+  new->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  new->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (new->cq_size > new->sq_size)
+    new->sq_size = new->cq_size;
+  ptr = mmap(NULL, new->sq_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, new->fd, IORING_OFF_SQ_RING);
+  if (ptr == MAP_FAILED) {
+    err_log("%s: failed to map the rings\n", __func__);
+    close(new->fd);
+    free(new);
+    return NULL;
+  }
+  /* one mapping holds both rings */
+  new->sq_ptr = ptr;
+  new->cq_ptr = ptr;
+  new->sq_head = (unsigned *)((char *)ptr + p.sq_off.head);
+  new->sq_tail = (unsigned *)((char *)ptr + p.sq_off.tail);
+  new->sq_mask = (unsigned *)((char *)ptr + p.sq_off.ring_mask);
+  new->sq_array = (unsigned *)((char *)ptr + p.sq_off.array);
+  new->cq_head = (unsigned *)((char *)ptr + p.cq_off.head);
+  new->cq_tail = (unsigned *)((char *)ptr + p.cq_off.tail);
+  new->cq_mask = (unsigned *)((char *)ptr + p.cq_off.ring_mask);
+  new->cqes = (struct io_uring_cqe *)((char *)ptr + p.cq_off.cqes);
+  new->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  new->sqes = mmap(NULL, new->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, new->fd, IORING_OFF_SQES);
+  if (new->sqes == MAP_FAILED) {
+    err_log("%s: failed to map the sqes\n", __func__);
+    munmap(ptr, new->sq_size);
+    close(new->fd);
+    free(new);
+    return NULL;
+  }
+  new->sq_local_tail = *new->sq_tail;
+  return new;
+}
+
+static void uring_op_free(struct event_uring *ring, struct uring_op *op) {
+  if (op->all_prev)
+    op->all_prev->all_next = op->all_next;
+  else
+    ring->ops = op->all_next;
+  if (op->all_next)
+    op->all_next->all_prev = op->all_prev;
+  free(op);
+}
+
+static void event_uring_free(void *backend) {
+  struct event_uring *ring = (struct event_uring *)backend;
+
+  /* closing the ring cancels whatever is still in flight */
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+  while (ring->ops)
+    uring_op_free(ring, ring->ops);
+  free(ring);
+}
+
+static struct uring_op *uring_op_make(struct event_uring *ring,
+                                      enum uring_op_kind kind, int id, int fd) {
+  struct uring_op *new = malloc(sizeof(struct uring_op));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct uring_op));
+  new->kind = kind;
+  new->id = id;
+  new->fd = fd;
+  new->all_next = ring->ops;
+  if (ring->ops)
+    ring->ops->all_prev = new;
+  ring->ops = new;
+  return new;
+}
+
+static int event_uring_watch(void *backend, int id, int fd, uint32_t events,
+                             size_t read_len) {
+  struct event_uring *ring = (struct event_uring *)backend;
+  struct uring_op *op;
+
+  if (read_len > EVENT_READ_MAX) {
+    err_log("%s: can not read %zu bytes for fd %d\n", __func__, read_len, fd);
+    return 1;
+  }
+  op = uring_op_make(ring, read_len ? URING_OP_WATCH_READ : URING_OP_POLL, id, fd);
+  if (!op)
+    return 1;
+  op->events = events;
+  op->len = read_len;
+  /* armed by the next wait */
+  op->next = ring->watches;
+  ring->watches = op;
+  return 0;
+}
+
+static void event_uring_unwatch(void *backend, int id, int fd) {
+  struct event_uring *ring = (struct event_uring *)backend;
+  struct uring_op **link = &ring->watches;
+  struct uring_op *op;
+  struct uring_op *cancel;
+  (void)fd;
+
+  while (*link && (*link)->id != id)
+    link = &(*link)->next;
+  op = *link;
+  if (!op)
+    return;
+  *link = op->next;
+  if (!op->armed) {
+    uring_op_free(ring, op);
+    return;
+  }
+  /* still in the kernel, freed by its completion */
+  op->removed = true;
+  cancel = uring_op_make(ring, URING_OP_CANCEL, id, -1);
+  if (!cancel)
+    return;
+  cancel->buf = op;
+  if (uring_arm(ring, cancel))
+    uring_op_free(ring, cancel);
+}
+
+static int event_uring_read(void *backend, int id, int fd, void *buf,
+                            size_t len, uint64_t offset) {
+  struct event_uring *ring = (struct event_uring *)backend;
+  struct uring_op *op = uring_op_make(ring, URING_OP_READ, id, fd);
+  if (!op)
+    return 1;
+  op->buf = buf;
+  op->len = len;
+  op->offset = offset;
+  if (uring_arm(ring, op)) {
+    uring_op_free(ring, op);
+    return 1;
+  }
+  return 0;
+}
+
+/* turn the finished cqes into completions, 0 for those nobody sees */
+static int uring_reap(struct event_uring *ring, struct event_completion *out,
+                      int max) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  int count = 0;
+
+  while (head != tail && count < max) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    struct uring_op *op = (struct uring_op *)(uintptr_t)cqe->user_data;
+    struct event_completion *c = &out[count];
+
+    head++;
+    op->armed = false;
+    if (op->removed || op->kind == URING_OP_TIMEOUT ||
+        op->kind == URING_OP_CANCEL) {
+      uring_op_free(ring, op);
+      continue;
+    }
+    c->id = op->id;
+    c->revents = 0;
+    c->data = NULL;
+    c->res = cqe->res;
+    switch (op->kind) {
+    case URING_OP_POLL:
+      c->revents = cqe->res < 0 ? POLLERR : (uint32_t)cqe->res;
+      break;
+    case URING_OP_WATCH_READ:
+      if (cqe->res < 0)
+        c->revents = POLLERR;
+      else
+        c->data = op->data;
+      break;
+    case URING_OP_READ:
+      c->data = op->buf;
+      uring_op_free(ring, op);
+      break;
+    default:
+      break;
+    }
+    count++;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return count;
+}
+
+static int event_uring_wait(void *backend, struct event_completion *out,
+                            int max, int timeout_ms) {
+  struct event_uring *ring = (struct event_uring *)backend;
+  bool ready = *ring->cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  unsigned min_complete = 0;
+
+  /* the watches completed last round go back in */
+  for (struct uring_op *op = ring->watches; op; op = op->next) {
+    if (!op->armed && uring_arm(ring, op))
+      return -1;
+  }
+  if (!ready && timeout_ms != 0) {
+    min_complete = 1;
+    if (timeout_ms > 0) {
+      struct uring_op *op = uring_op_make(ring, URING_OP_TIMEOUT, -1, -1);
+      if (!op)
+        return -1;
+      op->ts.tv_sec = timeout_ms / 1000;
+      op->ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+      if (uring_arm(ring, op)) {
+        uring_op_free(ring, op);
+        return -1;
+      }
+    }
+  }
+  if (ring->to_submit || min_complete) {
+    if (uring_enter(ring, ring->to_submit, min_complete,
+                    min_complete ? IORING_ENTER_GETEVENTS : 0) < 0 &&
+        errno != EINTR && errno != ETIME)
+      return -1;
+  }
+  return uring_reap(ring, out, max);
+}
+
+static uint64_t event_uring_syscalls(void *backend) {
+  return ((struct event_uring *)backend)->syscalls;
+}
+
+const struct event_backend_ops event_uring_ops = {
+  .name = "io_uring",
+  .blocking_reads = true,
+  .make = event_uring_make,
+  .free = event_uring_free,
+  .watch = event_uring_watch,
+  .unwatch = event_uring_unwatch,
+  .read = event_uring_read,
+  .wait = event_uring_wait,
+  .syscalls = event_uring_syscalls,
+};
@@ -0,0 +1,495 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h> // EPOLLERR for failed reads
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "event-backend.h"
+#include "event.h"
+
+/* the most completions taken from the backend by one wait */
+#define EVENT_WAIT_MAX 32
+
+struct event_subscriber {
+  event_handler handler;
+  void *data;
+};
+
+struct event_source {
+  int id;
+  enum event_type type;
+  int fd; // -1 for user and read sources
+  bool owns_fd; // timerfd and signalfd are closed with the source
+  struct event_subscriber subscribers[EVENT_SUBSCRIBERS_MAX];
+  int subscriber_count;
+  event_prepare_fn prepare;
+  event_check_fn check;
+  void *hook_data;
+  uint32_t revents; // of the current wait
+};
+
+struct event_dispatcher {
+  const struct event_backend_ops *backend;
+  void *backend_data;
+  /* ids index this, removed sources leave a NULL and ids are never reused */
+  struct event_source **sources;
+  int source_count;
+  int source_caps;
+  /* the queue of pending events */
+  struct event queue[EVENT_QUEUE_CAPS];
+  int head;
+  int count;
+  struct event current; // returned by event_dequeue
+  bool quit;
+  struct event_dispatcher_stats stats; // syscalls not counting the backend
+};
+
+static struct event_source *event_source_get(struct event_dispatcher *ed,
+                                             int id) {
+  if (id < 0 || id >= ed->source_count)
+    return NULL;
+  return ed->sources[id];
+}
+
+struct event_dispatcher *event_dispatcher_make_backend(enum event_backend backend) {
+  struct event_dispatcher *new = NULL;
+  const struct event_backend_ops *ops = &event_epoll_ops;
+
+  if (backend == EVENT_BACKEND_IO_URING) {
+#ifdef HAVE_IO_URING
+    ops = &event_uring_ops;
+#else
+    err_log("%s: built without io_uring support\n", __func__);
+    return NULL;
+#endif
+  }
+  new = malloc(sizeof(struct event_dispatcher));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct event_dispatcher));
+  new->backend = ops;
+  new->backend_data = ops->make();
+  if (!new->backend_data) {
+    free(new);
+    return NULL;
+  }
+  return new;
+}
+
+struct event_dispatcher *event_dispatcher_make(void) {
+  const char *name = getenv("DRAW_ENGINE_EVENT_BACKEND");
+  struct event_dispatcher *ed = NULL;
+
+  if (name && strcmp(name, "io_uring") == 0) {
+    ed = event_dispatcher_make_backend(EVENT_BACKEND_IO_URING);
+    if (ed)
+      return ed;
+    err_log("%s: falling back to epoll\n", __func__);
+  }
+  return event_dispatcher_make_backend(EVENT_BACKEND_EPOLL);
+}
+
+const char *event_dispatcher_backend_name(struct event_dispatcher *ed) {
+  return ed->backend->name;
+}
+
+void event_dispatcher_free(struct event_dispatcher **ptr) {
+  struct event_dispatcher *ed = *ptr;
+  if (ed) {
+    for (int i = 0; i < ed->source_count; i++)
+      event_source_remove(ed, i);
+    free(ed->sources);
+    ed->backend->free(ed->backend_data);
+    free(ed);
+    *ptr = NULL;
+  }
+}
+
+static struct event_source *event_source_add(struct event_dispatcher *ed,
+                                             enum event_type type, int fd,
+                                             bool owns_fd, uint32_t events,
+                                             size_t read_len) {
+  struct event_source *src = NULL;
+
+  if (ed->source_count == ed->source_caps) {
+    int caps = ed->source_caps ? ed->source_caps * 2 : 8;
+    struct event_source **sources =
+      realloc(ed->sources, caps * sizeof(struct event_source *));
+    if (!sources) {
+      err_log("%s: no enough memory\n", __func__);
+      return NULL;
+    }
+    ed->sources = sources;
+    ed->source_caps = caps;
+  }
+  src = malloc(sizeof(struct event_source));
+  if (!src) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(src, 0, sizeof(struct event_source));
+  src->id = ed->source_count;
+  src->type = type;
+  src->fd = fd;
+  src->owns_fd = owns_fd;
+  if (fd >= 0 && ed->backend->watch(ed->backend_data, src->id, fd, events,
+                                     read_len)) {
+    free(src);
+    return NULL;
+  }
+  ed->sources[ed->source_count++] = src;
+  return src;
+}
+
+int event_provide(struct event_dispatcher *ed, enum event_type type) {
+  struct event_source *src = event_source_add(ed, type, -1, false, 0, 0);
+  return src ? src->id : -1;
+}
+
+int event_provide_fd(struct event_dispatcher *ed, int fd, uint32_t events) {
+  struct event_source *src = event_source_add(ed, EVENT_TYPE_IO, fd, false,
+                                              events, 0);
+  return src ? src->id : -1;
+}
+
+int event_provide_timer(struct event_dispatcher *ed, uint64_t initial_ns,
+                        uint64_t interval_ns) {
+  struct event_source *src = NULL;
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC |
+                          (ed->backend->blocking_reads ? 0 : TFD_NONBLOCK));
+
+  if (fd < 0) {
+    err_log("%s: failed to create timerfd\n", __func__);
+    return -1;
+  }
+  src = event_source_add(ed, EVENT_TYPE_TIMER, fd, true, EPOLLIN,
+                         sizeof(uint64_t));
+  if (!src) {
+    close(fd);
+    return -1;
+  }
+  if (event_timer_set(ed, src->id, initial_ns, interval_ns)) {
+    event_source_remove(ed, src->id);
+    return -1;
+  }
+  return src->id;
+}
+
+int event_block_signal(int signo) {
+  sigset_t mask;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, signo);
+  if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+    err_log("%s: failed to block signal %d\n", __func__, signo);
+    return 1;
+  }
+  return 0;
+}
+
+int event_provide_signal(struct event_dispatcher *ed, int signo) {
+  struct event_source *src = NULL;
+  sigset_t mask;
+  int fd;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, signo);
+  /* or it is still delivered the old way */
+  if (event_block_signal(signo))
+    return -1;
+  fd = signalfd(-1, &mask, SFD_CLOEXEC |
+                 (ed->backend->blocking_reads ? 0 : SFD_NONBLOCK));
+  if (fd < 0) {
+    err_log("%s: failed to create signalfd\n", __func__);
+    return -1;
+  }
+  src = event_source_add(ed, EVENT_TYPE_SIGNAL, fd, true, EPOLLIN,
+                         sizeof(struct signalfd_siginfo));
+  if (!src) {
+    close(fd);
+    return -1;
+  }
+  return src->id;
+}
+
+void event_source_remove(struct event_dispatcher *ed, int id) {
+  struct event_source *src = event_source_get(ed, id);
+  if (!src)
+    return;
+  if (src->fd >= 0) {
+    ed->backend->unwatch(ed->backend_data, id, src->fd);
+    if (src->owns_fd) {
+      ed->stats.syscalls++;
+      close(src->fd);
+    }
+  }
+  ed->sources[id] = NULL;
+  free(src);
+}
+
+int event_timer_set(struct event_dispatcher *ed, int id, uint64_t initial_ns,
+                    uint64_t interval_ns) {
+  struct event_source *src = event_source_get(ed, id);
+  struct itimerspec its;
+
+  if (!src || src->type != EVENT_TYPE_TIMER) {
+    err_log("%s: %d is not a timer\n", __func__, id);
+    return 1;
+  }
+  its.it_value.tv_sec = initial_ns / 1000000000ull;
+  its.it_value.tv_nsec = initial_ns % 1000000000ull;
+  its.it_interval.tv_sec = interval_ns / 1000000000ull;
+  its.it_interval.tv_nsec = interval_ns % 1000000000ull;
+  ed->stats.syscalls++;
+  if (timerfd_settime(src->fd, 0, &its, NULL) < 0) {
+    err_log("%s: failed to arm timer %d\n", __func__, id);
+    return 1;
+  }
+  return 0;
+}
+
+int event_read(struct event_dispatcher *ed, int id, int fd, void *buf,
+               size_t len, uint64_t offset) {
+  struct event_source *src = event_source_get(ed, id);
+  if (!src || src->type != EVENT_TYPE_READ) {
+    err_log("%s: %d is not a read source\n", __func__, id);
+    return 1;
+  }
+  return ed->backend->read(ed->backend_data, id, fd, buf, len, offset);
+}
+
+int event_source_set_hooks(struct event_dispatcher *ed, int id,
+                           event_prepare_fn prepare, event_check_fn check,
+                           void *data) {
+  struct event_source *src = event_source_get(ed, id);
+  if (!src || src->fd < 0) {
+    err_log("%s: %d is not an fd source\n", __func__, id);
+    return 1;
+  }
+  src->prepare = prepare;
+  src->check = check;
+  src->hook_data = data;
+  return 0;
+}
+
+int subscribe_event_source(struct event_dispatcher *ed, int id,
+                           event_handler handler, void *data) {
+  struct event_source *src = event_source_get(ed, id);
+  if (!src) {
+    err_log("%s: no event source %d\n", __func__, id);
+    return 1;
+  }
+  if (src->subscriber_count == EVENT_SUBSCRIBERS_MAX) {
+    err_log("%s: event source %d has too many subscribers\n", __func__, id);
+    return 1;
+  }
+  src->subscribers[src->subscriber_count].handler = handler;
+  src->subscribers[src->subscriber_count].data = data;
+  src->subscriber_count++;
+  return 0;
+}
+
+void unsubscribe_event_source(struct event_dispatcher *ed, int id,
+                              event_handler handler, void *data) {
+  struct event_source *src = event_source_get(ed, id);
+  if (!src)
+    return;
+  for (int i = 0; i < src->subscriber_count; i++) {
+    if (src->subscribers[i].handler == handler &&
+        src->subscribers[i].data == data) {
+      memmove(&src->subscribers[i], &src->subscribers[i + 1],
+              (src->subscriber_count - i - 1) * sizeof(struct event_subscriber));
+      src->subscriber_count--;
+      return;
+    }
+  }
+}
+
+static int event_post(struct event_dispatcher *ed, struct event_source *src,
+                      uint32_t revents, uint64_t value, void *buf) {
+  struct event *ev;
+
+  if (ed->count == EVENT_QUEUE_CAPS) {
+    ed->stats.dropped++;
+    return 1;
+  }
+  ev = &ed->queue[(ed->head + ed->count) % EVENT_QUEUE_CAPS];
+  ev->id = src->id;
+  ev->type = src->type;
+  ev->revents = revents;
+  ev->value = value;
+  ev->buf = buf;
+  ed->count++;
+  return 0;
+}
+
+int event_enqueue(struct event_dispatcher *ed, int id) {
+  return event_enqueue_value(ed, id, 0);
+}
+
+int event_enqueue_value(struct event_dispatcher *ed, int id, uint64_t value) {
+  struct event_source *src = event_source_get(ed, id);
+  if (!src) {
+    err_log("%s: no event source %d\n", __func__, id);
+    return 1;
+  }
+  return event_post(ed, src, 0, value, NULL);
+}
+
+struct event *event_dequeue(struct event_dispatcher *ed) {
+  if (!ed->count)
+    return NULL;
+  ed->current = ed->queue[ed->head];
+  ed->head = (ed->head + 1) % EVENT_QUEUE_CAPS;
+  ed->count--;
+  return &ed->current;
+}
+
+void event_dispatch(struct event_dispatcher *ed, struct event *ev) {
+  struct event_source *src = event_source_get(ed, ev->id);
+  struct event_subscriber subscribers[EVENT_SUBSCRIBERS_MAX];
+  struct event local = *ev;
+  int count;
+
+  /* the source is gone if it was removed after the event was queued */
+  if (!src)
+    return;
+  /* handlers may (un)subscribe and remove sources while we iterate */
+  count = src->subscriber_count;
+  memcpy(subscribers, src->subscribers, count * sizeof(struct event_subscriber));
+  for (int i = 0; i < count; i++) {
+    if (subscribers[i].handler(ed, &local, subscribers[i].data))
+      unsubscribe_event_source(ed, local.id, subscribers[i].handler,
+                               subscribers[i].data);
+  }
+  ed->stats.dispatched++;
+}
+
+/* queue what a completion says, reading the fd if the backend did not */
+static void event_source_complete(struct event_dispatcher *ed,
+                                  struct event_source *src,
+                                  struct event_completion *c) {
+  uint64_t value = 0;
+  uint32_t revents = c->revents;
+  struct signalfd_siginfo info;
+  const void *data = c->data;
+
+  /* the fd blocks and the backend could not read it, nothing to do */
+  if (!data && ed->backend->blocking_reads &&
+      (src->type == EVENT_TYPE_TIMER || src->type == EVENT_TYPE_SIGNAL))
+    return;
+  switch (src->type) {
+  case EVENT_TYPE_TIMER:
+    if (!data) {
+      ed->stats.syscalls++;
+      if (read(src->fd, &value, sizeof(value)) != sizeof(value))
+        return;
+    } else if (c->res == sizeof(value)) {
+      memcpy(&value, data, sizeof(value));
+    } else {
+      return;
+    }
+    break;
+  case EVENT_TYPE_SIGNAL:
+    if (!data) {
+      ed->stats.syscalls++;
+      if (read(src->fd, &info, sizeof(info)) != sizeof(info))
+        return;
+    } else if (c->res == sizeof(info)) {
+      memcpy(&info, data, sizeof(info));
+    } else {
+      return;
+    }
+    value = info.ssi_signo;
+    break;
+  case EVENT_TYPE_READ:
+    if (c->res < 0) {
+      revents |= EPOLLERR;
+      value = (uint64_t)-c->res;
+    } else {
+      value = (uint64_t)c->res;
+    }
+    break;
+  default:
+    break;
+  }
+  if (src->subscriber_count)
+    event_post(ed, src, revents, value, (void *)data);
+}
+
+int event_wait(struct event_dispatcher *ed, int timeout_ms) {
+  struct event_completion completions[EVENT_WAIT_MAX];
+  int ready;
+
+  for (int i = 0; i < ed->source_count; i++) {
+    struct event_source *src = ed->sources[i];
+    if (src && src->prepare)
+      src->prepare(src->hook_data);
+  }
+  ready = ed->backend->wait(ed->backend_data, completions, EVENT_WAIT_MAX,
+                            ed->count ? 0 : timeout_ms);
+  ed->stats.waits++;
+  if (ready < 0 && errno != EINTR)
+    err_log("%s: the %s wait failed\n", __func__, ed->backend->name);
+  for (int i = 0; i < ready; i++) {
+    struct event_source *src = event_source_get(ed, completions[i].id);
+    if (!src)
+      continue;
+    /* io sources go after the checks so those see their revents */
+    if (src->type == EVENT_TYPE_IO)
+      src->revents |= completions[i].revents;
+    else
+      event_source_complete(ed, src, &completions[i]);
+  }
+  /* every prepare is paired with a check, even when the wait failed */
+  for (int i = 0; i < ed->source_count; i++) {
+    struct event_source *src = ed->sources[i];
+    if (src && src->check)
+      src->check(src->hook_data, src->revents);
+  }
+  for (int i = 0; i < ed->source_count; i++) {
+    struct event_source *src = ed->sources[i];
+    if (src && src->revents) {
+      struct event_completion c = {
+        .id = src->id,
+        .revents = src->revents,
+      };
+      src->revents = 0;
+      event_source_complete(ed, src, &c);
+    }
+  }
+  return ready;
+}
+
+int event_dispatcher_run_once(struct event_dispatcher *ed, int timeout_ms) {
+  int ready = event_wait(ed, timeout_ms);
+  /* events queued by the handlers wait for the next round */
+  int count = ed->count;
+  struct event *ev;
+
+  while (count-- > 0 && (ev = event_dequeue(ed)))
+    event_dispatch(ed, ev);
+  return ready;
+}
+
+void event_dispatcher_quit(struct event_dispatcher *ed) { ed->quit = true; }
+
+bool event_dispatcher_should_quit(struct event_dispatcher *ed) {
+  return ed->quit;
+}
+
+void event_dispatcher_get_stats(struct event_dispatcher *ed,
+                                struct event_dispatcher_stats *stats) {
+  *stats = ed->stats;
+  stats->syscalls += ed->backend->syscalls(ed->backend_data);
+}
@@ -0,0 +1,135 @@
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An event dispatcher, see docs/event-driven-framework.org.
+ *
+ * Event sources are provided first, subscribers register handlers for
+ * them and the loop dequeues the events and dispatches them:
+ *
+ *   id = event_provide_timer(ed, ns, ns);
+ *   subscribe_event_source(ed, id, handler, data);
+ *   while (!event_dispatcher_should_quit(ed))
+ *     event_dispatcher_run_once(ed, -1);
+ *
+ * fd, timer and signal sources are enqueued by event_wait() once their fd
+ * is ready, read sources when an event_read() finished and user sources
+ * only by event_enqueue().
+ *
+ * The waiting is done by a backend: epoll, or io_uring where the timer and
+ * signal reads, file reads and the timeout are batched into one
+ * io_uring_enter per wait.
+ */
+
+enum event_backend {
+  EVENT_BACKEND_EPOLL,
+  EVENT_BACKEND_IO_URING,
+};
+
+enum event_type {
+  EVENT_TYPE_USER,
+  EVENT_TYPE_IO,
+  EVENT_TYPE_TIMER,
+  EVENT_TYPE_SIGNAL,
+  EVENT_TYPE_READ,
+};
+
+struct event {
+  int id;
+  enum event_type type;
+  uint32_t revents; // epoll events of an io source, EPOLLERR if a read failed
+  /* timer expirations, the signal number, the bytes read (the errno if
+   * it failed) or a user value */
+  uint64_t value;
+  void *buf; // of a read
+};
+
+struct event_dispatcher;
+
+/* returns non-zero to unsubscribe */
+typedef int (*event_handler)(struct event_dispatcher *ed, struct event *ev,
+                             void *data);
+
+/*
+ * Hooks of an io source that has to run around the wait, e.g. a wayland
+ * display: prepare runs before every epoll_wait, check after it with the
+ * revents of the fd, 0 if it is not ready or the wait failed.
+ */
+typedef void (*event_prepare_fn)(void *data);
+typedef void (*event_check_fn)(void *data, uint32_t revents);
+
+#define EVENT_SUBSCRIBERS_MAX 4
+#define EVENT_QUEUE_CAPS 256
+
+struct event_dispatcher_stats {
+  uint64_t waits;
+  uint64_t dispatched;
+  uint64_t dropped; // enqueued while the queue was full
+  uint64_t syscalls; // made by the dispatcher and its backend
+};
+
+/* the backend named by DRAW_ENGINE_EVENT_BACKEND (epoll or io_uring),
+ * epoll if unset or io_uring is not available */
+struct event_dispatcher *event_dispatcher_make(void);
+struct event_dispatcher *event_dispatcher_make_backend(enum event_backend backend);
+const char *event_dispatcher_backend_name(struct event_dispatcher *ed);
+void event_dispatcher_free(struct event_dispatcher **ptr);
+
+/* a user or read source, returns its id or -1 */
+int event_provide(struct event_dispatcher *ed, enum event_type type);
+/* watch fd for events (EPOLLIN, ...), the fd stays owned by the caller */
+int event_provide_fd(struct event_dispatcher *ed, int fd, uint32_t events);
+/* a timerfd firing after initial_ns then every interval_ns, 0 for once */
+int event_provide_timer(struct event_dispatcher *ed, uint64_t initial_ns,
+                        uint64_t interval_ns);
+/*
+ * Block signo in the calling thread and in the threads it makes from then
+ * on. Call it from main before any thread exists, a thread still taking
+ * the signal would get the default action instead of the signalfd.
+ */
+int event_block_signal(int signo);
+/* delivers signo through a signalfd, blocking it in the calling thread */
+int event_provide_signal(struct event_dispatcher *ed, int signo);
+void event_source_remove(struct event_dispatcher *ed, int id);
+
+/* re-arm a timer source, an initial_ns of 0 disarms it */
+int event_timer_set(struct event_dispatcher *ed, int id, uint64_t initial_ns,
+                    uint64_t interval_ns);
+/* read len bytes at offset of fd into buf, buf must live till the event of
+ * the read source id arrives */
+int event_read(struct event_dispatcher *ed, int id, int fd, void *buf,
+               size_t len, uint64_t offset);
+int event_source_set_hooks(struct event_dispatcher *ed, int id,
+                           event_prepare_fn prepare, event_check_fn check,
+                           void *data);
+
+int subscribe_event_source(struct event_dispatcher *ed, int id,
+                           event_handler handler, void *data);
+void unsubscribe_event_source(struct event_dispatcher *ed, int id,
+                              event_handler handler, void *data);
+
+int event_enqueue(struct event_dispatcher *ed, int id);
+int event_enqueue_value(struct event_dispatcher *ed, int id, uint64_t value);
+/* the next queued event, valid till the next call, NULL if there is none */
+struct event *event_dequeue(struct event_dispatcher *ed);
+void event_dispatch(struct event_dispatcher *ed, struct event *ev);
+
+/*
+ * Wait up to timeout_ms (-1 forever) for the sources and enqueue the ready
+ * ones, does not block while events are queued. Returns the number of
+ * ready fds or -1.
+ */
+int event_wait(struct event_dispatcher *ed, int timeout_ms);
+/* one wait and the dispatch of everything queued before it */
+int event_dispatcher_run_once(struct event_dispatcher *ed, int timeout_ms);
+
+void event_dispatcher_quit(struct event_dispatcher *ed);
+bool event_dispatcher_should_quit(struct event_dispatcher *ed);
+void event_dispatcher_get_stats(struct event_dispatcher *ed,
+                                struct event_dispatcher_stats *stats);
+
+#endif
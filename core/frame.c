@@ -0,0 +1,268 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils/utils.h"
+#include "frame.h"
+
+/* vblank intervals the refresh rate is estimated over */
+#define FRAME_REFRESH_WINDOW 32
+/* render times the budget is the longest of */
+#define FRAME_RENDER_WINDOW 16
+/* frames committed and not shown yet */
+#define FRAME_PENDING_CAPS 8
+/* longer intervals are idle time, not a slow frame */
+#define FRAME_INTERVAL_GAP 8
+
+struct frame_scheduler {
+  struct frame_scheduler_config config;
+  /* the display clock */
+  uint64_t refresh_ns;
+  bool refresh_known; // told by presentation feedback
+  bool exact;
+  uint64_t vblank_ns; // the latest vblank a frame was shown at, 0 if none
+  uint32_t callback_ms; // the timestamp of the latest frame callback
+  bool has_callback;
+  uint64_t intervals[FRAME_REFRESH_WINDOW];
+  uint32_t vblanks[FRAME_REFRESH_WINDOW]; // in each interval
+  uint64_t interval_sum;
+  uint64_t vblank_sum;
+  int interval_next;
+  /* the render cost */
+  uint64_t render_ns[FRAME_RENDER_WINDOW];
+  int render_next;
+  uint64_t render_begin_ns;
+  bool rendering;
+  /* deadlines of the frames committed and not shown yet */
+  uint64_t deadline; // of the frame about to be rendered, 0 if none
+  uint64_t last_deadline; // of the newest frame committed
+  uint64_t pending[FRAME_PENDING_CAPS];
+  int pending_head;
+  int pending_count;
+  /* statistics */
+  uint64_t shown_ns; // the vblank of the latest frame shown
+  uint64_t frames;
+  uint64_t missed;
+  uint64_t discarded;
+  uint64_t interval_total_ns;
+  uint64_t jitter_total_ns;
+  uint64_t interval_count;
+};
+
+uint64_t frame_scheduler_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void frame_scheduler_config_default(struct frame_scheduler_config *cfg) {
+  const char *val = getenv("DRAW_ENGINE_TARGET_FPS");
+  cfg->target_fps = 0.0;
+  cfg->margin_ns = FRAME_DEFAULT_MARGIN_NS;
+  if (val && *val)
+    cfg->target_fps = strtod(val, NULL);
+  val = getenv("DRAW_ENGINE_FRAME_MARGIN_US");
+  if (val && *val)
+    cfg->margin_ns = strtoull(val, NULL, 10) * 1000;
+}
+
+struct frame_scheduler *frame_scheduler_make(const struct frame_scheduler_config *cfg) {
+  struct frame_scheduler *new = NULL;
+
+  if (cfg->target_fps < 0.0) {
+    err_log("%s: invalid config, target fps: %f\n", __func__, cfg->target_fps);
+    return NULL;
+  }
+  new = malloc(sizeof(struct frame_scheduler));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct frame_scheduler));
+  new->config = *cfg;
+  new->refresh_ns = FRAME_DEFAULT_REFRESH_NS;
+  return new;
+}
+
+void frame_scheduler_free(struct frame_scheduler **ptr) {
+  struct frame_scheduler *fs = *ptr;
+  if (fs) {
+    free(fs);
+    *ptr = NULL;
+  }
+}
+
+/* the target interval, a whole number of refreshes */
+static uint64_t frame_period(struct frame_scheduler *fs) {
+  uint64_t count = 1;
+  if (fs->config.target_fps > 0.0) {
+    double target_ns = 1e9 / fs->config.target_fps;
+    count = (uint64_t)(target_ns / fs->refresh_ns + 0.5);
+    if (count < 1)
+      count = 1;
+  }
+  return count * fs->refresh_ns;
+}
+
+/* the slowest recent frame, half a period before anything was measured */
+static uint64_t frame_render_budget(struct frame_scheduler *fs) {
+  uint64_t longest = 0;
+  for (int i = 0; i < FRAME_RENDER_WINDOW; i++) {
+    if (fs->render_ns[i] > longest)
+      longest = fs->render_ns[i];
+  }
+  if (!longest)
+    longest = frame_period(fs) / 2;
+  return longest + fs->config.margin_ns;
+}
+
+/*
+ * An interval between two vblanks a frame was shown at, frames skip
+ * vblanks so it is a multiple of the refresh. Averaging the intervals
+ * over the vblanks they span also gets below the ms of frame callbacks.
+ */
+static void frame_add_interval(struct frame_scheduler *fs, uint64_t interval_ns) {
+  uint64_t vblanks = (interval_ns + fs->refresh_ns / 2) / fs->refresh_ns;
+  int i = fs->interval_next;
+
+  if (!interval_ns || fs->refresh_known)
+    return;
+  if (vblanks < 1)
+    vblanks = 1;
+  if (vblanks > FRAME_INTERVAL_GAP)
+    return;
+  fs->interval_sum += interval_ns - fs->intervals[i];
+  fs->vblank_sum += vblanks - fs->vblanks[i];
+  fs->intervals[i] = interval_ns;
+  fs->vblanks[i] = (uint32_t)vblanks;
+  fs->interval_next = (i + 1) % FRAME_REFRESH_WINDOW;
+  fs->refresh_ns = fs->interval_sum / fs->vblank_sum;
+}
+
+/* the oldest frame committed was shown at vblank_ns */
+static void frame_shown(struct frame_scheduler *fs, uint64_t vblank_ns) {
+  uint64_t period = frame_period(fs);
+
+  if (vblank_ns > fs->vblank_ns)
+    fs->vblank_ns = vblank_ns;
+  if (!fs->pending_count)
+    return;
+  if (vblank_ns > fs->pending[fs->pending_head] + fs->refresh_ns / 2)
+    fs->missed++;
+  fs->pending_head = (fs->pending_head + 1) % FRAME_PENDING_CAPS;
+  fs->pending_count--;
+  fs->frames++;
+  if (fs->shown_ns && vblank_ns > fs->shown_ns &&
+      vblank_ns - fs->shown_ns <= period * FRAME_INTERVAL_GAP) {
+    uint64_t interval = vblank_ns - fs->shown_ns;
+    fs->interval_total_ns += interval;
+    fs->jitter_total_ns += interval > period ? interval - period
+                                             : period - interval;
+    fs->interval_count++;
+  }
+  fs->shown_ns = vblank_ns;
+}
+
+uint64_t frame_scheduler_next_start(struct frame_scheduler *fs, uint64_t now_ns) {
+  uint64_t period = frame_period(fs);
+  uint64_t budget = frame_render_budget(fs);
+  uint64_t deadline;
+
+  if (!fs->vblank_ns) {
+    /* nothing shown yet, nothing to line up with */
+    fs->deadline = now_ns + budget;
+    return now_ns;
+  }
+  deadline = fs->vblank_ns + period;
+  /* one frame per vblank, after the ones still waiting to be shown */
+  if (fs->pending_count && deadline < fs->last_deadline + period)
+    deadline = fs->last_deadline + period;
+  if (deadline < now_ns + budget)
+    deadline += (now_ns + budget - deadline + period - 1) / period * period;
+  fs->deadline = deadline;
+  return deadline - budget;
+}
+
+void frame_scheduler_render_begin(struct frame_scheduler *fs, uint64_t now_ns) {
+  if (!fs->deadline)
+    frame_scheduler_next_start(fs, now_ns);
+  fs->render_begin_ns = now_ns;
+  fs->rendering = true;
+}
+
+void frame_scheduler_render_end(struct frame_scheduler *fs, uint64_t now_ns) {
+  int tail;
+
+  if (!fs->rendering)
+    return;
+  fs->rendering = false;
+  fs->render_ns[fs->render_next] = now_ns - fs->render_begin_ns;
+  fs->render_next = (fs->render_next + 1) % FRAME_RENDER_WINDOW;
+  if (fs->pending_count == FRAME_PENDING_CAPS) {
+    /* the compositor never answered for the oldest one */
+    frame_scheduler_discarded(fs);
+  }
+  tail = (fs->pending_head + fs->pending_count) % FRAME_PENDING_CAPS;
+  fs->pending[tail] = fs->deadline;
+  fs->pending_count++;
+  fs->last_deadline = fs->deadline;
+  fs->deadline = 0;
+}
+
+void frame_scheduler_frame_done(struct frame_scheduler *fs, uint32_t time_ms,
+                                uint64_t now_ns) {
+  /* compositors stamp callbacks with CLOCK_MONOTONIC in ms, trust the
+   * stamp to place the vblank only if it looks like that clock */
+  uint32_t age_ms = (uint32_t)(now_ns / 1000000) - time_ms;
+  uint64_t vblank_ns = now_ns;
+
+  if ((uint64_t)age_ms * 1000000 < fs->refresh_ns * 2)
+    vblank_ns = now_ns - (uint64_t)age_ms * 1000000;
+  if (fs->has_callback)
+    frame_add_interval(fs, (uint64_t)(uint32_t)(time_ms - fs->callback_ms) *
+                           1000000);
+  fs->callback_ms = time_ms;
+  fs->has_callback = true;
+  frame_shown(fs, vblank_ns);
+}
+
+void frame_scheduler_presented(struct frame_scheduler *fs, uint64_t time_ns,
+                               uint64_t refresh_ns) {
+  fs->exact = true;
+  if (refresh_ns) {
+    fs->refresh_ns = refresh_ns;
+    fs->refresh_known = true;
+  } else {
+    fs->refresh_known = false;
+    if (fs->vblank_ns && time_ns > fs->vblank_ns)
+      frame_add_interval(fs, time_ns - fs->vblank_ns);
+  }
+  frame_shown(fs, time_ns);
+}
+
+void frame_scheduler_discarded(struct frame_scheduler *fs) {
+  if (!fs->pending_count)
+    return;
+  fs->pending_head = (fs->pending_head + 1) % FRAME_PENDING_CAPS;
+  fs->pending_count--;
+  fs->discarded++;
+}
+
+void frame_scheduler_get_stats(struct frame_scheduler *fs,
+                               struct frame_scheduler_stats *stats) {
+  uint64_t period = frame_period(fs);
+  stats->target_fps = 1e9 / period;
+  stats->refresh_ns = fs->refresh_ns;
+  stats->exact = fs->exact;
+  stats->render_budget_ns = frame_render_budget(fs);
+  stats->frames = fs->frames;
+  stats->missed = fs->missed;
+  stats->discarded = fs->discarded;
+  stats->interval_avg_ns = 0;
+  stats->jitter_ns = 0;
+  if (fs->interval_count) {
+    stats->interval_avg_ns = fs->interval_total_ns / fs->interval_count;
+    stats->jitter_ns = fs->jitter_total_ns / fs->interval_count;
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Frame pacing. The scheduler predicts the next vblank from the frames
+ * shown so far and tells when to start rendering so the frame is
+ * committed just before it, rendering as late as possible keeps the
+ * input to photon latency low:
+ *
+ *   start = frame_scheduler_next_start(fs, now);   // arm a timer
+ *   ...                                            // at start:
+ *   frame_scheduler_render_begin(fs, now);
+ *   render and commit
+ *   frame_scheduler_render_end(fs, now);
+ *   ...                                            // once shown:
+ *   frame_scheduler_presented(fs, vblank, refresh);
+ *
+ * The vblank times come either from presentation feedback, which gives
+ * them exactly, or from frame callbacks, whose millisecond timestamps
+ * only give the refresh rate. Every time is on CLOCK_MONOTONIC in ns.
+ */
+
+#define FRAME_DEFAULT_REFRESH_NS 16666667ull
+#define FRAME_DEFAULT_MARGIN_NS 2000000ull
+
+struct frame_scheduler_config {
+  double target_fps; // 0 follows the display, else rounded to a divisor of it
+  uint64_t margin_ns; // left between the commit and the vblank
+};
+
+struct frame_scheduler_stats {
+  double target_fps; // what the scheduler aims at with the refresh it sees
+  uint64_t refresh_ns;
+  bool exact; // the vblanks come from presentation feedback
+  uint64_t render_budget_ns; // started this much before the deadline
+  uint64_t frames; // shown
+  uint64_t missed; // shown after their deadline
+  uint64_t discarded; // never shown
+  uint64_t interval_avg_ns; // between consecutive frames shown
+  uint64_t jitter_ns; // mean distance of the intervals to the target one
+};
+
+/* follows the display, overridden by DRAW_ENGINE_TARGET_FPS and
+ * DRAW_ENGINE_FRAME_MARGIN_US */
+void frame_scheduler_config_default(struct frame_scheduler_config *cfg);
+
+struct frame_scheduler *frame_scheduler_make(const struct frame_scheduler_config *cfg);
+void frame_scheduler_free(struct frame_scheduler **ptr);
+
+/* the time to start rendering the next frame, now if it is already late */
+uint64_t frame_scheduler_next_start(struct frame_scheduler *fs, uint64_t now_ns);
+void frame_scheduler_render_begin(struct frame_scheduler *fs, uint64_t now_ns);
+/* the frame is committed and waits for the predicted vblank */
+void frame_scheduler_render_end(struct frame_scheduler *fs, uint64_t now_ns);
+
+/* a frame callback with its timestamp in ms, received at now_ns */
+void frame_scheduler_frame_done(struct frame_scheduler *fs, uint32_t time_ms,
+                                uint64_t now_ns);
+/* presentation feedback, a refresh_ns of 0 means it is unknown */
+void frame_scheduler_presented(struct frame_scheduler *fs, uint64_t time_ns,
+                               uint64_t refresh_ns);
+void frame_scheduler_discarded(struct frame_scheduler *fs);
+
+void frame_scheduler_get_stats(struct frame_scheduler *fs,
+                               struct frame_scheduler_stats *stats);
+
+uint64_t frame_scheduler_now_ns(void);
+
+#endif
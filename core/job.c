@@ -0,0 +1,497 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "job.h"
+
+#define JOB_THREADS_MAX 256
+/* power of two, a push to a full deque runs the job on the spot */
+#define JOB_DEQUE_CAPS 4096
+/* empty rounds before a worker goes to sleep */
+#define JOB_SPIN_ROUNDS 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define job_cpu_relax() __builtin_ia32_pause()
+#else
+#define job_cpu_relax() do {} while (0)
+#endif
+
+struct job {
+  job_fn fn;
+  void *data;
+  struct job_counter *counter;
+  struct job *next; // parked on a counter or in the inject queue
+};
+
+/* Chase-Lev deque, the owner works the bottom and thieves the top */
+struct job_deque {
+  int64_t top; // atomic
+  int64_t bottom; // atomic
+  struct job *jobs[JOB_DEQUE_CAPS];
+};
+
+struct job_worker {
+  struct job_system *js;
+  int index;
+  pthread_t thread;
+  uint32_t rand; // picks the first victim
+  struct job_deque deque;
+  struct job_system_stats stats; // atomic
+};
+
+struct job_system {
+  int thread_count;
+  struct job_worker *workers;
+  int started; // threads created, worker 0 is never one
+  /* jobs from threads outside the pool */
+  pthread_mutex_t inject_lock;
+  struct job *inject_head;
+  struct job *inject_tail;
+  int inject_count; // atomic
+  struct job_system_stats foreign; // atomic
+  /* sleeping */
+  pthread_mutex_t sleep_lock;
+  pthread_cond_t sleep_cond;
+  int queued; // atomic, jobs in deques and the inject queue
+  int sleepers; // atomic
+  bool quit;
+};
+
+static _Thread_local struct job_worker *tls_worker = NULL;
+
+static struct job_worker *job_self(struct job_system *js) {
+  struct job_worker *w = tls_worker;
+  return w && w->js == js ? w : NULL;
+}
+
+static struct job_system_stats *job_stats(struct job_system *js,
+                                          struct job_worker *w) {
+  return w ? &w->stats : &js->foreign;
+}
+
+#define job_stat_inc(stats, field)                                             \
+  __atomic_add_fetch(&(stats)->field, 1, __ATOMIC_RELAXED)
+
+static bool job_deque_push(struct job_deque *dq, struct job *job) {
+  int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+  int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+  if (b - t >= JOB_DEQUE_CAPS)
+    return false;
+  __atomic_store_n(&dq->jobs[b & (JOB_DEQUE_CAPS - 1)], job, __ATOMIC_RELAXED);
+  /* publishes the slot to thieves loading bottom */
+  __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static struct job *job_deque_pop(struct job_deque *dq) {
+  int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+  int64_t t;
+  struct job *job = NULL;
+
+  __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+  if (t <= b) {
+    job = __atomic_load_n(&dq->jobs[b & (JOB_DEQUE_CAPS - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+      /* the last one, race the thieves for it */
+      if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        job = NULL;
+      __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+  } else {
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return job;
+}
+
+static struct job *job_deque_steal(struct job_deque *dq) {
+  int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+  int64_t b;
+  struct job *job;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b)
+    return NULL;
+  job = __atomic_load_n(&dq->jobs[t & (JOB_DEQUE_CAPS - 1)], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return NULL;
+  return job;
+}
+
+static void job_wake(struct job_system *js) {
+  if (__atomic_load_n(&js->sleepers, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&js->sleep_lock);
+    pthread_cond_signal(&js->sleep_cond);
+    pthread_mutex_unlock(&js->sleep_lock);
+  }
+}
+
+static void job_execute(struct job_system *js, struct job_worker *w,
+                        struct job *job);
+
+/* hand a ready job to the pool */
+static void job_push(struct job_system *js, struct job *job) {
+  struct job_worker *w = job_self(js);
+
+  if (w) {
+    if (!job_deque_push(&w->deque, job)) {
+      job_stat_inc(&w->stats, inlined);
+      job_execute(js, w, job);
+      return;
+    }
+  } else {
+    job->next = NULL;
+    pthread_mutex_lock(&js->inject_lock);
+    if (js->inject_tail)
+      js->inject_tail->next = job;
+    else
+      js->inject_head = job;
+    js->inject_tail = job;
+    __atomic_add_fetch(&js->inject_count, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&js->inject_lock);
+    job_stat_inc(&js->foreign, injected);
+  }
+  __atomic_add_fetch(&js->queued, 1, __ATOMIC_SEQ_CST);
+  job_wake(js);
+}
+
+static struct job *job_take_injected(struct job_system *js) {
+  struct job *job;
+
+  if (!__atomic_load_n(&js->inject_count, __ATOMIC_ACQUIRE))
+    return NULL;
+  pthread_mutex_lock(&js->inject_lock);
+  job = js->inject_head;
+  if (job) {
+    js->inject_head = job->next;
+    if (!js->inject_head)
+      js->inject_tail = NULL;
+    __atomic_sub_fetch(&js->inject_count, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&js->inject_lock);
+  return job;
+}
+
+/* own deque first, then the inject queue, then the others' deques */
+static struct job *job_find(struct job_system *js, struct job_worker *w) {
+  struct job *job = NULL;
+  int start = 0;
+
+  if (w)
+    job = job_deque_pop(&w->deque);
+  if (!job)
+    job = job_take_injected(js);
+  if (!job) {
+    if (w) {
+      /* xorshift */
+      w->rand ^= w->rand << 13;
+      w->rand ^= w->rand >> 17;
+      w->rand ^= w->rand << 5;
+      start = w->rand % js->thread_count;
+    }
+    for (int i = 0; i < js->thread_count && !job; i++) {
+      struct job_worker *victim = &js->workers[(start + i) % js->thread_count];
+      if (victim == w)
+        continue;
+      job = job_deque_steal(&victim->deque);
+    }
+    if (job)
+      job_stat_inc(job_stats(js, w), stolen);
+  }
+  if (job)
+    __atomic_sub_fetch(&js->queued, 1, __ATOMIC_SEQ_CST);
+  return job;
+}
+
+static void job_counter_lock(struct job_counter *counter) {
+  while (__atomic_test_and_set(&counter->lock, __ATOMIC_ACQUIRE))
+    job_cpu_relax();
+}
+
+static void job_counter_unlock(struct job_counter *counter) {
+  __atomic_clear(&counter->lock, __ATOMIC_RELEASE);
+}
+
+static void job_counter_done(struct job_system *js, struct job_counter *counter) {
+  struct job *waiters = NULL;
+
+  /* a waiter may free the counter once value and busy are both zero */
+  __atomic_add_fetch(&counter->busy, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_sub_fetch(&counter->value, 1, __ATOMIC_SEQ_CST) == 0) {
+    job_counter_lock(counter);
+    waiters = counter->waiters;
+    counter->waiters = NULL;
+    job_counter_unlock(counter);
+  }
+  __atomic_sub_fetch(&counter->busy, 1, __ATOMIC_RELEASE);
+  while (waiters) {
+    struct job *next = waiters->next;
+    job_push(js, waiters);
+    waiters = next;
+  }
+}
+
+static void job_execute(struct job_system *js, struct job_worker *w,
+                        struct job *job) {
+  struct job_counter *counter = job->counter;
+
+  job->fn(js, job->data);
+  free(job);
+  job_stat_inc(job_stats(js, w), executed);
+  if (counter)
+    job_counter_done(js, counter);
+}
+
+static void *job_worker_main(void *arg) {
+  struct job_worker *w = (struct job_worker *)arg;
+  struct job_system *js = w->js;
+  int idle = 0;
+
+  tls_worker = w;
+  while (!__atomic_load_n(&js->quit, __ATOMIC_ACQUIRE)) {
+    struct job *job = job_find(js, w);
+    if (job) {
+      job_execute(js, w, job);
+      idle = 0;
+      continue;
+    }
+    if (++idle < JOB_SPIN_ROUNDS) {
+      job_cpu_relax();
+      continue;
+    }
+    /* pairs with the queued increment in job_push */
+    pthread_mutex_lock(&js->sleep_lock);
+    __atomic_add_fetch(&js->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (!js->quit && !__atomic_load_n(&js->queued, __ATOMIC_SEQ_CST)) {
+      job_stat_inc(&w->stats, sleeps);
+      pthread_cond_wait(&js->sleep_cond, &js->sleep_lock);
+    }
+    __atomic_sub_fetch(&js->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&js->sleep_lock);
+    idle = 0;
+  }
+  tls_worker = NULL;
+  return NULL;
+}
+
+void job_system_config_default(struct job_system_config *cfg) {
+  const char *val = getenv("DRAW_ENGINE_THREADS");
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cfg->thread_count = cpus > 0 ? (int)cpus : 1;
+  if (val && *val)
+    cfg->thread_count = atoi(val);
+}
+
+struct job_system *job_system_make(const struct job_system_config *cfg) {
+  struct job_system *new = NULL;
+
+  if (cfg->thread_count < 1 || cfg->thread_count > JOB_THREADS_MAX) {
+    err_log("%s: invalid config, threads: %d\n", __func__, cfg->thread_count);
+    return NULL;
+  }
+  if (tls_worker) {
+    err_log("%s: this thread already belongs to a job system\n", __func__);
+    return NULL;
+  }
+  new = malloc(sizeof(struct job_system));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct job_system));
+  new->thread_count = cfg->thread_count;
+  pthread_mutex_init(&new->inject_lock, NULL);
+  pthread_mutex_init(&new->sleep_lock, NULL);
+  pthread_cond_init(&new->sleep_cond, NULL);
+  new->workers = calloc(cfg->thread_count, sizeof(struct job_worker));
+  if (!new->workers) {
+    err_log("%s: no enough memory\n", __func__);
+    job_system_free(&new);
+    return NULL;
+  }
+  for (int i = 0; i < cfg->thread_count; i++) {
+    new->workers[i].js = new;
+    new->workers[i].index = i;
+    new->workers[i].rand = 0x9E3779B9u * (i + 1);
+  }
+  tls_worker = &new->workers[0];
+  for (int i = 1; i < cfg->thread_count; i++) {
+    if (pthread_create(&new->workers[i].thread, NULL, job_worker_main,
+                       &new->workers[i])) {
+      err_log("%s: failed to create worker %d\n", __func__, i);
+      break;
+    }
+    new->started++;
+  }
+  /* the deques of workers that failed to start just stay empty */
+  return new;
+}
+
+void job_system_free(struct job_system **ptr) {
+  struct job_system *js = *ptr;
+  if (js) {
+    pthread_mutex_lock(&js->sleep_lock);
+    __atomic_store_n(&js->quit, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&js->sleep_cond);
+    pthread_mutex_unlock(&js->sleep_lock);
+    for (int i = 1; i <= js->started; i++)
+      pthread_join(js->workers[i].thread, NULL);
+    if (job_self(js))
+      tls_worker = NULL;
+    pthread_cond_destroy(&js->sleep_cond);
+    pthread_mutex_destroy(&js->sleep_lock);
+    pthread_mutex_destroy(&js->inject_lock);
+    free(js->workers);
+    free(js);
+    *ptr = NULL;
+  }
+}
+
+int job_system_thread_count(struct job_system *js) { return js->thread_count; }
+
+void job_system_get_stats(struct job_system *js, struct job_system_stats *stats) {
+  *stats = js->foreign;
+  for (int i = 0; i < js->thread_count; i++) {
+    struct job_system_stats *s = &js->workers[i].stats;
+    stats->executed += __atomic_load_n(&s->executed, __ATOMIC_RELAXED);
+    stats->stolen += __atomic_load_n(&s->stolen, __ATOMIC_RELAXED);
+    stats->injected += __atomic_load_n(&s->injected, __ATOMIC_RELAXED);
+    stats->inlined += __atomic_load_n(&s->inlined, __ATOMIC_RELAXED);
+    stats->sleeps += __atomic_load_n(&s->sleeps, __ATOMIC_RELAXED);
+  }
+}
+
+void job_counter_init(struct job_counter *counter) {
+  counter->value = 0;
+  counter->busy = 0;
+  counter->lock = false;
+  counter->waiters = NULL;
+}
+
+static struct job *job_make(job_fn fn, void *data, struct job_counter *counter) {
+  struct job *new = malloc(sizeof(struct job));
+  if (!new)
+    return NULL;
+  new->fn = fn;
+  new->data = data;
+  new->counter = counter;
+  new->next = NULL;
+  if (counter)
+    __atomic_add_fetch(&counter->value, 1, __ATOMIC_RELAXED);
+  return new;
+}
+
+void job_run(struct job_system *js, job_fn fn, void *data,
+             struct job_counter *counter) {
+  struct job *job = job_make(fn, data, counter);
+  if (!job) {
+    /* still correct, just not parallel */
+    fn(js, data);
+    return;
+  }
+  job_push(js, job);
+}
+
+void job_run_after(struct job_system *js, struct job_counter *dep, job_fn fn,
+                   void *data, struct job_counter *counter) {
+  struct job *job;
+
+  if (!dep) {
+    job_run(js, fn, data, counter);
+    return;
+  }
+  job = job_make(fn, data, counter);
+  if (!job) {
+    job_wait(js, dep);
+    fn(js, data);
+    return;
+  }
+  job_counter_lock(dep);
+  /* checked under the lock, job_counter_done takes it once at zero */
+  if (__atomic_load_n(&dep->value, __ATOMIC_ACQUIRE) > 0) {
+    job->next = dep->waiters;
+    dep->waiters = job;
+    job = NULL;
+  }
+  job_counter_unlock(dep);
+  if (job)
+    job_push(js, job);
+}
+
+void job_wait(struct job_system *js, struct job_counter *counter) {
+  struct job_worker *w = job_self(js);
+  int idle = 0;
+
+  while (__atomic_load_n(&counter->value, __ATOMIC_SEQ_CST) > 0 ||
+         __atomic_load_n(&counter->busy, __ATOMIC_ACQUIRE) > 0) {
+    struct job *job = job_find(js, w);
+    if (job) {
+      job_execute(js, w, job);
+      idle = 0;
+    } else if (++idle < JOB_SPIN_ROUNDS) {
+      job_cpu_relax();
+    } else {
+      /* whatever is left is running elsewhere */
+      sched_yield();
+    }
+  }
+}
+
+struct job_range {
+  job_range_fn fn;
+  void *data;
+  int begin;
+  int end;
+  int grain;
+  struct job_counter *counter;
+};
+
+/* keep halving, the halves left in the deque are what thieves take */
+static void job_range_run(struct job_system *js, void *data) {
+  struct job_range *range = (struct job_range *)data;
+
+  while (range->end - range->begin > range->grain) {
+    int mid = range->begin + (range->end - range->begin) / 2;
+    struct job_range *half = malloc(sizeof(struct job_range));
+    if (!half)
+      break;
+    *half = *range;
+    half->begin = mid;
+    range->end = mid;
+    job_run(js, job_range_run, half, range->counter);
+  }
+  range->fn(range->data, range->begin, range->end);
+  free(range);
+}
+
+void job_parallel_for(struct job_system *js, int count, int grain,
+                      job_range_fn fn, void *data) {
+  struct job_counter counter = JOB_COUNTER_INIT;
+  struct job_range *range;
+
+  if (count <= 0)
+    return;
+  range = malloc(sizeof(struct job_range));
+  if (!range) {
+    fn(data, 0, count);
+    return;
+  }
+  range->fn = fn;
+  range->data = data;
+  range->begin = 0;
+  range->end = count;
+  range->grain = grain > 0 ? grain : 1;
+  range->counter = &counter;
+  job_run(js, job_range_run, range, &counter);
+  job_wait(js, &counter);
+}
@@ -0,0 +1,74 @@
+#ifndef _JOB_H_
+#define _JOB_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A work stealing job system. Every worker owns a deque: it pushes and
+ * pops at the bottom, idle workers steal from the top of the others.
+ * The thread making the system is worker 0, other threads outside the
+ * pool submit through a shared queue.
+ */
+
+struct job_system;
+
+typedef void (*job_fn)(struct job_system *js, void *data);
+/* runs the [begin, end) part of a job_parallel_for */
+typedef void (*job_range_fn)(void *data, int begin, int end);
+
+struct job;
+
+/*
+ * Counts the jobs still to finish. Jobs run with job_run_after() are
+ * parked on a counter and pushed once it drops to zero.
+ */
+struct job_counter {
+  int value; // atomic
+  int busy; // atomic, threads still touching the counter after a drop
+  bool lock; // guards waiters
+  struct job *waiters;
+};
+
+#define JOB_COUNTER_INIT {0, 0, false, NULL}
+
+struct job_system_config {
+  int thread_count; // counts worker 0, i.e. the making thread
+};
+
+struct job_system_stats {
+  uint64_t executed;
+  uint64_t stolen;
+  uint64_t injected; // submitted from threads outside the pool
+  uint64_t inlined;  // run on the spot because a deque was full
+  uint64_t sleeps;
+};
+
+/* the online cpus, overridden by DRAW_ENGINE_THREADS */
+void job_system_config_default(struct job_system_config *cfg);
+
+struct job_system *job_system_make(const struct job_system_config *cfg);
+void job_system_free(struct job_system **ptr);
+int job_system_thread_count(struct job_system *js);
+void job_system_get_stats(struct job_system *js, struct job_system_stats *stats);
+
+void job_counter_init(struct job_counter *counter);
+
+/* queue fn(js, data), counter (may be NULL) drops once it has run */
+void job_run(struct job_system *js, job_fn fn, void *data,
+             struct job_counter *counter);
+/* like job_run but only queued once dep drops to zero, right away if
+ * it already is */
+void job_run_after(struct job_system *js, struct job_counter *dep, job_fn fn,
+                   void *data, struct job_counter *counter);
+/* run other jobs till counter drops to zero, never sleeps */
+void job_wait(struct job_system *js, struct job_counter *counter);
+
+/*
+ * Call fn over [0, count) in ranges of at most grain, ranges are split in
+ * halves as they get stolen. Returns once every range is done.
+ */
+void job_parallel_for(struct job_system *js, int count, int grain,
+                      job_range_fn fn, void *data);
+
+#endif
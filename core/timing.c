@@ -0,0 +1,173 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utils/utils.h"
+#include "timing.h"
+
+static const char *frame_stage_names[FRAME_STAGE_COUNT] = {
+  [FRAME_STAGE_RENDER] = "render",
+  [FRAME_STAGE_ATTACH] = "attach",
+  [FRAME_STAGE_DAMAGE] = "damage",
+  [FRAME_STAGE_COMMIT] = "commit",
+  [FRAME_STAGE_CALLBACK] = "callback",
+};
+
+uint64_t timing_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* values below 8 get a bucket each, above every power of two gets 8 */
+static int timing_bucket(uint64_t ns) {
+  int msb;
+  int index;
+
+  if (ns < (1u << TIMING_SUB_BITS))
+    return (int)ns;
+  msb = 63 - __builtin_clzll(ns);
+  index = ((msb - TIMING_SUB_BITS + 1) << TIMING_SUB_BITS) +
+          (int)((ns >> (msb - TIMING_SUB_BITS)) & ((1u << TIMING_SUB_BITS) - 1));
+  return index < TIMING_BUCKETS ? index : TIMING_BUCKETS - 1;
+}
+
+/* the largest value falling into the bucket */
+static uint64_t timing_bucket_upper(int index) {
+  int shift;
+  uint64_t lower;
+
+  if (index < (1 << TIMING_SUB_BITS))
+    return (uint64_t)index;
+  shift = (index >> TIMING_SUB_BITS) - 1;
+  lower = (uint64_t)((1 << TIMING_SUB_BITS) +
+                     (index & ((1 << TIMING_SUB_BITS) - 1))) << shift;
+  return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void timing_histogram_record(struct timing_histogram *h, uint64_t ns) {
+  uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch(&h->buckets[timing_bucket(ns)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->total_ns, ns, __ATOMIC_RELAXED);
+  while (ns > max &&
+         !__atomic_compare_exchange_n(&h->max_ns, &max, ns, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+uint64_t timing_histogram_percentile(struct timing_histogram *h, double p) {
+  uint64_t counts[TIMING_BUCKETS];
+  uint64_t total = 0;
+  uint64_t rank;
+  uint64_t seen = 0;
+  uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+
+  /* a snapshot, the buckets keep moving while recorded into */
+  for (int i = 0; i < TIMING_BUCKETS; i++) {
+    counts[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+    total += counts[i];
+  }
+  if (!total)
+    return 0;
+  if (p < 0.0)
+    p = 0.0;
+  if (p > 1.0)
+    p = 1.0;
+  rank = (uint64_t)(p * total + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  for (int i = 0; i < TIMING_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      uint64_t upper = timing_bucket_upper(i);
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+void timing_histogram_summary(struct timing_histogram *h,
+                              struct timing_summary *summary) {
+  summary->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  summary->avg_ns = 0;
+  if (summary->count)
+    summary->avg_ns =
+      __atomic_load_n(&h->total_ns, __ATOMIC_RELAXED) / summary->count;
+  summary->p50_ns = timing_histogram_percentile(h, 0.50);
+  summary->p95_ns = timing_histogram_percentile(h, 0.95);
+  summary->p99_ns = timing_histogram_percentile(h, 0.99);
+  summary->max_ns = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+}
+
+struct frame_timing *frame_timing_make(const char *name) {
+  struct frame_timing *new = NULL;
+  const char *val = getenv("DRAW_ENGINE_TIMING_DUMP");
+
+  new = malloc(sizeof(struct frame_timing));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct frame_timing));
+  new->name = name;
+  if (val && *val)
+    new->dump_interval = strtoull(val, NULL, 10);
+  return new;
+}
+
+void frame_timing_free(struct frame_timing **ptr) {
+  struct frame_timing *ft = *ptr;
+  if (ft) {
+    free(ft);
+    *ptr = NULL;
+  }
+}
+
+const char *frame_stage_name(enum frame_stage stage) {
+  if ((unsigned)stage >= FRAME_STAGE_COUNT)
+    return "unknown";
+  return frame_stage_names[stage];
+}
+
+void frame_timing_record(struct frame_timing *ft, enum frame_stage stage,
+                         uint64_t ns) {
+  timing_histogram_record(&ft->stages[stage], ns);
+}
+
+uint64_t frame_timing_stage_end(struct frame_timing *ft, enum frame_stage stage,
+                                uint64_t start_ns) {
+  uint64_t now = timing_now_ns();
+  timing_histogram_record(&ft->stages[stage], now - start_ns);
+  return now;
+}
+
+void frame_timing_get(struct frame_timing *ft, enum frame_stage stage,
+                      struct timing_summary *summary) {
+  timing_histogram_summary(&ft->stages[stage], summary);
+}
+
+void frame_timing_frame_end(struct frame_timing *ft) {
+  uint64_t frames = __atomic_add_fetch(&ft->frames, 1, __ATOMIC_RELAXED);
+  if (ft->dump_interval && frames % ft->dump_interval == 0)
+    frame_timing_dump(ft);
+}
+
+void frame_timing_dump(struct frame_timing *ft) {
+  log("%s: %s, frames: %lu\n", __func__, ft->name,
+      (unsigned long)__atomic_load_n(&ft->frames, __ATOMIC_RELAXED));
+  for (int i = 0; i < FRAME_STAGE_COUNT; i++) {
+    struct timing_summary s;
+    timing_histogram_summary(&ft->stages[i], &s);
+    if (!s.count)
+      continue;
+    log("  %-8s n: %lu, avg: %lu ns, p50: %lu ns, p95: %lu ns, p99: %lu ns, "
+        "max: %lu ns\n", frame_stage_name(i), (unsigned long)s.count,
+        (unsigned long)s.avg_ns, (unsigned long)s.p50_ns,
+        (unsigned long)s.p95_ns, (unsigned long)s.p99_ns,
+        (unsigned long)s.max_ns);
+  }
+}
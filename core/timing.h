@@ -0,0 +1,72 @@
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include <stdint.h>
+
+/*
+ * Per stage frame timing. Durations go into fixed bucket histograms, a
+ * record is a relaxed atomic add on a bucket so any thread may record
+ * and readers never stop the writers. Buckets are logarithmic with 8
+ * steps per power of two, percentiles are exact to 12.5%.
+ */
+
+enum frame_stage {
+  FRAME_STAGE_RENDER, // filling the pixels
+  FRAME_STAGE_ATTACH, // wl_surface_attach
+  FRAME_STAGE_DAMAGE, // sending the damage
+  FRAME_STAGE_COMMIT, // wl_surface_commit
+  FRAME_STAGE_CALLBACK, // from the commit to its frame callback
+  FRAME_STAGE_COUNT,
+};
+
+#define TIMING_SUB_BITS 3
+#define TIMING_BUCKETS 320 // up to about 2^40 ns
+
+struct timing_histogram {
+  uint64_t buckets[TIMING_BUCKETS]; // atomic
+  uint64_t count; // atomic
+  uint64_t total_ns; // atomic
+  uint64_t max_ns; // atomic
+};
+
+struct timing_summary {
+  uint64_t count;
+  uint64_t avg_ns;
+  uint64_t p50_ns;
+  uint64_t p95_ns;
+  uint64_t p99_ns;
+  uint64_t max_ns;
+};
+
+struct frame_timing {
+  const char *name;
+  struct timing_histogram stages[FRAME_STAGE_COUNT];
+  uint64_t frames; // atomic
+  uint64_t dump_interval; // in frames, 0 never dumps
+};
+
+uint64_t timing_now_ns(void);
+
+void timing_histogram_record(struct timing_histogram *h, uint64_t ns);
+/* the upper bound of the bucket holding the p-th percentile, p in [0, 1] */
+uint64_t timing_histogram_percentile(struct timing_histogram *h, double p);
+void timing_histogram_summary(struct timing_histogram *h,
+                              struct timing_summary *summary);
+
+/* dumps every DRAW_ENGINE_TIMING_DUMP frames if set */
+struct frame_timing *frame_timing_make(const char *name);
+void frame_timing_free(struct frame_timing **ptr);
+const char *frame_stage_name(enum frame_stage stage);
+
+void frame_timing_record(struct frame_timing *ft, enum frame_stage stage,
+                         uint64_t ns);
+/* record the time since start_ns, returns now */
+uint64_t frame_timing_stage_end(struct frame_timing *ft, enum frame_stage stage,
+                                uint64_t start_ns);
+void frame_timing_get(struct frame_timing *ft, enum frame_stage stage,
+                      struct timing_summary *summary);
+/* counts a frame, dumps if the interval is reached */
+void frame_timing_frame_end(struct frame_timing *ft);
+void frame_timing_dump(struct frame_timing *ft);
+
+#endif
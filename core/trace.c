@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "trace.h"
+
+/* how often the flusher drains the rings */
+#define TRACE_FLUSH_INTERVAL_NS 10000000
+
+struct trace_record {
+  uint64_t ts_ns;
+  const struct trace_point *tp;
+  int argc;
+  uint64_t args[TRACE_ARGS_MAX];
+};
+
+/*
+ * One writer, the owning thread, and one reader holding trace.lock. The
+ * counters only grow, the slot is their value modulo the capacity.
+ */
+struct trace_ring {
+  uint64_t head; // atomic, written by the owner
+  uint64_t tail; // atomic, written by the reader
+  uint64_t dropped; // atomic
+  int tid;
+  struct trace_ring *next;
+  struct trace_record records[TRACE_RING_CAPS];
+};
+
+static struct {
+  pthread_mutex_t lock; // the ring list, the output and the reading side
+  struct trace_ring *rings;
+  int ring_count;
+  FILE *out;
+  bool owns_out;
+  uint64_t records;
+  pthread_t flusher;
+  bool flusher_running;
+  bool stop; // atomic
+} trace = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+bool trace_enabled;
+
+/* rings stay on the list after their thread exits, they are small */
+static __thread struct trace_ring *trace_ring;
+
+static uint64_t trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct trace_ring *trace_ring_make(void) {
+  struct trace_ring *new = NULL;
+
+  new = malloc(sizeof(struct trace_ring));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, offsetof(struct trace_ring, records));
+  new->tid = gettid();
+  pthread_mutex_lock(&trace.lock);
+  new->next = trace.rings;
+  trace.rings = new;
+  trace.ring_count++;
+  pthread_mutex_unlock(&trace.lock);
+  return new;
+}
+
+void trace_emit(const struct trace_point *tp, int argc, const uint64_t *args) {
+  struct trace_ring *ring = trace_ring;
+  struct trace_record *r;
+  uint64_t head;
+
+  if (!ring) {
+    ring = trace_ring_make();
+    if (!ring)
+      return;
+    trace_ring = ring;
+  }
+  head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_CAPS) {
+    __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  r = &ring->records[head & (TRACE_RING_CAPS - 1)];
+  r->ts_ns = trace_now_ns();
+  r->tp = tp;
+  r->argc = argc;
+  for (int i = 0; i < argc; i++)
+    r->args[i] = args[i];
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * printf with the arguments taken from the record, each conversion gets
+ * the next one cast back to the type its length modifier names.
+ */
+static void trace_format(FILE *out, const struct trace_record *r) {
+  const char *p = r->tp->fmt;
+  int arg = 0;
+
+  while (*p) {
+    char spec[24];
+    int len = 0;
+    int wide = 0; // 64 bit
+    int shorts = 0;
+    uint64_t v;
+
+    if (*p != '%') {
+      const char *end = strchr(p, '%');
+      size_t n = end ? (size_t)(end - p) : strlen(p);
+      fwrite(p, 1, n, out);
+      p += n;
+      continue;
+    }
+    if (p[1] == '%') {
+      fputc('%', out);
+      p += 2;
+      continue;
+    }
+    /* keep the flags, width and precision, drop the length */
+    spec[len++] = *p++;
+    while (*p && strchr("-+ #0123456789.", *p) && len < 16)
+      spec[len++] = *p++;
+    for (; *p && strchr("hlzjt", *p); p++) {
+      if (*p == 'h')
+        shorts++;
+      else
+        wide = 1; // long is 64 bit here
+    }
+    if (!*p)
+      break;
+    v = arg < r->argc ? r->args[arg] : 0;
+    arg++;
+    if (wide && strchr("diuxXo", *p)) {
+      spec[len++] = 'l';
+      spec[len++] = 'l';
+    }
+    spec[len++] = *p;
+    spec[len] = '\0';
+    switch (*p) {
+    case 'd':
+    case 'i':
+      if (wide)
+        fprintf(out, spec, (long long)v);
+      else if (shorts)
+        fprintf(out, spec, shorts > 1 ? (int)(signed char)v : (int)(short)v);
+      else
+        fprintf(out, spec, (int)v);
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      if (wide)
+        fprintf(out, spec, (unsigned long long)v);
+      else if (shorts)
+        fprintf(out, spec, shorts > 1 ? (unsigned)(unsigned char)v
+                                      : (unsigned)(unsigned short)v);
+      else
+        fprintf(out, spec, (unsigned)v);
+      break;
+    case 'c':
+      fprintf(out, spec, (int)v);
+      break;
+    case 's':
+      fprintf(out, spec, v ? (const char *)(uintptr_t)v : "(null)");
+      break;
+    case 'p':
+      fprintf(out, spec, (void *)(uintptr_t)v);
+      break;
+    default:
+      /* doubles do not fit the record */
+      fputc('?', out);
+      break;
+    }
+    p++;
+  }
+}
+
+/* with trace.lock held */
+static void trace_drain(FILE *out) {
+  for (struct trace_ring *ring = trace.rings; ring; ring = ring->next) {
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    for (; tail != head; tail++) {
+      const struct trace_record *r =
+        &ring->records[tail & (TRACE_RING_CAPS - 1)];
+      if (out) {
+        fprintf(out, "%lu.%06lu [%d] %s: ",
+                (unsigned long)(r->ts_ns / 1000000000),
+                (unsigned long)(r->ts_ns % 1000000000 / 1000), ring->tid,
+                r->tp->func);
+        trace_format(out, r);
+      }
+      trace.records++;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+  if (out)
+    fflush(out);
+}
+
+static void *trace_flusher(void *data) {
+  struct timespec ts = {
+    .tv_sec = 0,
+    .tv_nsec = TRACE_FLUSH_INTERVAL_NS,
+  };
+
+  (void)data;
+  while (!__atomic_load_n(&trace.stop, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&trace.lock);
+    trace_drain(trace.out);
+    pthread_mutex_unlock(&trace.lock);
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+int trace_start(FILE *out) {
+  pthread_mutex_lock(&trace.lock);
+  if (trace.flusher_running) {
+    pthread_mutex_unlock(&trace.lock);
+    err_log("%s: already started\n", __func__);
+    return 1;
+  }
+  trace.out = out;
+  __atomic_store_n(&trace.stop, false, __ATOMIC_RELAXED);
+  if (pthread_create(&trace.flusher, NULL, trace_flusher, NULL)) {
+    trace.out = NULL;
+    pthread_mutex_unlock(&trace.lock);
+    err_log("%s: failed to start the flusher\n", __func__);
+    return 1;
+  }
+  trace.flusher_running = true;
+  pthread_mutex_unlock(&trace.lock);
+  __atomic_store_n(&trace_enabled, true, __ATOMIC_RELAXED);
+  return 0;
+}
+
+int trace_start_from_env(void) {
+  const char *val = getenv("DRAW_ENGINE_TRACE");
+  FILE *out;
+
+  if (!val || !*val)
+    return 0;
+  if (!strcmp(val, "-"))
+    return trace_start(stdout);
+  out = fopen(val, "w");
+  if (!out) {
+    err_log("%s: failed to open %s\n", __func__, val);
+    return 1;
+  }
+  if (trace_start(out)) {
+    fclose(out);
+    return 1;
+  }
+  trace.owns_out = true;
+  return 0;
+}
+
+void trace_stop(void) {
+  __atomic_store_n(&trace_enabled, false, __ATOMIC_RELAXED);
+  if (!trace.flusher_running)
+    return;
+  __atomic_store_n(&trace.stop, true, __ATOMIC_RELEASE);
+  pthread_join(trace.flusher, NULL);
+  pthread_mutex_lock(&trace.lock);
+  trace.flusher_running = false;
+  trace_drain(trace.out);
+  if (trace.owns_out)
+    fclose(trace.out);
+  trace.out = NULL;
+  trace.owns_out = false;
+  pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_dump(FILE *out) {
+  pthread_mutex_lock(&trace.lock);
+  trace_drain(out);
+  pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_get_stats(struct trace_stats *stats) {
+  pthread_mutex_lock(&trace.lock);
+  stats->records = trace.records;
+  stats->rings = trace.ring_count;
+  stats->dropped = 0;
+  for (struct trace_ring *ring = trace.rings; ring; ring = ring->next)
+    stats->dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&trace.lock);
+}
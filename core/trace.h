@@ -0,0 +1,86 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../utils/utils.h"
+
+/*
+ * Tracing for the hot paths. trace() formats nothing, it copies a pointer
+ * to its call site and up to TRACE_ARGS_MAX integer or pointer arguments
+ * into a ring owned by the calling thread, which costs a few stores. The
+ * records are formatted later by a background thread started with
+ * trace_start(), or by trace_dump() after something went wrong. %s only
+ * takes strings living as long as the program, like string literals or
+ * __func__, since the pointer is kept and read later.
+ *
+ * Tracing is off until trace_start(), a trace point then is one branch.
+ * Built with LOG_LEVEL below LOG_LEVEL_TRACE the trace points are gone.
+ * A full ring drops the new records and counts them.
+ */
+
+#define TRACE_ARGS_MAX 6
+#define TRACE_RING_CAPS 4096 // records per thread, a power of two
+
+struct trace_point {
+  const char *func;
+  const char *fmt;
+};
+
+struct trace_stats {
+  uint64_t records; // formatted
+  uint64_t dropped; // lost to full rings
+  int rings; // threads that traced
+};
+
+extern bool trace_enabled;
+
+void trace_emit(const struct trace_point *tp, int argc, const uint64_t *args);
+
+/* DRAW_ENGINE_TRACE set to a path, or - for stdout, starts the flusher */
+int trace_start_from_env(void);
+/* formats the records every few ms on a thread into out */
+int trace_start(FILE *out);
+/* stops tracing, formats what is left and closes the output if it opened it */
+void trace_stop(void);
+/* formats what the rings hold from the calling thread */
+void trace_dump(FILE *out);
+void trace_get_stats(struct trace_stats *stats);
+
+#define TRACE_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define TRACE_NARGS(...) TRACE_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+#define TRACE_ARG_(x) ((uint64_t)(uintptr_t)(x))
+#define TRACE_MAP_0()
+#define TRACE_MAP_1(a) , TRACE_ARG_(a)
+#define TRACE_MAP_2(a, b) TRACE_MAP_1(a) TRACE_MAP_1(b)
+#define TRACE_MAP_3(a, ...) TRACE_MAP_1(a) TRACE_MAP_2(__VA_ARGS__)
+#define TRACE_MAP_4(a, ...) TRACE_MAP_1(a) TRACE_MAP_3(__VA_ARGS__)
+#define TRACE_MAP_5(a, ...) TRACE_MAP_1(a) TRACE_MAP_4(__VA_ARGS__)
+#define TRACE_MAP_6(a, ...) TRACE_MAP_1(a) TRACE_MAP_5(__VA_ARGS__)
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+#define TRACE_MAP(...)                                                         \
+  TRACE_CAT(TRACE_MAP_, TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+#define trace(fmt, ...)                                                        \
+  do {                                                                         \
+    if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED),    \
+                         0)) {                                                 \
+      static const struct trace_point trace_point_ = {__func__, fmt};          \
+      trace_emit(&trace_point_, TRACE_NARGS(__VA_ARGS__),                      \
+                 (const uint64_t[]){0 TRACE_MAP(__VA_ARGS__)} + 1);            \
+    }                                                                          \
+  } while(0)
+#else
+#define trace(fmt, ...)                                                        \
+  do {                                                                         \
+    if (0)                                                                     \
+      fprintf(stdout, fmt, ##__VA_ARGS__);                                     \
+  } while(0)
+#endif
+
+#endif
@@ -1,18 +1,60 @@
 #include <assert.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
+#ifdef HAVE_WAYLAND
 #include "linux/window-wayland.h"
+#endif
+#include "linux/window-headless.h"
+#include "linux/shm.h"
+#include "../core/trace.h"
+#include "../render/display-list.h"
+#include "../render/format.h"
+#include "../render/tile.h"
+#include "../utils/utils.h"
 #include "display.h"
 
 #define WIDTH 2560
 #define HEIGHT 1440
 
+#define STATUS_INTERVAL_NS 1000000000ull
+
 struct win_ctx *g_ctx = NULL;
 
-void window_system_init(void) {
-  window_wayland_init();
+#ifdef HAVE_WAYLAND
+#define WIN_CTX_DEFAULT_BACKEND WIN_CTX_BACKEND_WAYLAND
+#else
+#define WIN_CTX_DEFAULT_BACKEND WIN_CTX_BACKEND_HEADLESS
+#endif
+
+enum win_ctx_backend win_ctx_backend_from_name(const char *name) {
+  if (!name || !*name)
+    return WIN_CTX_DEFAULT_BACKEND;
+  if (strcmp(name, "headless") == 0)
+    return WIN_CTX_BACKEND_HEADLESS;
+  if (strcmp(name, "wayland") == 0)
+    return WIN_CTX_BACKEND_WAYLAND;
+  err_log("%s: unknown backend %s, using the default\n", __func__, name);
+  return WIN_CTX_DEFAULT_BACKEND;
+}
+
+int window_system_init(enum win_ctx_backend backend) {
+  switch (backend) {
+  case WIN_CTX_BACKEND_WAYLAND:
+#ifdef HAVE_WAYLAND
+    window_wayland_init();
+    return 0;
+#else
+    fprintf(stderr, "%s: built without wayland support\n", __func__);
+    return 1;
+#endif
+  case WIN_CTX_BACKEND_HEADLESS:
+    window_headless_init();
+    return 0;
+  }
+  return 1;
 }
 
 void win_ctx_ops_register(struct win_ctx_ops *ops) {
@@ -21,13 +63,22 @@ void win_ctx_ops_register(struct win_ctx_ops *ops) {
 }
 
 
-int win_ctx_init(void) {
+int win_ctx_init(enum win_ctx_backend backend) {
   g_ctx = malloc(sizeof(struct win_ctx));
   if (!g_ctx) {
     return 1;
   }
-  window_system_init();
+  if (window_system_init(backend)) {
+    free(g_ctx);
+    g_ctx = NULL;
+    return 1;
+  }
   g_ctx->ctx = g_ctx->ops->ctx_make();
+  if (!g_ctx->ctx) {
+    free(g_ctx);
+    g_ctx = NULL;
+    return 1;
+  }
   return 0;
 }
 
@@ -42,20 +93,38 @@ void win_ctx_close_window(void) {
 
 /* A R G B */
 static void pixel_buffer_init(uint32_t *buf, int height, int width, uint32_t value) {
-  for (int y = 0; y < height; ++y) {
-    for (int x = 0; x < width; ++x) {
-      if ((x + y / 8 * 8) % 16 < 8) {
-	buf[y * width + x] = value;
-      } else {
-	buf[y * width + x] = 0xFFFFFFFF;
-      }
-    }
+  struct tile_renderer *tiles = tile_renderer_default();
+  struct display_list *dl = display_list_make();
+  struct display_list_stats dl_stats;
+  struct draw_surface surf;
+  struct tile_stats stats;
+
+  if (!dl) {
+    err_log("%s: failed to make a display list\n", __func__);
+    return;
   }
+  display_list_fill_checker(dl, 0, 0, width, height, 8, value, 0xFFFFFFFF);
+  draw_surface_init(&surf, buf, g_ctx->ops->get_stride(g_ctx->ctx), width,
+                    height);
+  draw_surface_set_format(&surf, g_ctx->ops->get_pixel_format(g_ctx->ctx),
+                          pixel_dither_from_env());
+  display_list_replay(dl, tiles, &surf, NULL);
+  display_list_get_stats(dl, &dl_stats);
+  display_list_free(&dl);
+  tile_renderer_get_stats(tiles, &stats);
+  log("%s: %d tiles, min: %lu ns, max: %lu ns, cpu: %lu ns, wall: %lu ns\n",
+      __func__, stats.tile_count, (unsigned long)stats.min_ns,
+      (unsigned long)stats.max_ns, (unsigned long)stats.total_ns,
+      (unsigned long)stats.wall_ns);
+  log("%s: %d commands, %lu bytes, %lu tile refs\n", __func__,
+      dl_stats.commands, (unsigned long)dl_stats.bytes,
+      (unsigned long)dl_stats.refs);
 }
 
 void win_context_buffer_draw(int height, int width, uint32_t value) {
   uint32_t *pixels = g_ctx->ops->get_pixel_buffer_ptr(g_ctx->ctx);
   pixel_buffer_init(pixels, height, width, value);
+  g_ctx->ops->damage_buffer(g_ctx->ctx, 0, 0, width, height);
   g_ctx->ops->attach_buffer(g_ctx->ctx, 0, 0);
   g_ctx->ops->commit_buffer(g_ctx->ctx);
 }
@@ -65,17 +134,84 @@ int win_ctx_poll_events(struct win_ctx *ctx) {
   return g_ctx->ops->poll_events(ctx->ctx);
 }
 
+static int handle_signal(struct event_dispatcher *ed, struct event *ev,
+                         void *data) {
+  (void)data;
+  log("%s: got signal %lu, closing\n", __func__, (unsigned long)ev->value);
+  event_dispatcher_quit(ed);
+  return 0;
+}
+
+static int handle_status_timer(struct event_dispatcher *ed, struct event *ev,
+                               void *data) {
+  struct event_dispatcher_stats stats;
+  (void)ev;
+  (void)data;
+  event_dispatcher_get_stats(ed, &stats);
+  log("%s: %s waits: %lu, dispatched: %lu, dropped: %lu, syscalls: %lu\n",
+      __func__, event_dispatcher_backend_name(ed), (unsigned long)stats.waits,
+      (unsigned long)stats.dispatched, (unsigned long)stats.dropped,
+      (unsigned long)stats.syscalls);
+  return 0;
+}
+
+static int event_loop_setup(struct event_dispatcher *ed) {
+  int id;
+
+  if (g_ctx->ops->attach_events(g_ctx->ctx, ed))
+    return 1;
+  id = event_provide_signal(ed, SIGINT);
+  if (id < 0 || subscribe_event_source(ed, id, handle_signal, NULL))
+    return 1;
+  id = event_provide_signal(ed, SIGTERM);
+  if (id < 0 || subscribe_event_source(ed, id, handle_signal, NULL))
+    return 1;
+  id = event_provide_timer(ed, STATUS_INTERVAL_NS, STATUS_INTERVAL_NS);
+  if (id < 0 || subscribe_event_source(ed, id, handle_status_timer, NULL))
+    return 1;
+  return 0;
+}
+
 int main(void) {
   int ret = 0;
-  ret = win_ctx_init();
+  struct event_dispatcher *ed = NULL;
+  long faults;
+  /* before the trace flusher and tile workers, they inherit the mask */
+  if (event_block_signal(SIGINT) || event_block_signal(SIGTERM))
+    return 1;
+  if (trace_start_from_env())
+    return 1;
+  atexit(trace_stop);
+  /* DRAW_ENGINE_BACKEND=headless runs without a compositor */
+  ret = win_ctx_init(win_ctx_backend_from_name(getenv("DRAW_ENGINE_BACKEND")));
   if (ret)
     return 1;
+  faults = shm_page_faults();
   ret = win_ctx_create_window("helloworld", WIDTH, HEIGHT);
+  if (ret)
+    return 1;
+  log("%s: window creation: %ld page faults\n", __func__,
+      shm_page_faults() - faults);
+  log("%s: window format: %s\n", __func__,
+      pixel_format_name(g_ctx->ops->get_pixel_format(g_ctx->ctx)));
+  ed = event_dispatcher_make();
+  if (!ed || event_loop_setup(ed)) {
+    err_log("%s: failed to set up the event loop\n", __func__);
+    event_dispatcher_free(&ed);
+    win_ctx_close_window();
+    return 1;
+  }
+  /* what prefaulting the shm saves shows here */
+  faults = shm_page_faults();
   win_context_buffer_draw(HEIGHT, WIDTH, 0xFF000000);
-  while (!g_ctx->ops->window_should_close(g_ctx->ctx)) {
-    win_ctx_poll_events(g_ctx);
+  log("%s: first frame: %ld page faults\n", __func__,
+      shm_page_faults() - faults);
+  while (!g_ctx->ops->window_should_close(g_ctx->ctx) &&
+         !event_dispatcher_should_quit(ed)) {
+    event_dispatcher_run_once(ed, -1);
     //update_pixel_buffer();
   }
+  event_dispatcher_free(&ed);
   win_ctx_close_window();
   return ret;
 }
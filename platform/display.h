@@ -4,17 +4,33 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "../core/event.h"
+#include "../render/format.h"
+
 struct win_ctx_ops {
   void* (*ctx_make)(void);
   void (*ctx_free)(void **ctx);
+  /* stride is for 4 bytes per pixel, get_stride() has the one used */
   int (*create_window)(void *ctx, const char *name, int height, int width,
                       int stride);
   void (*close_window)(void *ctx);
   bool (*window_should_close)(void *vctx);
   uint32_t* (*get_pixel_buffer_ptr)(void *ctx);
+  /* of the pixel buffer, RGB565 if the backend negotiated it */
+  enum pixel_format (*get_pixel_format)(void *ctx);
+  int (*get_stride)(void *ctx); // in bytes
   void (*attach_buffer)(void *ctx, int x, int y);
+  /* mark a rect of the pixel buffer as changed for the next commit */
+  void (*damage_buffer)(void *ctx, int x, int y, int width, int height);
   void (*commit_buffer)(void *ctx);
   int (*poll_events)(void *ctx);
+  /* hook the backend's fds and timers into the event loop */
+  int (*attach_events)(void *ctx, struct event_dispatcher *ed);
+};
+
+enum win_ctx_backend {
+  WIN_CTX_BACKEND_WAYLAND,
+  WIN_CTX_BACKEND_HEADLESS,
 };
 
 struct win_ctx {
@@ -25,7 +41,9 @@ struct win_ctx {
 
 void win_ctx_ops_register(struct win_ctx_ops* ops);
 
-int win_ctx_init(void);
+/* the default backend for NULL, "" and names it does not know */
+enum win_ctx_backend win_ctx_backend_from_name(const char *name);
+int win_ctx_init(enum win_ctx_backend backend);
 
 int win_context_setup(struct win_ctx *ctx);
 void win_context_cleanup(struct win_ctx *ctx);
@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "../../core/buddy.h"
+#include "shm.h"
+#include "shm-pool.h"
+
+struct shm_pool {
+  struct wl_shm_pool *pool;
+  int fd;
+  int hugetlb;
+  struct shm_config config;
+  uint8_t *reserve;
+  uint8_t *data; // the start of the reserved range, huge page aligned
+  size_t size;
+  struct buddy_allocator *blocks;
+  uint64_t grows;
+  size_t prefaulted;
+};
+
+static size_t shm_pool_round(size_t size) {
+  size_t rounded = SHM_POOL_MIN_BLOCK;
+  while (rounded < size)
+    rounded <<= 1;
+  return rounded;
+}
+
+/*
+ * Map a new file at the start of the reserved range. Without reserved
+ * huge pages a hugetlb file only fails here, it is then redone with
+ * normal ones.
+ */
+static int shm_pool_map(struct shm_pool *pool) {
+  pool->fd = shm_file_make(pool->size, &pool->config, &pool->hugetlb);
+  if (pool->fd < 0) {
+    err_log("%s: failed to alloc shm file\n", __func__);
+    return 1;
+  }
+  if (mmap(pool->data, pool->size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, pool->fd, 0) != MAP_FAILED)
+    return 0;
+  if (pool->hugetlb) {
+    log("%s: no huge pages for %zu, using normal ones\n", __func__,
+        pool->size);
+    close(pool->fd);
+    pool->config.hugepages = SHM_HUGEPAGES_NONE;
+    return shm_pool_map(pool);
+  }
+  err_log("%s: failed to mmap %zu for pool_data\n", __func__, pool->size);
+  return 1;
+}
+
+struct shm_pool *shm_pool_make(struct wl_shm *shm, size_t size) {
+  struct shm_pool *new = NULL;
+
+  size = shm_pool_round(size);
+  if (size > SHM_POOL_RESERVE) {
+    err_log("%s: %zu is over the %lu reserved\n", __func__, size,
+            SHM_POOL_RESERVE);
+    return NULL;
+  }
+  new = malloc(sizeof(struct shm_pool));
+  if (!new) {
+    err_log("%s: no enough memory\n", __func__);
+    return NULL;
+  }
+  memset(new, 0, sizeof(struct shm_pool));
+  new->fd = -1;
+  new->size = size;
+  new->blocks = buddy_allocator_make(size, SHM_POOL_MIN_BLOCK);
+  if (!new->blocks) {
+    shm_pool_free(&new);
+    return NULL;
+  }
+  shm_config_default(&new->config);
+  /* only address space, the file is mapped over its start */
+  new->reserve = mmap(NULL, SHM_POOL_RESERVE + SHM_HUGE_PAGE_SIZE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (new->reserve == MAP_FAILED) {
+    err_log("%s: failed to reserve %lu\n", __func__, SHM_POOL_RESERVE);
+    new->reserve = NULL;
+    shm_pool_free(&new);
+    return NULL;
+  }
+  new->data = (uint8_t *)(((uintptr_t)new->reserve + SHM_HUGE_PAGE_SIZE - 1) &
+                          ~(SHM_HUGE_PAGE_SIZE - 1));
+  if (shm_pool_map(new)) {
+    shm_pool_free(&new);
+    return NULL;
+  }
+  new->pool = wl_shm_create_pool(shm, new->fd, (int32_t)size);
+  if (!new->pool) {
+    err_log("%s: failed to create the wl_shm_pool\n", __func__);
+    shm_pool_free(&new);
+    return NULL;
+  }
+  return new;
+}
+
+void shm_pool_free(struct shm_pool **ptr) {
+  struct shm_pool *pool = *ptr;
+  if (pool) {
+    if (pool->pool)
+      wl_shm_pool_destroy(pool->pool);
+    if (pool->reserve)
+      munmap(pool->reserve, SHM_POOL_RESERVE + SHM_HUGE_PAGE_SIZE);
+    if (pool->fd >= 0)
+      close(pool->fd);
+    buddy_allocator_free(&pool->blocks);
+    free(pool);
+    *ptr = NULL;
+  }
+}
+
+/* double the file and map the new half right after the old one */
+static int shm_pool_grow(struct shm_pool *pool) {
+  size_t new_size = pool->size * 2;
+  int ret;
+
+  if (new_size > SHM_POOL_RESERVE) {
+    err_log("%s: %zu is over the %lu reserved\n", __func__, new_size,
+            SHM_POOL_RESERVE);
+    return 1;
+  }
+  do {
+    ret = ftruncate(pool->fd, new_size);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    err_log("%s: failed to resize the shm file to %zu\n", __func__, new_size);
+    return 1;
+  }
+  if (mmap(pool->data + pool->size, pool->size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, pool->fd, pool->size) == MAP_FAILED) {
+    err_log("%s: failed to mmap %zu more\n", __func__, pool->size);
+    return 1;
+  }
+  if (buddy_allocator_grow(pool->blocks))
+    return 1;
+  wl_shm_pool_resize(pool->pool, (int32_t)new_size);
+  pool->size = new_size;
+  pool->grows++;
+  return 0;
+}
+
+long shm_pool_alloc(struct shm_pool *pool, size_t size) {
+  long offset = buddy_alloc(pool->blocks, size);
+  while (offset < 0) {
+    if (shm_pool_grow(pool))
+      return -1;
+    offset = buddy_alloc(pool->blocks, size);
+  }
+  /* fault the block in before it is drawn into */
+  if (pool->config.prefault != SHM_PREFAULT_NONE)
+    pool->prefaulted += shm_pool_block_size(pool, offset);
+  shm_prepare(pool->data + offset, shm_pool_block_size(pool, offset),
+              &pool->config);
+  return offset;
+}
+
+void shm_pool_release(struct shm_pool *pool, long offset) {
+  buddy_release(pool->blocks, offset);
+}
+
+size_t shm_pool_block_size(struct shm_pool *pool, long offset) {
+  return buddy_block_size(pool->blocks, offset);
+}
+
+void *shm_pool_data(struct shm_pool *pool, long offset) {
+  return pool->data + offset;
+}
+
+struct wl_buffer *shm_pool_create_buffer(struct shm_pool *pool, long offset,
+                                         int width, int height, int stride,
+                                         uint32_t format) {
+  if ((size_t)height * stride > shm_pool_block_size(pool, offset)) {
+    err_log("%s: %dx%d does not fit the block at %ld\n", __func__, width,
+            height, offset);
+    return NULL;
+  }
+  return wl_shm_pool_create_buffer(pool->pool, (int32_t)offset, width, height,
+                                   stride, format);
+}
+
+void shm_pool_get_stats(struct shm_pool *pool, struct shm_pool_stats *stats) {
+  struct buddy_stats blocks;
+  buddy_get_stats(pool->blocks, &blocks);
+  stats->size = pool->size;
+  stats->used = blocks.used;
+  stats->largest_free = blocks.largest_free;
+  stats->buffers = blocks.allocations;
+  stats->grows = pool->grows;
+  stats->prefaulted = pool->prefaulted;
+  stats->hugetlb = pool->hugetlb;
+}
@@ -0,0 +1,50 @@
+#ifndef _SHM_POOL_H_
+#define _SHM_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+/*
+ * One wl_shm_pool for every buffer of a process, whatever surface it is
+ * for. Buffers get blocks of a buddy allocator over the pool, a block
+ * released merges back with its free neighbours. A full pool doubles in
+ * place: the file grows, the mapping grows inside an address range
+ * reserved up front so the pixels never move, and the compositor is told
+ * with wl_shm_pool_resize. The pool never shrinks, the compositor may
+ * still map what a smaller file would cut off. The file and the faulting
+ * in of new blocks follow shm_config_default.
+ */
+
+#define SHM_POOL_MIN_BLOCK 4096
+#define SHM_POOL_RESERVE (1ul << 30) // the largest the pool may grow to
+
+struct shm_pool_stats {
+  size_t size;
+  size_t used; // in blocks, rounding to powers of two included
+  size_t largest_free;
+  int buffers;
+  uint64_t grows;
+  size_t prefaulted; // handed to shm_prepare, blocks reused are not counted
+  int hugetlb;
+};
+
+struct shm_pool;
+
+/* size is rounded up to a power of two */
+struct shm_pool *shm_pool_make(struct wl_shm *shm, size_t size);
+void shm_pool_free(struct shm_pool **ptr);
+
+/* a block of at least size bytes, the pool grows if needed, -1 on failure */
+long shm_pool_alloc(struct shm_pool *pool, size_t size);
+void shm_pool_release(struct shm_pool *pool, long offset);
+/* the size of the block at offset, an allocation may be reused up to it */
+size_t shm_pool_block_size(struct shm_pool *pool, long offset);
+void *shm_pool_data(struct shm_pool *pool, long offset);
+struct wl_buffer *shm_pool_create_buffer(struct shm_pool *pool, long offset,
+                                         int width, int height, int stride,
+                                         uint32_t format);
+
+void shm_pool_get_stats(struct shm_pool *pool, struct shm_pool_stats *stats);
+
+#endif
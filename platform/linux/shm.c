@@ -1,6 +1,12 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -17,6 +23,7 @@ static void randname(char *buf)
   }
 }
 
+/* for kernels without memfd, the file can't be sealed then */
 static int create_shm_file(void)
 {
   int retries = 100;
@@ -33,18 +40,148 @@ static int create_shm_file(void)
   return -1;
 }
 
-int allocate_shm_file(size_t size)
+static int resize_shm_file(int fd, size_t size)
 {
-  int fd = create_shm_file();
-  if (fd < 0)
-    return -1;
   int ret;
   do {
     ret = ftruncate(fd, size);
   } while (ret < 0 && errno == EINTR);
-  if (ret < 0) {
-    close(fd);
-    return -1;
+  return ret;
+}
+
+static enum shm_hugepages shm_hugepages_from_name(const char *name)
+{
+  if (!name || !*name)
+    return SHM_HUGEPAGES_THP;
+  if (strcmp(name, "hugetlb") == 0)
+    return SHM_HUGEPAGES_HUGETLB;
+  if (strcmp(name, "thp") == 0)
+    return SHM_HUGEPAGES_THP;
+  return SHM_HUGEPAGES_NONE;
+}
+
+static enum shm_prefault shm_prefault_from_name(const char *name)
+{
+  if (!name || !*name)
+    return SHM_PREFAULT_ASYNC;
+  if (strcmp(name, "sync") == 0)
+    return SHM_PREFAULT_SYNC;
+  if (strcmp(name, "async") == 0)
+    return SHM_PREFAULT_ASYNC;
+  return SHM_PREFAULT_NONE;
+}
+
+void shm_config_default(struct shm_config *cfg)
+{
+  cfg->hugepages = shm_hugepages_from_name(getenv("DRAW_ENGINE_SHM_HUGEPAGES"));
+  cfg->prefault = shm_prefault_from_name(getenv("DRAW_ENGINE_SHM_PREFAULT"));
+}
+
+int shm_file_make(size_t size, const struct shm_config *cfg, int *hugetlb)
+{
+  unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+  int fd = -1;
+
+  if (hugetlb)
+    *hugetlb = 0;
+  if (cfg && cfg->hugepages == SHM_HUGEPAGES_HUGETLB &&
+      size % SHM_HUGE_PAGE_SIZE == 0) {
+    fd = memfd_create("wl_shm", flags | MFD_HUGETLB);
+    if (fd >= 0 && resize_shm_file(fd, size) < 0) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd >= 0 && hugetlb)
+      *hugetlb = 1;
   }
+  if (fd < 0) {
+    fd = memfd_create("wl_shm", flags);
+    if (fd < 0 && errno == ENOSYS)
+      fd = create_shm_file();
+    if (fd < 0)
+      return -1;
+    if (resize_shm_file(fd, size) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  /* growing stays allowed */
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
   return fd;
 }
+
+int allocate_shm_file(size_t size)
+{
+  return shm_file_make(size, NULL, NULL);
+}
+
+struct shm_prefault_range {
+  void *addr;
+  size_t len;
+};
+
+/*
+ * Fault the pages in without writing them, the range may already be
+ * drawn into. A read fault on shmem allocates the page, writes to it
+ * then fault no more.
+ */
+static void shm_prefault(void *addr, size_t len)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  volatile const uint8_t *p = addr;
+
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(addr, len, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  for (size_t off = 0; off < len; off += page)
+    (void)p[off];
+}
+
+/* a racing munmap only makes madvise fail, no fallback reads here */
+static void *shm_prefault_thread(void *data)
+{
+  struct shm_prefault_range *range = (struct shm_prefault_range *)data;
+#ifdef MADV_POPULATE_WRITE
+  madvise(range->addr, range->len, MADV_POPULATE_WRITE);
+#endif
+  free(range);
+  return NULL;
+}
+
+void shm_prepare(void *addr, size_t len, const struct shm_config *cfg)
+{
+  struct shm_prefault_range *range;
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  if (cfg->hugepages == SHM_HUGEPAGES_THP)
+    madvise(addr, len, MADV_HUGEPAGE);
+  switch (cfg->prefault) {
+  case SHM_PREFAULT_NONE:
+    return;
+  case SHM_PREFAULT_SYNC:
+    shm_prefault(addr, len);
+    return;
+  case SHM_PREFAULT_ASYNC:
+    range = malloc(sizeof(struct shm_prefault_range));
+    if (!range)
+      return;
+    range->addr = addr;
+    range->len = len;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, shm_prefault_thread, range))
+      free(range);
+    pthread_attr_destroy(&attr);
+    return;
+  }
+}
+
+long shm_page_faults(void)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) < 0)
+    return 0;
+  return usage.ru_minflt;
+}
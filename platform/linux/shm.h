@@ -2,5 +2,44 @@
 #define _SHM_H_
 
 #include <stddef.h>
+
+/*
+ * Shm files for pixel buffers. They are memfds sealed against shrinking,
+ * a compositor mapping one never gets a SIGBUS from us truncating it.
+ * Pages can be faulted in ahead of the first frame, on the calling
+ * thread or on a background one, so rendering does not stall on them.
+ */
+
+#define SHM_HUGE_PAGE_SIZE (2ul << 20)
+
+enum shm_hugepages {
+  SHM_HUGEPAGES_NONE,
+  SHM_HUGEPAGES_THP, // madvise(MADV_HUGEPAGE), if shmem THP is enabled
+  SHM_HUGEPAGES_HUGETLB, // MFD_HUGETLB, needs reserved huge pages
+};
+
+enum shm_prefault {
+  SHM_PREFAULT_NONE,
+  SHM_PREFAULT_SYNC, // before the mapping is handed out
+  SHM_PREFAULT_ASYNC, // on a detached thread
+};
+
+struct shm_config {
+  enum shm_hugepages hugepages;
+  enum shm_prefault prefault;
+};
+
+/* THP advice and async prefault, overridden by DRAW_ENGINE_SHM_HUGEPAGES
+ * (none, thp or hugetlb) and DRAW_ENGINE_SHM_PREFAULT (none, sync or async) */
+void shm_config_default(struct shm_config *cfg);
+
 int allocate_shm_file(size_t size);
+/* falls back to normal pages if huge ones can't be had, *hugetlb tells */
+int shm_file_make(size_t size, const struct shm_config *cfg, int *hugetlb);
+/* the advice and the prefault of the config for a mapping of a shm file */
+void shm_prepare(void *addr, size_t len, const struct shm_config *cfg);
+/* the minor page faults of the process so far, the ones of the render
+ * workers and of an async prefault too */
+long shm_page_faults(void);
+
 #endif
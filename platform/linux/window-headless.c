@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../display.h"
+#include "window-headless.h"
+#include "shm.h"
+#include "../utils/utils.h"
+#include "../../render/damage.h"
+
+/*
+ * A backend without a compositor. Buffers live in a memfd the same way
+ * wl_shm buffers do, the frame clock is simulated and a committed buffer
+ * is "released" on the next frame tick, like a compositor latching a newer
+ * buffer would do. Useful for profiling the render path on build boxes.
+ */
+
+#define HEADLESS_BUFFER_CAPS 2
+#define HEADLESS_DEFAULT_FRAME_LIMIT 600
+#define HEADLESS_DEFAULT_REFRESH_NS 16666667ull
+
+struct headless_buffer {
+  uint32_t *pixels;
+  int busy;
+};
+
+struct headless_context {
+  /* the context of buffer */
+  int fd; // memfd
+  struct shm_config shm;
+  uint8_t *pool_data;
+  size_t pool_size;
+  struct headless_buffer bufs[HEADLESS_BUFFER_CAPS];
+  int back; // the buffer handed out to the drawing code
+  int attached; // the buffer attached but not committed yet, -1 if none
+  int front; // the buffer "on screen", -1 if none
+  int released; // the buffer to be released on the next tick, -1 if none
+  int height;
+  int width;
+  int stride;
+  enum pixel_format format; // any the renderer draws, there is no compositor
+  struct damage_region damage; // drawn since the last commit
+  /* simulated frame clock */
+  uint64_t refresh_ns;
+  uint64_t clock_ns;
+  uint64_t frames;
+  uint64_t frame_limit; // 0 means run forever
+  bool realtime; // sleep till the simulated vblank
+  bool timer_driven; // a timerfd of the event loop paces the ticks
+  struct timespec epoch;
+  /* statistics */
+  uint64_t commits;
+  uint64_t releases;
+  uint64_t damaged_pixels; // what a compositor would have to upload
+  /* states */
+  bool should_close;
+};
+
+static uint64_t env_to_u64(const char *name, uint64_t def) {
+  const char *val = getenv(name);
+  if (!val || !*val)
+    return def;
+  return strtoull(val, NULL, 10);
+}
+
+/* one simulated vblank: deliver the pending release and advance the clock */
+static int headless_tick(struct headless_context *ctx) {
+  int events = 1; // frame done
+  ctx->clock_ns += ctx->refresh_ns;
+  if (ctx->realtime && !ctx->timer_driven) {
+    struct timespec ts = ctx->epoch;
+    ts.tv_sec += ctx->clock_ns / 1000000000ull;
+    ts.tv_nsec += ctx->clock_ns % 1000000000ull;
+    if (ts.tv_nsec >= 1000000000l) {
+      ts.tv_sec += 1;
+      ts.tv_nsec -= 1000000000l;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  }
+  if (ctx->released >= 0) {
+    ctx->bufs[ctx->released].busy = 0;
+    ctx->released = -1;
+    ctx->releases++;
+    events++;
+  }
+  ctx->frames++;
+  if (ctx->frame_limit && ctx->frames >= ctx->frame_limit)
+    ctx->should_close = true;
+  return events;
+}
+
+static int headless_find_a_free_buffer(struct headless_context *ctx) {
+  for (int i = 0; i < HEADLESS_BUFFER_CAPS; i++) {
+    if (!ctx->bufs[i].busy)
+      return i;
+  }
+  return -1;
+}
+
+void headless_ctx_damage_buffer(void *vctx, int x, int y, int width,
+                                int height) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  damage_region_add(&ctx->damage, x, y, width, height);
+}
+
+uint32_t* headless_ctx_get_pixel_buffer_ptr(void *vctx) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  if (!ctx->pool_data)
+    return NULL;
+  if (ctx->back < 0) {
+    int i = headless_find_a_free_buffer(ctx);
+    /* every buffer is held by the "compositor", wait for a release */
+    while (i < 0) {
+      headless_tick(ctx);
+      i = headless_find_a_free_buffer(ctx);
+    }
+    ctx->back = i;
+  }
+  return ctx->bufs[ctx->back].pixels;
+}
+
+enum pixel_format headless_ctx_get_pixel_format(void *vctx) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  return ctx->format;
+}
+
+int headless_ctx_get_stride(void *vctx) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  return ctx->stride;
+}
+
+void headless_ctx_attach_buffer(void *vctx, int x, int y) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  (void)x;
+  (void)y;
+  if (ctx->back < 0)
+    headless_ctx_get_pixel_buffer_ptr(ctx);
+  ctx->attached = ctx->back;
+}
+
+void headless_ctx_commit_buffer(void *vctx) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  headless_ctx_attach_buffer(vctx, 0, 0);
+  if (ctx->attached < 0)
+    return;
+  /* the previous front buffer is released once the new one is latched */
+  if (ctx->front >= 0 && ctx->front != ctx->attached)
+    ctx->released = ctx->front;
+  ctx->front = ctx->attached;
+  ctx->bufs[ctx->front].busy = 1;
+  ctx->damaged_pixels += damage_region_area(&ctx->damage);
+  damage_region_clear(&ctx->damage);
+  ctx->attached = -1;
+  ctx->back = -1;
+  ctx->commits++;
+}
+
+int headless_ctx_poll_events(void *vctx) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  return headless_tick(ctx);
+}
+
+/* a tick per event, a user source re-enqueues itself to run flat out */
+static int headless_ctx_handle_tick(struct event_dispatcher *ed,
+                                    struct event *ev, void *data) {
+  struct headless_context *ctx = (struct headless_context *)data;
+  headless_tick(ctx);
+  if (ev->type == EVENT_TYPE_USER && !ctx->should_close)
+    event_enqueue(ed, ev->id);
+  return 0;
+}
+
+int headless_ctx_attach_events(void *vctx, struct event_dispatcher *ed) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  int id;
+
+  if (ctx->realtime) {
+    id = event_provide_timer(ed, ctx->refresh_ns, ctx->refresh_ns);
+    if (id < 0)
+      return 1;
+    ctx->timer_driven = true;
+    return subscribe_event_source(ed, id, headless_ctx_handle_tick, ctx);
+  }
+  id = event_provide(ed, EVENT_TYPE_USER);
+  if (id < 0 || subscribe_event_source(ed, id, headless_ctx_handle_tick, ctx))
+    return 1;
+  return event_enqueue(ed, id);
+}
+
+void *headless_ctx_make(void) {
+  struct headless_context *new = NULL;
+  new = malloc(sizeof(struct headless_context));
+  if (!new)
+    return NULL;
+  memset(new, 0, sizeof(struct headless_context));
+  new->fd = -1;
+  new->pool_data = NULL;
+  new->back = -1;
+  new->attached = -1;
+  new->front = -1;
+  new->released = -1;
+  new->refresh_ns = env_to_u64("DRAW_ENGINE_HEADLESS_REFRESH_NS",
+                               HEADLESS_DEFAULT_REFRESH_NS);
+  new->frame_limit = env_to_u64("DRAW_ENGINE_HEADLESS_FRAMES",
+                                HEADLESS_DEFAULT_FRAME_LIMIT);
+  new->realtime = env_to_u64("DRAW_ENGINE_HEADLESS_REALTIME", 0) != 0;
+  new->timer_driven = false;
+  new->should_close = false;
+  return new;
+}
+
+void headless_ctx_free(void **pctx) {
+  struct headless_context *ctx = *(struct headless_context **)pctx;
+  if (ctx) {
+    free(ctx);
+    *pctx = NULL;
+  }
+}
+
+int headless_ctx_create_window(void *vctx, const char *name, int height,
+                               int width, int stride) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  enum pixel_format format = pixel_format_from_env();
+  size_t buf_size, pool_size;
+
+  (void)name;
+  /* stride is for 4 bytes per pixel, rows stay 4 byte aligned */
+  stride = (stride / 4 * pixel_format_bpp(format) + 3) & ~3;
+  buf_size = (size_t)stride * height;
+  pool_size = buf_size * HEADLESS_BUFFER_CAPS;
+
+  shm_config_default(&ctx->shm);
+  /* the pool is not sized in huge pages, advice is all it gets */
+  if (ctx->shm.hugepages == SHM_HUGEPAGES_HUGETLB)
+    ctx->shm.hugepages = SHM_HUGEPAGES_THP;
+  ctx->fd = shm_file_make(pool_size, &ctx->shm, NULL);
+  if (ctx->fd < 0) {
+    err_log("%s: failed to create memfd of %zu\n", __func__, pool_size);
+    return EXIT_FAILURE;
+  }
+  ctx->pool_data = mmap(NULL, pool_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        ctx->fd, 0);
+  if (ctx->pool_data == MAP_FAILED) {
+    err_log("%s: failed to mmap %zu for pool_data\n", __func__, pool_size);
+    ctx->pool_data = NULL;
+    close(ctx->fd);
+    ctx->fd = -1;
+    return EXIT_FAILURE;
+  }
+  shm_prepare(ctx->pool_data, pool_size, &ctx->shm);
+  ctx->pool_size = pool_size;
+  for (int i = 0; i < HEADLESS_BUFFER_CAPS; i++) {
+    ctx->bufs[i].pixels = (uint32_t *)&ctx->pool_data[i * buf_size];
+    ctx->bufs[i].busy = 0;
+  }
+  ctx->height = height;
+  ctx->width = width;
+  ctx->stride = stride;
+  ctx->format = format;
+  damage_region_init(&ctx->damage, width, height);
+  clock_gettime(CLOCK_MONOTONIC, &ctx->epoch);
+  return 0;
+}
+
+void headless_ctx_close_window(void *vctx) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  log("%s: frames: %lu, commits: %lu, releases: %lu, damaged pixels: %lu\n",
+      __func__, (unsigned long)ctx->frames, (unsigned long)ctx->commits,
+      (unsigned long)ctx->releases, (unsigned long)ctx->damaged_pixels);
+  if (ctx->pool_data) {
+    munmap(ctx->pool_data, ctx->pool_size);
+    ctx->pool_data = NULL;
+    ctx->pool_size = 0;
+  }
+  if (ctx->fd >= 0) {
+    close(ctx->fd);
+    ctx->fd = -1;
+  }
+}
+
+bool headless_ctx_window_should_close(void *vctx) {
+  struct headless_context *ctx = (struct headless_context *)vctx;
+  return ctx->should_close;
+}
+
+static struct win_ctx_ops headless_ctx_ops = {
+    .ctx_make = headless_ctx_make,
+    .ctx_free = headless_ctx_free,
+    .create_window = headless_ctx_create_window,
+    .close_window = headless_ctx_close_window,
+    .window_should_close = headless_ctx_window_should_close,
+    .get_pixel_buffer_ptr = headless_ctx_get_pixel_buffer_ptr,
+    .get_pixel_format = headless_ctx_get_pixel_format,
+    .get_stride = headless_ctx_get_stride,
+    .attach_buffer = headless_ctx_attach_buffer,
+    .damage_buffer = headless_ctx_damage_buffer,
+    .commit_buffer = headless_ctx_commit_buffer,
+    .poll_events = headless_ctx_poll_events,
+    .attach_events = headless_ctx_attach_events,
+};
+
+void window_headless_init(void) { win_ctx_ops_register(&headless_ctx_ops); }
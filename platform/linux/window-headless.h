@@ -0,0 +1,5 @@
+#ifndef _WINDOW_HEADLESS_H_
+#define _WINDOW_HEADLESS_H_
+
+void window_headless_init(void);
+#endif
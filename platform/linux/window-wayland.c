@@ -1,18 +1,31 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include <wayland-client.h>
 
 #include "../display.h"
 #include "window-wayland.h"
 #include "../utils/utils.h"
-#include "shm.h"
+#include "shm-pool.h"
+#include "../../core/frame.h"
+#include "../../core/timing.h"
+#include "../../core/trace.h"
+#include "../../render/damage.h"
+#include "../../render/format.h"
+#include "../../render/scene.h"
+#include "../../render/tile.h"
 #include "xdg-shell-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+
+/* how often the pacing statistics are printed, in rendered frames */
+#define FRAME_STATS_INTERVAL 600
 
 
 struct wayland_context {
@@ -20,26 +33,50 @@ struct wayland_context {
   struct wl_display *display;
   struct wl_registry *registry;
   struct wl_shm *shm; // provide a format interface to set pixel format
+  uint32_t shm_formats; // 1 << enum pixel_format for each one announced
   void *shm_data;
   struct wl_compositor *compositor;
   struct xdg_wm_base *xdg_wm_base;
   struct wl_seat *seat; // for handling events from input source, such as keyboard, pointer, touch and so on
+  struct wp_presentation *presentation; // NULL if the compositor has none
+  uint32_t presentation_clock;
   /* the context of surface */
   struct wl_surface *surface;
   struct xdg_surface *xdg_surface;
   struct xdg_toplevel *xdg_toplevel;
   /* the context of buffer */
-  int fd; // shm fd
-  uint8_t *pool_data; // shm buffer pool
-  int offset; //
-  int shm_pool_size; // move it to wayland context
-  struct wl_shm_pool *pool; // move it to wayland context
+  struct shm_pool *shm_pool;
+  long block; // of the buffer in the pool, -1 if none
   struct wl_buffer *buffer; // move it to wayland context
   uint32_t *pixels;         // move it to wayland context
+  uint32_t format; // ARGB8888 pixels are premultiplied, see render/blend.h
+  enum pixel_format pixel_format; // the same format, for the renderer
+  int dither; // of RGB565 pixels
+  int height;
+  int width;
+  int stride;
+  struct damage_region damage; // drawn since the last commit
+  /* what the window shows, a frame redraws and commits what changed */
+  struct scene *scene;
+  struct scene_node *panel; // cached, it slides along the top
+  struct scene_node *dot; // follows the frame time
+  /* frame pacing */
+  struct frame_scheduler *frames;
+  struct event_dispatcher *ed;
+  int frame_timer; // fires when the next frame should start, -1 if none
+  struct wl_callback *frame_cb; // requested with the latest commit
+  uint32_t frame_time; // the timestamp of the latest frame callback
+  uint64_t rendered;
+  struct frame_timing *timing;
+  uint64_t commit_ns; // of the latest commit, 0 if none
   const char* name;
   /* states */
   bool configured;
   bool should_close;
+  bool buffer_committed; // the buffer has been presented at least once
+  bool buffer_busy; // committed, the compositor may read it till released
+  bool frame_deferred; // a frame waits for the release of the buffer
+  uint64_t deferred; // frames that had to wait for it
 };
 
 
@@ -91,6 +128,106 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 };
 
 
+/* presentation interfaces */
+static void wp_presentation_handle_clock_id(void *data,
+                                            struct wp_presentation *presentation,
+                                            uint32_t clk_id) {
+  struct wayland_context *ctx = (struct wayland_context *)data;
+  (void)presentation;
+  ctx->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener wp_presentation_listener = {
+  .clock_id = wp_presentation_handle_clock_id,
+};
+
+/* the scheduler runs on CLOCK_MONOTONIC, other clocks are not comparable */
+static bool wayland_ctx_has_feedback(struct wayland_context *ctx) {
+  return ctx->presentation && ctx->presentation_clock == CLOCK_MONOTONIC;
+}
+
+static void wp_feedback_handle_sync_output(void *data,
+                                           struct wp_presentation_feedback *fb,
+                                           struct wl_output *output) {
+  (void)data;
+  (void)fb;
+  (void)output;
+}
+
+static void wp_feedback_handle_presented(void *data,
+                                         struct wp_presentation_feedback *fb,
+                                         uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                                         uint32_t tv_nsec, uint32_t refresh,
+                                         uint32_t seq_hi, uint32_t seq_lo,
+                                         uint32_t flags) {
+  struct wayland_context *ctx = (struct wayland_context *)data;
+  uint64_t sec = ((uint64_t)tv_sec_hi << 32) | tv_sec_lo;
+
+  (void)seq_hi;
+  (void)seq_lo;
+  (void)flags;
+  frame_scheduler_presented(ctx->frames, sec * 1000000000ull + tv_nsec,
+                            refresh);
+  wp_presentation_feedback_destroy(fb);
+}
+
+static void wp_feedback_handle_discarded(void *data,
+                                         struct wp_presentation_feedback *fb) {
+  struct wayland_context *ctx = (struct wayland_context *)data;
+  frame_scheduler_discarded(ctx->frames);
+  wp_presentation_feedback_destroy(fb);
+}
+
+static const struct wp_presentation_feedback_listener wp_feedback_listener = {
+  .sync_output = wp_feedback_handle_sync_output,
+  .presented = wp_feedback_handle_presented,
+  .discarded = wp_feedback_handle_discarded,
+};
+
+
+/* the wl_shm formats the renderer can draw */
+static int wayland_shm_format_to_pixel(uint32_t format,
+                                       enum pixel_format *pixel_format) {
+  switch (format) {
+  case WL_SHM_FORMAT_XRGB8888:
+    *pixel_format = PIXEL_FORMAT_XRGB8888;
+    return 0;
+  case WL_SHM_FORMAT_ARGB8888:
+    *pixel_format = PIXEL_FORMAT_ARGB8888;
+    return 0;
+  case WL_SHM_FORMAT_RGB565:
+    *pixel_format = PIXEL_FORMAT_RGB565;
+    return 0;
+  }
+  return -1;
+}
+
+static uint32_t wayland_shm_format_from_pixel(enum pixel_format format) {
+  switch (format) {
+  case PIXEL_FORMAT_ARGB8888:
+    return WL_SHM_FORMAT_ARGB8888;
+  case PIXEL_FORMAT_RGB565:
+    return WL_SHM_FORMAT_RGB565;
+  default:
+    return WL_SHM_FORMAT_XRGB8888;
+  }
+}
+
+/* callbacks for shm */
+static void handle_shm_format(void *data, struct wl_shm *shm,
+                              uint32_t format) {
+  struct wayland_context *ctx = (struct wayland_context *)data;
+  enum pixel_format pixel_format;
+
+  (void)shm;
+  if (wayland_shm_format_to_pixel(format, &pixel_format) == 0)
+    ctx->shm_formats |= 1u << pixel_format;
+}
+
+static const struct wl_shm_listener shm_listener = {
+  .format = handle_shm_format,
+};
+
 /* callbacks for registry */
 static void handle_global(void *data, struct wl_registry *registry,
                           uint32_t name, const char *interface,
@@ -99,12 +236,21 @@ static void handle_global(void *data, struct wl_registry *registry,
 
   if (strcmp(interface, wl_shm_interface.name) == 0) {
     ctx->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    /* the formats come with the next roundtrip */
+    wl_shm_add_listener(ctx->shm, &shm_listener, ctx);
   } else if (strcmp(interface, wl_compositor_interface.name) == 0) {
-    ctx->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 1);
+    /* version 4 brings wl_surface_damage_buffer */
+    ctx->compositor = wl_registry_bind(registry, name, &wl_compositor_interface,
+                                       version < 4 ? version : 4);
   } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
     ctx->xdg_wm_base =
       wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
     xdg_wm_base_add_listener(ctx->xdg_wm_base, &xdg_wm_base_listener, NULL);
+  } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+    ctx->presentation =
+      wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+    wp_presentation_add_listener(ctx->presentation, &wp_presentation_listener,
+                                 ctx);
   }
 }
 
@@ -118,12 +264,20 @@ static const struct wl_registry_listener registry_listener = {
   .global_remove = handle_global_remove,
 };
 
+static void wayland_ctx_render_frame(struct wayland_context *ctx);
+
 /* callbacks for buffer */
 static void
 wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
 {
     /* Sent by the compositor when it's no longer using this buffer */
-    //wl_buffer_destroy(wl_buffer);
+    struct wayland_context *ctx = (struct wayland_context *)data;
+    (void)wl_buffer;
+    ctx->buffer_busy = false;
+    if (ctx->frame_deferred) {
+      ctx->frame_deferred = false;
+      wayland_ctx_render_frame(ctx);
+    }
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
@@ -134,42 +288,97 @@ static const struct wl_buffer_listener wl_buffer_listener = {
 /* callbacks for frame */
 static const struct wl_callback_listener wl_surface_frame_listener;
 
+void wayland_ctx_commit_buffer(void *vctx);
+
+
+static void wayland_ctx_log_frame_stats(struct wayland_context *ctx) {
+  struct frame_scheduler_stats stats;
+  struct scene_stats scene;
+  frame_scheduler_get_stats(ctx->frames, &stats);
+  log("%s: target fps: %.1f, refresh: %lu ns (%s), budget: %lu ns, "
+      "frames: %lu, missed: %lu, discarded: %lu, interval: %lu ns, "
+      "jitter: %lu ns\n", __func__, stats.target_fps,
+      (unsigned long)stats.refresh_ns, stats.exact ? "presentation" : "callbacks",
+      (unsigned long)stats.render_budget_ns, (unsigned long)stats.frames,
+      (unsigned long)stats.missed, (unsigned long)stats.discarded,
+      (unsigned long)stats.interval_avg_ns, (unsigned long)stats.jitter_ns);
+  scene_get_stats(ctx->scene, &scene);
+  log("%s: scene nodes: %d, layers: %d, drawn: %d, damage: %d rects, "
+      "%lu px, waited for the buffer: %lu\n", __func__, scene.nodes,
+      scene.layers, scene.layers_drawn, scene.damage_rects,
+      (unsigned long)scene.damage_area, (unsigned long)ctx->deferred);
+}
+
+/*
+ * render and commit, as close to the predicted vblank as the budget allows.
+ * There is one buffer: while the compositor may still read it the frame
+ * waits for its release, drawing into it then would tear.
+ */
+static void wayland_ctx_render_frame(struct wayland_context *ctx) {
+  uint64_t start = timing_now_ns();
+
+  struct draw_surface surf;
+  int travel = ctx->width > 512 ? ctx->width - 512 : 1;
+
+  if (ctx->buffer_busy) {
+    if (!ctx->frame_deferred)
+      ctx->deferred++;
+    ctx->frame_deferred = true;
+    return;
+  }
+  frame_scheduler_render_begin(ctx->frames, start);
+  scene_node_set_position(ctx->panel, 64 + (int)(ctx->rendered % travel), 64);
+  scene_node_set_position(ctx->dot, ctx->width / 2 - 32, ctx->height / 2 - 32);
+  scene_node_set_circle(ctx->dot, 32, 0xFF000000 | (ctx->frame_time % 256));
+  /* only where the nodes changed is drawn, and damaged */
+  draw_surface_init(&surf, ctx->pixels, ctx->stride, ctx->width, ctx->height);
+  draw_surface_set_format(&surf, ctx->pixel_format, ctx->dither);
+  if (scene_render(ctx->scene, tile_renderer_default(), &surf, &ctx->damage))
+    damage_region_add_all(&ctx->damage);
+  frame_timing_stage_end(ctx->timing, FRAME_STAGE_RENDER, start);
+  wayland_ctx_commit_buffer(ctx);
+  frame_scheduler_render_end(ctx->frames, frame_scheduler_now_ns());
+  if (++ctx->rendered % FRAME_STATS_INTERVAL == 0)
+    wayland_ctx_log_frame_stats(ctx);
+}
+
+static int wayland_ctx_handle_frame_timer(struct event_dispatcher *ed,
+                                          struct event *ev, void *data) {
+  (void)ed;
+  (void)ev;
+  wayland_ctx_render_frame((struct wayland_context *)data);
+  return 0;
+}
 
+/*
+ * The compositor is ready for a new frame. Instead of rendering right away
+ * and waiting in the compositor for the vblank, the frame timer starts the
+ * rendering just in time for it.
+ */
 static void wl_surface_frame_done(void *data, struct wl_callback *cb,
                                   uint32_t time)
 {
   struct wayland_context *ctx = (struct wayland_context *)data;
-  /*
-  Now, with each frame, we'll
-  1. Destroy the now-used frame callback.
-  2. Request a new callback for the next frame.
-  3. Render and submit the new frame.
-  The third step, broken down, is:
-  1. Update our state with a new offset, using the time since the last frame to scroll at a consistent rate.
-  2. Prepare a new wl_buffer and render a frame for it.
-  3. Attach the new wl_buffer to our surface.
-  4. Damage the entire surface.
-  5. Commit the surface.
-*/
+  uint64_t now = frame_scheduler_now_ns();
+  uint64_t start;
+
   wl_callback_destroy(cb);
-  cb = wl_surface_frame(ctx->surface);
-  wl_callback_add_listener(cb, &wl_surface_frame_listener, ctx);
-  log("%s: time: %u\n", __func__, time);
-
-  for (int y = 0; y < 1440; ++y) {
-    for (int x = 0; x < 2560; ++x) {
-      if ((x + y / 8 * 8) % 16 < 8) {
-	ctx->pixels[y * 2560 + x] = 0xFF000000 | (time % 256);
-      } else {
-	ctx->pixels[y * 2560 + x] = 0xFFFFFFFF;
-      }
-    }
+  ctx->frame_cb = NULL;
+  ctx->frame_time = time;
+  if (ctx->commit_ns)
+    frame_timing_record(ctx->timing, FRAME_STAGE_CALLBACK, now - ctx->commit_ns);
+  frame_timing_frame_end(ctx->timing);
+  trace("time: %u\n", time);
+  /* the feedback places the vblank exactly, callbacks only roughly */
+  if (!wayland_ctx_has_feedback(ctx))
+    frame_scheduler_frame_done(ctx->frames, time, now);
+  if (ctx->frame_timer < 0) {
+    wayland_ctx_render_frame(ctx);
+    return;
   }
-
-  //struct wl_buffer *buffer = draw_frame(state);
-  wl_surface_attach(ctx->surface, ctx->buffer, 0, 0);
-  wl_surface_damage_buffer(ctx->surface, 0, 0, INT32_MAX, INT32_MAX);
-  wl_surface_commit(ctx->surface);
+  start = frame_scheduler_next_start(ctx->frames, now);
+  /* a zero timeout would disarm the timer */
+  event_timer_set(ctx->ed, ctx->frame_timer, start > now ? start - now : 1, 0);
 }
 
 static const struct wl_callback_listener wl_surface_frame_listener = {
@@ -225,40 +434,53 @@ void wayland_ctx_free_surface(void *vctx) {
 
 int wayland_ctx_create_shm_pool(void *vctx, int shm_pool_size) {
   struct wayland_context *ctx = (struct wayland_context *)vctx;
-  ctx->fd = allocate_shm_file(shm_pool_size);
-  if (ctx->fd == -1) {
-    err_log("failed to alloc shm file\n");
+  ctx->shm_pool = shm_pool_make(ctx->shm, shm_pool_size);
+  if (!ctx->shm_pool)
     return EXIT_FAILURE;
-  }
-  ctx->pool_data = mmap(NULL, shm_pool_size, PROT_READ | PROT_WRITE,
-                        MAP_SHARED, ctx->fd, 0);
-  if (ctx->pool_data == MAP_FAILED) {
-    err_log("failed to mmap %d for pool_data", shm_pool_size);
-    return EXIT_FAILURE;
-  }
-  ctx->pool = wl_shm_create_pool(ctx->shm, ctx->fd, shm_pool_size);
-  ctx->shm_pool_size = shm_pool_size;
   return 0;
 }
 
-void wayland_ctx_free_shm_pool(void *vctx, int shm_pool_size) {
+void wayland_ctx_free_shm_pool(void *vctx) {
   struct wayland_context *ctx = (struct wayland_context *)vctx;
-  if (ctx->pool)
-    wl_shm_pool_destroy(ctx->pool);
-  if (ctx->pool_data)
-    munmap(ctx->pool_data, shm_pool_size);
-  if (ctx->fd > 0)
-    close(ctx->fd);
+  if (ctx->shm_pool && ctx->block >= 0)
+    shm_pool_release(ctx->shm_pool, ctx->block);
+  ctx->block = -1;
+  shm_pool_free(&ctx->shm_pool);
 }
 
-// need a shm manager to record the allocations of buffer
-// WL_SHM_FORMAT_XRGB8888
-int wayland_ctx_create_buffer(void *vctx, int height, int width, int stride, int offset, uint32_t format) {
+/*
+ * a block of the shm pool, WL_SHM_FORMAT_XRGB8888 or, for a translucent
+ * window, WL_SHM_FORMAT_ARGB8888. Every compositor has both, RGB565 only
+ * if it announced it.
+ */
+int wayland_ctx_create_buffer(void *vctx, int height, int width, int stride, uint32_t format) {
   struct wayland_context *ctx = (struct wayland_context *)vctx;
-  ctx->buffer =
-      wl_shm_pool_create_buffer(ctx->pool, offset, width, height, stride, format);
-  wl_buffer_add_listener(ctx->buffer, &wl_buffer_listener, NULL);
-  ctx->pixels = (uint32_t *)&ctx->pool_data[offset];
+  enum pixel_format pixel_format;
+  if (wayland_shm_format_to_pixel(format, &pixel_format)) {
+    err_log("%s: unsupported format %#x\n", __func__, format);
+    return EXIT_FAILURE;
+  }
+  ctx->block = shm_pool_alloc(ctx->shm_pool, (size_t)height * stride);
+  if (ctx->block < 0)
+    return EXIT_FAILURE;
+  ctx->buffer = shm_pool_create_buffer(ctx->shm_pool, ctx->block, width,
+                                       height, stride, format);
+  if (!ctx->buffer) {
+    shm_pool_release(ctx->shm_pool, ctx->block);
+    ctx->block = -1;
+    return EXIT_FAILURE;
+  }
+  wl_buffer_add_listener(ctx->buffer, &wl_buffer_listener, ctx);
+  ctx->pixels = shm_pool_data(ctx->shm_pool, ctx->block);
+  ctx->height = height;
+  ctx->width = width;
+  ctx->stride = stride;
+  ctx->format = format;
+  ctx->pixel_format = pixel_format;
+  damage_region_init(&ctx->damage, width, height);
+  ctx->buffer_committed = false;
+  ctx->buffer_busy = false;
+  ctx->frame_deferred = false;
   return 0;
 }
 
@@ -267,18 +489,70 @@ uint32_t* wayland_ctx_get_pixel_buffer_ptr(void *vctx) {
   return ctx->pixels;
 }
 
+enum pixel_format wayland_ctx_get_pixel_format(void *vctx) {
+  struct wayland_context *ctx = (struct wayland_context *)vctx;
+  return ctx->pixel_format;
+}
+
+int wayland_ctx_get_stride(void *vctx) {
+  struct wayland_context *ctx = (struct wayland_context *)vctx;
+  return ctx->stride;
+}
+
+void wayland_ctx_damage_buffer(void *vctx, int x, int y, int width, int height) {
+  struct wayland_context *ctx = (struct wayland_context *)vctx;
+  damage_region_add(&ctx->damage, x, y, width, height);
+}
+
+/* send what was drawn since the last commit, the first commit sends it all */
+static void wayland_ctx_flush_damage(struct wayland_context *ctx) {
+  struct damage_region *damage = &ctx->damage;
+  bool buffer_coords =
+    wl_surface_get_version(ctx->surface) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+
+  if (!ctx->buffer_committed)
+    damage_region_add_all(damage);
+  for (int i = 0; i < damage->count; i++) {
+    struct damage_rect *r = &damage->rects[i];
+    if (buffer_coords)
+      wl_surface_damage_buffer(ctx->surface, r->x, r->y, r->width, r->height);
+    else
+      wl_surface_damage(ctx->surface, r->x, r->y, r->width, r->height);
+  }
+  damage_region_clear(damage);
+}
+
 void wayland_ctx_attach_buffer(void *vctx, int x, int y) {
   struct wayland_context *ctx = (struct wayland_context *)vctx;
+  uint64_t start = timing_now_ns();
   wl_surface_attach(ctx->surface, ctx->buffer, x, y);
-  wl_surface_damage(ctx->surface, x, y, UINT32_MAX, UINT32_MAX);
+  frame_timing_stage_end(ctx->timing, FRAME_STAGE_ATTACH, start);
 }
 
 void wayland_ctx_commit_buffer(void *vctx) {
   struct wayland_context *ctx = (struct wayland_context *)vctx;
-  log("%s, begin\n", __func__);
+  uint64_t start;
+  trace("begin\n");
   wayland_ctx_attach_buffer(vctx, 0, 0);
+  start = timing_now_ns();
+  wayland_ctx_flush_damage(ctx);
+  frame_timing_stage_end(ctx->timing, FRAME_STAGE_DAMAGE, start);
+  /* keep the frame loop going */
+  if (!ctx->frame_cb) {
+    ctx->frame_cb = wl_surface_frame(ctx->surface);
+    wl_callback_add_listener(ctx->frame_cb, &wl_surface_frame_listener, ctx);
+  }
+  if (wayland_ctx_has_feedback(ctx)) {
+    struct wp_presentation_feedback *fb =
+      wp_presentation_feedback(ctx->presentation, ctx->surface);
+    wp_presentation_feedback_add_listener(fb, &wp_feedback_listener, ctx);
+  }
+  start = timing_now_ns();
   wl_surface_commit(ctx->surface);
-  log("%s, end\n", __func__);
+  ctx->commit_ns = frame_timing_stage_end(ctx->timing, FRAME_STAGE_COMMIT, start);
+  ctx->buffer_committed = true;
+  ctx->buffer_busy = true;
+  trace("end\n");
 }
 
 int wayland_ctx_poll_events(void *vctx) {
@@ -286,12 +560,67 @@ int wayland_ctx_poll_events(void *vctx) {
   return wl_display_dispatch(ctx->display);
 }
 
+/* before the loop sleeps: queue nothing unread and flush the requests */
+static void wayland_ctx_prepare_read(void *data) {
+  struct wayland_context *ctx = (struct wayland_context *)data;
+  while (wl_display_prepare_read(ctx->display) != 0)
+    wl_display_dispatch_pending(ctx->display);
+  if (wl_display_flush(ctx->display) < 0 && errno != EAGAIN)
+    err_log("%s: failed to flush the display\n", __func__);
+}
+
+static void wayland_ctx_check_read(void *data, uint32_t revents) {
+  struct wayland_context *ctx = (struct wayland_context *)data;
+  if (revents & EPOLLIN) {
+    if (wl_display_read_events(ctx->display) < 0) {
+      err_log("%s: failed to read events\n", __func__);
+      ctx->should_close = true;
+    }
+  } else {
+    wl_display_cancel_read(ctx->display);
+    if (revents & (EPOLLERR | EPOLLHUP)) {
+      err_log("%s: lost the compositor\n", __func__);
+      ctx->should_close = true;
+    }
+  }
+  if (wl_display_dispatch_pending(ctx->display) < 0)
+    ctx->should_close = true;
+}
+
+int wayland_ctx_attach_events(void *vctx, struct event_dispatcher *ed) {
+  struct wayland_context *ctx = (struct wayland_context *)vctx;
+  int id = event_provide_fd(ed, wl_display_get_fd(ctx->display), EPOLLIN);
+  if (id < 0 || event_source_set_hooks(ed, id, wayland_ctx_prepare_read,
+                                       wayland_ctx_check_read, ctx))
+    return 1;
+  /* disarmed till a frame callback schedules the next frame */
+  id = event_provide_timer(ed, 0, 0);
+  if (id < 0 ||
+      subscribe_event_source(ed, id, wayland_ctx_handle_frame_timer, ctx))
+    return 1;
+  ctx->ed = ed;
+  ctx->frame_timer = id;
+  return 0;
+}
+
 /* wayland context interfaces */
 void *wayland_ctx_make(void) {
   struct wayland_context *new = NULL;
+  struct frame_scheduler_config cfg;
   new = malloc(sizeof(struct wayland_context));
   if (!new)
     return NULL;
+  frame_scheduler_config_default(&cfg);
+  new->frames = frame_scheduler_make(&cfg);
+  new->timing = frame_timing_make("wayland-app");
+  new->scene = scene_make(0xFFFFFFFF);
+  if (!new->frames || !new->timing || !new->scene) {
+    frame_scheduler_free(&new->frames);
+    frame_timing_free(&new->timing);
+    scene_free(&new->scene);
+    free(new);
+    return NULL;
+  }
   new->display = NULL;
   new->registry = NULL;
   new->shm = NULL;
@@ -299,35 +628,95 @@ void *wayland_ctx_make(void) {
   new->compositor = NULL;
   new->xdg_wm_base = NULL;
   new->seat = NULL;
+  new->presentation = NULL;
+  new->presentation_clock = 0;
   new->surface = NULL;
   new->xdg_surface = NULL;
   new->xdg_toplevel = NULL;
   new->configured = false;
   new->should_close = false;
-  new->fd = -1;
-  new->pool_data = NULL;
-  new->shm_pool_size = 0;
-  new->pool = NULL;
+  new->shm_pool = NULL;
+  new->block = -1;
   new->buffer = NULL;
   new->pixels = NULL;
+  new->shm_formats = 0;
+  new->format = WL_SHM_FORMAT_XRGB8888;
+  new->pixel_format = PIXEL_FORMAT_XRGB8888;
+  new->dither = pixel_dither_from_env();
+  new->height = 0;
+  new->width = 0;
+  new->stride = 0;
+  damage_region_init(&new->damage, 0, 0);
+  new->buffer_committed = false;
+  new->ed = NULL;
+  new->frame_timer = -1;
+  new->frame_cb = NULL;
+  new->frame_time = 0;
+  new->panel = NULL;
+  new->dot = NULL;
+  new->rendered = 0;
+  new->commit_ns = 0;
   return new;
 }
 
 void wayland_ctx_free(void **pctx) {
   struct wayland_context *ctx = *(struct wayland_context **)pctx;
   if (ctx) {
+    frame_scheduler_free(&ctx->frames);
+    frame_timing_free(&ctx->timing);
+    scene_free(&ctx->scene);
     free(ctx);
     ctx = NULL;
   }
 }
 
+/*
+ * DRAW_ENGINE_WINDOW_FORMAT=argb8888 makes the window translucent, rgb565
+ * halves the bytes of a frame if the compositor takes it
+ */
+static enum pixel_format wayland_ctx_negotiate_format(struct wayland_context *ctx) {
+  enum pixel_format format = pixel_format_from_env();
+
+  if (!(ctx->shm_formats & (1u << format))) {
+    log("%s: %s is not supported by the compositor, using %s\n", __func__,
+        pixel_format_name(format), pixel_format_name(PIXEL_FORMAT_XRGB8888));
+    format = PIXEL_FORMAT_XRGB8888;
+  }
+  return format;
+}
+
+/* the checker of the first frame, a panel and a dot over it */
+static int wayland_ctx_build_scene(struct wayland_context *ctx) {
+  struct scene_node *checker = scene_node_make(ctx->scene, NULL);
+  struct scene_node *panel = scene_node_make(ctx->scene, NULL);
+  struct scene_node *bar = scene_node_make(ctx->scene, panel);
+  struct scene_node *knob = scene_node_make(ctx->scene, panel);
+
+  ctx->dot = scene_node_make(ctx->scene, NULL);
+  if (!checker || !panel || !bar || !knob || !ctx->dot) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  scene_node_set_checker(checker, ctx->width, ctx->height, 8, 0xFF000000,
+                         0xFFFFFFFF);
+  scene_node_set_rect(panel, 384, 256, 0xFF303040);
+  scene_node_set_position(bar, 16, 16);
+  scene_node_set_rect(bar, 352, 32, 0xFF5060A0);
+  scene_node_set_position(knob, 160, 96);
+  scene_node_set_circle(knob, 64, 0xFFE0A030);
+  scene_node_set_cached(panel, true);
+  ctx->panel = panel;
+  return 0;
+}
+
 static int is_context_noready(struct wayland_context *ctx) {
   return (ctx->shm == NULL || ctx->compositor == NULL || ctx->xdg_wm_base == NULL);
 }
 
 int wayland_ctx_create_window(void *vctx, const char *name, int height, int width,
                       int stride) {
-  int shm_pool_size = stride * height * 2;
+  int shm_pool_size;
+  enum pixel_format format;
   struct wayland_context *ctx = (struct wayland_context *)vctx;
   /* use WAYLAND_DISPLAY (the default value is wayland-0) if passing NULL to this function */
   ctx->display = wl_display_connect(NULL);
@@ -363,6 +752,18 @@ int wayland_ctx_create_window(void *vctx, const char *name, int height, int widt
     return EXIT_FAILURE;
   }
 
+  /* the wl_shm.format events of the bound shm */
+  if (wl_display_roundtrip(ctx->display) == -1) {
+    err_log("%s: failed to get the shm formats\n", __func__);
+    wl_registry_destroy(ctx->registry);
+    wl_display_disconnect(ctx->display);
+    return EXIT_FAILURE;
+  }
+  format = wayland_ctx_negotiate_format(ctx);
+  /* stride is for 4 bytes per pixel, rows stay 4 byte aligned */
+  stride = (stride / 4 * pixel_format_bpp(format) + 3) & ~3;
+  shm_pool_size = stride * height * 2;
+
   int ret = wayland_ctx_create_surface(ctx, name);
   if (ret) {
     err_log("%s: failed to create surface\n", __func__);
@@ -380,10 +781,20 @@ int wayland_ctx_create_window(void *vctx, const char *name, int height, int widt
     return EXIT_FAILURE;
   }
 
-  ret = wayland_ctx_create_buffer(ctx, height, width, stride, 0, WL_SHM_FORMAT_XRGB8888);
+  ret = wayland_ctx_create_buffer(ctx, height, width, stride,
+                                  wayland_shm_format_from_pixel(format));
   if (ret) {
     err_log("%s: failed to create surface\n", __func__);
-    wayland_ctx_free_shm_pool(ctx, shm_pool_size);
+    wayland_ctx_free_shm_pool(ctx);
+    wayland_ctx_free_surface(ctx);
+    wl_registry_destroy(ctx->registry);
+    wl_display_disconnect(ctx->display);
+    return EXIT_FAILURE;
+  }
+
+  if (wayland_ctx_build_scene(ctx)) {
+    wl_buffer_destroy(ctx->buffer);
+    wayland_ctx_free_shm_pool(ctx);
     wayland_ctx_free_surface(ctx);
     wl_registry_destroy(ctx->registry);
     wl_display_disconnect(ctx->display);
@@ -395,10 +806,16 @@ int wayland_ctx_create_window(void *vctx, const char *name, int height, int widt
 void wayland_ctx_close_window(void* vctx) {
   struct wayland_context *ctx = (struct wayland_context *)vctx;
 
+  wayland_ctx_log_frame_stats(ctx);
+  frame_timing_dump(ctx->timing);
+  if (ctx->frame_cb)
+    wl_callback_destroy(ctx->frame_cb);
   if (ctx->buffer)
       wl_buffer_destroy(ctx->buffer);
-  wayland_ctx_free_shm_pool(ctx, ctx->shm_pool_size);
+  wayland_ctx_free_shm_pool(ctx);
   wayland_ctx_free_surface(ctx);
+  if (ctx->presentation)
+    wp_presentation_destroy(ctx->presentation);
   wl_registry_destroy(ctx->registry);
   wl_display_disconnect(ctx->display);
 }
@@ -415,9 +832,13 @@ static struct win_ctx_ops wayland_ctx_ops = {
     .close_window = wayland_ctx_close_window,
     .window_should_close = wayland_ctx_window_should_close,
     .get_pixel_buffer_ptr = wayland_ctx_get_pixel_buffer_ptr,
+    .get_pixel_format = wayland_ctx_get_pixel_format,
+    .get_stride = wayland_ctx_get_stride,
     .attach_buffer = wayland_ctx_attach_buffer,
+    .damage_buffer = wayland_ctx_damage_buffer,
     .commit_buffer = wayland_ctx_commit_buffer,
     .poll_events = wayland_ctx_poll_events,
+    .attach_events = wayland_ctx_attach_events,
 };
 
 void window_wayland_init(void) { win_ctx_ops_register(&wayland_ctx_ops); }
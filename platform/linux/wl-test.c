@@ -1,17 +1,31 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include <wayland-client.h>
 
 #include "window-wayland.h"
 #include "../utils/utils.h"
+#include "../../core/event.h"
+#include "../../core/frame.h"
+#include "../../core/timing.h"
+#include "../../core/trace.h"
 #include "shm.h"
+#include "shm-pool.h"
+#include "../../render/damage.h"
+#include "../../render/fill.h"
+#include "../../render/tile.h"
 #include "xdg-shell-client-protocol.h"
+#include "presentation-time-client-protocol.h"
 
 #define WIDTH 800
 #define HEIGHT 600
@@ -24,14 +38,20 @@ struct wayland_buffer;
 
 void wayland_window_attach_buffer(struct wayland_window *win, struct wayland_buffer *buf, int x, int y);
 void wayland_window_commit_buffer(struct wayland_window *win, struct wayland_buffer *buf);
+void wayland_window_damage_buffer(struct wayland_window *win, int x, int y,
+                                  int width, int height);
 struct wayland_buffer *wayland_window_find_a_free_buffer(struct wayland_window *win);
+void wayland_window_produce_frame(struct wayland_window *win);
+void wayland_window_present_frame(struct wayland_window *win);
 int buffer_manager_resize_buffers(struct wayland_buffer_manager *buf_manager,
                                   int height, int width, int stride,
                                   uint32_t format);
+int wayland_window_resize(struct wayland_window *win, int height, int width);
 void wayland_window_free_buffer_manager(
 					struct wayland_buffer_manager **pbuf_manager);
 struct wayland_buffer_manager *
-wayland_window_create_buffer_manager(struct wayland_window *win);
+wayland_window_create_buffer_manager(struct wayland_window *win, int buffer_caps,
+                                     int present_mode);
 void wayland_surface_manager_free_window(struct wayland_window **pwin);
 
 struct wayland_context {
@@ -42,29 +62,91 @@ struct wayland_context {
   struct wl_compositor *compositor;
   struct xdg_wm_base *xdg_wm_base;
   struct wl_seat *seat; // for handling events from input source, such as keyboard, pointer, touch and so on
+  struct wp_presentation *presentation; // NULL if the compositor has none
+  uint32_t presentation_clock;
+  struct shm_pool *shm_pool; // every buffer of every window
 };
 
-#define BUFFER_CAPS 1
+#define BUFFER_CAPS_MIN 2
+#define BUFFER_CAPS_MAX 4
+#define BUFFER_CAPS_DEFAULT 2
+
+/* the frames whose damage is remembered, older buffers are fully repainted */
+#define DAMAGE_HISTORY_LEN 8
+
+/* how often the present statistics are printed, in presented frames */
+#define PRESENT_STATS_INTERVAL 600
+
+/* the shared shm pool starts this large and doubles when full */
+#define SHM_POOL_INITIAL_SIZE (4 << 20)
+/*
+ * A resized buffer keeps its block while it fits, blocks are powers of
+ * two so an interactive resize seldom needs a new one. A buffer using
+ * less than a quarter of its block gets a smaller one.
+ */
+#define SHM_BLOCK_SHRINK_RATIO 4
+
+enum wayland_buffer_state {
+  BUFFER_FREE,    // can be rendered into
+  BUFFER_PENDING, // rendered, waiting for a frame callback to be presented
+  BUFFER_BUSY,    // committed, held by the compositor till wl_buffer_release
+};
+
+/*
+ * FIFO presents the rendered frames in order and waits for a released
+ * buffer when all of them are in use, no frame is ever dropped.
+ * MAILBOX always presents the newest frame, a frame rendered while no
+ * buffer is free replaces the newest pending one, which is then dropped.
+ */
+enum wayland_present_mode {
+  PRESENT_MODE_FIFO,
+  PRESENT_MODE_MAILBOX,
+};
+
+struct wayland_present_stats {
+  uint64_t rendered;
+  uint64_t presented;
+  uint64_t dropped; // rendered frames replaced before being presented
+  uint64_t stalled; // frames that had to wait for a wl_buffer_release
+  uint64_t missed;  // frame callbacks with nothing new to present
+  uint64_t repainted_pixels; // rendered from scratch
+  uint64_t copied_pixels; // copied forward from the newest frame
+};
+
+struct wayland_pool_stats {
+  uint64_t buffers_created;
+  uint64_t blocks_reused; // buffers recreated in the block they had
+};
 
 struct wayland_buffer {
   struct wayland_window *win;
   int offset; // offset in shm pool
   struct wl_buffer *buffer; // move it to wayland context
   uint32_t *pixels;         // move it to wayland context
-  int busy;
+  long block; // its block in the shm pool, -1 if none
+  enum wayland_buffer_state state;
+  uint64_t seq; // the frame rendered into the buffer, 0 if undefined
+  bool stale; // of an older size, recreated once the compositor releases it
 };
 
 struct wayland_buffer_manager
 {
   struct wayland_window *win;
-  /* the context of buffer */
-  int fd; // shm fd
-  uint8_t *pool_data; // shm buffer pool
-  int shm_pool_size; // move it to wayland context
-  struct wl_shm_pool *pool; // move it to wayland context
+  /* the context of buffer, blocks of the shm pool of the context */
+  struct shm_pool *shm_pool;
+  /* what the buffers were created with */
+  int buf_height;
+  int buf_width;
+  int buf_stride;
+  uint32_t buf_format;
+  struct wayland_pool_stats pool_stats;
   int buffer_caps;
-  struct wayland_buffer bufs[BUFFER_CAPS];
+  struct wayland_buffer *bufs;
   int index; // the index of buffer being used now
+  enum wayland_present_mode present_mode;
+  uint64_t seq; // the number of frames rendered so far
+  bool frame_owed; // a frame is waiting for a free buffer
+  struct wayland_present_stats stats;
 };
 
 struct wayland_window
@@ -85,6 +167,30 @@ struct wayland_window
   int width;
   int stride;
   uint32_t format;
+  uint32_t frame_time; // the timestamp of the latest frame callback
+  struct damage_region damage; // changed by the frame being rendered
+  /* the damage of each rendered frame, indexed by seq */
+  struct damage_region damage_history[DAMAGE_HISTORY_LEN];
+  uint64_t presented_seq; // the frame the compositor has, 0 if none
+  /* frame pacing */
+  struct frame_scheduler *frames;
+  struct event_dispatcher *ed;
+  int frame_timer; // fires when the next frame should start, -1 if none
+  struct frame_timing *timing;
+  uint64_t commit_ns; // of the latest commit, 0 if none
+};
+
+/* the animated part of the wl-test scene, the rest is a static checker board */
+struct wl_test_box {
+  int x;
+  int y;
+  int size;
+  uint32_t color;
+  bool shown;
+};
+
+static struct wl_test_box g_box = {
+  .size = 96,
 };
 
 
@@ -133,6 +239,9 @@ static void xdg_surface_handle_configure(void *data,
                                          uint32_t serial) {
   struct wayland_window *win = (struct wayland_window *)data;
   xdg_surface_ack_configure(xdg_surface, serial);
+  /* the toplevel configure only proposes a size, this one applies it */
+  if (wayland_window_resize(win, win->actual_height, win->actual_width))
+    win->should_close = true;
   if (win->configured) {
     wl_surface_commit(win->surface);
     log("%s: end\n", __func__);
@@ -180,6 +289,19 @@ static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 };
 
 
+/* presentation interfaces */
+static void wp_presentation_handle_clock_id(void *data,
+                                            struct wp_presentation *presentation,
+                                            uint32_t clk_id) {
+  struct wayland_context *ctx = (struct wayland_context *)data;
+  (void)presentation;
+  ctx->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener wp_presentation_listener = {
+  .clock_id = wp_presentation_handle_clock_id,
+};
+
 /* callbacks for registry */
 static void handle_global(void *data, struct wl_registry *registry,
                           uint32_t name, const char *interface,
@@ -189,11 +311,18 @@ static void handle_global(void *data, struct wl_registry *registry,
   if (strcmp(interface, wl_shm_interface.name) == 0) {
     ctx->shm = wl_registry_bind(registry, name, &wl_shm_interface, version);
   } else if (strcmp(interface, wl_compositor_interface.name) == 0) {
-    ctx->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, version);
+    /* version 4 brings wl_surface_damage_buffer */
+    ctx->compositor = wl_registry_bind(registry, name, &wl_compositor_interface,
+                                       version < 4 ? version : 4);
   } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
     ctx->xdg_wm_base =
       wl_registry_bind(registry, name, &xdg_wm_base_interface, version);
     xdg_wm_base_add_listener(ctx->xdg_wm_base, &xdg_wm_base_listener, NULL);
+  } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+    ctx->presentation =
+      wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+    wp_presentation_add_listener(ctx->presentation, &wp_presentation_listener,
+                                 ctx);
   }
 }
 
@@ -231,6 +360,9 @@ void *wayland_ctx_make(void) {
   new->compositor = NULL;
   new->xdg_wm_base = NULL;
   new->seat = NULL;
+  new->presentation = NULL;
+  new->presentation_clock = 0;
+  new->shm_pool = NULL;
   return new;
 }
 
@@ -269,12 +401,22 @@ int wayland_ctx_setup(struct wayland_context *ctx)
     wl_display_disconnect(ctx->display);
     return EXIT_FAILURE;
   }
+
+  ctx->shm_pool = shm_pool_make(ctx->shm, SHM_POOL_INITIAL_SIZE);
+  if (!ctx->shm_pool) {
+    wl_registry_destroy(ctx->registry);
+    wl_display_disconnect(ctx->display);
+    return EXIT_FAILURE;
+  }
   return 0;
 }
 
 void wayland_ctx_cleanup(struct wayland_context *ctx)
 {
   if (ctx) {
+    shm_pool_free(&ctx->shm_pool);
+    if (ctx->presentation)
+      wp_presentation_destroy(ctx->presentation);
     if (ctx->registry)
       wl_registry_destroy(ctx->registry);
     if (ctx->display)
@@ -293,16 +435,28 @@ void wayland_ctx_free(void **pctx) {
 
 
 /* callbacks for buffer */
+static int buffer_manager_create_buffer(struct wayland_buffer_manager *buf_manager,
+                                        struct wayland_buffer *buf);
+
 static void wl_buffer_release(void *data, struct wl_buffer *wl_buffer) {
   (void)wl_buffer;
   struct wayland_buffer *buf =
     (struct wayland_buffer *)data;
   /* Sent by the compositor when it's no longer using this buffer */
-  log("%s: begin\n", __func__);
-  buf->busy = 0;
-  log("buf[%d] busy: %d\n", buf->offset, buf->busy);
+  trace("begin\n");
+  buf->state = BUFFER_FREE;
+  trace("buf[%d] state: %d\n", buf->offset, buf->state);
+  /* the window was resized while the compositor had the buffer */
+  if (buf->stale && buffer_manager_create_buffer(buf->win->buf_manager, buf)) {
+    buf->state = BUFFER_BUSY;
+    buf->win->should_close = true;
+    return;
+  }
   //wl_buffer_destroy(wl_buffer);
-  log("%s: end\n", __func__);
+  /* a frame was waiting for this buffer */
+  if (buf->win->buf_manager->frame_owed)
+    wayland_window_produce_frame(buf->win);
+  trace("end\n");
 }
 
 static const struct wl_buffer_listener wl_buffer_listener = {
@@ -314,56 +468,108 @@ static const struct wl_buffer_listener wl_buffer_listener = {
 static const struct wl_callback_listener wl_surface_frame_listener;
 
 
+/* the scheduler runs on CLOCK_MONOTONIC, other clocks are not comparable */
+static bool wayland_window_has_feedback(struct wayland_window *win) {
+  struct wayland_context *ctx = win->surf_manager->g_ctx;
+  return ctx->presentation && ctx->presentation_clock == CLOCK_MONOTONIC;
+}
+
+static void wp_feedback_handle_sync_output(void *data,
+                                           struct wp_presentation_feedback *fb,
+                                           struct wl_output *output) {
+  (void)data;
+  (void)fb;
+  (void)output;
+}
+
+static void wp_feedback_handle_presented(void *data,
+                                         struct wp_presentation_feedback *fb,
+                                         uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                                         uint32_t tv_nsec, uint32_t refresh,
+                                         uint32_t seq_hi, uint32_t seq_lo,
+                                         uint32_t flags) {
+  struct wayland_window *win = (struct wayland_window *)data;
+  uint64_t sec = ((uint64_t)tv_sec_hi << 32) | tv_sec_lo;
+
+  (void)seq_hi;
+  (void)seq_lo;
+  (void)flags;
+  frame_scheduler_presented(win->frames, sec * 1000000000ull + tv_nsec,
+                            refresh);
+  wp_presentation_feedback_destroy(fb);
+}
+
+static void wp_feedback_handle_discarded(void *data,
+                                         struct wp_presentation_feedback *fb) {
+  struct wayland_window *win = (struct wayland_window *)data;
+  frame_scheduler_discarded(win->frames);
+  wp_presentation_feedback_destroy(fb);
+}
+
+static const struct wp_presentation_feedback_listener wp_feedback_listener = {
+  .sync_output = wp_feedback_handle_sync_output,
+  .presented = wp_feedback_handle_presented,
+  .discarded = wp_feedback_handle_discarded,
+};
+
+/*
+ * mailbox renders the freshest frame right before presenting it, fifo
+ * presents the frame queued earlier and queues the next one. Only frames
+ * that commit a buffer are paced, the others get no feedback.
+ */
+static void wl_test_run_frame(struct wayland_window *win) {
+  struct wayland_buffer_manager *buf_manager = win->buf_manager;
+  uint64_t presented = buf_manager->stats.presented;
+
+  frame_scheduler_render_begin(win->frames, frame_scheduler_now_ns());
+  if (buf_manager->present_mode == PRESENT_MODE_MAILBOX) {
+    wayland_window_produce_frame(win);
+    wayland_window_present_frame(win);
+  } else {
+    wayland_window_present_frame(win);
+    wayland_window_produce_frame(win);
+  }
+  if (buf_manager->stats.presented != presented)
+    frame_scheduler_render_end(win->frames, frame_scheduler_now_ns());
+}
+
+static int wl_test_handle_frame_timer(struct event_dispatcher *ed,
+                                      struct event *ev, void *data) {
+  (void)ed;
+  (void)ev;
+  wl_test_run_frame((struct wayland_window *)data);
+  return 0;
+}
+
+/* the compositor is ready for a new frame, start it just in time */
 static void wl_surface_frame_done(void *data, struct wl_callback *cb,
                                   uint32_t time)
 {
   struct wayland_window *win = (struct wayland_window *)data;
-  log("%s: begin\n", __func__);
-  /*
-  Now, with each frame, we'll
-  1. Destroy the now-used frame callback.
-  2. Request a new callback for the next frame.
-  3. Render and submit the new frame.
-  The third step, broken down, is:
-  1. Update our state with a new offset, using the time since the last frame to scroll at a consistent rate.
-  2. Prepare a new wl_buffer and render a frame for it.
-  3. Attach the new wl_buffer to our surface.
-  4. Damage the entire surface.
-  5. Commit the surface.
-   */
-  wl_callback_destroy(cb);
-  struct wayland_buffer *free_buf = wayland_window_find_a_free_buffer(win);
-  if (!free_buf) {
-    log("skipping this frame\n");
-    struct wl_callback *frame_cb = wl_surface_frame(win->surface);
-    wl_callback_add_listener(frame_cb, &wl_surface_frame_listener, win);
-    wl_surface_commit(win->surface);
-    return;
-  }
-  log("%s: time: %u\n", __func__, time);
-  log("free_buf: %p\n", (void *)free_buf);
-  log("free_buf->buffer: %p\n", (void *)free_buf->buffer);
-  for (int i = 0; i < win->buf_manager->buffer_caps; i++) {
-    log("win->buf_manager->bufs[%d] address: %p\n", i, (void *)&win->buf_manager->bufs[i]);
-    log("win->buf_manager->bufs[%d].buffer address: %p\n", i, (void *)win->buf_manager->bufs[i].buffer);
-  }
+  uint64_t now = frame_scheduler_now_ns();
+  uint64_t start;
 
-  for (int y = 0; y < HEIGHT; ++y) {
-    for (int x = 0; x < WIDTH; ++x) {
-      if ((x + y / 8 * 8) % 16 < 8) {
-	free_buf->pixels[y * HEIGHT + x] = 0xFF000000 | (((time % 256) & 0xff) << 8);
-      } else {
-	free_buf->pixels[y * HEIGHT + x] = 0xFFFFFFFF;
-      }
-    }
-  }
-  //wl_surface_attach(win->surface, free_buf->buffer, 0, 0);
-  //wl_surface_damage_buffer(win->surface, 0, 0, INT32_MAX, INT32_MAX);
-  wayland_window_attach_buffer(win, free_buf, 0, 0);
+  trace("begin\n");
+  wl_callback_destroy(cb);
+  trace("time: %u\n", time);
+  win->frame_time = time;
+  if (win->commit_ns)
+    frame_timing_record(win->timing, FRAME_STAGE_CALLBACK, now - win->commit_ns);
+  frame_timing_frame_end(win->timing);
   struct wl_callback *frame_cb = wl_surface_frame(win->surface);
   wl_callback_add_listener(frame_cb, &wl_surface_frame_listener, win);
-  wayland_window_commit_buffer(win, free_buf);
-  log("%s: end\n", __func__);
+  /* the feedback places the vblank exactly, callbacks only roughly */
+  if (!wayland_window_has_feedback(win))
+    frame_scheduler_frame_done(win->frames, time, now);
+  if (win->frame_timer < 0) {
+    wl_test_run_frame(win);
+  } else {
+    start = frame_scheduler_next_start(win->frames, now);
+    /* a zero timeout would disarm the timer */
+    event_timer_set(win->ed, win->frame_timer, start > now ? start - now : 1,
+                    0);
+  }
+  trace("end\n");
 }
 
 static const struct wl_callback_listener wl_surface_frame_listener = {
@@ -373,19 +579,41 @@ static const struct wl_callback_listener wl_surface_frame_listener = {
 /* wayland context interfaces */
 struct wayland_window *wayland_surface_manager_create_window(
     struct wayland_surface_manager *surf_manager, const char *name, int height,
-							     int width, int stride, uint32_t format) {
+    int width, int stride, uint32_t format, int buffer_caps, int present_mode,
+    const struct frame_scheduler_config *pacing) {
   struct wayland_context *ctx = surf_manager->g_ctx;
   struct wayland_window *win = NULL;
   win = malloc(sizeof(struct wayland_window));
   if (!win)
     return NULL;
+  win->frames = frame_scheduler_make(pacing);
+  win->timing = frame_timing_make(name);
+  if (!win->frames || !win->timing) {
+    frame_scheduler_free(&win->frames);
+    frame_timing_free(&win->timing);
+    free(win);
+    return NULL;
+  }
+  win->commit_ns = 0;
+  win->ed = NULL;
+  win->frame_timer = -1;
   win->surf_manager = surf_manager;
   win->height = height;
   win->width = width;
   win->format = format;
   win->stride = stride;
+  win->frame_time = 0;
+  damage_region_init(&win->damage, width, height);
+  for (int i = 0; i < DAMAGE_HISTORY_LEN; i++)
+    damage_region_init(&win->damage_history[i], width, height);
+  win->presented_seq = 0;
+  win->buf_manager = NULL;
+  win->configured = false;
+  win->should_close = false;
   win->surface = wl_compositor_create_surface(ctx->compositor);
   if (!win->surface) {
+    frame_scheduler_free(&win->frames);
+    frame_timing_free(&win->timing);
     free(win);
     return NULL;
   }
@@ -393,6 +621,8 @@ struct wayland_window *wayland_surface_manager_create_window(
     xdg_wm_base_get_xdg_surface(ctx->xdg_wm_base, win->surface);
   if (!win->xdg_surface) {
     wl_surface_destroy(win->surface);
+    frame_scheduler_free(&win->frames);
+    frame_timing_free(&win->timing);
     free(win);
     return NULL;
   }
@@ -400,6 +630,8 @@ struct wayland_window *wayland_surface_manager_create_window(
   if (!win->xdg_toplevel) {
     xdg_surface_destroy(win->xdg_surface);
     wl_surface_destroy(win->surface);
+    frame_scheduler_free(&win->frames);
+    frame_timing_free(&win->timing);
     free(win);
     return NULL;
   }
@@ -416,7 +648,7 @@ struct wayland_window *wayland_surface_manager_create_window(
     log("Waiting for the configure event\n");
   }
   struct wayland_buffer_manager *buf_manager =
-    wayland_window_create_buffer_manager(win);
+    wayland_window_create_buffer_manager(win, buffer_caps, present_mode);
   if (!buf_manager) {
     wayland_surface_manager_free_window(&win);
     return NULL;
@@ -437,22 +669,40 @@ void wayland_surface_manager_free_window(struct wayland_window **pwin) {
       wl_surface_destroy(win->surface);
     if (win->buf_manager)
       wayland_window_free_buffer_manager(&win->buf_manager);
+    frame_scheduler_free(&win->frames);
+    frame_timing_free(&win->timing);
     free(win);
     win = NULL;
   }
 }
 
 
-// need a shm manager to record the allocations of buffer
+// the buffers are blocks of the shm pool of the context
 // WL_SHM_FORMAT_XRGB8888
 struct wayland_buffer_manager *
-wayland_window_create_buffer_manager(struct wayland_window *win) {
+wayland_window_create_buffer_manager(struct wayland_window *win, int buffer_caps,
+                                     int present_mode) {
   struct wayland_buffer_manager *new = NULL;
+  if (buffer_caps < BUFFER_CAPS_MIN || buffer_caps > BUFFER_CAPS_MAX) {
+    err_log("%s: %d buffers is out of [%d, %d]\n", __func__, buffer_caps,
+            BUFFER_CAPS_MIN, BUFFER_CAPS_MAX);
+    return NULL;
+  }
   new = malloc(sizeof(struct wayland_buffer_manager));
   if (!new)
     return NULL;
+  memset(new, 0, sizeof(struct wayland_buffer_manager));
+  new->shm_pool = win->surf_manager->g_ctx->shm_pool;
   new->win = win;
-  new->buffer_caps = BUFFER_CAPS;
+  new->buffer_caps = buffer_caps;
+  new->present_mode = present_mode;
+  new->bufs = calloc(buffer_caps, sizeof(struct wayland_buffer));
+  if (!new->bufs) {
+    free(new);
+    return NULL;
+  }
+  for (int i = 0; i < buffer_caps; i++)
+    new->bufs[i].block = -1;
   int ret = buffer_manager_resize_buffers(new, win->height, win->width, win->stride, win->format);
   if (ret) {
     wayland_window_free_buffer_manager(&new);
@@ -465,92 +715,509 @@ void wayland_window_free_buffer_manager(
 					struct wayland_buffer_manager **pbuf_manager) {
   struct wayland_buffer_manager *buf_manager = *pbuf_manager;
   if (buf_manager) {
-    if (buf_manager->pool)
-      wl_shm_pool_destroy(buf_manager->pool);
-    if (buf_manager->pool_data && buf_manager->shm_pool_size != 0) {
-      munmap(buf_manager->pool_data, buf_manager->shm_pool_size);
-      buf_manager->shm_pool_size = 0;
+    if (buf_manager->bufs) {
+      for (int i = 0; i < buf_manager->buffer_caps; i++) {
+        if (buf_manager->bufs[i].buffer)
+          wl_buffer_destroy(buf_manager->bufs[i].buffer);
+        if (buf_manager->bufs[i].block >= 0)
+          shm_pool_release(buf_manager->shm_pool, buf_manager->bufs[i].block);
+      }
+      free(buf_manager->bufs);
     }
-    if (buf_manager->fd > 0)
-      close(buf_manager->fd);
     free(buf_manager);
     buf_manager = NULL;
   }
 }
 
-int buffer_manager_resize_buffers(struct wayland_buffer_manager *buf_manager,
-                                  int height, int width, int stride, uint32_t format) {
-  int new_size = height * stride * buf_manager->buffer_caps;
-  buf_manager->fd = allocate_shm_file(new_size);
-  if (buf_manager->fd == -1) {
-    err_log("failed to alloc shm file\n");
-    return 1;
+/*
+ * (re)create the wl_buffer with the current geometry, in the block the
+ * buffer has if that still fits it well, else in a new one
+ */
+static int buffer_manager_create_buffer(struct wayland_buffer_manager *buf_manager,
+                                        struct wayland_buffer *buf) {
+  size_t size = (size_t)buf_manager->buf_height * buf_manager->buf_stride;
+  size_t block_size = 0;
+
+  if (buf->buffer) {
+    wl_buffer_destroy(buf->buffer);
+    buf->buffer = NULL;
   }
-  buf_manager->pool_data = mmap(NULL, new_size, PROT_READ | PROT_WRITE,
-                        MAP_SHARED, buf_manager->fd, 0);
-  if (buf_manager->pool_data == MAP_FAILED) {
-    err_log("failed to mmap %d for pool_data\n", new_size);
-    close(buf_manager->fd);
-    return 1;
+  if (buf->block >= 0)
+    block_size = shm_pool_block_size(buf_manager->shm_pool, buf->block);
+  if (block_size >= size && size * SHM_BLOCK_SHRINK_RATIO > block_size) {
+    buf_manager->pool_stats.blocks_reused++;
+  } else {
+    if (buf->block >= 0)
+      shm_pool_release(buf_manager->shm_pool, buf->block);
+    buf->block = shm_pool_alloc(buf_manager->shm_pool, size);
+    if (buf->block < 0) {
+      err_log("%s: no room for %zu in the shm pool\n", __func__, size);
+      return 1;
+    }
   }
-  buf_manager->pool = wl_shm_create_pool(buf_manager->win->surf_manager->g_ctx->shm, buf_manager->fd, new_size);
-  if (!buf_manager->pool) {
-    close(buf_manager->fd);
-    munmap(buf_manager->pool_data, new_size);
+  buf->buffer = shm_pool_create_buffer(buf_manager->shm_pool, buf->block,
+                                       buf_manager->buf_width,
+                                       buf_manager->buf_height,
+                                       buf_manager->buf_stride,
+                                       buf_manager->buf_format);
+  if (!buf->buffer) {
+    err_log("failed to create wl_buffer\n");
     return 1;
   }
-  buf_manager->shm_pool_size = new_size;
+  wl_buffer_add_listener(buf->buffer, &wl_buffer_listener, buf);
+  buf->pixels = shm_pool_data(buf_manager->shm_pool, buf->block);
+  buf->offset = (int)(buf - buf_manager->bufs);
+  buf->state = BUFFER_FREE;
+  buf->seq = 0;
+  buf->stale = false;
+  buf->win = buf_manager->win;
+  buf_manager->pool_stats.buffers_created++;
+  return 0;
+}
+
+/*
+ * Fit the buffers to a new size. A buffer the compositor holds keeps its
+ * block till it is released and recreated, so nothing it shows is drawn
+ * over in the meantime.
+ */
+int buffer_manager_resize_buffers(struct wayland_buffer_manager *buf_manager,
+                                  int height, int width, int stride, uint32_t format) {
+  if (height == buf_manager->buf_height && width == buf_manager->buf_width &&
+      stride == buf_manager->buf_stride && format == buf_manager->buf_format)
+    return 0;
+  buf_manager->buf_height = height;
+  buf_manager->buf_width = width;
+  buf_manager->buf_stride = stride;
+  buf_manager->buf_format = format;
   for (int i = 0; i < buf_manager->buffer_caps; i++) {
-    int offset = i * height * stride;
-    buf_manager->bufs[i].buffer = wl_shm_pool_create_buffer(
-							    buf_manager->pool, offset, width, height, stride, format);
-    if (!buf_manager->bufs[i].buffer) {
-      err_log("failed to create wl_buffer\n");
+    struct wayland_buffer *buf = &buf_manager->bufs[i];
+    if (buf->state == BUFFER_BUSY) {
+      buf->stale = true;
+      buf->seq = 0;
+      continue;
     }
-    wl_buffer_add_listener(buf_manager->bufs[i].buffer, &wl_buffer_listener, &buf_manager->bufs[i]);
-    buf_manager->bufs[i].pixels = (uint32_t *)&buf_manager->pool_data[offset];
-    buf_manager->bufs[i].offset = i;
-    buf_manager->bufs[i].busy = 0;
-    buf_manager->bufs[i].win = buf_manager->win;
-  }
-  wl_shm_pool_destroy(buf_manager->pool);
-  close(buf_manager->fd);
+    if (buf->state == BUFFER_PENDING)
+      buf_manager->stats.dropped++;
+    if (buffer_manager_create_buffer(buf_manager, buf))
+      return 1;
+  }
   return 0;
 }
 
+/* buffers and damage follow the size the compositor configured */
+int wayland_window_resize(struct wayland_window *win, int height, int width) {
+  if (height <= 0 || width <= 0 ||
+      (height == win->height && width == win->width))
+    return 0;
+  trace("%dx%d -> %dx%d\n", win->width, win->height, width, height);
+  win->height = height;
+  win->width = width;
+  win->stride = width * 4;
+  damage_region_init(&win->damage, width, height);
+  for (int i = 0; i < DAMAGE_HISTORY_LEN; i++)
+    damage_region_init(&win->damage_history[i], width, height);
+  /* the compositor has nothing of this size yet */
+  win->presented_seq = 0;
+  if (!win->buf_manager)
+    return 0;
+  return buffer_manager_resize_buffers(win->buf_manager, height, width,
+                                       win->stride, win->format);
+}
+
 struct wayland_buffer *
 wayland_window_find_a_free_buffer(struct wayland_window *win) {
   struct wayland_buffer *tmp = NULL;
   struct wayland_buffer_manager *buf_manager = win->buf_manager;
-  log("buf_manager->buffer_caps: %d\n", buf_manager->buffer_caps);
+  trace("buffer_caps: %d\n", buf_manager->buffer_caps);
   for (int i = 0; i < buf_manager->buffer_caps; i++) {
-    if (!buf_manager->bufs[i].busy) {
+    if (buf_manager->bufs[i].state == BUFFER_FREE) {
       tmp = &buf_manager->bufs[i];
-      log("buf[%d] is available\n", i);
+      trace("buf[%d] is available\n", i);
       return tmp;
     }
   }
   return tmp;
 }
 
+/* the pending buffer a present takes: the oldest for fifo, the newest for mailbox */
+static struct wayland_buffer *
+buffer_manager_find_pending(struct wayland_buffer_manager *buf_manager,
+                            bool newest) {
+  struct wayland_buffer *found = NULL;
+  for (int i = 0; i < buf_manager->buffer_caps; i++) {
+    struct wayland_buffer *buf = &buf_manager->bufs[i];
+    if (buf->state != BUFFER_PENDING)
+      continue;
+    if (!found || (newest ? buf->seq > found->seq : buf->seq < found->seq))
+      found = buf;
+  }
+  return found;
+}
+
+/* the union of the damage of frames (from, to] */
+static void wayland_window_damage_since(struct wayland_window *win,
+                                        uint64_t from, uint64_t to,
+                                        struct damage_region *out) {
+  for (uint64_t seq = from + 1; seq <= to; seq++)
+    damage_region_union(out, &win->damage_history[seq % DAMAGE_HISTORY_LEN]);
+}
+
+/*
+ * How many frames behind the newest one the content of the buffer is:
+ * 1 means it holds the newest frame, 0 means its content is undefined or
+ * too old for the damage history.
+ */
+static int buffer_manager_buffer_age(struct wayland_buffer_manager *buf_manager,
+                                     struct wayland_buffer *buf) {
+  uint64_t age;
+  if (!buf->seq)
+    return 0;
+  age = buf_manager->seq - buf->seq + 1;
+  return age > DAMAGE_HISTORY_LEN ? 0 : (int)age;
+}
+
+static struct wayland_buffer *
+buffer_manager_find_newest(struct wayland_buffer_manager *buf_manager) {
+  for (int i = 0; i < buf_manager->buffer_caps; i++) {
+    if (buf_manager->bufs[i].seq && buf_manager->bufs[i].seq == buf_manager->seq)
+      return &buf_manager->bufs[i];
+  }
+  return NULL;
+}
+
+/*
+ * Bring the buffer up to date with the newest frame by copying forward
+ * what changed since it was rendered, and return in repaint what the new
+ * frame has to draw: its own damage, or everything if the age is unknown.
+ */
+static void wayland_window_prepare_buffer(struct wayland_window *win,
+                                          struct wayland_buffer *buf,
+                                          struct damage_region *repaint) {
+  struct wayland_buffer_manager *buf_manager = win->buf_manager;
+  struct wayland_buffer *newest = buffer_manager_find_newest(buf_manager);
+  int age = buffer_manager_buffer_age(buf_manager, buf);
+
+  damage_region_init(repaint, win->width, win->height);
+  if (age == 0 || !newest) {
+    damage_region_add_all(repaint);
+    return;
+  }
+  if (age > 1) {
+    struct damage_region stale;
+    damage_region_init(&stale, win->width, win->height);
+    wayland_window_damage_since(win, buf->seq, buf_manager->seq, &stale);
+    for (int i = 0; i < stale.count; i++) {
+      struct damage_rect *r = &stale.rects[i];
+      pixels_copy_rect(buf->pixels, newest->pixels, win->stride, r->x, r->y,
+                       r->width, r->height);
+    }
+    buf_manager->stats.copied_pixels += damage_region_area(&stale);
+  }
+  damage_region_union(repaint, &win->damage);
+}
+
+/* move the box with the frame time, damaging where it was and where it goes */
+static void wl_test_update(struct wayland_window *win) {
+  uint32_t time = win->frame_time;
+  struct wl_test_box *box = &g_box;
+
+  if (box->shown)
+    wayland_window_damage_buffer(win, box->x, box->y, box->size, box->size);
+  box->shown = win->width > box->size && win->height > box->size;
+  if (!box->shown)
+    return;
+  box->x = (time / 4) % (win->width - box->size);
+  box->y = (win->height - box->size) / 2;
+  box->color = 0xFF000000 | (((time % 256) & 0xff) << 8);
+  wayland_window_damage_buffer(win, box->x, box->y, box->size, box->size);
+}
+
+/* draws one tile's share of the repaint region, may run on any worker */
+static void wl_test_render_tile(void *data, uint32_t *pixels, int stride,
+                                int x, int y, int width, int height) {
+  struct wl_test_box *box = (struct wl_test_box *)data;
+  int x0 = x > box->x ? x : box->x;
+  int y0 = y > box->y ? y : box->y;
+  int x1 = x + width < box->x + box->size ? x + width : box->x + box->size;
+  int y1 = y + height < box->y + box->size ? y + height : box->y + box->size;
+
+  pixels_fill_checker_rect(pixels, stride, x, y, width, height, 8, 0xFF000000,
+                           0xFFFFFFFF);
+  if (box->shown && x1 > x0 && y1 > y0)
+    pixels_fill_rect(pixels, stride, x0, y0, x1 - x0, y1 - y0, box->color);
+}
+
+static void wayland_window_render(struct wayland_window *win,
+                                  struct wayland_buffer *buf,
+                                  struct damage_region *repaint) {
+  uint64_t start = timing_now_ns();
+  /* joins before the buffer can be committed */
+  tile_renderer_run(tile_renderer_default(), buf->pixels, win->width,
+                    win->height, win->stride, repaint, wl_test_render_tile,
+                    &g_box);
+  frame_timing_stage_end(win->timing, FRAME_STAGE_RENDER, start);
+  win->buf_manager->stats.repainted_pixels += damage_region_area(repaint);
+}
+
+void wayland_window_produce_frame(struct wayland_window *win) {
+  struct wayland_buffer_manager *buf_manager = win->buf_manager;
+  struct wayland_buffer *buf = wayland_window_find_a_free_buffer(win);
+  struct damage_region repaint;
+
+  if (!buf && buf_manager->present_mode == PRESENT_MODE_MAILBOX) {
+    /* replace the newest frame nobody has seen yet */
+    buf = buffer_manager_find_pending(buf_manager, true);
+    if (buf)
+      buf_manager->stats.dropped++;
+  }
+  if (!buf) {
+    /* wait for wl_buffer_release */
+    if (!buf_manager->frame_owed)
+      buf_manager->stats.stalled++;
+    buf_manager->frame_owed = true;
+    return;
+  }
+  buf_manager->frame_owed = false;
+  wl_test_update(win);
+  wayland_window_prepare_buffer(win, buf, &repaint);
+  wayland_window_render(win, buf, &repaint);
+  buf->state = BUFFER_PENDING;
+  buf->seq = ++buf_manager->seq;
+  win->damage_history[buf->seq % DAMAGE_HISTORY_LEN] = win->damage;
+  damage_region_clear(&win->damage);
+  buf_manager->stats.rendered++;
+}
+
+static void buffer_manager_print_stats(struct wayland_buffer_manager *buf_manager) {
+  struct wayland_present_stats *stats = &buf_manager->stats;
+  struct frame_scheduler_stats pacing;
+  struct shm_pool_stats pool;
+  struct tile_stats tiles;
+  log("present mode: %s, buffers: %d, rendered: %lu, presented: %lu, "
+      "dropped: %lu, stalled: %lu, missed: %lu, repainted pixels: %lu, "
+      "copied pixels: %lu\n",
+      buf_manager->present_mode == PRESENT_MODE_MAILBOX ? "mailbox" : "fifo",
+      buf_manager->buffer_caps, (unsigned long)stats->rendered,
+      (unsigned long)stats->presented, (unsigned long)stats->dropped,
+      (unsigned long)stats->stalled, (unsigned long)stats->missed,
+      (unsigned long)stats->repainted_pixels,
+      (unsigned long)stats->copied_pixels);
+  tile_renderer_get_stats(tile_renderer_default(), &tiles);
+  log("last frame: %d tiles, min: %lu ns, max: %lu ns, cpu: %lu ns, "
+      "wall: %lu ns\n", tiles.tile_count, (unsigned long)tiles.min_ns,
+      (unsigned long)tiles.max_ns, (unsigned long)tiles.total_ns,
+      (unsigned long)tiles.wall_ns);
+  shm_pool_get_stats(buf_manager->shm_pool, &pool);
+  log("shm pool: %zu bytes, used: %zu, largest free: %zu, blocks: %d, "
+      "grows: %lu, buffers created: %lu, blocks reused: %lu, "
+      "prefaulted: %zu, hugetlb: %s\n", pool.size, pool.used,
+      pool.largest_free, pool.buffers, (unsigned long)pool.grows,
+      (unsigned long)buf_manager->pool_stats.buffers_created,
+      (unsigned long)buf_manager->pool_stats.blocks_reused, pool.prefaulted,
+      pool.hugetlb ? "yes" : "no");
+  frame_scheduler_get_stats(buf_manager->win->frames, &pacing);
+  log("pacing: target fps: %.1f, refresh: %lu ns (%s), budget: %lu ns, "
+      "frames: %lu, missed deadlines: %lu, discarded: %lu, interval: %lu ns, "
+      "jitter: %lu ns\n", pacing.target_fps, (unsigned long)pacing.refresh_ns,
+      pacing.exact ? "presentation" : "callbacks",
+      (unsigned long)pacing.render_budget_ns, (unsigned long)pacing.frames,
+      (unsigned long)pacing.missed, (unsigned long)pacing.discarded,
+      (unsigned long)pacing.interval_avg_ns, (unsigned long)pacing.jitter_ns);
+  frame_timing_dump(buf_manager->win->timing);
+}
+
+void wayland_window_present_frame(struct wayland_window *win) {
+  struct wayland_buffer_manager *buf_manager = win->buf_manager;
+  bool mailbox = buf_manager->present_mode == PRESENT_MODE_MAILBOX;
+  struct wayland_buffer *buf = buffer_manager_find_pending(buf_manager, mailbox);
+
+  if (!buf) {
+    /* nothing new, commit anyway so the frame callback fires */
+    buf_manager->stats.missed++;
+    wl_surface_commit(win->surface);
+    return;
+  }
+  if (mailbox) {
+    /* older frames are superseded by the one being presented */
+    for (int i = 0; i < buf_manager->buffer_caps; i++) {
+      struct wayland_buffer *old = &buf_manager->bufs[i];
+      if (old != buf && old->state == BUFFER_PENDING) {
+        old->state = BUFFER_FREE;
+        buf_manager->stats.dropped++;
+      }
+    }
+  }
+  wayland_window_commit_buffer(win, buf);
+  buf_manager->stats.presented++;
+  if (buf_manager->stats.presented % PRESENT_STATS_INTERVAL == 0)
+    buffer_manager_print_stats(buf_manager);
+}
+
+void wayland_window_damage_buffer(struct wayland_window *win, int x, int y,
+                                  int width, int height) {
+  damage_region_add(&win->damage, x, y, width, height);
+}
+
+/*
+ * Send what changed between the frame the compositor has and the one in
+ * buf, which may skip frames dropped by mailbox, as buffer coordinates.
+ */
+static void wayland_window_flush_damage(struct wayland_window *win,
+                                        struct wayland_buffer *buf) {
+  struct damage_region damage;
+  bool buffer_coords =
+    wl_surface_get_version(win->surface) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+
+  damage_region_init(&damage, win->width, win->height);
+  if (!win->presented_seq || buf->seq <= win->presented_seq ||
+      buf->seq - win->presented_seq > DAMAGE_HISTORY_LEN)
+    damage_region_add_all(&damage);
+  else
+    wayland_window_damage_since(win, win->presented_seq, buf->seq, &damage);
+  for (int i = 0; i < damage.count; i++) {
+    struct damage_rect *r = &damage.rects[i];
+    if (buffer_coords)
+      wl_surface_damage_buffer(win->surface, r->x, r->y, r->width, r->height);
+    else
+      wl_surface_damage(win->surface, r->x, r->y, r->width, r->height);
+  }
+  win->presented_seq = buf->seq;
+}
+
 void wayland_window_attach_buffer(struct wayland_window *win, struct wayland_buffer *buf, int x, int y) {
-  log("%s, begin\n", __func__);
+  uint64_t start = timing_now_ns();
+  trace("begin\n");
   wl_surface_attach(win->surface, buf->buffer, x, y);
-  wl_surface_damage(win->surface, x, y, UINT32_MAX, UINT32_MAX);
-  log("%s, end\n", __func__);
+  frame_timing_stage_end(win->timing, FRAME_STAGE_ATTACH, start);
+  trace("end\n");
 }
 
 void wayland_window_commit_buffer(struct wayland_window *win, struct wayland_buffer *buf) {
-  log("%s, begin\n", __func__);
+  uint64_t start;
+  trace("begin\n");
   wayland_window_attach_buffer(win, buf, 0, 0);
-  buf->busy = 1;
+  start = timing_now_ns();
+  wayland_window_flush_damage(win, buf);
+  frame_timing_stage_end(win->timing, FRAME_STAGE_DAMAGE, start);
+  if (wayland_window_has_feedback(win)) {
+    struct wp_presentation_feedback *fb =
+      wp_presentation_feedback(win->surf_manager->g_ctx->presentation,
+                               win->surface);
+    wp_presentation_feedback_add_listener(fb, &wp_feedback_listener, win);
+  }
+  buf->state = BUFFER_BUSY;
   win->buf_manager->index = buf->offset;
+  start = timing_now_ns();
   wl_surface_commit(win->surface);
-  log("%s, end\n", __func__);
+  win->commit_ns = frame_timing_stage_end(win->timing, FRAME_STAGE_COMMIT, start);
+  trace("end\n");
+}
+
+/* drive the display from the event loop instead of wl_display_dispatch */
+static void wl_test_prepare_read(void *data) {
+  struct wayland_window *win = (struct wayland_window *)data;
+  struct wl_display *display = win->surf_manager->g_ctx->display;
+  while (wl_display_prepare_read(display) != 0)
+    wl_display_dispatch_pending(display);
+  if (wl_display_flush(display) < 0 && errno != EAGAIN)
+    err_log("%s: failed to flush the display\n", __func__);
+}
+
+static void wl_test_check_read(void *data, uint32_t revents) {
+  struct wayland_window *win = (struct wayland_window *)data;
+  struct wl_display *display = win->surf_manager->g_ctx->display;
+  if (revents & EPOLLIN) {
+    if (wl_display_read_events(display) < 0)
+      win->should_close = true;
+  } else {
+    wl_display_cancel_read(display);
+    if (revents & (EPOLLERR | EPOLLHUP))
+      win->should_close = true;
+  }
+  if (wl_display_dispatch_pending(display) < 0)
+    win->should_close = true;
+}
+
+static int wl_test_handle_signal(struct event_dispatcher *ed, struct event *ev,
+                                 void *data) {
+  (void)data;
+  log("%s: got signal %lu, closing\n", __func__, (unsigned long)ev->value);
+  event_dispatcher_quit(ed);
+  return 0;
 }
 
-int main(void) {
+static int wl_test_event_loop_setup(struct event_dispatcher *ed,
+                                    struct wayland_window *win) {
+  struct wl_display *display = win->surf_manager->g_ctx->display;
+  int id = event_provide_fd(ed, wl_display_get_fd(display), EPOLLIN);
+  if (id < 0 || event_source_set_hooks(ed, id, wl_test_prepare_read,
+                                       wl_test_check_read, win))
+    return 1;
+  id = event_provide_signal(ed, SIGINT);
+  if (id < 0 || subscribe_event_source(ed, id, wl_test_handle_signal, NULL))
+    return 1;
+  id = event_provide_signal(ed, SIGTERM);
+  if (id < 0 || subscribe_event_source(ed, id, wl_test_handle_signal, NULL))
+    return 1;
+  /* disarmed till a frame callback schedules the next frame */
+  id = event_provide_timer(ed, 0, 0);
+  if (id < 0 || subscribe_event_source(ed, id, wl_test_handle_frame_timer, win))
+    return 1;
+  win->ed = ed;
+  win->frame_timer = id;
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-b buffers(%d-%d)] [-m fifo|mailbox] [-f target fps]\n",
+          prog, BUFFER_CAPS_MIN, BUFFER_CAPS_MAX);
+}
+
+int main(int argc, char **argv) {
   int ret = 0;
+  int opt;
+  int buffer_caps = BUFFER_CAPS_DEFAULT;
+  enum wayland_present_mode present_mode = PRESENT_MODE_FIFO;
+  struct frame_scheduler_config pacing;
+
+  frame_scheduler_config_default(&pacing);
+  while ((opt = getopt(argc, argv, "b:m:f:")) != -1) {
+    switch (opt) {
+    case 'b':
+      buffer_caps = atoi(optarg);
+      break;
+    case 'm':
+      if (strcmp(optarg, "mailbox") == 0) {
+        present_mode = PRESENT_MODE_MAILBOX;
+      } else if (strcmp(optarg, "fifo") == 0) {
+        present_mode = PRESENT_MODE_FIFO;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'f':
+      pacing.target_fps = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (buffer_caps < BUFFER_CAPS_MIN || buffer_caps > BUFFER_CAPS_MAX ||
+      pacing.target_fps < 0.0) {
+    usage(argv[0]);
+    return 1;
+  }
+  /* before the trace flusher and tile workers, they inherit the mask */
+  if (event_block_signal(SIGINT) || event_block_signal(SIGTERM))
+    return 1;
+  /* the trace points are formatted off the frame loop */
+  if (trace_start_from_env())
+    return 1;
+  atexit(trace_stop);
+
   struct wayland_context *ctx = wayland_ctx_make();
   if (!ctx)
     return 1;
@@ -572,7 +1239,7 @@ int main(void) {
 
   struct wayland_window *win = wayland_surface_manager_create_window(
       surf_manager, "wl-test", HEIGHT, WIDTH, WIDTH * 4,
-								     WL_SHM_FORMAT_XRGB8888);
+      WL_SHM_FORMAT_XRGB8888, buffer_caps, present_mode, &pacing);
   if (!win) {
     wayland_surface_manager_free_window(&win);
     wayland_ctx_cleanup(ctx);
@@ -580,16 +1247,28 @@ int main(void) {
     return 1;
   }
 
-  struct wayland_buffer *buf = wayland_window_find_a_free_buffer(win);
-  if (!buf) {
+  struct event_dispatcher *ed = event_dispatcher_make();
+  if (!ed || wl_test_event_loop_setup(ed, win)) {
+    event_dispatcher_free(&ed);
     wayland_surface_manager_free_window(&win);
     wayland_ctx_cleanup(ctx);
     wayland_ctx_free((void**)&ctx);
     return 1;
   }
-  wayland_window_commit_buffer(win, buf);
-  while (wayland_ctx_poll_events(ctx) > 0) {
+
+  /* what prefaulting the pool saves shows here */
+  long faults = shm_page_faults();
+  wayland_window_produce_frame(win);
+  wayland_window_present_frame(win);
+  log("%s: first frame: %ld page faults\n", __func__,
+      shm_page_faults() - faults);
+  while (!win->should_close && !event_dispatcher_should_quit(ed)) {
+    if (event_dispatcher_run_once(ed, -1) < 0 && errno != EINTR)
+      break;
   }
+  event_dispatcher_free(&ed);
+  buffer_manager_print_stats(win->buf_manager);
+  wayland_surface_manager_free_window(&win);
   wayland_ctx_cleanup(ctx);
   wayland_ctx_free((void**)&ctx);
   log("%s, end\n", __func__);
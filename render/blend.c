@@ -0,0 +1,433 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "blend.h"
+#include "cpu.h"
+
+/*
+ * The vector kernels take the op as a constant: the per op loops are
+ * inlined copies of one body, the switch on op is out of the loop.
+ */
+struct blend_kernels {
+  const char *name;
+  void (*span)(enum blend_op op, uint32_t *dst, const uint32_t *src,
+               int count);
+  void (*span_solid)(enum blend_op op, uint32_t *dst, uint32_t color,
+                     const uint8_t *mask, int count);
+};
+
+/* x / 255 rounded to the nearest, exact for x in [0, 255 * 255] */
+static inline uint32_t blend_div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t blend_min255(uint32_t x) { return x > 255 ? 255 : x; }
+
+/* scalar kernels, the reference the others must match */
+static uint32_t blend_pixel(enum blend_op op, uint32_t s, uint32_t d) {
+  uint32_t sa = s >> 24;
+  uint32_t out = 0;
+
+  if (op == BLEND_OP_SRC)
+    return s;
+  for (int shift = 0; shift < 32; shift += 8) {
+    uint32_t sc = (s >> shift) & 0xFF;
+    uint32_t dc = (d >> shift) & 0xFF;
+    uint32_t c = 0;
+    switch (op) {
+    case BLEND_OP_SRC:
+      c = sc;
+      break;
+    case BLEND_OP_SRC_OVER:
+      c = blend_min255(sc + blend_div255(dc * (255 - sa)));
+      break;
+    case BLEND_OP_DST_IN:
+      c = blend_div255(dc * sa);
+      break;
+    case BLEND_OP_ADD:
+      c = blend_min255(sc + dc);
+      break;
+    }
+    out |= c << shift;
+  }
+  return out;
+}
+
+/* color * m / 255 on every channel */
+static uint32_t blend_coverage(uint32_t color, uint32_t m) {
+  uint32_t out = 0;
+
+  if (m == 255)
+    return color;
+  for (int shift = 0; shift < 32; shift += 8)
+    out |= blend_div255(((color >> shift) & 0xFF) * m) << shift;
+  return out;
+}
+
+static void blend_span_scalar(enum blend_op op, uint32_t *dst,
+                              const uint32_t *src, int count) {
+  for (int i = 0; i < count; i++)
+    dst[i] = blend_pixel(op, src[i], dst[i]);
+}
+
+static void blend_span_solid_scalar(enum blend_op op, uint32_t *dst,
+                                    uint32_t color, const uint8_t *mask,
+                                    int count) {
+  for (int i = 0; i < count; i++) {
+    uint32_t s = mask ? blend_coverage(color, mask[i]) : color;
+    dst[i] = blend_pixel(op, s, dst[i]);
+  }
+}
+
+static const struct blend_kernels blend_kernels_scalar = {
+  .name = "scalar",
+  .span = blend_span_scalar,
+  .span_solid = blend_span_solid_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/* SSE4.1 kernels, 4 pixels at a time */
+#define BLEND_SSE41 __attribute__((target("sse4.1"), always_inline)) inline
+
+static BLEND_SSE41 __m128i blend_div255_sse41(__m128i x) {
+  x = _mm_add_epi16(x, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* d * m / 255 per byte, m holds the factor of each byte */
+static BLEND_SSE41 __m128i blend_mul_sse41(__m128i d, __m128i m) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero),
+                               _mm_unpacklo_epi8(m, zero));
+  __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero),
+                               _mm_unpackhi_epi8(m, zero));
+  return _mm_packus_epi16(blend_div255_sse41(lo), blend_div255_sse41(hi));
+}
+
+/* the alpha of each pixel in all of its bytes */
+static BLEND_SSE41 __m128i blend_alpha_sse41(__m128i s) {
+  return _mm_shuffle_epi8(s, _mm_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11,
+                                           11, 11, 15, 15, 15, 15));
+}
+
+static BLEND_SSE41 __m128i blend_op_sse41(enum blend_op op, __m128i s,
+                                          __m128i d) {
+  switch (op) {
+  case BLEND_OP_SRC:
+    return s;
+  case BLEND_OP_SRC_OVER:
+    return _mm_adds_epu8(s, blend_mul_sse41(d, _mm_xor_si128(
+                                blend_alpha_sse41(s), _mm_set1_epi8(-1))));
+  case BLEND_OP_DST_IN:
+    return blend_mul_sse41(d, blend_alpha_sse41(s));
+  case BLEND_OP_ADD:
+    return _mm_adds_epu8(s, d);
+  }
+  return s;
+}
+
+static BLEND_SSE41 void blend_span_op_sse41(enum blend_op op, uint32_t *dst,
+                                            const uint32_t *src, int count) {
+  __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i d;
+    /* transparent and opaque runs of SRC_OVER skip the math */
+    if (op == BLEND_OP_SRC_OVER) {
+      if (_mm_testz_si128(s, s))
+        continue;
+      if (_mm_testc_si128(s, alpha)) {
+        _mm_storeu_si128((__m128i *)(dst + i), s);
+        continue;
+      }
+    }
+    d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), blend_op_sse41(op, s, d));
+  }
+  for (; i < count; i++)
+    dst[i] = blend_pixel(op, src[i], dst[i]);
+}
+
+__attribute__((target("sse4.1")))
+static void blend_span_sse41(enum blend_op op, uint32_t *dst,
+                             const uint32_t *src, int count) {
+  switch (op) {
+  case BLEND_OP_SRC:
+    memmove(dst, src, (size_t)count * 4);
+    break;
+  case BLEND_OP_SRC_OVER:
+    blend_span_op_sse41(BLEND_OP_SRC_OVER, dst, src, count);
+    break;
+  case BLEND_OP_DST_IN:
+    blend_span_op_sse41(BLEND_OP_DST_IN, dst, src, count);
+    break;
+  case BLEND_OP_ADD:
+    blend_span_op_sse41(BLEND_OP_ADD, dst, src, count);
+    break;
+  }
+}
+
+static BLEND_SSE41 void blend_span_solid_op_sse41(enum blend_op op,
+                                                  uint32_t *dst,
+                                                  uint32_t color,
+                                                  const uint8_t *mask,
+                                                  int count) {
+  __m128i c = _mm_set1_epi32((int)color);
+  __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12,
+                                 12, 12);
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i s = c;
+    __m128i d;
+    if (mask) {
+      int32_t m4;
+      memcpy(&m4, mask + i, 4);
+      /* no coverage leaves SRC_OVER and ADD nothing to do */
+      if (!m4 && (op == BLEND_OP_SRC_OVER || op == BLEND_OP_ADD))
+        continue;
+      if (m4 != -1) {
+        __m128i m = _mm_shuffle_epi8(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(m4)),
+                                     spread);
+        s = blend_mul_sse41(c, m);
+      }
+    }
+    d = _mm_loadu_si128((const __m128i *)(dst + i));
+    _mm_storeu_si128((__m128i *)(dst + i), blend_op_sse41(op, s, d));
+  }
+  for (; i < count; i++) {
+    uint32_t s = mask ? blend_coverage(color, mask[i]) : color;
+    dst[i] = blend_pixel(op, s, dst[i]);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void blend_span_solid_sse41(enum blend_op op, uint32_t *dst,
+                                   uint32_t color, const uint8_t *mask,
+                                   int count) {
+  switch (op) {
+  case BLEND_OP_SRC:
+    blend_span_solid_op_sse41(BLEND_OP_SRC, dst, color, mask, count);
+    break;
+  case BLEND_OP_SRC_OVER:
+    blend_span_solid_op_sse41(BLEND_OP_SRC_OVER, dst, color, mask, count);
+    break;
+  case BLEND_OP_DST_IN:
+    blend_span_solid_op_sse41(BLEND_OP_DST_IN, dst, color, mask, count);
+    break;
+  case BLEND_OP_ADD:
+    blend_span_solid_op_sse41(BLEND_OP_ADD, dst, color, mask, count);
+    break;
+  }
+}
+
+static const struct blend_kernels blend_kernels_sse41 = {
+  .name = "sse4.1",
+  .span = blend_span_sse41,
+  .span_solid = blend_span_solid_sse41,
+};
+
+/* AVX2 kernels, the same with 8 pixels */
+#define BLEND_AVX2 __attribute__((target("avx2"), always_inline)) inline
+
+static BLEND_AVX2 __m256i blend_div255_avx2(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+static BLEND_AVX2 __m256i blend_mul_avx2(__m256i d, __m256i m) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero),
+                                  _mm256_unpacklo_epi8(m, zero));
+  __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero),
+                                  _mm256_unpackhi_epi8(m, zero));
+  return _mm256_packus_epi16(blend_div255_avx2(lo), blend_div255_avx2(hi));
+}
+
+static BLEND_AVX2 __m256i blend_alpha_avx2(__m256i s) {
+  return _mm256_shuffle_epi8(s, _mm256_setr_epi8(
+      3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+      3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15));
+}
+
+static BLEND_AVX2 __m256i blend_op_avx2(enum blend_op op, __m256i s,
+                                        __m256i d) {
+  switch (op) {
+  case BLEND_OP_SRC:
+    return s;
+  case BLEND_OP_SRC_OVER:
+    return _mm256_adds_epu8(s, blend_mul_avx2(d, _mm256_xor_si256(
+                                blend_alpha_avx2(s), _mm256_set1_epi8(-1))));
+  case BLEND_OP_DST_IN:
+    return blend_mul_avx2(d, blend_alpha_avx2(s));
+  case BLEND_OP_ADD:
+    return _mm256_adds_epu8(s, d);
+  }
+  return s;
+}
+
+static BLEND_AVX2 void blend_span_op_avx2(enum blend_op op, uint32_t *dst,
+                                          const uint32_t *src, int count) {
+  __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i d;
+    if (op == BLEND_OP_SRC_OVER) {
+      if (_mm256_testz_si256(s, s))
+        continue;
+      if (_mm256_testc_si256(s, alpha)) {
+        _mm256_storeu_si256((__m256i *)(dst + i), s);
+        continue;
+      }
+    }
+    d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), blend_op_avx2(op, s, d));
+  }
+  for (; i < count; i++)
+    dst[i] = blend_pixel(op, src[i], dst[i]);
+}
+
+__attribute__((target("avx2")))
+static void blend_span_avx2(enum blend_op op, uint32_t *dst,
+                            const uint32_t *src, int count) {
+  switch (op) {
+  case BLEND_OP_SRC:
+    memmove(dst, src, (size_t)count * 4);
+    break;
+  case BLEND_OP_SRC_OVER:
+    blend_span_op_avx2(BLEND_OP_SRC_OVER, dst, src, count);
+    break;
+  case BLEND_OP_DST_IN:
+    blend_span_op_avx2(BLEND_OP_DST_IN, dst, src, count);
+    break;
+  case BLEND_OP_ADD:
+    blend_span_op_avx2(BLEND_OP_ADD, dst, src, count);
+    break;
+  }
+}
+
+static BLEND_AVX2 void blend_span_solid_op_avx2(enum blend_op op,
+                                                uint32_t *dst, uint32_t color,
+                                                const uint8_t *mask,
+                                                int count) {
+  __m256i c = _mm256_set1_epi32((int)color);
+  __m256i spread = _mm256_setr_epi8(
+      0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12,
+      0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12);
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i s = c;
+    __m256i d;
+    if (mask) {
+      int64_t m8;
+      memcpy(&m8, mask + i, 8);
+      if (!m8 && (op == BLEND_OP_SRC_OVER || op == BLEND_OP_ADD))
+        continue;
+      if (m8 != -1) {
+        __m128i m8v = _mm_loadl_epi64((const __m128i *)(mask + i));
+        __m256i m =
+          _mm256_shuffle_epi8(_mm256_cvtepu8_epi32(m8v), spread);
+        s = blend_mul_avx2(c, m);
+      }
+    }
+    d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), blend_op_avx2(op, s, d));
+  }
+  for (; i < count; i++) {
+    uint32_t s = mask ? blend_coverage(color, mask[i]) : color;
+    dst[i] = blend_pixel(op, s, dst[i]);
+  }
+}
+
+__attribute__((target("avx2")))
+static void blend_span_solid_avx2(enum blend_op op, uint32_t *dst,
+                                  uint32_t color, const uint8_t *mask,
+                                  int count) {
+  switch (op) {
+  case BLEND_OP_SRC:
+    blend_span_solid_op_avx2(BLEND_OP_SRC, dst, color, mask, count);
+    break;
+  case BLEND_OP_SRC_OVER:
+    blend_span_solid_op_avx2(BLEND_OP_SRC_OVER, dst, color, mask, count);
+    break;
+  case BLEND_OP_DST_IN:
+    blend_span_solid_op_avx2(BLEND_OP_DST_IN, dst, color, mask, count);
+    break;
+  case BLEND_OP_ADD:
+    blend_span_solid_op_avx2(BLEND_OP_ADD, dst, color, mask, count);
+    break;
+  }
+}
+
+static const struct blend_kernels blend_kernels_avx2 = {
+  .name = "avx2",
+  .span = blend_span_avx2,
+  .span_solid = blend_span_solid_avx2,
+};
+#endif
+
+static const struct blend_kernels *g_blend_kernels = NULL;
+
+void blend_kernels_select(unsigned int features) {
+  const struct blend_kernels *k = &blend_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  if (features & CPU_FEATURE_AVX2)
+    k = &blend_kernels_avx2;
+  else if (features & CPU_FEATURE_SSE41)
+    k = &blend_kernels_sse41;
+#endif
+  __atomic_store_n(&g_blend_kernels, k, __ATOMIC_RELEASE);
+}
+
+static const struct blend_kernels *blend_kernels_get(void) {
+  const struct blend_kernels *k =
+    __atomic_load_n(&g_blend_kernels, __ATOMIC_ACQUIRE);
+  if (!k) {
+    blend_kernels_select(cpu_features());
+    k = __atomic_load_n(&g_blend_kernels, __ATOMIC_ACQUIRE);
+  }
+  return k;
+}
+
+const char *blend_kernels_name(void) { return blend_kernels_get()->name; }
+
+const char *blend_op_name(enum blend_op op) {
+  switch (op) {
+  case BLEND_OP_SRC:
+    return "src";
+  case BLEND_OP_SRC_OVER:
+    return "src_over";
+  case BLEND_OP_DST_IN:
+    return "dst_in";
+  case BLEND_OP_ADD:
+    return "add";
+  }
+  return "unknown";
+}
+
+void blend_span(enum blend_op op, uint32_t *dst, const uint32_t *src,
+                int count) {
+  if (count > 0)
+    blend_kernels_get()->span(op, dst, src, count);
+}
+
+void blend_span_solid(enum blend_op op, uint32_t *dst, uint32_t color,
+                      const uint8_t *mask, int count) {
+  if (count > 0)
+    blend_kernels_get()->span_solid(op, dst, color, mask, count);
+}
+
+uint32_t blend_premultiply(uint32_t argb) {
+  uint32_t a = argb >> 24;
+  return (a << 24) | (blend_coverage(argb, a) & 0x00FFFFFF);
+}
@@ -0,0 +1,37 @@
+#ifndef _BLEND_H_
+#define _BLEND_H_
+
+#include <stdint.h>
+
+/*
+ * Porter-Duff compositing of premultiplied ARGB8888 spans. Every channel
+ * is rounded exactly, x / 255 to the nearest, so the vector kernels give
+ * the same pixels as the scalar ones. The variant (scalar, SSE4.1 or AVX2)
+ * is picked from cpuid the first time, blend_kernels_select() overrides it.
+ */
+
+enum blend_op {
+  BLEND_OP_SRC, // s
+  BLEND_OP_SRC_OVER, // s + d (1 - sa)
+  BLEND_OP_DST_IN, // d sa
+  BLEND_OP_ADD, // s + d, saturated
+};
+
+void blend_kernels_select(unsigned int features);
+const char *blend_kernels_name(void);
+const char *blend_op_name(enum blend_op op);
+
+/* dst[i] = op(src[i], dst[i]) for i in [0, count) */
+void blend_span(enum blend_op op, uint32_t *dst, const uint32_t *src,
+                int count);
+/*
+ * dst[i] = op(color * mask[i] / 255, dst[i]), the mask is the coverage of
+ * each pixel, NULL covers them all
+ */
+void blend_span_solid(enum blend_op op, uint32_t *dst, uint32_t color,
+                      const uint8_t *mask, int count);
+
+/* premultiply a straight alpha color */
+uint32_t blend_premultiply(uint32_t argb);
+
+#endif
@@ -0,0 +1,383 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "../utils/utils.h"
+#include "blit.h"
+#include "cpu.h"
+
+/*
+ * Source rows are converted to premultiplied ARGB8888 once, into line
+ * buffers covering the columns the blit reads, and filtered from there.
+ * Bilinear filtering lerps the two rows around the sample first, then
+ * the two columns, both with 8 bit weights:
+ *
+ *   (a (256 - w) + b w + 128) >> 8
+ */
+struct blit_kernels {
+  const char *name;
+  void (*lerp_rows)(uint32_t *out, const uint32_t *a, const uint32_t *b,
+                    int w, int count);
+  /* out[i] is the lerp of line[idx[i]] and line[idx[i] + 1] by w[i] */
+  void (*lerp_cols)(uint32_t *out, const uint32_t *line, const int32_t *idx,
+                    const uint8_t *w, int count);
+};
+
+static inline uint32_t blit_lerp_pixel(uint32_t a, uint32_t b, uint32_t w) {
+  uint32_t out = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    uint32_t ca = (a >> shift) & 0xFF;
+    uint32_t cb = (b >> shift) & 0xFF;
+    out |= ((ca * (256 - w) + cb * w + 128) >> 8) << shift;
+  }
+  return out;
+}
+
+/* scalar kernels */
+static void blit_lerp_rows_scalar(uint32_t *out, const uint32_t *a,
+                                  const uint32_t *b, int w, int count) {
+  for (int i = 0; i < count; i++)
+    out[i] = blit_lerp_pixel(a[i], b[i], w);
+}
+
+static void blit_lerp_cols_scalar(uint32_t *out, const uint32_t *line,
+                                  const int32_t *idx, const uint8_t *w,
+                                  int count) {
+  for (int i = 0; i < count; i++)
+    out[i] = blit_lerp_pixel(line[idx[i]], line[idx[i] + 1], w[i]);
+}
+
+static const struct blit_kernels blit_kernels_scalar = {
+  .name = "scalar",
+  .lerp_rows = blit_lerp_rows_scalar,
+  .lerp_cols = blit_lerp_cols_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/* SSE2 kernels */
+__attribute__((target("sse2")))
+static void blit_lerp_rows_sse2(uint32_t *out, const uint32_t *a,
+                                const uint32_t *b, int w, int count) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i wa = _mm_set1_epi16((short)(256 - w));
+  __m128i wb = _mm_set1_epi16((short)w);
+  __m128i half = _mm_set1_epi16(128);
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i lo = _mm_add_epi16(
+      _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+      _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+    __m128i hi = _mm_add_epi16(
+      _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+      _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+  }
+  for (; i < count; i++)
+    out[i] = blit_lerp_pixel(a[i], b[i], w);
+}
+
+/* the two pixels of a column pair side by side, weighted and folded */
+__attribute__((target("sse2")))
+static inline __m128i blit_lerp_pair_sse2(const uint32_t *pair, int w) {
+  __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pair),
+                                _mm_setzero_si128());
+  __m128i wv = _mm_set_epi16((short)w, (short)w, (short)w, (short)w,
+                             (short)(256 - w), (short)(256 - w),
+                             (short)(256 - w), (short)(256 - w));
+  v = _mm_mullo_epi16(v, wv);
+  v = _mm_add_epi16(v, _mm_srli_si128(v, 8));
+  return _mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(128)), 8);
+}
+
+__attribute__((target("sse2")))
+static void blit_lerp_cols_sse2(uint32_t *out, const uint32_t *line,
+                                const int32_t *idx, const uint8_t *w,
+                                int count) {
+  int i = 0;
+
+  for (; i + 2 <= count; i += 2) {
+    __m128i p0 = blit_lerp_pair_sse2(line + idx[i], w[i]);
+    __m128i p1 = blit_lerp_pair_sse2(line + idx[i + 1], w[i + 1]);
+    _mm_storel_epi64((__m128i *)(out + i),
+                     _mm_packus_epi16(_mm_unpacklo_epi64(p0, p1),
+                                      _mm_setzero_si128()));
+  }
+  for (; i < count; i++)
+    out[i] = blit_lerp_pixel(line[idx[i]], line[idx[i] + 1], w[i]);
+}
+
+static const struct blit_kernels blit_kernels_sse2 = {
+  .name = "sse2",
+  .lerp_rows = blit_lerp_rows_sse2,
+  .lerp_cols = blit_lerp_cols_sse2,
+};
+
+/* AVX2 kernels, the columns are gathers, they stay on SSE2 */
+__attribute__((target("avx2")))
+static void blit_lerp_rows_avx2(uint32_t *out, const uint32_t *a,
+                                const uint32_t *b, int w, int count) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i wa = _mm256_set1_epi16((short)(256 - w));
+  __m256i wb = _mm256_set1_epi16((short)w);
+  __m256i half = _mm256_set1_epi16(128);
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i lo = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), wa),
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), wb));
+    __m256i hi = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), wa),
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), wb));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, half), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, half), 8);
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_packus_epi16(lo, hi));
+  }
+  for (; i < count; i++)
+    out[i] = blit_lerp_pixel(a[i], b[i], w);
+}
+
+static const struct blit_kernels blit_kernels_avx2 = {
+  .name = "avx2",
+  .lerp_rows = blit_lerp_rows_avx2,
+  .lerp_cols = blit_lerp_cols_sse2,
+};
+#endif
+
+static const struct blit_kernels *g_blit_kernels = NULL;
+
+void blit_kernels_select(unsigned int features) {
+  const struct blit_kernels *k = &blit_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  if (features & CPU_FEATURE_AVX2)
+    k = &blit_kernels_avx2;
+  else if (features & CPU_FEATURE_SSE2)
+    k = &blit_kernels_sse2;
+#endif
+  __atomic_store_n(&g_blit_kernels, k, __ATOMIC_RELEASE);
+}
+
+static const struct blit_kernels *blit_kernels_get(void) {
+  const struct blit_kernels *k =
+    __atomic_load_n(&g_blit_kernels, __ATOMIC_ACQUIRE);
+  if (!k) {
+    blit_kernels_select(cpu_features());
+    k = __atomic_load_n(&g_blit_kernels, __ATOMIC_ACQUIRE);
+  }
+  return k;
+}
+
+const char *blit_kernels_name(void) { return blit_kernels_get()->name; }
+
+/* count pixels of row y from column x, as premultiplied ARGB8888 */
+static void blit_fetch(const struct blit_image *image, int y, int x,
+                       int count, uint32_t *out) {
+  const uint8_t *row =
+    (const uint8_t *)image->pixels + (size_t)y * image->stride;
+  const uint32_t *p32 = (const uint32_t *)row + x;
+  const uint16_t *p16 = (const uint16_t *)row + x;
+
+  switch (image->format) {
+  case PIXEL_FORMAT_XRGB8888:
+    for (int i = 0; i < count; i++)
+      out[i] = p32[i] | 0xFF000000;
+    break;
+  case PIXEL_FORMAT_ARGB8888:
+    memcpy(out, p32, (size_t)count * 4);
+    break;
+  case PIXEL_FORMAT_RGB565:
+    pixels_unpack_rgb565(out, p16, count);
+    break;
+  case PIXEL_FORMAT_RGBA8888:
+    for (int i = 0; i < count; i++) {
+      uint32_t v = p32[i];
+      out[i] = blend_premultiply((v & 0xFF00FF00) | (v & 0xFF) << 16 |
+                                 (v >> 16 & 0xFF));
+    }
+    break;
+  }
+}
+
+struct blit_rows {
+  uint32_t *line[2]; // converted source rows, with a pad pixel
+  int y[2]; // the source row of each line, -1 if none
+};
+
+/* line i holds source row y, converted if it is not there yet */
+static uint32_t *blit_rows_get(struct blit_rows *rows, int i,
+                               const struct blit_image *image, int y, int x,
+                               int count) {
+  if (rows->y[i] != y) {
+    if (rows->y[!i] == y) {
+      uint32_t *t = rows->line[i];
+      rows->line[i] = rows->line[!i];
+      rows->line[!i] = t;
+      rows->y[!i] = rows->y[i];
+    } else {
+      blit_fetch(image, y, x, count, rows->line[i]);
+      rows->line[i][count] = rows->line[i][count - 1];
+    }
+    rows->y[i] = y;
+  }
+  return rows->line[i];
+}
+
+/* the first source pixel of a destination one and the weight of the next */
+static int blit_sample(int64_t center, int size, enum blit_filter filter,
+                       uint8_t *w) {
+  int64_t pos = center;
+  int i;
+
+  *w = 0;
+  if (filter == BLIT_FILTER_BILINEAR) {
+    pos -= 0x8000;
+    if (pos < 0)
+      pos = 0;
+    *w = (uint8_t)(pos >> 8);
+  }
+  i = (int)(pos >> 16);
+  if (i >= size - 1) {
+    i = size - 1;
+    *w = 0;
+  }
+  return i;
+}
+
+/*
+ * The row buffers of a blit, one per thread and kept between blits: tile
+ * workers replaying a display list blit once per tile and image, they
+ * would all wait on the allocator otherwise. Freed when the thread exits.
+ */
+struct blit_scratch {
+  size_t size;
+  uint8_t mem[];
+};
+
+static pthread_key_t blit_scratch_key;
+static pthread_once_t blit_scratch_once = PTHREAD_ONCE_INIT;
+static int blit_scratch_ready = 0;
+
+static void blit_scratch_init(void) {
+  if (pthread_key_create(&blit_scratch_key, free))
+    err_log("%s: failed to create the scratch key\n", __func__);
+  else
+    blit_scratch_ready = 1;
+}
+
+/* size bytes for this thread, NULL if they can not be allocated */
+static uint8_t *blit_scratch_get(size_t size) {
+  struct blit_scratch *scratch, *grown;
+
+  pthread_once(&blit_scratch_once, blit_scratch_init);
+  if (!blit_scratch_ready)
+    return NULL;
+  scratch = pthread_getspecific(blit_scratch_key);
+  if (scratch && scratch->size >= size)
+    return scratch->mem;
+  grown = malloc(sizeof(struct blit_scratch) + size);
+  if (!grown || pthread_setspecific(blit_scratch_key, grown)) {
+    free(grown);
+    return NULL;
+  }
+  free(scratch);
+  grown->size = size;
+  return grown->mem;
+}
+
+void blit_image(struct draw_surface *surf, int x, int y, int width,
+                int height, const struct blit_image *image, int sx, int sy,
+                int sw, int sh, enum blit_filter filter, enum blend_op op) {
+  const struct blit_kernels *k = blit_kernels_get();
+  int sx1 = sx + sw < image->width ? sx + sw : image->width;
+  int sy1 = sy + sh < image->height ? sy + sh : image->height;
+  int x0 = x > surf->clip.x0 ? x : surf->clip.x0;
+  int y0 = y > surf->clip.y0 ? y : surf->clip.y0;
+  int x1 = x + width < surf->clip.x1 ? x + width : surf->clip.x1;
+  int y1 = y + height < surf->clip.y1 ? y + height : surf->clip.y1;
+  int64_t xstep, ystep;
+  struct blit_rows rows = {.y = {-1, -1}};
+  int32_t *idx;
+  uint8_t *wx;
+  uint32_t *out, *vline, *tmp;
+  int n, xa, range;
+  int rgb565 = surf->format == PIXEL_FORMAT_RGB565;
+  uint8_t *mem;
+  uint8_t unused;
+
+  sx = sx > 0 ? sx : 0;
+  sy = sy > 0 ? sy : 0;
+  sw = sx1 - sx;
+  sh = sy1 - sy;
+  if (width <= 0 || height <= 0 || sw <= 0 || sh <= 0 || x0 >= x1 ||
+      y0 >= y1)
+    return;
+  xstep = ((int64_t)sw << 16) / width;
+  ystep = ((int64_t)sh << 16) / height;
+  n = x1 - x0;
+  /* the source columns the clipped rows read, one more for the filter */
+  xa = blit_sample((x0 - x) * xstep + xstep / 2, sw, filter, &unused);
+  range = blit_sample((x1 - 1 - x) * xstep + xstep / 2, sw, filter,
+                      &unused) + 2 - xa;
+  if (xa + range > sw)
+    range = sw - xa;
+  /* a 565 surface is blended in a converted copy of its row */
+  mem = blit_scratch_get((size_t)n * (4 + 4 + 4 * rgb565 + 1) +
+                         (size_t)(range + 1) * 4 * 3);
+  if (!mem) {
+    err_log("%s: no enough memory\n", __func__);
+    return;
+  }
+  out = (uint32_t *)mem;
+  tmp = out + n;
+  idx = (int32_t *)(tmp + n * rgb565);
+  rows.line[0] = (uint32_t *)(idx + n);
+  rows.line[1] = rows.line[0] + range + 1;
+  vline = rows.line[1] + range + 1;
+  wx = (uint8_t *)(vline + range + 1);
+  for (int i = 0; i < n; i++)
+    idx[i] = blit_sample((x0 - x + i) * xstep + xstep / 2, sw, filter,
+                         &wx[i]) - xa;
+
+  for (int row = y0; row < y1; row++) {
+    uint8_t *base = (uint8_t *)surf->pixels + (size_t)row * surf->stride;
+    uint32_t *dst = rgb565 ? tmp : (uint32_t *)base + x0;
+    uint8_t wy;
+    int sy0 = blit_sample((row - y) * ystep + ystep / 2, sh, filter, &wy);
+    uint32_t *a = blit_rows_get(&rows, 0, image, sy + sy0, sx + xa, range);
+    uint32_t *line = a;
+
+    if (wy) {
+      uint32_t *b = blit_rows_get(&rows, 1, image, sy + sy0 + 1, sx + xa,
+                                  range);
+      k->lerp_rows(vline, a, b, wy, range + 1);
+      line = vline;
+    }
+    if (filter == BLIT_FILTER_BILINEAR && xstep != 0x10000) {
+      k->lerp_cols(out, line, idx, wx, n);
+    } else if (xstep == 0x10000) {
+      /* unscaled columns, the line is the row already */
+      memcpy(out, line + idx[0], (size_t)n * 4);
+    } else {
+      for (int i = 0; i < n; i++)
+        out[i] = line[idx[i]];
+    }
+    if (rgb565 && op != BLEND_OP_SRC)
+      pixels_unpack_rgb565(dst, (uint16_t *)base + x0, n);
+    blend_span(op, dst, out, n);
+    if (rgb565)
+      pixels_pack_rgb565((uint16_t *)base + x0, dst, n, x0, row,
+                         surf->dither);
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef _BLIT_H_
+#define _BLIT_H_
+
+#include <stdint.h>
+
+#include "blend.h"
+#include "draw.h"
+#include "format.h"
+
+/*
+ * Images blitted into a draw surface, scaled and converted to the
+ * premultiplied ARGB8888 of the surface on the way. The source is only
+ * read, rows may be padded, so an image can be used where it is mapped.
+ * Source positions step in 16.16 fixed point from the center of each
+ * destination pixel, a clipped blit samples what the whole one would.
+ */
+
+enum blit_filter {
+  BLIT_FILTER_NEAREST,
+  BLIT_FILTER_BILINEAR, // the edge pixels of the source rect are repeated
+};
+
+struct blit_image {
+  const void *pixels;
+  int stride; // in bytes
+  int width;
+  int height;
+  enum pixel_format format;
+};
+
+/* the variant (scalar, SSE2 or AVX2) of the filter loops */
+void blit_kernels_select(unsigned int features);
+const char *blit_kernels_name(void);
+
+/*
+ * the source rect (sx, sy, sw, sh) of the image, clipped to it, stretched
+ * over the destination rect (x, y, width, height) and composited with op
+ */
+void blit_image(struct draw_surface *surf, int x, int y, int width,
+                int height, const struct blit_image *image, int sx, int sy,
+                int sw, int sh, enum blit_filter filter, enum blend_op op);
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+static uint64_t xgetbv0(void) {
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx << 32) | eax;
+}
+
+static unsigned int cpu_probe(void) {
+  unsigned int eax, ebx, ecx, edx;
+  unsigned int features = 0;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  if (edx & bit_SSE2)
+    features |= CPU_FEATURE_SSE2;
+  if (ecx & bit_SSE4_1)
+    features |= CPU_FEATURE_SSE41;
+  /* AVX2 also needs the OS to save the ymm state (OSXSAVE + XCR0) */
+  if ((ecx & bit_OSXSAVE) && (xgetbv0() & 0x6) == 0x6 &&
+      __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2))
+    features |= CPU_FEATURE_AVX2;
+  return features;
+}
+#else
+static unsigned int cpu_probe(void) { return 0; }
+#endif
+
+unsigned int cpu_features(void) {
+  static int probed = 0;
+  static unsigned int features = 0;
+
+  if (!__atomic_load_n(&probed, __ATOMIC_ACQUIRE)) {
+    unsigned int f = cpu_probe();
+    /* DRAW_ENGINE_CPU_MASK restricts the kernels, e.g. 0 forces scalar */
+    const char *mask = getenv("DRAW_ENGINE_CPU_MASK");
+    if (mask && *mask)
+      f &= (unsigned int)strtoul(mask, NULL, 0);
+    __atomic_store_n(&features, f, __ATOMIC_RELAXED);
+    __atomic_store_n(&probed, 1, __ATOMIC_RELEASE);
+  }
+  return __atomic_load_n(&features, __ATOMIC_RELAXED);
+}
+
+size_t cpu_cache_size(void) {
+  static size_t size = 0;
+  size_t s = __atomic_load_n(&size, __ATOMIC_RELAXED);
+
+  if (!s) {
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l3 > 0)
+      s = l3;
+    else if (l2 > 0)
+      s = l2;
+    else
+      s = 8 << 20;
+    __atomic_store_n(&size, s, __ATOMIC_RELAXED);
+  }
+  return s;
+}
@@ -0,0 +1,17 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <stddef.h>
+
+enum cpu_feature {
+  CPU_FEATURE_SSE2 = 1 << 0,
+  CPU_FEATURE_SSE41 = 1 << 1,
+  CPU_FEATURE_AVX2 = 1 << 2,
+};
+
+/* bitmask of enum cpu_feature, probed once with cpuid */
+unsigned int cpu_features(void);
+/* size of the last level cache in bytes, a guess if it can't be queried */
+size_t cpu_cache_size(void);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "damage.h"
+
+static int64_t rect_area(const struct damage_rect *r) {
+  return (int64_t)r->width * r->height;
+}
+
+static bool rect_contains(const struct damage_rect *outer,
+                          const struct damage_rect *inner) {
+  return inner->x >= outer->x && inner->y >= outer->y &&
+         inner->x + inner->width <= outer->x + outer->width &&
+         inner->y + inner->height <= outer->y + outer->height;
+}
+
+static struct damage_rect rect_union(const struct damage_rect *a,
+                                     const struct damage_rect *b) {
+  struct damage_rect u;
+  int x1 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+  int y1 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+  u.x = a->x < b->x ? a->x : b->x;
+  u.y = a->y < b->y ? a->y : b->y;
+  u.width = x1 - u.x;
+  u.height = y1 - u.y;
+  return u;
+}
+
+static int64_t rect_overlap(const struct damage_rect *a,
+                            const struct damage_rect *b) {
+  int x0 = a->x > b->x ? a->x : b->x;
+  int y0 = a->y > b->y ? a->y : b->y;
+  int x1 = a->x + a->width < b->x + b->width ? a->x + a->width : b->x + b->width;
+  int y1 = a->y + a->height < b->y + b->height ? a->y + a->height : b->y + b->height;
+  if (x1 <= x0 || y1 <= y0)
+    return 0;
+  return (int64_t)(x1 - x0) * (y1 - y0);
+}
+
+/* the area the union of a and b covers that neither of them does */
+static int64_t merge_waste(const struct damage_rect *a,
+                           const struct damage_rect *b) {
+  struct damage_rect u = rect_union(a, b);
+  return rect_area(&u) - (rect_area(a) + rect_area(b) - rect_overlap(a, b));
+}
+
+static void damage_region_remove(struct damage_region *region, int i) {
+  region->rects[i] = region->rects[--region->count];
+}
+
+void damage_region_init(struct damage_region *region, int width, int height) {
+  region->count = 0;
+  region->width = width;
+  region->height = height;
+}
+
+void damage_region_clear(struct damage_region *region) { region->count = 0; }
+
+void damage_region_add(struct damage_region *region, int x, int y, int width,
+                       int height) {
+  struct damage_rect r;
+  int x1 = x + width;
+  int y1 = y + height;
+  bool merged;
+
+  /* clip to the surface */
+  if (x < 0)
+    x = 0;
+  if (y < 0)
+    y = 0;
+  if (x1 > region->width)
+    x1 = region->width;
+  if (y1 > region->height)
+    y1 = region->height;
+  if (x1 <= x || y1 <= y)
+    return;
+  r.x = x;
+  r.y = y;
+  r.width = x1 - x;
+  r.height = y1 - y;
+
+  /* absorb every rect the new one covers or sits cheaply next to */
+  do {
+    merged = false;
+    for (int i = 0; i < region->count; i++) {
+      struct damage_rect *cur = &region->rects[i];
+      if (rect_contains(cur, &r))
+        return;
+      if (rect_contains(&r, cur) ||
+          merge_waste(cur, &r) <= (rect_area(cur) + rect_area(&r)) / 4) {
+        r = rect_union(cur, &r);
+        damage_region_remove(region, i);
+        merged = true;
+        break;
+      }
+    }
+  } while (merged);
+
+  if (region->count == DAMAGE_RECTS_MAX) {
+    /* full, fold the new rect into the one it wastes the least with */
+    int best = 0;
+    int64_t best_waste = merge_waste(&region->rects[0], &r);
+    for (int i = 1; i < region->count; i++) {
+      int64_t waste = merge_waste(&region->rects[i], &r);
+      if (waste < best_waste) {
+        best = i;
+        best_waste = waste;
+      }
+    }
+    region->rects[best] = rect_union(&region->rects[best], &r);
+    return;
+  }
+  region->rects[region->count++] = r;
+}
+
+void damage_region_add_all(struct damage_region *region) {
+  region->count = 0;
+  damage_region_add(region, 0, 0, region->width, region->height);
+}
+
+void damage_region_union(struct damage_region *dst,
+                         const struct damage_region *src) {
+  for (int i = 0; i < src->count; i++)
+    damage_region_add(dst, src->rects[i].x, src->rects[i].y,
+                      src->rects[i].width, src->rects[i].height);
+}
+
+bool damage_region_empty(const struct damage_region *region) {
+  return region->count == 0;
+}
+
+uint64_t damage_region_area(const struct damage_region *region) {
+  uint64_t area = 0;
+  for (int i = 0; i < region->count; i++)
+    area += rect_area(&region->rects[i]);
+  return area;
+}
@@ -0,0 +1,41 @@
+#ifndef _DAMAGE_H_
+#define _DAMAGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* the most rects a region keeps before merging the closest ones */
+#define DAMAGE_RECTS_MAX 8
+
+struct damage_rect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+/*
+ * A bounded list of rects covering everything drawn since the last
+ * commit. Rects are clipped to the surface and merged when the union
+ * wastes little area, so the list stays short enough to hand straight to
+ * wl_surface_damage_buffer.
+ */
+struct damage_region {
+  struct damage_rect rects[DAMAGE_RECTS_MAX];
+  int count;
+  int width; // the surface the rects are clipped to
+  int height;
+};
+
+void damage_region_init(struct damage_region *region, int width, int height);
+void damage_region_clear(struct damage_region *region);
+void damage_region_add(struct damage_region *region, int x, int y, int width,
+                       int height);
+void damage_region_add_all(struct damage_region *region);
+void damage_region_union(struct damage_region *dst,
+                         const struct damage_region *src);
+bool damage_region_empty(const struct damage_region *region);
+/* the number of pixels the rects cover, overlaps counted twice */
+uint64_t damage_region_area(const struct damage_region *region);
+
+#endif
@@ -0,0 +1,409 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/utils.h"
+#include "display-list.h"
+#include "fill.h"
+#include "format.h"
+
+#define DISPLAY_LIST_ARENA_MIN (64 * 1024)
+
+enum display_list_op {
+  DISPLAY_LIST_OP_FILL_RECT,
+  DISPLAY_LIST_OP_LINE,
+  DISPLAY_LIST_OP_FILL_CIRCLE,
+  DISPLAY_LIST_OP_FILL_TRIANGLE,
+  DISPLAY_LIST_OP_FILL_CHECKER,
+  DISPLAY_LIST_OP_BLIT,
+};
+
+/* every command starts with it, the arguments of the op follow */
+struct display_list_cmd {
+  uint32_t op;
+  uint32_t size; // with the arguments, a multiple of 8
+  struct draw_rect bounds; // what it can touch, clipped
+};
+
+struct display_list_rect {
+  int x, y, width, height;
+  uint32_t color;
+};
+
+struct display_list_line {
+  int x0, y0, x1, y1;
+  uint32_t color;
+};
+
+struct display_list_circle {
+  int cx, cy, radius;
+  uint32_t color;
+};
+
+struct display_list_triangle {
+  int x[3], y[3];
+  uint32_t color;
+};
+
+struct display_list_checker {
+  int x, y, width, height, cell;
+  uint32_t c0, c1;
+};
+
+struct display_list_blit {
+  struct blit_image image;
+  int x, y, width, height;
+  int sx, sy, sw, sh;
+  enum blit_filter filter;
+  enum blend_op op;
+};
+
+struct display_list {
+  /* the arena, commands back to back */
+  uint8_t *data;
+  size_t size;
+  size_t cap;
+  struct draw_rect clip;
+  bool clipped;
+  /* the bins of the replay, the commands of tile t are the offsets in
+   * refs[bins[t], bins[t + 1]) */
+  uint32_t *bins;
+  int bins_cap;
+  uint32_t *refs;
+  uint64_t refs_cap;
+  /* the replay in flight */
+  struct draw_surface target;
+  int tile_size;
+  int tiles_x;
+  struct display_list_stats stats;
+};
+
+struct display_list *display_list_make(void) {
+  struct display_list *new = NULL;
+  new = malloc(sizeof(struct display_list));
+  if (!new)
+    return NULL;
+  memset(new, 0, sizeof(struct display_list));
+  return new;
+}
+
+void display_list_free(struct display_list **ptr) {
+  struct display_list *dl = *ptr;
+  if (dl) {
+    free(dl->data);
+    free(dl->bins);
+    free(dl->refs);
+    free(dl);
+    *ptr = NULL;
+  }
+}
+
+void display_list_reset(struct display_list *dl) {
+  dl->size = 0;
+  dl->clipped = false;
+  memset(&dl->stats, 0, sizeof(struct display_list_stats));
+}
+
+void display_list_set_clip(struct display_list *dl, int x, int y, int width,
+                           int height) {
+  dl->clip.x0 = x;
+  dl->clip.y0 = y;
+  dl->clip.x1 = x + (width > 0 ? width : 0);
+  dl->clip.y1 = y + (height > 0 ? height : 0);
+  dl->clipped = true;
+}
+
+void display_list_reset_clip(struct display_list *dl) { dl->clipped = false; }
+
+/* append a command touching at most bounds, culled if that is empty */
+static int display_list_push(struct display_list *dl, uint32_t op,
+                             struct draw_rect bounds, const void *args,
+                             size_t args_size) {
+  struct display_list_cmd cmd;
+  size_t size = (sizeof(cmd) + args_size + 7) & ~(size_t)7;
+
+  if (dl->clipped) {
+    bounds.x0 = bounds.x0 > dl->clip.x0 ? bounds.x0 : dl->clip.x0;
+    bounds.y0 = bounds.y0 > dl->clip.y0 ? bounds.y0 : dl->clip.y0;
+    bounds.x1 = bounds.x1 < dl->clip.x1 ? bounds.x1 : dl->clip.x1;
+    bounds.y1 = bounds.y1 < dl->clip.y1 ? bounds.y1 : dl->clip.y1;
+  }
+  if (bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1) {
+    dl->stats.culled++;
+    return 0;
+  }
+  if (dl->size + size > dl->cap) {
+    size_t cap = dl->cap ? dl->cap * 2 : DISPLAY_LIST_ARENA_MIN;
+    uint8_t *data;
+    while (cap < dl->size + size)
+      cap *= 2;
+    /* the bins hold 32 bit offsets */
+    data = cap <= UINT32_MAX ? realloc(dl->data, cap) : NULL;
+    if (!data) {
+      err_log("%s: no enough memory\n", __func__);
+      return 1;
+    }
+    dl->data = data;
+    dl->cap = cap;
+  }
+  cmd.op = op;
+  cmd.size = (uint32_t)size;
+  cmd.bounds = bounds;
+  memcpy(dl->data + dl->size, &cmd, sizeof(cmd));
+  memcpy(dl->data + dl->size + sizeof(cmd), args, args_size);
+  dl->size += size;
+  dl->stats.commands++;
+  dl->stats.bytes = dl->size;
+  return 0;
+}
+
+static struct draw_rect display_list_bounds(int x0, int y0, int x1, int y1) {
+  struct draw_rect r = {x0, y0, x1, y1};
+  return r;
+}
+
+static int display_list_min(int a, int b) { return a < b ? a : b; }
+static int display_list_max(int a, int b) { return a > b ? a : b; }
+
+int display_list_fill_rect(struct display_list *dl, int x, int y, int width,
+                           int height, uint32_t color) {
+  struct display_list_rect args = {x, y, width, height, color};
+  if (width <= 0 || height <= 0)
+    return 0;
+  return display_list_push(dl, DISPLAY_LIST_OP_FILL_RECT,
+                           display_list_bounds(x, y, x + width, y + height),
+                           &args, sizeof(args));
+}
+
+int display_list_line(struct display_list *dl, int x0, int y0, int x1,
+                      int y1, uint32_t color) {
+  struct display_list_line args = {x0, y0, x1, y1, color};
+  return display_list_push(
+    dl, DISPLAY_LIST_OP_LINE,
+    display_list_bounds(display_list_min(x0, x1), display_list_min(y0, y1),
+                        display_list_max(x0, x1) + 1,
+                        display_list_max(y0, y1) + 1),
+    &args, sizeof(args));
+}
+
+int display_list_fill_circle(struct display_list *dl, int cx, int cy,
+                             int radius, uint32_t color) {
+  struct display_list_circle args = {cx, cy, radius, color};
+  if (radius < 0)
+    return 0;
+  return display_list_push(dl, DISPLAY_LIST_OP_FILL_CIRCLE,
+                           display_list_bounds(cx - radius, cy - radius,
+                                               cx + radius + 1,
+                                               cy + radius + 1),
+                           &args, sizeof(args));
+}
+
+int display_list_fill_triangle(struct display_list *dl, int x0, int y0,
+                               int x1, int y1, int x2, int y2,
+                               uint32_t color) {
+  struct display_list_triangle args = {{x0, x1, x2}, {y0, y1, y2}, color};
+  /* corners of pixels, the pixels are left of and above the max */
+  return display_list_push(
+    dl, DISPLAY_LIST_OP_FILL_TRIANGLE,
+    display_list_bounds(
+      display_list_min(x0, display_list_min(x1, x2)),
+      display_list_min(y0, display_list_min(y1, y2)),
+      display_list_max(x0, display_list_max(x1, x2)),
+      display_list_max(y0, display_list_max(y1, y2))),
+    &args, sizeof(args));
+}
+
+int display_list_fill_checker(struct display_list *dl, int x, int y,
+                              int width, int height, int cell, uint32_t c0,
+                              uint32_t c1) {
+  struct display_list_checker args = {x, y, width, height, cell, c0, c1};
+  if (width <= 0 || height <= 0 || cell <= 0)
+    return 0;
+  return display_list_push(dl, DISPLAY_LIST_OP_FILL_CHECKER,
+                           display_list_bounds(x, y, x + width, y + height),
+                           &args, sizeof(args));
+}
+
+int display_list_blit(struct display_list *dl, int x, int y, int width,
+                      int height, const struct blit_image *image, int sx,
+                      int sy, int sw, int sh, enum blit_filter filter,
+                      enum blend_op op) {
+  struct display_list_blit args = {*image, x, y, width, height, sx, sy,
+                                   sw, sh, filter, op};
+  if (width <= 0 || height <= 0)
+    return 0;
+  return display_list_push(dl, DISPLAY_LIST_OP_BLIT,
+                           display_list_bounds(x, y, x + width, y + height),
+                           &args, sizeof(args));
+}
+
+static void display_list_exec(struct draw_surface *surf,
+                              const struct display_list_cmd *cmd) {
+  const void *args = cmd + 1;
+
+  switch (cmd->op) {
+  case DISPLAY_LIST_OP_FILL_RECT: {
+    const struct display_list_rect *a = args;
+    draw_fill_rect(surf, a->x, a->y, a->width, a->height, a->color);
+    break;
+  }
+  case DISPLAY_LIST_OP_LINE: {
+    const struct display_list_line *a = args;
+    draw_line(surf, a->x0, a->y0, a->x1, a->y1, a->color);
+    break;
+  }
+  case DISPLAY_LIST_OP_FILL_CIRCLE: {
+    const struct display_list_circle *a = args;
+    draw_fill_circle(surf, a->cx, a->cy, a->radius, a->color);
+    break;
+  }
+  case DISPLAY_LIST_OP_FILL_TRIANGLE: {
+    const struct display_list_triangle *a = args;
+    draw_fill_triangle(surf, a->x[0], a->y[0], a->x[1], a->y[1], a->x[2],
+                       a->y[2], a->color);
+    break;
+  }
+  case DISPLAY_LIST_OP_FILL_CHECKER: {
+    /* the bounds of the command are in the clip already */
+    const struct draw_rect *c = &surf->clip;
+    const struct display_list_checker *a = args;
+    pixels_fill_checker_rect_format(surf->pixels, surf->stride, surf->format,
+                                    surf->dither, c->x0, c->y0,
+                                    c->x1 - c->x0, c->y1 - c->y0, a->cell,
+                                    a->c0, a->c1);
+    break;
+  }
+  case DISPLAY_LIST_OP_BLIT: {
+    const struct display_list_blit *a = args;
+    blit_image(surf, a->x, a->y, a->width, a->height, &a->image, a->sx,
+               a->sy, a->sw, a->sh, a->filter, a->op);
+    break;
+  }
+  }
+}
+
+static void display_list_replay_tile(void *data, uint32_t *pixels,
+                                     int stride, int x, int y, int width,
+                                     int height) {
+  struct display_list *dl = (struct display_list *)data;
+  struct draw_surface surf = dl->target;
+  int tile = y / dl->tile_size * dl->tiles_x + x / dl->tile_size;
+
+  (void)pixels;
+  (void)stride;
+  for (uint32_t i = dl->bins[tile]; i < dl->bins[tile + 1]; i++) {
+    const struct display_list_cmd *cmd =
+      (const struct display_list_cmd *)(dl->data + dl->refs[i]);
+    surf.clip.x0 = display_list_max(x, cmd->bounds.x0);
+    surf.clip.y0 = display_list_max(y, cmd->bounds.y0);
+    surf.clip.x1 = display_list_min(x + width, cmd->bounds.x1);
+    surf.clip.y1 = display_list_min(y + height, cmd->bounds.y1);
+    if (surf.clip.x0 < surf.clip.x1 && surf.clip.y0 < surf.clip.y1)
+      display_list_exec(&surf, cmd);
+  }
+}
+
+/* the tiles a command lands in, false if none */
+static bool display_list_tile_span(const struct display_list *dl,
+                                   const struct display_list_cmd *cmd,
+                                   struct draw_rect *tiles) {
+  int x0 = display_list_max(cmd->bounds.x0, 0);
+  int y0 = display_list_max(cmd->bounds.y0, 0);
+  int x1 = display_list_min(cmd->bounds.x1, dl->target.width);
+  int y1 = display_list_min(cmd->bounds.y1, dl->target.height);
+
+  if (x0 >= x1 || y0 >= y1)
+    return false;
+  tiles->x0 = x0 / dl->tile_size;
+  tiles->y0 = y0 / dl->tile_size;
+  tiles->x1 = (x1 - 1) / dl->tile_size + 1;
+  tiles->y1 = (y1 - 1) / dl->tile_size + 1;
+  return true;
+}
+
+/*
+ * A counting sort of the commands into tiles: count per tile, turn the
+ * counts into starts, then drop each command into its tiles in order.
+ */
+static int display_list_bin(struct display_list *dl, int tile_count) {
+  struct draw_rect span;
+  uint64_t refs = 0;
+
+  if (tile_count + 1 > dl->bins_cap) {
+    uint32_t *bins = realloc(dl->bins, (tile_count + 1) * sizeof(uint32_t));
+    if (!bins) {
+      err_log("%s: no enough memory\n", __func__);
+      return 1;
+    }
+    dl->bins = bins;
+    dl->bins_cap = tile_count + 1;
+  }
+  memset(dl->bins, 0, (tile_count + 1) * sizeof(uint32_t));
+  for (size_t off = 0; off < dl->size;) {
+    const struct display_list_cmd *cmd =
+      (const struct display_list_cmd *)(dl->data + off);
+    if (display_list_tile_span(dl, cmd, &span)) {
+      for (int ty = span.y0; ty < span.y1; ty++)
+        for (int tx = span.x0; tx < span.x1; tx++)
+          dl->bins[ty * dl->tiles_x + tx + 1]++;
+      refs += (uint64_t)(span.x1 - span.x0) * (span.y1 - span.y0);
+    }
+    off += cmd->size;
+  }
+  if (refs > UINT32_MAX) {
+    err_log("%s: %lu tile refs\n", __func__, (unsigned long)refs);
+    return 1;
+  }
+  if (refs > dl->refs_cap) {
+    uint32_t *r = realloc(dl->refs, refs * sizeof(uint32_t));
+    if (!r) {
+      err_log("%s: no enough memory\n", __func__);
+      return 1;
+    }
+    dl->refs = r;
+    dl->refs_cap = refs;
+  }
+  for (int t = 0; t < tile_count; t++)
+    dl->bins[t + 1] += dl->bins[t];
+  /* while filling bins[t] is the next free slot of tile t */
+  for (size_t off = 0; off < dl->size;) {
+    const struct display_list_cmd *cmd =
+      (const struct display_list_cmd *)(dl->data + off);
+    if (display_list_tile_span(dl, cmd, &span)) {
+      for (int ty = span.y0; ty < span.y1; ty++)
+        for (int tx = span.x0; tx < span.x1; tx++)
+          dl->refs[dl->bins[ty * dl->tiles_x + tx]++] = (uint32_t)off;
+    }
+    off += cmd->size;
+  }
+  /* filling moved every start to the next one */
+  memmove(dl->bins + 1, dl->bins, tile_count * sizeof(uint32_t));
+  dl->bins[0] = 0;
+  dl->stats.refs = refs;
+  return 0;
+}
+
+int display_list_replay(struct display_list *dl, struct tile_renderer *tr,
+                        const struct draw_surface *surf,
+                        const struct damage_region *clip) {
+  int tiles_y;
+
+  dl->target = *surf;
+  draw_reset_clip(&dl->target);
+  dl->tile_size = tile_renderer_tile_size(tr);
+  dl->tiles_x = (surf->width + dl->tile_size - 1) / dl->tile_size;
+  tiles_y = (surf->height + dl->tile_size - 1) / dl->tile_size;
+  if (surf->width <= 0 || surf->height <= 0 || !dl->size)
+    return 0;
+  if (display_list_bin(dl, dl->tiles_x * tiles_y))
+    return 1;
+  return tile_renderer_run(tr, surf->pixels, surf->width, surf->height,
+                           surf->stride, clip, display_list_replay_tile, dl);
+}
+
+void display_list_get_stats(struct display_list *dl,
+                            struct display_list_stats *stats) {
+  *stats = dl->stats;
+}
@@ -0,0 +1,73 @@
+#ifndef _DISPLAY_LIST_H_
+#define _DISPLAY_LIST_H_
+
+#include <stdint.h>
+
+#include "blit.h"
+#include "damage.h"
+#include "draw.h"
+#include "tile.h"
+
+/*
+ * Draw commands recorded into an arena during a frame and replayed into a
+ * draw surface afterwards. Each command keeps the rect it can touch, at
+ * replay the commands are binned by tile and every tile runs its own bin
+ * on the tile renderer, in recording order and clipped to the tile. A
+ * command outside a tile costs that tile nothing. Tiles give the same
+ * pixels as drawing the commands straight into the surface would.
+ */
+
+struct display_list_stats {
+  int commands; // recorded since the last reset
+  int culled; // dropped at recording, nothing of them is visible
+  uint64_t bytes; // of the arena in use
+  uint64_t refs; // tile bin entries of the last replay
+};
+
+struct display_list;
+
+struct display_list *display_list_make(void);
+void display_list_free(struct display_list **ptr);
+/* drop the commands for the next frame, the arena is kept */
+void display_list_reset(struct display_list *dl);
+
+/*
+ * Recording, the arguments are those of the draw.h and blit.h calls. They
+ * return 1 if the arena can not grow, the command is lost then. The pixels
+ * of a blitted image are read at replay, they must live till then.
+ */
+int display_list_fill_rect(struct display_list *dl, int x, int y, int width,
+                           int height, uint32_t color);
+int display_list_line(struct display_list *dl, int x0, int y0, int x1,
+                      int y1, uint32_t color);
+int display_list_fill_circle(struct display_list *dl, int cx, int cy,
+                             int radius, uint32_t color);
+int display_list_fill_triangle(struct display_list *dl, int x0, int y0,
+                               int x1, int y1, int x2, int y2,
+                               uint32_t color);
+/* the checker of pixels_fill_checker(), limited to a rect */
+int display_list_fill_checker(struct display_list *dl, int x, int y,
+                              int width, int height, int cell, uint32_t c0,
+                              uint32_t c1);
+int display_list_blit(struct display_list *dl, int x, int y, int width,
+                      int height, const struct blit_image *image, int sx,
+                      int sy, int sw, int sh, enum blit_filter filter,
+                      enum blend_op op);
+/* clips the commands recorded after it, till the next one */
+void display_list_set_clip(struct display_list *dl, int x, int y, int width,
+                           int height);
+void display_list_reset_clip(struct display_list *dl);
+
+/*
+ * Replay into the surface, inside clip only if it is not NULL. The clip
+ * rect of the surface is ignored, the list keeps its own. The commands
+ * stay recorded, a list can be replayed again.
+ */
+int display_list_replay(struct display_list *dl, struct tile_renderer *tr,
+                        const struct draw_surface *surf,
+                        const struct damage_region *clip);
+
+void display_list_get_stats(struct display_list *dl,
+                            struct display_list_stats *stats);
+
+#endif
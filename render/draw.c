@@ -0,0 +1,275 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "draw.h"
+#include "fill.h"
+#include "format.h"
+
+static int draw_min(int a, int b) { return a < b ? a : b; }
+static int draw_max(int a, int b) { return a > b ? a : b; }
+
+static uint32_t *draw_row(struct draw_surface *surf, int y) {
+  return (uint32_t *)((uint8_t *)surf->pixels + (size_t)y * surf->stride);
+}
+
+/* count pixels of row y from column x, already clipped */
+static void draw_pixels(struct draw_surface *surf, int y, int x, int count,
+                        uint32_t color) {
+  uint16_t pattern[4];
+
+  if (surf->format != PIXEL_FORMAT_RGB565) {
+    span_fill(draw_row(surf, y) + x, count, color);
+    return;
+  }
+  pixel_rgb565_pattern(pattern, color, y, surf->dither);
+  span_fill16_periodic((uint16_t *)draw_row(surf, y) + x, count, pattern, 4,
+                       x & 3);
+}
+
+/* a span of row y, clipped */
+static void draw_span(struct draw_surface *surf, int y, int x0, int x1,
+                      uint32_t color) {
+  x0 = draw_max(x0, surf->clip.x0);
+  x1 = draw_min(x1, surf->clip.x1);
+  if (x0 < x1)
+    draw_pixels(surf, y, x0, x1 - x0, color);
+}
+
+static int draw_row_visible(struct draw_surface *surf, int y) {
+  return y >= surf->clip.y0 && y < surf->clip.y1;
+}
+
+void draw_surface_init(struct draw_surface *surf, uint32_t *pixels,
+                       int stride, int width, int height) {
+  surf->pixels = pixels;
+  surf->stride = stride;
+  surf->width = width;
+  surf->height = height;
+  surf->format = PIXEL_FORMAT_XRGB8888;
+  surf->dither = 0;
+  draw_reset_clip(surf);
+}
+
+void draw_surface_set_format(struct draw_surface *surf,
+                             enum pixel_format format, int dither) {
+  surf->format = format;
+  surf->dither = dither;
+}
+
+void draw_set_clip(struct draw_surface *surf, int x, int y, int width,
+                   int height) {
+  surf->clip.x0 = draw_max(x, 0);
+  surf->clip.y0 = draw_max(y, 0);
+  surf->clip.x1 = draw_min(x + draw_max(width, 0), surf->width);
+  surf->clip.y1 = draw_min(y + draw_max(height, 0), surf->height);
+  if (surf->clip.x1 < surf->clip.x0)
+    surf->clip.x1 = surf->clip.x0;
+  if (surf->clip.y1 < surf->clip.y0)
+    surf->clip.y1 = surf->clip.y0;
+}
+
+void draw_reset_clip(struct draw_surface *surf) {
+  draw_set_clip(surf, 0, 0, surf->width, surf->height);
+}
+
+void draw_fill_rect(struct draw_surface *surf, int x, int y, int width,
+                    int height, uint32_t color) {
+  int x0 = draw_max(x, surf->clip.x0);
+  int y0 = draw_max(y, surf->clip.y0);
+  int x1 = draw_min(x + width, surf->clip.x1);
+  int y1 = draw_min(y + height, surf->clip.y1);
+
+  if (width <= 0 || height <= 0 || x0 >= x1 || y0 >= y1)
+    return;
+  pixels_fill_rect_format(surf->pixels, surf->stride, surf->format,
+                          surf->dither, x0, y0, x1 - x0, y1 - y0, color);
+}
+
+/*
+ * Bresenham, started at the first column (or row) inside the clip with
+ * the error term it would have there. Pixels of an x major line that share
+ * a row go out as one span.
+ */
+static void draw_line_x_major(struct draw_surface *surf, int x0, int y0,
+                              int x1, int y1, uint32_t color) {
+  int64_t dx = (int64_t)x1 - x0;
+  int64_t dy = llabs((int64_t)y1 - y0);
+  int sy = y1 < y0 ? -1 : 1;
+  int k0 = draw_max(0, surf->clip.x0 - x0);
+  int k1 = (int)(draw_min(x1, surf->clip.x1 - 1) - (int64_t)x0);
+  int64_t e;
+  int y, run;
+
+  if (k0 > k1)
+    return;
+  /* y(k) = y0 + sy * floor((2 k dy + dx) / 2 dx) */
+  e = 2 * k0 * dy + dx;
+  y = y0 + sy * (int)(e / (2 * dx));
+  e %= 2 * dx;
+  run = k0;
+  for (int k = k0; k <= k1; k++) {
+    e += 2 * dy;
+    if (e >= 2 * dx || k == k1) {
+      if (draw_row_visible(surf, y))
+        draw_span(surf, y, x0 + run, x0 + k + 1, color);
+      else if ((sy > 0 && y >= surf->clip.y1) || (sy < 0 && y < surf->clip.y0))
+        return;
+      e -= 2 * dx;
+      y += sy;
+      run = k + 1;
+    }
+  }
+}
+
+static void draw_line_y_major(struct draw_surface *surf, int x0, int y0,
+                              int x1, int y1, uint32_t color) {
+  int64_t dy = (int64_t)y1 - y0;
+  int64_t dx = llabs((int64_t)x1 - x0);
+  int sx = x1 < x0 ? -1 : 1;
+  int k0 = draw_max(0, surf->clip.y0 - y0);
+  int k1 = (int)(draw_min(y1, surf->clip.y1 - 1) - (int64_t)y0);
+  int64_t e;
+  int x;
+
+  if (k0 > k1)
+    return;
+  e = 2 * k0 * dx + dy;
+  x = x0 + sx * (int)(e / (2 * dy));
+  e %= 2 * dy;
+  for (int k = k0; k <= k1; k++) {
+    if (x >= surf->clip.x0 && x < surf->clip.x1)
+      draw_pixels(surf, y0 + k, x, 1, color);
+    else if ((sx > 0 && x >= surf->clip.x1) || (sx < 0 && x < surf->clip.x0))
+      return;
+    e += 2 * dx;
+    if (e >= 2 * dy) {
+      e -= 2 * dy;
+      x += sx;
+    }
+  }
+}
+
+void draw_line(struct draw_surface *surf, int x0, int y0, int x1, int y1,
+               uint32_t color) {
+  int t;
+
+  if (llabs((int64_t)x1 - x0) >= llabs((int64_t)y1 - y0)) {
+    if (x1 < x0) {
+      t = x0; x0 = x1; x1 = t;
+      t = y0; y0 = y1; y1 = t;
+    }
+    if (x0 == x1) {
+      if (draw_row_visible(surf, y0))
+        draw_span(surf, y0, x0, x0 + 1, color);
+      return;
+    }
+    draw_line_x_major(surf, x0, y0, x1, y1, color);
+  } else {
+    if (y1 < y0) {
+      t = x0; x0 = x1; x1 = t;
+      t = y0; y0 = y1; y1 = t;
+    }
+    draw_line_y_major(surf, x0, y0, x1, y1, color);
+  }
+}
+
+/* the pixels whose centers are within radius of the center pixel */
+void draw_fill_circle(struct draw_surface *surf, int cx, int cy, int radius,
+                      uint32_t color) {
+  int64_t r2 = (int64_t)radius * radius + radius; // no lone pixel at the poles
+  int64_t dx = radius;
+
+  if (radius < 0)
+    return;
+  if (cx + radius < surf->clip.x0 || cx - radius >= surf->clip.x1 ||
+      cy + radius < surf->clip.y0 || cy - radius >= surf->clip.y1)
+    return;
+  /* the half width only shrinks going away from the center row */
+  for (int64_t dy = 0; dy <= radius; dy++) {
+    while (dx * dx + dy * dy > r2)
+      dx--;
+    if (draw_row_visible(surf, cy + dy))
+      draw_span(surf, cy + dy, cx - dx, cx + dx + 1, color);
+    if (dy && draw_row_visible(surf, cy - dy))
+      draw_span(surf, cy - dy, cx - dx, cx + dx + 1, color);
+  }
+}
+
+static int64_t draw_floor_div(int64_t a, int64_t b) {
+  int64_t q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+/*
+ * An edge function e(px, py) = a px + b py + c, in doubled coordinates so
+ * pixel centers (2x + 1, 2y + 1) are integers. Inside is e >= 0, the bias
+ * takes a pixel center right on the edge out unless the edge is a top or
+ * a left one.
+ */
+struct draw_edge {
+  int64_t a;
+  int64_t b;
+  int64_t c;
+};
+
+static void draw_edge_setup(struct draw_edge *edge, int64_t x0, int64_t y0,
+                            int64_t x1, int64_t y1) {
+  edge->a = -(y1 - y0);
+  edge->b = x1 - x0;
+  edge->c = -(edge->a * 2 * x0 + edge->b * 2 * y0);
+  if (!(edge->a > 0 || (edge->a == 0 && edge->b > 0)))
+    edge->c -= 1;
+}
+
+/* narrow [*lo, *hi) of row y to the columns inside the edge */
+static void draw_edge_span(const struct draw_edge *edge, int y, int64_t *lo,
+                           int64_t *hi) {
+  int64_t r = edge->b * (2 * (int64_t)y + 1) + edge->c;
+
+  /* a (2x + 1) + r >= 0 */
+  if (edge->a > 0) {
+    int64_t x = -draw_floor_div(r + edge->a, 2 * edge->a);
+    if (x > *lo)
+      *lo = x;
+  } else if (edge->a < 0) {
+    int64_t x = draw_floor_div(r + edge->a, -2 * edge->a) + 1;
+    if (x < *hi)
+      *hi = x;
+  } else if (r < 0) {
+    *hi = *lo;
+  }
+}
+
+/*
+ * Each row is the intersection of the three edges, solved for x, so the
+ * inside is filled a span at a time by the span kernels instead of testing
+ * pixels one by one.
+ */
+void draw_fill_triangle(struct draw_surface *surf, int x0, int y0, int x1,
+                        int y1, int x2, int y2, uint32_t color) {
+  struct draw_edge edges[3];
+  int64_t area = ((int64_t)x1 - x0) * ((int64_t)y2 - y0) -
+                 ((int64_t)y1 - y0) * ((int64_t)x2 - x0);
+  int top, bottom, t;
+
+  if (!area)
+    return;
+  /* the edge functions want the inside on their left */
+  if (area < 0) {
+    t = x1; x1 = x2; x2 = t;
+    t = y1; y1 = y2; y2 = t;
+  }
+  top = draw_max(draw_min(y0, draw_min(y1, y2)), surf->clip.y0);
+  bottom = draw_min(draw_max(y0, draw_max(y1, y2)), surf->clip.y1);
+  draw_edge_setup(&edges[0], x0, y0, x1, y1);
+  draw_edge_setup(&edges[1], x1, y1, x2, y2);
+  draw_edge_setup(&edges[2], x2, y2, x0, y0);
+  for (int y = top; y < bottom; y++) {
+    int64_t lo = surf->clip.x0;
+    int64_t hi = surf->clip.x1;
+    for (int i = 0; i < 3 && lo < hi; i++)
+      draw_edge_span(&edges[i], y, &lo, &hi);
+    if (lo < hi)
+      draw_pixels(surf, y, (int)lo, (int)(hi - lo), color);
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef _DRAW_H_
+#define _DRAW_H_
+
+#include <stdint.h>
+
+#include "format.h"
+
+/*
+ * Immediate mode primitives over a pixel buffer. Everything is clipped to
+ * the clip rect of the surface and broken down into horizontal spans, the
+ * spans go through the span kernels of fill.h. Rects and triangles take
+ * the corners of pixels and cover the pixels whose centers are inside,
+ * lines and circles take the pixels themselves. Surfaces are XRGB8888
+ * unless set to RGB565, the colors are ARGB8888 either way.
+ */
+
+struct draw_rect {
+  int x0; // inclusive
+  int y0;
+  int x1; // exclusive
+  int y1;
+};
+
+struct draw_surface {
+  uint32_t *pixels; // uint16_t pixels for RGB565
+  int stride; // in bytes
+  int width;
+  int height;
+  struct draw_rect clip;
+  enum pixel_format format;
+  int dither; // ordered dither of RGB565 colors
+};
+
+/* the clip starts as the whole surface */
+void draw_surface_init(struct draw_surface *surf, uint32_t *pixels,
+                       int stride, int width, int height);
+/* intersected with the surface, an empty rect clips everything */
+void draw_set_clip(struct draw_surface *surf, int x, int y, int width,
+                   int height);
+void draw_reset_clip(struct draw_surface *surf);
+/* XRGB8888, ARGB8888 or RGB565 */
+void draw_surface_set_format(struct draw_surface *surf,
+                             enum pixel_format format, int dither);
+
+void draw_fill_rect(struct draw_surface *surf, int x, int y, int width,
+                    int height, uint32_t color);
+/* one pixel wide, both end points included */
+void draw_line(struct draw_surface *surf, int x0, int y0, int x1, int y1,
+               uint32_t color);
+void draw_fill_circle(struct draw_surface *surf, int cx, int cy, int radius,
+                      uint32_t color);
+/* either winding, edges shared by two triangles are filled once */
+void draw_fill_triangle(struct draw_surface *surf, int x0, int y0, int x1,
+                        int y1, int x2, int y2, uint32_t color);
+
+#endif
@@ -0,0 +1,410 @@
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "cpu.h"
+#include "fill.h"
+
+/* the widest vector of the kernels, in pixels */
+#define SPAN_VEC_MAX 8
+
+/*
+ * ext holds the period followed by SPAN_VEC_MAX more pixels of it, so a
+ * vector load at any phase in [0, period_len) stays inside the buffer.
+ */
+struct span_kernels {
+  const char *name;
+  void (*fill)(uint32_t *dst, int count, uint32_t color, int nt);
+  void (*fill_periodic)(uint32_t *dst, int count, const uint32_t *ext,
+                        int period_len, int phase, int nt);
+};
+
+/* scalar kernels */
+static void span_fill_scalar(uint32_t *dst, int count, uint32_t color,
+                             int nt) {
+  (void)nt;
+  for (int i = 0; i < count; i++)
+    dst[i] = color;
+}
+
+static void span_fill_periodic_scalar(uint32_t *dst, int count,
+                                      const uint32_t *ext, int period_len,
+                                      int phase, int nt) {
+  (void)nt;
+  for (int i = 0; i < count; i++) {
+    dst[i] = ext[phase];
+    if (++phase == period_len)
+      phase = 0;
+  }
+}
+
+static const struct span_kernels span_kernels_scalar = {
+  .name = "scalar",
+  .fill = span_fill_scalar,
+  .fill_periodic = span_fill_periodic_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/* SSE2 kernels */
+__attribute__((target("sse2")))
+static void span_fill_sse2(uint32_t *dst, int count, uint32_t color, int nt) {
+  __m128i v = _mm_set1_epi32((int)color);
+  int i = 0;
+
+  while (i < count && ((uintptr_t)(dst + i) & 15))
+    dst[i++] = color;
+  if (nt) {
+    for (; i + 16 <= count; i += 16) {
+      _mm_stream_si128((__m128i *)(dst + i), v);
+      _mm_stream_si128((__m128i *)(dst + i + 4), v);
+      _mm_stream_si128((__m128i *)(dst + i + 8), v);
+      _mm_stream_si128((__m128i *)(dst + i + 12), v);
+    }
+  } else {
+    for (; i + 16 <= count; i += 16) {
+      _mm_store_si128((__m128i *)(dst + i), v);
+      _mm_store_si128((__m128i *)(dst + i + 4), v);
+      _mm_store_si128((__m128i *)(dst + i + 8), v);
+      _mm_store_si128((__m128i *)(dst + i + 12), v);
+    }
+  }
+  for (; i + 4 <= count; i += 4)
+    _mm_store_si128((__m128i *)(dst + i), v);
+  for (; i < count; i++)
+    dst[i] = color;
+  if (nt)
+    _mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static void span_fill_periodic_sse2(uint32_t *dst, int count,
+                                    const uint32_t *ext, int period_len,
+                                    int phase, int nt) {
+  int i = 0;
+
+  while (i < count && ((uintptr_t)(dst + i) & 15)) {
+    dst[i++] = ext[phase];
+    if (++phase == period_len)
+      phase = 0;
+  }
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(ext + phase));
+    if (nt)
+      _mm_stream_si128((__m128i *)(dst + i), v);
+    else
+      _mm_store_si128((__m128i *)(dst + i), v);
+    phase += 4;
+    while (phase >= period_len)
+      phase -= period_len;
+  }
+  for (; i < count; i++) {
+    dst[i] = ext[phase];
+    if (++phase == period_len)
+      phase = 0;
+  }
+  if (nt)
+    _mm_sfence();
+}
+
+static const struct span_kernels span_kernels_sse2 = {
+  .name = "sse2",
+  .fill = span_fill_sse2,
+  .fill_periodic = span_fill_periodic_sse2,
+};
+
+/* AVX2 kernels */
+__attribute__((target("avx2")))
+static void span_fill_avx2(uint32_t *dst, int count, uint32_t color, int nt) {
+  __m256i v = _mm256_set1_epi32((int)color);
+  int i = 0;
+
+  while (i < count && ((uintptr_t)(dst + i) & 31))
+    dst[i++] = color;
+  if (nt) {
+    for (; i + 32 <= count; i += 32) {
+      _mm256_stream_si256((__m256i *)(dst + i), v);
+      _mm256_stream_si256((__m256i *)(dst + i + 8), v);
+      _mm256_stream_si256((__m256i *)(dst + i + 16), v);
+      _mm256_stream_si256((__m256i *)(dst + i + 24), v);
+    }
+  } else {
+    for (; i + 32 <= count; i += 32) {
+      _mm256_store_si256((__m256i *)(dst + i), v);
+      _mm256_store_si256((__m256i *)(dst + i + 8), v);
+      _mm256_store_si256((__m256i *)(dst + i + 16), v);
+      _mm256_store_si256((__m256i *)(dst + i + 24), v);
+    }
+  }
+  for (; i + 8 <= count; i += 8)
+    _mm256_store_si256((__m256i *)(dst + i), v);
+  for (; i < count; i++)
+    dst[i] = color;
+  if (nt)
+    _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static void span_fill_periodic_avx2(uint32_t *dst, int count,
+                                    const uint32_t *ext, int period_len,
+                                    int phase, int nt) {
+  int i = 0;
+
+  while (i < count && ((uintptr_t)(dst + i) & 31)) {
+    dst[i++] = ext[phase];
+    if (++phase == period_len)
+      phase = 0;
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(ext + phase));
+    if (nt)
+      _mm256_stream_si256((__m256i *)(dst + i), v);
+    else
+      _mm256_store_si256((__m256i *)(dst + i), v);
+    phase += 8;
+    while (phase >= period_len)
+      phase -= period_len;
+  }
+  for (; i < count; i++) {
+    dst[i] = ext[phase];
+    if (++phase == period_len)
+      phase = 0;
+  }
+  if (nt)
+    _mm_sfence();
+}
+
+static const struct span_kernels span_kernels_avx2 = {
+  .name = "avx2",
+  .fill = span_fill_avx2,
+  .fill_periodic = span_fill_periodic_avx2,
+};
+#endif
+
+static const struct span_kernels *g_span_kernels = NULL;
+
+void span_kernels_select(unsigned int features) {
+  const struct span_kernels *k = &span_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  if (features & CPU_FEATURE_AVX2)
+    k = &span_kernels_avx2;
+  else if (features & CPU_FEATURE_SSE2)
+    k = &span_kernels_sse2;
+#endif
+  __atomic_store_n(&g_span_kernels, k, __ATOMIC_RELEASE);
+}
+
+static const struct span_kernels *span_kernels_get(void) {
+  const struct span_kernels *k =
+    __atomic_load_n(&g_span_kernels, __ATOMIC_ACQUIRE);
+  if (!k) {
+    span_kernels_select(cpu_features());
+    k = __atomic_load_n(&g_span_kernels, __ATOMIC_ACQUIRE);
+  }
+  return k;
+}
+
+const char *span_kernels_name(void) { return span_kernels_get()->name; }
+
+/* fills that would evict most of the last level cache bypass it */
+static int span_use_nt(size_t bytes) { return bytes >= cpu_cache_size() / 2; }
+
+/* ext must hold period_len + SPAN_VEC_MAX pixels */
+static void span_periodic_extend(uint32_t *ext, const uint32_t *period,
+                                 int period_len) {
+  for (int i = 0; i < period_len + SPAN_VEC_MAX; i++)
+    ext[i] = i < period_len ? period[i] : ext[i - period_len];
+}
+
+void span_fill(uint32_t *dst, int count, uint32_t color) {
+  if (count > 0)
+    span_kernels_get()->fill(dst, count, color,
+                             span_use_nt((size_t)count * 4));
+}
+
+void span_fill_periodic(uint32_t *dst, int count, const uint32_t *period,
+                        int period_len, int phase) {
+  uint32_t ext[SPAN_PERIOD_MAX + SPAN_VEC_MAX];
+
+  if (count <= 0 || period_len <= 0 || period_len > SPAN_PERIOD_MAX)
+    return;
+  span_periodic_extend(ext, period, period_len);
+  span_kernels_get()->fill_periodic(dst, count, ext, period_len,
+                                    phase % period_len,
+                                    span_use_nt((size_t)count * 4));
+}
+
+static void span_fill16_nt(const struct span_kernels *k, uint16_t *dst,
+                           int count, uint16_t color, int nt) {
+  if (count > 0 && ((uintptr_t)dst & 2)) {
+    *dst++ = color;
+    count--;
+  }
+  if (count >= 2)
+    k->fill((uint32_t *)dst, count / 2, color | (uint32_t)color << 16, nt);
+  if (count & 1)
+    dst[count - 1] = color;
+}
+
+void span_fill16(uint16_t *dst, int count, uint16_t color) {
+  if (count > 0)
+    span_fill16_nt(span_kernels_get(), dst, count, color,
+                   span_use_nt((size_t)count * 2));
+}
+
+void span_fill16_periodic(uint16_t *dst, int count, const uint16_t *period,
+                          int period_len, int phase) {
+  uint32_t pairs[SPAN_PERIOD_MAX];
+  int pairs_len = period_len % 2 ? period_len : period_len / 2;
+
+  if (count <= 0 || period_len <= 0 || period_len > SPAN_PERIOD_MAX)
+    return;
+  phase %= period_len;
+  if ((uintptr_t)dst & 2) {
+    *dst++ = period[phase];
+    count--;
+    phase = (phase + 1) % period_len;
+  }
+  if (count >= 2) {
+    /* an odd period takes two rounds to line up with the pairs again */
+    for (int i = 0; i < pairs_len; i++)
+      pairs[i] = period[(phase + 2 * i) % period_len] |
+                 (uint32_t)period[(phase + 2 * i + 1) % period_len] << 16;
+    span_fill_periodic((uint32_t *)dst, count / 2, pairs, pairs_len, 0);
+    phase = (phase + count / 2 * 2) % period_len;
+  }
+  if (count & 1)
+    dst[count - 1] = period[phase];
+}
+
+void pixels_fill_rect16(uint16_t *pixels, int stride, int x, int y,
+                        int width, int height, uint16_t color) {
+  const struct span_kernels *k = span_kernels_get();
+  int nt = span_use_nt((size_t)width * height * 2);
+
+  if (width <= 0 || height <= 0)
+    return;
+  for (int row = y; row < y + height; row++) {
+    uint16_t *dst = (uint16_t *)((uint8_t *)pixels + (size_t)row * stride) + x;
+    span_fill16_nt(k, dst, width, color, nt);
+  }
+}
+
+/*
+ * With a stride of whole pairs every row of the rect starts at the same
+ * parity of address, so each pattern row turns into one period of pixel
+ * pairs, extended once.
+ */
+void pixels_fill_pattern_rect16(uint16_t *pixels, int stride, int x, int y,
+                                int width, int height, const uint16_t *pattern,
+                                int pattern_width, int rows) {
+  const struct span_kernels *k = span_kernels_get();
+  uint32_t ext[SPAN_PATTERN_ROWS][SPAN_PERIOD_MAX / 2 + SPAN_VEC_MAX];
+  uint32_t pairs[SPAN_PERIOD_MAX / 2];
+  int pairs_len = pattern_width / 2;
+  int nt = span_use_nt((size_t)width * height * 2);
+  int head, count, first, last, r;
+
+  if (width <= 0 || height <= 0 || pattern_width <= 0 || pattern_width % 2 ||
+      pattern_width > SPAN_PERIOD_MAX || rows <= 0 ||
+      rows > SPAN_PATTERN_ROWS)
+    return;
+  /* a lone pixel up to the first pair, the pairs and a lone last pixel */
+  head = (int)(((uintptr_t)pixels + (size_t)x * 2) & 2) / 2;
+  head = head < width ? head : width;
+  count = width - head;
+  first = x % pattern_width;
+  last = (x + width - 1) % pattern_width;
+  for (int i = 0; i < rows && i < height; i++) {
+    const uint16_t *line = pattern + (y + i) % rows * pattern_width;
+    int j = (x + head) % pattern_width;
+    for (int p = 0; p < pairs_len; p++) {
+      int next = j + 1 < pattern_width ? j + 1 : 0;
+      pairs[p] = line[j] | (uint32_t)line[next] << 16;
+      j = next + 1 < pattern_width ? next + 1 : 0;
+    }
+    span_periodic_extend(ext[(y + i) % rows], pairs, pairs_len);
+  }
+  r = y % rows;
+  for (int row = y; row < y + height; row++) {
+    const uint16_t *line = pattern + r * pattern_width;
+    uint16_t *dst = (uint16_t *)((uint8_t *)pixels + (size_t)row * stride) + x;
+
+    if (head)
+      *dst++ = line[first];
+    if (count >= 2)
+      k->fill_periodic((uint32_t *)dst, count / 2, ext[r], pairs_len, 0, nt);
+    if (count & 1)
+      dst[count - 1] = line[last];
+    r = r + 1 < rows ? r + 1 : 0;
+  }
+}
+
+void pixels_fill_rect(uint32_t *pixels, int stride, int x, int y, int width,
+                      int height, uint32_t color) {
+  const struct span_kernels *k = span_kernels_get();
+  int nt = span_use_nt((size_t)width * height * 4);
+
+  if (width <= 0 || height <= 0)
+    return;
+  for (int row = y; row < y + height; row++) {
+    uint32_t *dst = (uint32_t *)((uint8_t *)pixels + (size_t)row * stride) + x;
+    k->fill(dst, width, color, nt);
+  }
+}
+
+void pixels_fill_checker(uint32_t *pixels, int stride, int width, int height,
+                         int cell, uint32_t c0, uint32_t c1) {
+  pixels_fill_checker_rect(pixels, stride, 0, 0, width, height, cell, c0, c1);
+}
+
+void pixels_fill_checker_rect(uint32_t *pixels, int stride, int x, int y,
+                              int width, int height, int cell, uint32_t c0,
+                              uint32_t c1) {
+  const struct span_kernels *k = span_kernels_get();
+  uint32_t ext[SPAN_PERIOD_MAX + SPAN_VEC_MAX];
+  uint32_t period[SPAN_PERIOD_MAX];
+  int period_len = 2 * cell;
+  int nt = span_use_nt((size_t)width * height * 4);
+
+  if (width <= 0 || height <= 0 || cell <= 0)
+    return;
+  if (period_len > SPAN_PERIOD_MAX) {
+    /* cells too wide for a period are runs of solid fills */
+    for (int row = y; row < y + height; row++) {
+      uint32_t *dst =
+        (uint32_t *)((uint8_t *)pixels + (size_t)row * stride) + x;
+      int shift = row / cell % 2 * cell;
+      for (int col = x; col < x + width;) {
+        int pos = col + shift;
+        int n = cell - pos % cell;
+        if (n > x + width - col)
+          n = x + width - col;
+        k->fill(dst + (col - x), n, pos / cell % 2 ? c1 : c0, nt);
+        col += n;
+      }
+    }
+    return;
+  }
+  for (int i = 0; i < period_len; i++)
+    period[i] = i < cell ? c0 : c1;
+  span_periodic_extend(ext, period, period_len);
+  for (int row = y; row < y + height; row++) {
+    uint32_t *dst = (uint32_t *)((uint8_t *)pixels + (size_t)row * stride) + x;
+    int phase = (x + row / cell % 2 * cell) % period_len;
+    k->fill_periodic(dst, width, ext, period_len, phase, nt);
+  }
+}
+
+void pixels_copy_rect(uint32_t *dst, const uint32_t *src, int stride, int x,
+                      int y, int width, int height) {
+  if (width <= 0 || height <= 0)
+    return;
+  for (int row = y; row < y + height; row++) {
+    size_t offset = (size_t)row * stride + (size_t)x * 4;
+    memcpy((uint8_t *)dst + offset, (const uint8_t *)src + offset,
+           (size_t)width * 4);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef _FILL_H_
+#define _FILL_H_
+
+#include <stdint.h>
+
+/* the longest period span_fill_periodic() accepts, in pixels */
+#define SPAN_PERIOD_MAX 256
+/* the most rows pixels_fill_pattern_rect16() repeats */
+#define SPAN_PATTERN_ROWS 16
+
+/*
+ * Span kernels. The variant (scalar, SSE2 or AVX2) is picked from cpuid the
+ * first time a kernel is used, span_kernels_select() overrides it.
+ */
+void span_kernels_select(unsigned int features);
+const char *span_kernels_name(void);
+
+/* dst[i] = color for i in [0, count) */
+void span_fill(uint32_t *dst, int count, uint32_t color);
+/* dst[i] = period[(phase + i) % period_len] */
+void span_fill_periodic(uint32_t *dst, int count, const uint32_t *period,
+                        int period_len, int phase);
+
+/*
+ * 16 bit pixels (RGB565), run through the 32 bit kernels two at a time.
+ * Pixels pair up little endian, the first one in the low half.
+ */
+void span_fill16(uint16_t *dst, int count, uint16_t color);
+void span_fill16_periodic(uint16_t *dst, int count, const uint16_t *period,
+                          int period_len, int phase);
+
+/*
+ * Rect helpers over a pixel buffer, stride is in bytes. Fills larger than
+ * the cache use non-temporal stores since the buffer goes to the compositor.
+ */
+void pixels_fill_rect(uint32_t *pixels, int stride, int x, int y, int width,
+                      int height, uint32_t color);
+void pixels_fill_rect16(uint16_t *pixels, int stride, int x, int y,
+                        int width, int height, uint16_t color);
+/*
+ * pixel (x, y) is pattern[y % rows * pattern_width + x % pattern_width],
+ * the width is even and at most SPAN_PERIOD_MAX, rows at most
+ * SPAN_PATTERN_ROWS. A dithered color is a 4x4 pattern.
+ */
+void pixels_fill_pattern_rect16(uint16_t *pixels, int stride, int x, int y,
+                                int width, int height, const uint16_t *pattern,
+                                int pattern_width, int rows);
+/* pixel (x, y) is c0 if (x + y / cell * cell) % (2 * cell) < cell, else c1 */
+void pixels_fill_checker(uint32_t *pixels, int stride, int width, int height,
+                         int cell, uint32_t c0, uint32_t c1);
+/* the same pattern, limited to a rect of the buffer */
+void pixels_fill_checker_rect(uint32_t *pixels, int stride, int x, int y,
+                              int width, int height, int cell, uint32_t c0,
+                              uint32_t c1);
+/* copy a rect between two buffers of the same layout */
+void pixels_copy_rect(uint32_t *dst, const uint32_t *src, int stride, int x,
+                      int y, int width, int height);
+
+#endif
@@ -0,0 +1,579 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "font.h"
+#include "path.h"
+
+/* how deep compound glyphs may nest */
+#define FONT_COMPOUND_DEPTH 8
+
+/* the flags of the points of simple glyphs */
+#define FONT_ON_CURVE 0x01
+#define FONT_X_SHORT 0x02
+#define FONT_Y_SHORT 0x04
+#define FONT_REPEAT 0x08
+#define FONT_X_SAME 0x10 // or positive if short
+#define FONT_Y_SAME 0x20
+
+/* the flags of the components of compound glyphs */
+#define FONT_ARG_WORDS 0x0001
+#define FONT_ARGS_XY 0x0002
+#define FONT_SCALE 0x0008
+#define FONT_MORE 0x0020
+#define FONT_XY_SCALE 0x0040
+#define FONT_TWO_BY_TWO 0x0080
+
+struct font {
+  const uint8_t *data;
+  size_t size;
+  void *map; // of font_load(), NULL otherwise
+  size_t map_size;
+  const uint8_t *cmap; // the subtable used, NULL if none
+  size_t cmap_size;
+  int cmap_format;
+  const uint8_t *loca;
+  bool loca_long;
+  const uint8_t *glyf;
+  size_t glyf_size;
+  const uint8_t *hmtx;
+  int hmetrics;
+  struct font_metrics metrics;
+};
+
+static uint16_t font_u16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static int16_t font_i16(const uint8_t *p) { return (int16_t)font_u16(p); }
+static uint32_t font_u32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* the table with tag, its length checked against the file */
+static const uint8_t *font_table(const uint8_t *data, size_t size,
+                                 const char *tag, size_t *len) {
+  int tables;
+
+  if (size < 12)
+    return NULL;
+  tables = font_u16(data + 4);
+  if (12 + (size_t)tables * 16 > size)
+    return NULL;
+  for (int i = 0; i < tables; i++) {
+    const uint8_t *rec = data + 12 + i * 16;
+    uint32_t off = font_u32(rec + 8);
+    uint32_t length = font_u32(rec + 12);
+    if (memcmp(rec, tag, 4) != 0)
+      continue;
+    if (off > size || length > size - off)
+      return NULL;
+    *len = length;
+    return data + off;
+  }
+  return NULL;
+}
+
+/* the unicode subtable, format 12 over format 4 */
+static void font_find_cmap(struct font *font, const uint8_t *cmap,
+                           size_t len) {
+  int tables;
+
+  if (len < 4)
+    return;
+  tables = font_u16(cmap + 2);
+  if (4 + (size_t)tables * 8 > len)
+    return;
+  for (int i = 0; i < tables; i++) {
+    const uint8_t *rec = cmap + 4 + i * 8;
+    int platform = font_u16(rec);
+    int encoding = font_u16(rec + 2);
+    uint32_t off = font_u32(rec + 4);
+    size_t size;
+    int format;
+    if (!(platform == 0 || (platform == 3 && (encoding == 1 ||
+                                              encoding == 10))))
+      continue;
+    if (off > len || len - off < 8)
+      continue;
+    format = font_u16(cmap + off);
+    if (format == 4)
+      size = font_u16(cmap + off + 2);
+    else if (format == 12)
+      size = font_u32(cmap + off + 4);
+    else
+      continue;
+    if (size > len - off || format < font->cmap_format)
+      continue;
+    font->cmap = cmap + off;
+    font->cmap_size = size;
+    font->cmap_format = format;
+  }
+}
+
+struct font *font_make(const void *data, size_t size) {
+  struct font *new = NULL;
+  const uint8_t *head, *maxp, *hhea, *cmap;
+  size_t head_len, maxp_len, hhea_len, cmap_len, loca_len, hmtx_len;
+  uint32_t version;
+
+  if (size < 12) {
+    err_log("%s: not a font\n", __func__);
+    return NULL;
+  }
+  version = font_u32(data);
+  if (version != 0x00010000 && version != 0x74727565) { // 'true'
+    err_log("%s: not a TrueType font\n", __func__);
+    return NULL;
+  }
+  new = malloc(sizeof(struct font));
+  if (!new)
+    return NULL;
+  memset(new, 0, sizeof(struct font));
+  new->data = data;
+  new->size = size;
+  head = font_table(data, size, "head", &head_len);
+  maxp = font_table(data, size, "maxp", &maxp_len);
+  hhea = font_table(data, size, "hhea", &hhea_len);
+  cmap = font_table(data, size, "cmap", &cmap_len);
+  new->loca = font_table(data, size, "loca", &loca_len);
+  new->glyf = font_table(data, size, "glyf", &new->glyf_size);
+  new->hmtx = font_table(data, size, "hmtx", &hmtx_len);
+  if (!head || head_len < 54 || !maxp || maxp_len < 6 || !hhea ||
+      hhea_len < 36 || !cmap || !new->loca || !new->glyf || !new->hmtx) {
+    err_log("%s: tables are missing\n", __func__);
+    free(new);
+    return NULL;
+  }
+  new->metrics.units_per_em = font_u16(head + 18);
+  new->loca_long = font_i16(head + 50) != 0;
+  new->metrics.glyph_count = font_u16(maxp + 4);
+  new->metrics.ascent = font_i16(hhea + 4);
+  new->metrics.descent = font_i16(hhea + 6);
+  new->metrics.line_gap = font_i16(hhea + 8);
+  new->hmetrics = font_u16(hhea + 34);
+  font_find_cmap(new, cmap, cmap_len);
+  if (!new->metrics.units_per_em || !new->hmetrics ||
+      (size_t)new->hmetrics * 4 > hmtx_len ||
+      (size_t)(new->metrics.glyph_count + 1) * (new->loca_long ? 4 : 2) >
+        loca_len) {
+    err_log("%s: broken tables\n", __func__);
+    free(new);
+    return NULL;
+  }
+  if (!new->cmap)
+    log("%s: no unicode cmap, only glyph 0 is drawn\n", __func__);
+  return new;
+}
+
+struct font *font_load(const char *path) {
+  struct font *font;
+  struct stat st;
+  void *map;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    err_log("%s: failed to open %s\n", __func__, path);
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    err_log("%s: failed to stat %s\n", __func__, path);
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    err_log("%s: failed to map %s\n", __func__, path);
+    return NULL;
+  }
+  font = font_make(map, st.st_size);
+  if (!font) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  font->map = map;
+  font->map_size = st.st_size;
+  return font;
+}
+
+void font_free(struct font **ptr) {
+  struct font *font = *ptr;
+  if (font) {
+    if (font->map)
+      munmap(font->map, font->map_size);
+    free(font);
+    *ptr = NULL;
+  }
+}
+
+void font_get_metrics(struct font *font, struct font_metrics *metrics) {
+  *metrics = font->metrics;
+}
+
+static int font_cmap4(const uint8_t *t, size_t len, uint32_t c) {
+  int segs = font_u16(t + 6) / 2;
+  const uint8_t *ends = t + 14;
+  const uint8_t *starts = ends + segs * 2 + 2;
+  const uint8_t *deltas = starts + segs * 2;
+  const uint8_t *ranges = deltas + segs * 2;
+  int lo = 0, hi = segs;
+
+  if (c > 0xFFFF || 16 + (size_t)segs * 8 > len)
+    return 0;
+  /* the first segment ending at or after c */
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (font_u16(ends + mid * 2) < c)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == segs || c < font_u16(starts + lo * 2))
+    return 0;
+  if (font_u16(ranges + lo * 2)) {
+    const uint8_t *p = ranges + lo * 2 + font_u16(ranges + lo * 2) +
+                       (c - font_u16(starts + lo * 2)) * 2;
+    uint16_t g;
+    if (p + 2 > t + len)
+      return 0;
+    g = font_u16(p);
+    return g ? (uint16_t)(g + font_u16(deltas + lo * 2)) : 0;
+  }
+  return (uint16_t)(c + font_u16(deltas + lo * 2));
+}
+
+static int font_cmap12(const uint8_t *t, size_t len, uint32_t c) {
+  uint32_t groups = len >= 16 ? font_u32(t + 12) : 0;
+  uint32_t lo = 0, hi = groups;
+
+  if (groups > (len - 16) / 12)
+    return 0;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const uint8_t *g = t + 16 + mid * 12;
+    if (c < font_u32(g))
+      hi = mid;
+    else if (c > font_u32(g + 4))
+      lo = mid + 1;
+    else
+      return (int)(font_u32(g + 8) + (c - font_u32(g)));
+  }
+  return 0;
+}
+
+int font_glyph_index(struct font *font, uint32_t codepoint) {
+  int glyph = 0;
+
+  if (font->cmap_format == 4)
+    glyph = font_cmap4(font->cmap, font->cmap_size, codepoint);
+  else if (font->cmap_format == 12)
+    glyph = font_cmap12(font->cmap, font->cmap_size, codepoint);
+  return glyph >= 0 && glyph < font->metrics.glyph_count ? glyph : 0;
+}
+
+int font_glyph_advance(struct font *font, int glyph) {
+  if (glyph >= font->hmetrics)
+    glyph = font->hmetrics - 1;
+  return font_u16(font->hmtx + glyph * 4);
+}
+
+/* the glyf data of a glyph, NULL if it has none */
+static const uint8_t *font_glyph_data(struct font *font, int glyph,
+                                      size_t *len) {
+  uint32_t start, end;
+
+  if (glyph < 0 || glyph >= font->metrics.glyph_count)
+    return NULL;
+  if (font->loca_long) {
+    start = font_u32(font->loca + glyph * 4);
+    end = font_u32(font->loca + glyph * 4 + 4);
+  } else {
+    start = font_u16(font->loca + glyph * 2) * 2u;
+    end = font_u16(font->loca + glyph * 2 + 2) * 2u;
+  }
+  if (start >= end || end > font->glyf_size || end - start < 10)
+    return NULL;
+  *len = end - start;
+  return font->glyf + start;
+}
+
+static int font_floor(float v) {
+  int i = (int)v;
+  return i - (v < i);
+}
+
+static int font_ceil(float v) {
+  int i = (int)v;
+  return i + (v > i);
+}
+
+void font_glyph_box(struct font *font, int glyph, float scale, float shift_x,
+                    struct draw_rect *box) {
+  size_t len;
+  const uint8_t *g = font_glyph_data(font, glyph, &len);
+
+  memset(box, 0, sizeof(struct draw_rect));
+  if (!g)
+    return;
+  box->x0 = font_floor(font_i16(g + 2) * scale + shift_x);
+  box->y0 = font_floor(-font_i16(g + 8) * scale);
+  box->x1 = font_ceil(font_i16(g + 6) * scale + shift_x);
+  box->y1 = font_ceil(-font_i16(g + 4) * scale);
+  if (box->x0 >= box->x1 || box->y0 >= box->y1)
+    memset(box, 0, sizeof(struct draw_rect));
+}
+
+/* outlines go into a path, in pixels of the surface */
+struct font_raster {
+  struct path *path;
+  /* x' = m[0] x + m[2] y + m[4], y' = m[1] x + m[3] y + m[5], font units
+   * to pixels */
+  float m[6];
+};
+
+struct font_point {
+  float x;
+  float y;
+  bool on;
+};
+
+/* a closed contour, points off the curve between two others imply one
+ * on it in the middle */
+static int font_raster_contour(struct font_raster *r,
+                               const struct font_point *p, int n) {
+  struct font_point start, ctrl = {0};
+  bool have_ctrl = false;
+  int first = -1;
+  int i0, count, ret;
+
+  if (n < 2)
+    return 0;
+  for (int i = 0; i < n && first < 0; i++)
+    if (p[i].on)
+      first = i;
+  if (first < 0) {
+    start.x = 0.5f * (p[n - 1].x + p[0].x);
+    start.y = 0.5f * (p[n - 1].y + p[0].y);
+    i0 = 0;
+    count = n;
+  } else {
+    start = p[first];
+    i0 = first + 1;
+    count = n - 1;
+  }
+  ret = path_move_to(r->path, start.x, start.y);
+  for (int k = 0; k < count && !ret; k++) {
+    const struct font_point *q = &p[(i0 + k) % n];
+    if (q->on) {
+      if (have_ctrl)
+        ret = path_quad_to(r->path, ctrl.x, ctrl.y, q->x, q->y);
+      else
+        ret = path_line_to(r->path, q->x, q->y);
+      have_ctrl = false;
+    } else {
+      if (have_ctrl)
+        ret = path_quad_to(r->path, ctrl.x, ctrl.y, 0.5f * (ctrl.x + q->x),
+                           0.5f * (ctrl.y + q->y));
+      ctrl = *q;
+      have_ctrl = true;
+    }
+  }
+  if (have_ctrl && !ret)
+    ret = path_quad_to(r->path, ctrl.x, ctrl.y, start.x, start.y);
+  path_close(r->path);
+  return ret;
+}
+
+static int font_raster_simple(struct font_raster *r, const uint8_t *g,
+                              size_t len, int contours) {
+  const uint8_t *end = g + len;
+  const uint8_t *p = g + 10;
+  const uint8_t *ends = p;
+  struct font_point *pts;
+  uint8_t *flags;
+  int count, x = 0, y = 0, first = 0, ret = 0;
+
+  if (len < 10 + (size_t)contours * 2 + 2)
+    return 0;
+  count = font_u16(ends + (contours - 1) * 2) + 1;
+  p += contours * 2;
+  p += 2 + font_u16(p); // the instructions
+  if (p > end)
+    return 0;
+  pts = malloc((size_t)count * (sizeof(struct font_point) + 1));
+  if (!pts) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  flags = (uint8_t *)(pts + count);
+  for (int i = 0; i < count;) {
+    uint8_t f;
+    int repeat = 0;
+    if (p >= end)
+      goto out;
+    f = *p++;
+    if (f & FONT_REPEAT) {
+      if (p >= end)
+        goto out;
+      repeat = *p++;
+    }
+    for (int k = 0; k <= repeat && i < count; k++)
+      flags[i++] = f;
+  }
+  for (int i = 0; i < count; i++) {
+    if (flags[i] & FONT_X_SHORT) {
+      if (p + 1 > end)
+        goto out;
+      x += flags[i] & FONT_X_SAME ? *p : -*p;
+      p += 1;
+    } else if (!(flags[i] & FONT_X_SAME)) {
+      if (p + 2 > end)
+        goto out;
+      x += font_i16(p);
+      p += 2;
+    }
+    pts[i].x = (float)x;
+  }
+  for (int i = 0; i < count; i++) {
+    float fx = pts[i].x;
+    if (flags[i] & FONT_Y_SHORT) {
+      if (p + 1 > end)
+        goto out;
+      y += flags[i] & FONT_Y_SAME ? *p : -*p;
+      p += 1;
+    } else if (!(flags[i] & FONT_Y_SAME)) {
+      if (p + 2 > end)
+        goto out;
+      y += font_i16(p);
+      p += 2;
+    }
+    pts[i].x = r->m[0] * fx + r->m[2] * y + r->m[4];
+    pts[i].y = r->m[1] * fx + r->m[3] * y + r->m[5];
+    pts[i].on = flags[i] & FONT_ON_CURVE;
+  }
+  for (int c = 0; c < contours && !ret; c++) {
+    int last = font_u16(ends + c * 2);
+    if (last < first || last >= count)
+      break;
+    ret = font_raster_contour(r, pts + first, last - first + 1);
+    first = last + 1;
+  }
+out:
+  free(pts);
+  return ret;
+}
+
+static int font_raster_glyph(struct font *font, struct font_raster *r,
+                             int glyph, int depth);
+
+static int font_raster_compound(struct font *font, struct font_raster *r,
+                                const uint8_t *g, size_t len, int depth) {
+  const uint8_t *end = g + len;
+  const uint8_t *p = g + 10;
+  float parent[6];
+  uint16_t flags;
+  int ret = 0;
+
+  memcpy(parent, r->m, sizeof(parent));
+  do {
+    float a = 1, b = 0, c = 0, d = 1, e = 0, f = 0;
+    int glyph;
+    if (p + 4 > end)
+      break;
+    flags = font_u16(p);
+    glyph = font_u16(p + 2);
+    p += 4;
+    if (flags & FONT_ARG_WORDS) {
+      if (p + 4 > end)
+        break;
+      e = font_i16(p);
+      f = font_i16(p + 2);
+      p += 4;
+    } else {
+      if (p + 2 > end)
+        break;
+      e = (int8_t)p[0];
+      f = (int8_t)p[1];
+      p += 2;
+    }
+    /* matching points are not supported, the component stays in place */
+    if (!(flags & FONT_ARGS_XY))
+      e = f = 0;
+    if (flags & FONT_SCALE) {
+      if (p + 2 > end)
+        break;
+      a = d = font_i16(p) / 16384.0f;
+      p += 2;
+    } else if (flags & FONT_XY_SCALE) {
+      if (p + 4 > end)
+        break;
+      a = font_i16(p) / 16384.0f;
+      d = font_i16(p + 2) / 16384.0f;
+      p += 4;
+    } else if (flags & FONT_TWO_BY_TWO) {
+      if (p + 8 > end)
+        break;
+      a = font_i16(p) / 16384.0f;
+      b = font_i16(p + 2) / 16384.0f;
+      c = font_i16(p + 4) / 16384.0f;
+      d = font_i16(p + 6) / 16384.0f;
+      p += 8;
+    }
+    r->m[0] = parent[0] * a + parent[2] * b;
+    r->m[1] = parent[1] * a + parent[3] * b;
+    r->m[2] = parent[0] * c + parent[2] * d;
+    r->m[3] = parent[1] * c + parent[3] * d;
+    r->m[4] = parent[0] * e + parent[2] * f + parent[4];
+    r->m[5] = parent[1] * e + parent[3] * f + parent[5];
+    ret |= font_raster_glyph(font, r, glyph, depth + 1);
+  } while (flags & FONT_MORE);
+  memcpy(r->m, parent, sizeof(parent));
+  return ret;
+}
+
+static int font_raster_glyph(struct font *font, struct font_raster *r,
+                             int glyph, int depth) {
+  size_t len;
+  const uint8_t *g = font_glyph_data(font, glyph, &len);
+  int contours;
+
+  if (!g || depth > FONT_COMPOUND_DEPTH)
+    return 0;
+  contours = font_i16(g);
+  if (contours > 0)
+    return font_raster_simple(r, g, len, contours);
+  if (contours < 0)
+    return font_raster_compound(font, r, g, len, depth);
+  return 0;
+}
+
+int font_glyph_rasterize(struct font *font, int glyph, float scale,
+                         float shift_x, const struct draw_rect *box,
+                         uint8_t *coverage, int stride) {
+  struct font_raster r;
+  int ret;
+
+  if (box->x0 >= box->x1 || box->y0 >= box->y1)
+    return 0;
+  r.path = path_make();
+  if (!r.path) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  r.m[0] = scale;
+  r.m[1] = 0;
+  r.m[2] = 0;
+  r.m[3] = -scale;
+  r.m[4] = shift_x;
+  r.m[5] = 0;
+  ret = font_raster_glyph(font, &r, glyph, 0);
+  if (!ret)
+    ret = path_rasterize(r.path, PATH_FILL_NONZERO, box, coverage, stride);
+  path_free(&r.path);
+  return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef _FONT_H_
+#define _FONT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "draw.h"
+
+/*
+ * TrueType fonts read straight from the file, the glyf outlines are
+ * filled by path.h, nothing of the system is needed. Simple and
+ * compound glyphs are read, hinting instructions are ignored. Every
+ * offset of the file is checked, a broken font fails to open or gives
+ * empty glyphs.
+ *
+ * Glyph boxes and coverage are in pixels, x to the right of the pen and y
+ * down from the baseline. shift_x moves the outline right by a part of a
+ * pixel, for pens that are not on a pixel boundary.
+ */
+
+struct font_metrics {
+  int units_per_em;
+  int ascent; // in font units, above the baseline
+  int descent; // negative, below it
+  int line_gap;
+  int glyph_count;
+};
+
+struct font;
+
+/* over data, which must live as long as the font */
+struct font *font_make(const void *data, size_t size);
+/* the file is mapped for as long as the font lives */
+struct font *font_load(const char *path);
+void font_free(struct font **ptr);
+
+void font_get_metrics(struct font *font, struct font_metrics *metrics);
+/* 0, the missing glyph, if the font has no glyph for the code point */
+int font_glyph_index(struct font *font, uint32_t codepoint);
+/* in font units */
+int font_glyph_advance(struct font *font, int glyph);
+
+/* the pixels the glyph can touch at scale (pixels per font unit), empty
+ * for glyphs without an outline */
+void font_glyph_box(struct font *font, int glyph, float scale, float shift_x,
+                    struct draw_rect *box);
+/*
+ * The coverage of the glyph, 0 to 255, into the box of it at coverage,
+ * rows stride bytes apart. Returns 1 if it can not get its memory.
+ */
+int font_glyph_rasterize(struct font *font, int glyph, float scale,
+                         float shift_x, const struct draw_rect *box,
+                         uint8_t *coverage, int stride);
+
+#endif
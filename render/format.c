@@ -0,0 +1,287 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "../utils/utils.h"
+#include "cpu.h"
+#include "fill.h"
+#include "format.h"
+
+/* thresholds of the ordered dither, in sixteenths of a step */
+static const uint8_t bayer4[4][4] = {
+  {0, 8, 2, 10},
+  {12, 4, 14, 6},
+  {3, 11, 1, 9},
+  {15, 7, 13, 5},
+};
+
+const char *pixel_format_name(enum pixel_format format) {
+  switch (format) {
+  case PIXEL_FORMAT_XRGB8888:
+    return "xrgb8888";
+  case PIXEL_FORMAT_ARGB8888:
+    return "argb8888";
+  case PIXEL_FORMAT_RGB565:
+    return "rgb565";
+  case PIXEL_FORMAT_RGBA8888:
+    return "rgba8888";
+  }
+  return "unknown";
+}
+
+int pixel_format_bpp(enum pixel_format format) {
+  return format == PIXEL_FORMAT_RGB565 ? 2 : 4;
+}
+
+enum pixel_format pixel_format_from_env(void) {
+  const char *name = getenv("DRAW_ENGINE_WINDOW_FORMAT");
+  if (name && strcmp(name, "argb8888") == 0)
+    return PIXEL_FORMAT_ARGB8888;
+  if (name && strcmp(name, "rgb565") == 0)
+    return PIXEL_FORMAT_RGB565;
+  return PIXEL_FORMAT_XRGB8888;
+}
+
+int pixel_dither_from_env(void) {
+  const char *val = getenv("DRAW_ENGINE_DITHER");
+  return !val || strcmp(val, "0") != 0;
+}
+
+/*
+ * A channel is scaled to 31 / 32 (63 / 64) of itself, which takes the
+ * unpacked values back to multiples of the step, then the top bits are
+ * kept after adding an offset. Half a step rounds to the nearest, the
+ * dither thresholds spread it instead. Nothing can overflow a byte.
+ */
+static uint16_t pixel_pack_rgb565_offset(uint32_t argb, uint32_t rb_off,
+                                         uint32_t g_off) {
+  uint32_t r = (argb >> 16) & 0xFF;
+  uint32_t g = (argb >> 8) & 0xFF;
+  uint32_t b = argb & 0xFF;
+  r = r - (r >> 5) + rb_off;
+  g = g - (g >> 6) + g_off;
+  b = b - (b >> 5) + rb_off;
+  return (uint16_t)((r >> 3) << 11 | (g >> 2) << 5 | b >> 3);
+}
+
+uint16_t pixel_pack_rgb565(uint32_t argb) {
+  return pixel_pack_rgb565_offset(argb, 4, 2);
+}
+
+uint16_t pixel_pack_rgb565_dither(uint32_t argb, int x, int y) {
+  uint32_t t = bayer4[y & 3][x & 3];
+  return pixel_pack_rgb565_offset(argb, t >> 1, t >> 2);
+}
+
+uint32_t pixel_unpack_rgb565(uint16_t pixel) {
+  uint32_t r = pixel >> 11, g = (pixel >> 5) & 0x3F, b = pixel & 0x1F;
+  return 0xFF000000 | (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 |
+         (b << 3 | b >> 2);
+}
+
+void pixel_rgb565_pattern(uint16_t pattern[4], uint32_t argb, int y,
+                          int dither) {
+  for (int x = 0; x < 4; x++)
+    pattern[x] = dither ? pixel_pack_rgb565_dither(argb, x, y)
+                        : pixel_pack_rgb565(argb);
+}
+
+static void pixels_pack_rgb565_scalar(uint16_t *dst, const uint32_t *src,
+                                      int count, int x, int y, int dither) {
+  for (int i = 0; i < count; i++)
+    dst[i] = dither ? pixel_pack_rgb565_dither(src[i], x + i, y)
+                    : pixel_pack_rgb565(src[i]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* the offsets of 4 pixels from column x on, as bytes b, g, r, a */
+__attribute__((target("sse2")))
+static __m128i pixels_pack_offsets_sse2(int x, int y, int dither) {
+  uint8_t off[16];
+  for (int i = 0; i < 4; i++) {
+    uint32_t t = bayer4[y & 3][(x + i) & 3];
+    off[i * 4] = (uint8_t)(dither ? t >> 1 : 4);
+    off[i * 4 + 1] = (uint8_t)(dither ? t >> 2 : 2);
+    off[i * 4 + 2] = off[i * 4];
+    off[i * 4 + 3] = 0;
+  }
+  return _mm_loadu_si128((const __m128i *)off);
+}
+
+/* 4 pixels to 565 in the low halves of the 32 bit lanes, sign extended */
+__attribute__((target("sse2")))
+static inline __m128i pixels_pack4_sse2(__m128i v, __m128i off) {
+  __m128i r, g, b;
+  /* the scale of pixel_pack_rgb565_offset(), a byte at a time */
+  __m128i q = _mm_or_si128(
+    _mm_and_si128(_mm_srli_epi16(v, 5), _mm_set1_epi32(0x00070007)),
+    _mm_and_si128(_mm_srli_epi16(v, 6), _mm_set1_epi32(0x00000300)));
+  v = _mm_add_epi8(_mm_sub_epi8(v, q), off);
+  r = _mm_and_si128(_mm_srli_epi32(v, 8), _mm_set1_epi32(0xF800));
+  g = _mm_and_si128(_mm_srli_epi32(v, 5), _mm_set1_epi32(0x07E0));
+  b = _mm_and_si128(_mm_srli_epi32(v, 3), _mm_set1_epi32(0x001F));
+  v = _mm_or_si128(r, _mm_or_si128(g, b));
+  return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+__attribute__((target("sse2")))
+static void pixels_pack_rgb565_sse2(uint16_t *dst, const uint32_t *src,
+                                    int count, int x, int y, int dither) {
+  __m128i off = pixels_pack_offsets_sse2(x, y, dither);
+  int i = 0;
+
+  /* 8 pixels keep the column phase of the dither */
+  for (; i + 8 <= count; i += 8) {
+    __m128i lo = pixels_pack4_sse2(
+      _mm_loadu_si128((const __m128i *)(src + i)), off);
+    __m128i hi = pixels_pack4_sse2(
+      _mm_loadu_si128((const __m128i *)(src + i + 4)), off);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+  }
+  pixels_pack_rgb565_scalar(dst + i, src + i, count - i, x + i, y, dither);
+}
+#endif
+
+void pixels_pack_rgb565(uint16_t *dst, const uint32_t *src, int count, int x,
+                        int y, int dither) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (cpu_features() & CPU_FEATURE_SSE2) {
+    pixels_pack_rgb565_sse2(dst, src, count, x, y, dither);
+    return;
+  }
+#endif
+  pixels_pack_rgb565_scalar(dst, src, count, x, y, dither);
+}
+
+void pixels_unpack_rgb565(uint32_t *dst, const uint16_t *src, int count) {
+  for (int i = 0; i < count; i++)
+    dst[i] = pixel_unpack_rgb565(src[i]);
+}
+
+/* the 4x4 pattern of a dithered color */
+static void pixel_rgb565_pattern4(uint16_t pattern[16], uint32_t argb) {
+  for (int y = 0; y < 4; y++)
+    pixel_rgb565_pattern(pattern + y * 4, argb, y, 1);
+}
+
+int pixels_fill_rect_format(void *pixels, int stride,
+                            enum pixel_format format, int dither, int x,
+                            int y, int width, int height, uint32_t color) {
+  uint16_t pattern[16];
+
+  if (width <= 0 || height <= 0)
+    return 0;
+  switch (format) {
+  case PIXEL_FORMAT_XRGB8888:
+  case PIXEL_FORMAT_ARGB8888:
+    pixels_fill_rect(pixels, stride, x, y, width, height, color);
+    break;
+  case PIXEL_FORMAT_RGB565:
+    if (!dither) {
+      pixels_fill_rect16(pixels, stride, x, y, width, height,
+                         pixel_pack_rgb565(color));
+      break;
+    }
+    pixel_rgb565_pattern4(pattern, color);
+    pixels_fill_pattern_rect16(pixels, stride, x, y, width, height, pattern,
+                               4, 4);
+    break;
+  case PIXEL_FORMAT_RGBA8888:
+    err_log("%s: can not draw into %s\n", __func__,
+            pixel_format_name(format));
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * A 565 row of the checker repeats every 2 * cell columns, and every 4
+ * for the dither, the period covers both. Rows repeat the same way, small
+ * cells make one pattern of the whole checker, larger ones a pattern per
+ * band of cells, 4 rows high for the dither. Cells too wide for a period
+ * are filled one by one.
+ */
+static void pixels_fill_checker_rect16(void *pixels, int stride, int dither,
+                                       int x, int y, int width, int height,
+                                       int cell, uint32_t c0, uint32_t c1) {
+  uint16_t pattern[SPAN_PATTERN_ROWS * SPAN_PERIOD_MAX];
+  uint16_t packed[2][16];
+  int period_len = 2 * cell;
+  int rows;
+
+  if (dither && period_len % 4)
+    period_len *= 2;
+  if (period_len > SPAN_PERIOD_MAX) {
+    for (int row = y; row < y + height;) {
+      int end = (row / cell + 1) * cell;
+      int shift = row / cell % 2 * cell;
+      if (end > y + height)
+        end = y + height;
+      for (int col = x; col < x + width;) {
+        int pos = col + shift;
+        int n = cell - pos % cell;
+        if (n > x + width - col)
+          n = x + width - col;
+        pixels_fill_rect_format(pixels, stride, PIXEL_FORMAT_RGB565, dither,
+                                col, row, n, end - row,
+                                pos / cell % 2 ? c1 : c0);
+        col += n;
+      }
+      row = end;
+    }
+    return;
+  }
+  rows = period_len <= SPAN_PATTERN_ROWS ? period_len : dither ? 4 : 1;
+  for (int row = 0; row < 4; row++) {
+    pixel_rgb565_pattern(packed[0] + row * 4, c0, row, dither);
+    pixel_rgb565_pattern(packed[1] + row * 4, c1, row, dither);
+  }
+  for (int row = y; row < y + height;) {
+    /* the band of cells row is in, or all of them */
+    int band = rows == period_len ? 0 : row / cell % 2;
+    int end = rows == period_len ? y + height : (row / cell + 1) * cell;
+    if (end > y + height)
+      end = y + height;
+    for (int r = 0; r < rows; r++) {
+      uint16_t *line = pattern + r * period_len;
+      const uint16_t *p[2] = {packed[0] + r % 4 * 4, packed[1] + r % 4 * 4};
+      int shift = (band + r / cell) % 2 * cell;
+      int k = shift; // column i of the checker cycle
+      for (int i = 0; i < period_len; i++) {
+        line[i] = p[k >= cell][i & 3];
+        k = k + 1 < 2 * cell ? k + 1 : 0;
+      }
+    }
+    pixels_fill_pattern_rect16(pixels, stride, x, row, width, end - row,
+                               pattern, period_len, rows);
+    row = end;
+  }
+}
+
+int pixels_fill_checker_rect_format(void *pixels, int stride,
+                                    enum pixel_format format, int dither,
+                                    int x, int y, int width, int height,
+                                    int cell, uint32_t c0, uint32_t c1) {
+  if (width <= 0 || height <= 0 || cell <= 0)
+    return 0;
+  switch (format) {
+  case PIXEL_FORMAT_XRGB8888:
+  case PIXEL_FORMAT_ARGB8888:
+    pixels_fill_checker_rect(pixels, stride, x, y, width, height, cell, c0,
+                             c1);
+    break;
+  case PIXEL_FORMAT_RGB565:
+    pixels_fill_checker_rect16(pixels, stride, dither, x, y, width, height,
+                               cell, c0, c1);
+    break;
+  case PIXEL_FORMAT_RGBA8888:
+    err_log("%s: can not draw into %s\n", __func__,
+            pixel_format_name(format));
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#include <stdint.h>
+
+/*
+ * Pixel formats of images and windows. Colors handed to the drawing code
+ * are premultiplied ARGB8888 whatever the format of the target, they are
+ * packed on the way out. RGB565 halves the bytes written per frame and
+ * uploaded by the compositor, an ordered dither (4x4 Bayer) hides the
+ * banding of its 5 and 6 bit channels.
+ */
+
+enum pixel_format {
+  PIXEL_FORMAT_XRGB8888, // the alpha byte is ignored
+  PIXEL_FORMAT_ARGB8888, // premultiplied
+  PIXEL_FORMAT_RGB565,
+  PIXEL_FORMAT_RGBA8888, // bytes r, g, b, a in memory, straight alpha
+};
+
+const char *pixel_format_name(enum pixel_format format);
+/* bytes per pixel */
+int pixel_format_bpp(enum pixel_format format);
+
+/* the format asked for with DRAW_ENGINE_WINDOW_FORMAT (xrgb8888, argb8888
+ * or rgb565), XRGB8888 if unset */
+enum pixel_format pixel_format_from_env(void);
+/* DRAW_ENGINE_DITHER=0 turns the RGB565 dither off */
+int pixel_dither_from_env(void);
+
+uint16_t pixel_pack_rgb565(uint32_t argb);
+/* the dithered pixel at (x, y) of a surface */
+uint16_t pixel_pack_rgb565_dither(uint32_t argb, int x, int y);
+uint32_t pixel_unpack_rgb565(uint16_t pixel);
+/* row y of a solid color, pattern[x & 3] is the pixel at column x */
+void pixel_rgb565_pattern(uint16_t pattern[4], uint32_t argb, int y,
+                          int dither);
+
+/* dst[0] is the pixel at (x, y), for the dither */
+void pixels_pack_rgb565(uint16_t *dst, const uint32_t *src, int count, int x,
+                        int y, int dither);
+void pixels_unpack_rgb565(uint32_t *dst, const uint16_t *src, int count);
+
+/*
+ * pixels_fill_rect() and pixels_fill_checker_rect() in any window format,
+ * they return 1 for RGBA8888, which is only read from
+ */
+int pixels_fill_rect_format(void *pixels, int stride,
+                            enum pixel_format format, int dither, int x,
+                            int y, int width, int height, uint32_t color);
+int pixels_fill_checker_rect_format(void *pixels, int stride,
+                                    enum pixel_format format, int dither,
+                                    int x, int y, int width, int height,
+                                    int cell, uint32_t c0, uint32_t c1);
+
+#endif
@@ -0,0 +1,894 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "../utils/utils.h"
+#include "blend.h"
+#include "cpu.h"
+#include "format.h"
+#include "path.h"
+
+/* rows summed at once, the band of cells stays in the cache */
+#define PATH_BAND_ROWS 16
+/* how far, in pixels, the lines of a flattened curve may be off it */
+#define PATH_TOLERANCE 0.1f
+/* lines a curve is flattened into at most */
+#define PATH_FLATTEN_MAX 256
+/* pixels blended at once on RGB565 surfaces */
+#define PATH_CHUNK 256
+
+struct path_contour {
+  int start; // of the points
+  bool closed;
+};
+
+struct path {
+  float *points; // x y pairs
+  int count;
+  int cap;
+  struct path_contour *contours;
+  int contour_count;
+  int contour_cap;
+  bool open; // the last contour takes more points
+  float x0; // bounds of the points
+  float y0;
+  float x1;
+  float y1;
+};
+
+struct path *path_make(void) {
+  struct path *new = malloc(sizeof(struct path));
+  if (!new)
+    return NULL;
+  memset(new, 0, sizeof(struct path));
+  return new;
+}
+
+void path_free(struct path **ptr) {
+  struct path *path = *ptr;
+  if (path) {
+    free(path->points);
+    free(path->contours);
+    free(path);
+    *ptr = NULL;
+  }
+}
+
+void path_reset(struct path *path) {
+  path->count = 0;
+  path->contour_count = 0;
+  path->open = false;
+}
+
+/* room for count more points */
+static int path_reserve(struct path *path, int count) {
+  if (path->count + count > path->cap) {
+    int cap = path->cap ? path->cap * 2 : 64;
+    float *points;
+    while (cap < path->count + count)
+      cap *= 2;
+    points = realloc(path->points, (size_t)cap * 2 * sizeof(float));
+    if (!points) {
+      err_log("%s: no enough memory\n", __func__);
+      return 1;
+    }
+    path->points = points;
+    path->cap = cap;
+  }
+  return 0;
+}
+
+static int path_point(struct path *path, float x, float y) {
+  if (path_reserve(path, 1))
+    return 1;
+  if (!path->count) {
+    path->x0 = path->x1 = x;
+    path->y0 = path->y1 = y;
+  }
+  path->x0 = x < path->x0 ? x : path->x0;
+  path->y0 = y < path->y0 ? y : path->y0;
+  path->x1 = x > path->x1 ? x : path->x1;
+  path->y1 = y > path->y1 ? y : path->y1;
+  path->points[path->count * 2] = x;
+  path->points[path->count * 2 + 1] = y;
+  path->count++;
+  return 0;
+}
+
+int path_move_to(struct path *path, float x, float y) {
+  struct path_contour *c;
+
+  /* a contour of a single point is moved instead */
+  if (path->open &&
+      path->contours[path->contour_count - 1].start == path->count - 1) {
+    path->count--;
+    return path_point(path, x, y);
+  }
+  if (path->contour_count == path->contour_cap) {
+    int cap = path->contour_cap ? path->contour_cap * 2 : 8;
+    c = realloc(path->contours, cap * sizeof(struct path_contour));
+    if (!c) {
+      err_log("%s: no enough memory\n", __func__);
+      return 1;
+    }
+    path->contours = c;
+    path->contour_cap = cap;
+  }
+  if (path_point(path, x, y))
+    return 1;
+  c = &path->contours[path->contour_count++];
+  c->start = path->count - 1;
+  c->closed = false;
+  path->open = true;
+  return 0;
+}
+
+/* the current point, a contour is started if there is none */
+static int path_current(struct path *path, float *x, float *y) {
+  if (!path->open) {
+    if (path->contour_count) {
+      /* where the closed contour started */
+      int start = path->contours[path->contour_count - 1].start;
+      *x = path->points[start * 2];
+      *y = path->points[start * 2 + 1];
+    } else {
+      *x = *y = 0;
+    }
+    return path_move_to(path, *x, *y);
+  }
+  *x = path->points[path->count * 2 - 2];
+  *y = path->points[path->count * 2 - 1];
+  return 0;
+}
+
+int path_line_to(struct path *path, float x, float y) {
+  float cx, cy;
+  if (path_current(path, &cx, &cy))
+    return 1;
+  return path_point(path, x, y);
+}
+
+int path_lines_to(struct path *path, const float *points, int count) {
+  float cx, cy, x0, y0, x1, y1;
+  float *out;
+
+  if (count <= 0)
+    return 0;
+  if (path_current(path, &cx, &cy) || path_reserve(path, count))
+    return 1;
+  out = path->points + path->count * 2;
+  x0 = path->x0;
+  y0 = path->y0;
+  x1 = path->x1;
+  y1 = path->y1;
+  for (int i = 0; i < count; i++) {
+    float x = points[i * 2], y = points[i * 2 + 1];
+    x0 = x < x0 ? x : x0;
+    y0 = y < y0 ? y : y0;
+    x1 = x > x1 ? x : x1;
+    y1 = y > y1 ? y : y1;
+    out[i * 2] = x;
+    out[i * 2 + 1] = y;
+  }
+  path->x0 = x0;
+  path->y0 = y0;
+  path->x1 = x1;
+  path->y1 = y1;
+  path->count += count;
+  return 0;
+}
+
+/*
+ * Wang's formula: n lines keep a curve of degree d within tol of it if
+ * n^2 >= d (d - 1) / 8 * max |second difference| / tol. Both sides are
+ * squared again, no square root is needed.
+ */
+static int path_segments(float ddx, float ddy, float factor) {
+  float dd = (ddx * ddx + ddy * ddy) * factor * factor;
+  int n = 1;
+  while (n < PATH_FLATTEN_MAX && (float)n * n * n * n < dd)
+    n++;
+  return n;
+}
+
+int path_quad_to(struct path *path, float cx, float cy, float x, float y) {
+  float x0, y0;
+  int n;
+
+  if (path_current(path, &x0, &y0))
+    return 1;
+  n = path_segments(x0 - 2 * cx + x, y0 - 2 * cy + y,
+                    2.0f / 8 / PATH_TOLERANCE);
+  for (int i = 1; i < n; i++) {
+    float t = (float)i / n;
+    float u = 1.0f - t;
+    if (path_point(path, u * u * x0 + 2 * u * t * cx + t * t * x,
+                   u * u * y0 + 2 * u * t * cy + t * t * y))
+      return 1;
+  }
+  return path_point(path, x, y);
+}
+
+int path_cubic_to(struct path *path, float c0x, float c0y, float c1x,
+                  float c1y, float x, float y) {
+  float x0, y0, ax, ay, bx, by;
+  int n;
+
+  if (path_current(path, &x0, &y0))
+    return 1;
+  ax = x0 - 2 * c0x + c1x;
+  ay = y0 - 2 * c0y + c1y;
+  bx = c0x - 2 * c1x + x;
+  by = c0y - 2 * c1y + y;
+  if (bx * bx + by * by > ax * ax + ay * ay) {
+    ax = bx;
+    ay = by;
+  }
+  n = path_segments(ax, ay, 6.0f / 8 / PATH_TOLERANCE);
+  for (int i = 1; i < n; i++) {
+    float t = (float)i / n;
+    float u = 1.0f - t;
+    float a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t, d = t * t * t;
+    if (path_point(path, a * x0 + b * c0x + c * c1x + d * x,
+                   a * y0 + b * c0y + c * c1y + d * y))
+      return 1;
+  }
+  return path_point(path, x, y);
+}
+
+void path_close(struct path *path) {
+  if (path->open) {
+    path->contours[path->contour_count - 1].closed = true;
+    path->open = false;
+  }
+}
+
+int path_add_rect(struct path *path, float x, float y, float width,
+                  float height, float radius) {
+  float x1 = x + width, y1 = y + height;
+  int ret;
+
+  if (radius > width / 2)
+    radius = width / 2;
+  if (radius > height / 2)
+    radius = height / 2;
+  if (radius <= 0) {
+    ret = path_move_to(path, x, y) || path_line_to(path, x1, y) ||
+          path_line_to(path, x1, y1) || path_line_to(path, x, y1);
+  } else {
+    /* the control points of a cubic quarter circle */
+    float k = radius * (1.0f - 0.5522847f);
+    ret = path_move_to(path, x + radius, y) ||
+          path_line_to(path, x1 - radius, y) ||
+          path_cubic_to(path, x1 - k, y, x1, y + k, x1, y + radius) ||
+          path_line_to(path, x1, y1 - radius) ||
+          path_cubic_to(path, x1, y1 - k, x1 - k, y1, x1 - radius, y1) ||
+          path_line_to(path, x + radius, y1) ||
+          path_cubic_to(path, x + k, y1, x, y1 - k, x, y1 - radius) ||
+          path_line_to(path, x, y + radius) ||
+          path_cubic_to(path, x, y + k, x + k, y, x + radius, y);
+  }
+  path_close(path);
+  return ret;
+}
+
+static int path_floor(float v) {
+  int i = (int)v;
+  return i - (v < i);
+}
+
+static int path_ceil(float v) {
+  int i = (int)v;
+  return i + (v > i);
+}
+
+void path_get_bounds(const struct path *path, struct draw_rect *box) {
+  memset(box, 0, sizeof(struct draw_rect));
+  if (!path->count)
+    return;
+  box->x0 = path_floor(path->x0);
+  box->y0 = path_floor(path->y0);
+  box->x1 = path_ceil(path->x1);
+  box->y1 = path_ceil(path->y1);
+  if (box->x0 >= box->x1 || box->y0 >= box->y1)
+    memset(box, 0, sizeof(struct draw_rect));
+}
+
+int path_contour_count(const struct path *path) {
+  return path->contour_count;
+}
+
+const float *path_contour(const struct path *path, int i, int *count,
+                          int *closed) {
+  int end = i + 1 < path->contour_count ? path->contours[i + 1].start
+                                        : path->count;
+  *count = end - path->contours[i].start;
+  *closed = path->contours[i].closed;
+  return path->points + path->contours[i].start * 2;
+}
+
+/*
+ * Kernels turning a row of cells into coverage: sum + the running sum of
+ * acc, folded by the rule and clamped to [0, 1]. The cells are cleared
+ * for the next band, the sum at the end of the row is returned.
+ */
+struct path_kernels {
+  const char *name;
+  float (*resolve)(float *acc, uint8_t *out, int count, int even_odd,
+                   float sum);
+};
+
+static inline uint8_t path_coverage(float sum, int even_odd) {
+  float v = sum < 0 ? -sum : sum;
+  if (even_odd) {
+    v -= 2.0f * (int)(v * 0.5f);
+    v = v < 2.0f - v ? v : 2.0f - v;
+  } else if (v > 1.0f) {
+    v = 1.0f;
+  }
+  return (uint8_t)(v * 255.0f + 0.5f);
+}
+
+static float path_resolve_scalar(float *acc, uint8_t *out, int count,
+                                 int even_odd, float sum) {
+  for (int i = 0; i < count; i++) {
+    sum += acc[i];
+    acc[i] = 0;
+    out[i] = path_coverage(sum, even_odd);
+  }
+  return sum;
+}
+
+static const struct path_kernels path_kernels_scalar = {
+  .name = "scalar",
+  .resolve = path_resolve_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/* SSE2 kernels, 4 cells at a time, the sum is a shift and add scan */
+#define PATH_SSE2 __attribute__((target("sse2"), always_inline)) inline
+
+static PATH_SSE2 __m128 path_fold_sse2(__m128 v, int even_odd) {
+  v = _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+  if (even_odd) {
+    __m128 t = _mm_cvtepi32_ps(
+      _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps(0.5f))));
+    v = _mm_sub_ps(v, _mm_add_ps(t, t));
+    return _mm_min_ps(v, _mm_sub_ps(_mm_set1_ps(2.0f), v));
+  }
+  return _mm_min_ps(v, _mm_set1_ps(1.0f));
+}
+
+static PATH_SSE2 float path_resolve_rule_sse2(float *acc, uint8_t *out,
+                                              int count, int even_odd,
+                                              float sum) {
+  __m128 carry = _mm_set1_ps(sum);
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 v = _mm_loadu_ps(acc + i);
+    __m128i c;
+    int32_t packed;
+    v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+    v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+    v = _mm_add_ps(v, carry);
+    carry = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(acc + i, _mm_setzero_ps());
+    v = _mm_add_ps(_mm_mul_ps(path_fold_sse2(v, even_odd),
+                              _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f));
+    c = _mm_cvttps_epi32(v);
+    c = _mm_packs_epi32(c, c);
+    packed = _mm_cvtsi128_si32(_mm_packus_epi16(c, c));
+    memcpy(out + i, &packed, 4);
+  }
+  return path_resolve_scalar(acc + i, out + i, count - i, even_odd,
+                             _mm_cvtss_f32(carry));
+}
+
+__attribute__((target("sse2")))
+static float path_resolve_sse2(float *acc, uint8_t *out, int count,
+                               int even_odd, float sum) {
+  if (even_odd)
+    return path_resolve_rule_sse2(acc, out, count, 1, sum);
+  return path_resolve_rule_sse2(acc, out, count, 0, sum);
+}
+
+static const struct path_kernels path_kernels_sse2 = {
+  .name = "sse2",
+  .resolve = path_resolve_sse2,
+};
+
+/* AVX2 kernels, 8 cells at a time, the lanes are scanned apart and the
+ * low one is carried into the high one */
+#define PATH_AVX2 __attribute__((target("avx2"), always_inline)) inline
+
+static PATH_AVX2 float path_resolve_rule_avx2(float *acc, uint8_t *out,
+                                              int count, int even_odd,
+                                              float sum) {
+  __m256 carry = _mm256_set1_ps(sum);
+  __m256i last = _mm256_set1_epi32(7);
+  __m256i mid = _mm256_set1_epi32(3);
+  __m256 sign = _mm256_set1_ps(-0.0f);
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256 v = _mm256_loadu_ps(acc + i);
+    __m128i lo, hi;
+    __m256i c;
+    v = _mm256_add_ps(v, _mm256_castsi256_ps(
+                             _mm256_slli_si256(_mm256_castps_si256(v), 4)));
+    v = _mm256_add_ps(v, _mm256_castsi256_ps(
+                             _mm256_slli_si256(_mm256_castps_si256(v), 8)));
+    v = _mm256_add_ps(v, _mm256_blend_ps(_mm256_setzero_ps(),
+                                         _mm256_permutevar8x32_ps(v, mid),
+                                         0xF0));
+    v = _mm256_add_ps(v, carry);
+    carry = _mm256_permutevar8x32_ps(v, last);
+    _mm256_storeu_ps(acc + i, _mm256_setzero_ps());
+    v = _mm256_andnot_ps(sign, v);
+    if (even_odd) {
+      __m256 t = _mm256_round_ps(_mm256_mul_ps(v, _mm256_set1_ps(0.5f)),
+                                 _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+      v = _mm256_sub_ps(v, _mm256_add_ps(t, t));
+      v = _mm256_min_ps(v, _mm256_sub_ps(_mm256_set1_ps(2.0f), v));
+    } else {
+      v = _mm256_min_ps(v, _mm256_set1_ps(1.0f));
+    }
+    c = _mm256_cvttps_epi32(_mm256_add_ps(
+      _mm256_mul_ps(v, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+    lo = _mm_packs_epi32(_mm256_castsi256_si128(c),
+                         _mm256_extracti128_si256(c, 1));
+    hi = _mm_packus_epi16(lo, lo);
+    _mm_storel_epi64((__m128i *)(out + i), hi);
+  }
+  return path_resolve_scalar(acc + i, out + i, count - i, even_odd,
+                             _mm256_cvtss_f32(carry));
+}
+
+__attribute__((target("avx2")))
+static float path_resolve_avx2(float *acc, uint8_t *out, int count,
+                               int even_odd, float sum) {
+  if (even_odd)
+    return path_resolve_rule_avx2(acc, out, count, 1, sum);
+  return path_resolve_rule_avx2(acc, out, count, 0, sum);
+}
+
+static const struct path_kernels path_kernels_avx2 = {
+  .name = "avx2",
+  .resolve = path_resolve_avx2,
+};
+#endif
+
+static const struct path_kernels *g_path_kernels = NULL;
+
+void path_kernels_select(unsigned int features) {
+  const struct path_kernels *k = &path_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  if (features & CPU_FEATURE_AVX2)
+    k = &path_kernels_avx2;
+  else if (features & CPU_FEATURE_SSE2)
+    k = &path_kernels_sse2;
+#endif
+  __atomic_store_n(&g_path_kernels, k, __ATOMIC_RELEASE);
+}
+
+static const struct path_kernels *path_kernels_get(void) {
+  const struct path_kernels *k =
+    __atomic_load_n(&g_path_kernels, __ATOMIC_ACQUIRE);
+  if (!k) {
+    path_kernels_select(cpu_features());
+    k = __atomic_load_n(&g_path_kernels, __ATOMIC_ACQUIRE);
+  }
+  return k;
+}
+
+const char *path_kernels_name(void) { return path_kernels_get()->name; }
+
+/* a line of the path, y0 < y1, in cells of the box */
+struct path_edge {
+  float x0;
+  float y0;
+  float dxdy;
+  float y1;
+  float dir; // 1 going down, -1 going up
+};
+
+/* where the coverage of the rows goes */
+struct path_target {
+  struct draw_surface *surf; // NULL for a coverage buffer
+  uint32_t color; // premultiplied
+  uint8_t *coverage;
+  int stride;
+};
+
+struct path_raster {
+  struct path_edge *edges; // in the order of the path
+  int edge_count;
+  int edge_cap; // -1 once they could not grow
+  int *band_start; // of the edges of each band in order
+  struct path_edge *sorted; // the edges by the band they start in
+  int *active; // edges crossing the band
+  int width; // of the box
+  int height;
+  int even_odd;
+  float *acc; // PATH_BAND_ROWS rows of width + 2 cells
+  int x_min[PATH_BAND_ROWS]; // the cells touched in each row
+  int x_max[PATH_BAND_ROWS];
+  uint8_t *mask; // a row of coverage
+};
+
+/* edges from above the box start in the first band */
+static inline int path_edge_band(float y0) {
+  return (int)((unsigned int)(y0 > 0 ? y0 : 0) / PATH_BAND_ROWS);
+}
+
+static int path_raster_grow(struct path_raster *r) {
+  int cap = r->edge_cap * 2;
+  struct path_edge *edges;
+
+  if (r->edge_cap < 0)
+    return 1;
+  edges = realloc(r->edges, (size_t)cap * sizeof(struct path_edge));
+  if (!edges) {
+    err_log("%s: no enough memory\n", __func__);
+    r->edge_cap = -1;
+    return 1;
+  }
+  r->edges = edges;
+  r->edge_cap = cap;
+  return 0;
+}
+
+static inline void path_edge_push(struct path_raster *r, float x0,
+                                  float y0, float x1, float y1) {
+  /* outlines go up and down at random, the ends are picked by an index
+   * rather than a branch */
+  float xs[2] = {x0, x1}, ys[2] = {y0, y1};
+  int down = y0 < y1;
+  float ya = ys[!down], yb = ys[down];
+  struct path_edge *e;
+
+  if (ya == yb || yb <= 0 || ya >= r->height)
+    return;
+  if (r->edge_count == r->edge_cap && path_raster_grow(r))
+    return;
+  r->band_start[path_edge_band(ya) + 2]++;
+  e = &r->edges[r->edge_count++];
+  e->x0 = xs[!down];
+  e->y0 = ya;
+  e->dxdy = (xs[down] - e->x0) / (yb - ya);
+  e->y1 = yb;
+  e->dir = (float)(down * 2 - 1);
+}
+
+/*
+ * Lines are cut at the left and right of the box: left of it a line only
+ * changes the winding, it is moved onto the left side; right of it
+ * nothing is seen, it is moved onto the right side.
+ */
+static void path_edge_add(struct path_raster *r, float x0, float y0,
+                          float x1, float y1) {
+  float w = (float)r->width;
+  float cuts[2];
+  int n = 0;
+
+  if (x0 >= 0 && x1 >= 0 && x0 <= w && x1 <= w) {
+    path_edge_push(r, x0, y0, x1, y1);
+    return;
+  }
+  if ((x0 < 0) != (x1 < 0))
+    cuts[n++] = 0;
+  if ((x0 < w) != (x1 < w))
+    cuts[n++] = w;
+  if (n == 2 && x0 > x1) {
+    cuts[0] = w;
+    cuts[1] = 0;
+  }
+  for (int i = 0; i <= n; i++) {
+    float xa = x0, ya = y0, xb = x1, yb = y1;
+    if (i > 0) {
+      xa = cuts[i - 1];
+      ya = y0 + (y1 - y0) * (xa - x0) / (x1 - x0);
+    }
+    if (i < n) {
+      xb = cuts[i];
+      yb = y0 + (y1 - y0) * (xb - x0) / (x1 - x0);
+    }
+    xa = xa < 0 ? 0 : xa > w ? w : xa;
+    xb = xb < 0 ? 0 : xb > w ? w : xb;
+    path_edge_push(r, xa, ya, xb, yb);
+  }
+}
+
+/* the edges of the path inside the box, every contour closed */
+static void path_raster_edges(struct path_raster *r, const struct path *path,
+                              const struct draw_rect *box) {
+  for (int c = 0; c < path->contour_count; c++) {
+    int count, closed;
+    const float *p = path_contour(path, c, &count, &closed);
+    for (int i = 0; i < count; i++) {
+      const float *q = i + 1 < count ? p + i * 2 + 2 : p;
+      path_edge_add(r, p[i * 2] - box->x0, p[i * 2 + 1] - box->y0,
+                    q[0] - box->x0, q[1] - box->y0);
+    }
+  }
+}
+
+static int path_raster_init(struct path_raster *r, const struct path *path,
+                            const struct draw_rect *box, int even_odd) {
+  int bands;
+
+  memset(r, 0, sizeof(struct path_raster));
+  r->width = box->x1 - box->x0;
+  r->height = box->y1 - box->y0;
+  r->even_odd = even_odd;
+  bands = (r->height + PATH_BAND_ROWS - 1) / PATH_BAND_ROWS;
+  /* a line to every point, more if the sides of the box cut some */
+  r->edge_cap = path->count + 16;
+  r->edges = malloc((size_t)r->edge_cap * sizeof(struct path_edge));
+  r->band_start = calloc(bands + 2, sizeof(int));
+  r->acc = calloc((size_t)PATH_BAND_ROWS * (r->width + 2), sizeof(float));
+  r->mask = malloc(r->width);
+  if (!r->edges || !r->band_start || !r->acc || !r->mask) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  /*
+   * The edges are made and counted by band in one walk of the path, then
+   * only their indices are sorted by band.
+   */
+  path_raster_edges(r, path, box);
+  if (r->edge_cap < 0)
+    return 1;
+  for (int b = 2; b < bands + 2; b++)
+    r->band_start[b] += r->band_start[b - 1];
+  r->sorted = malloc(((size_t)r->edge_count + 1) * sizeof(struct path_edge));
+  r->active = malloc(((size_t)r->edge_count + 1) * sizeof(int));
+  if (!r->sorted || !r->active) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  for (int i = 0; i < r->edge_count; i++)
+    r->sorted[r->band_start[path_edge_band(r->edges[i].y0) + 1]++] =
+        r->edges[i];
+  return 0;
+}
+
+static void path_raster_fini(struct path_raster *r) {
+  free(r->edges);
+  free(r->band_start);
+  free(r->sorted);
+  free(r->active);
+  free(r->acc);
+  free(r->mask);
+}
+
+/* the signed area right of the edge in each cell it crosses in the band */
+static void path_raster_edge(struct path_raster *r, const struct path_edge *e,
+                             int band) {
+  int stride = r->width + 2;
+  float dxdy = e->dxdy;
+  float y0 = e->y0 > band ? e->y0 : (float)band;
+  float y1 = e->y1;
+  float x = e->x0 + (y0 - e->y0) * dxdy;
+  int ystart = (int)y0;
+  int yend = path_ceil(y1);
+  float x_end;
+  int xi;
+
+  if (yend > band + PATH_BAND_ROWS)
+    yend = band + PATH_BAND_ROWS;
+  if (yend > r->height)
+    yend = r->height;
+  /* steep edges of thin lines stay in a column, no cell of a row is
+   * looked for */
+  x_end = x + ((float)yend < y1 ? yend - y0 : y1 - y0) * dxdy;
+  xi = path_floor(x);
+  if (xi == path_floor(x_end) && xi >= 0 && xi < r->width) {
+    for (int y = ystart; y < yend; y++) {
+      int row_index = y - band;
+      float *row = r->acc + (size_t)row_index * stride + xi;
+      float dy = (y + 1 < y1 ? y + 1 : y1) - (y > y0 ? y : y0);
+      float xnext = x + dxdy * dy;
+      float d = dy * e->dir;
+      float xm = 0.5f * (x + xnext) - xi;
+      row[0] += d - d * xm;
+      row[1] += d * xm;
+      if (xi < r->x_min[row_index])
+        r->x_min[row_index] = xi;
+      if (xi + 1 > r->x_max[row_index])
+        r->x_max[row_index] = xi + 1;
+      x = xnext;
+    }
+    return;
+  }
+  for (int y = ystart; y < yend; y++) {
+    int row_index = y - band;
+    float *row = r->acc + (size_t)row_index * stride;
+    float dy = (y + 1 < y1 ? y + 1 : y1) - (y > y0 ? y : y0);
+    float xnext = x + dxdy * dy;
+    float d = dy * e->dir;
+    float xa = x < xnext ? x : xnext;
+    float xb = x < xnext ? xnext : x;
+    int xai, xbi;
+
+    /* the clamps only catch rounding */
+    xa = xa < 0 ? 0 : xa > r->width ? r->width : xa;
+    xb = xb < 0 ? 0 : xb > r->width ? r->width : xb;
+    xai = path_floor(xa);
+    xbi = path_ceil(xb);
+    if (xbi <= xai + 1) {
+      /* within a cell, split by the middle of the edge */
+      float xm = 0.5f * (xa + xb) - xai;
+      row[xai] += d - d * xm;
+      row[xai + 1] += d * xm;
+      xbi = xai + 1;
+    } else {
+      float s = 1.0f / (xb - xa);
+      float xaf = xa - xai;
+      float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+      float xbf = xb - xbi + 1.0f;
+      float am = 0.5f * s * xbf * xbf;
+      row[xai] += d * a0;
+      if (xbi == xai + 2) {
+        row[xai + 1] += d * (1.0f - a0 - am);
+      } else {
+        float a1 = s * (1.5f - xaf);
+        float a2 = a1 + (xbi - xai - 3) * s;
+        row[xai + 1] += d * (a1 - a0);
+        for (int xi = xai + 2; xi < xbi - 1; xi++)
+          row[xi] += d * s;
+        row[xbi - 1] += d * (1.0f - a2 - am);
+      }
+      row[xbi] += d * am;
+    }
+    if (xai < r->x_min[row_index])
+      r->x_min[row_index] = xai;
+    if (xbi > r->x_max[row_index])
+      r->x_max[row_index] = xbi;
+    x = xnext;
+  }
+}
+
+/* count pixels of a row, mask NULL covers them all */
+static void path_blend(struct draw_surface *surf, int x, int y,
+                       uint32_t color, const uint8_t *mask, int count) {
+  uint8_t *base = (uint8_t *)surf->pixels + (size_t)y * surf->stride;
+  uint32_t tmp[PATH_CHUNK];
+
+  if (surf->format != PIXEL_FORMAT_RGB565) {
+    blend_span_solid(BLEND_OP_SRC_OVER, (uint32_t *)base + x, color, mask,
+                     count);
+    return;
+  }
+  for (int i = 0; i < count; i += PATH_CHUNK) {
+    int n = count - i < PATH_CHUNK ? count - i : PATH_CHUNK;
+    uint16_t *p = (uint16_t *)base + x + i;
+    pixels_unpack_rgb565(tmp, p, n);
+    blend_span_solid(BLEND_OP_SRC_OVER, tmp, color, mask ? mask + i : NULL,
+                     n);
+    pixels_pack_rgb565(p, tmp, n, x + i, y, surf->dither);
+  }
+}
+
+/*
+ * A summed row out to the target. Left of the first cell touched nothing
+ * is covered, right of the last one the winding stays the same.
+ */
+static void path_raster_row(struct path_raster *r,
+                            const struct path_kernels *k,
+                            const struct path_target *t, int row_index,
+                            int x0, int y) {
+  float *acc = r->acc + (size_t)row_index * (r->width + 2);
+  int start = r->x_min[row_index];
+  int end = r->x_max[row_index] + 1;
+  uint8_t *out = t->coverage ? t->coverage + (size_t)y * t->stride : NULL;
+  uint8_t tail;
+  float sum;
+
+  if (start > end) {
+    if (out)
+      memset(out, 0, r->width);
+    return;
+  }
+  if (end > r->width) {
+    /* the cells right of the box are only cleared */
+    memset(acc + r->width, 0, (end - r->width) * sizeof(float));
+    end = r->width;
+  }
+  if (out) {
+    memset(out, 0, start);
+    sum = k->resolve(acc + start, out + start, end - start, r->even_odd, 0);
+    tail = path_coverage(sum, r->even_odd);
+    memset(out + end, tail, r->width - end);
+    return;
+  }
+  sum = k->resolve(acc + start, r->mask, end - start, r->even_odd, 0);
+  path_blend(t->surf, x0 + start, y, t->color, r->mask, end - start);
+  tail = path_coverage(sum, r->even_odd);
+  if (tail == 255) {
+    path_blend(t->surf, x0 + end, y, t->color, NULL, r->width - end);
+  } else if (tail) {
+    memset(r->mask, tail, r->width - end);
+    path_blend(t->surf, x0 + end, y, t->color, r->mask, r->width - end);
+  }
+}
+
+/* the edges are walked in bands of rows, each is summed as it is done */
+static void path_raster_run(struct path_raster *r, const struct path_target *t,
+                            int x0, int y0) {
+  const struct path_kernels *k = path_kernels_get();
+  int active = 0;
+
+  for (int band = 0; band < r->height; band += PATH_BAND_ROWS) {
+    int rows = r->height - band < PATH_BAND_ROWS ? r->height - band
+                                                 : PATH_BAND_ROWS;
+    int b = band / PATH_BAND_ROWS;
+    int kept = 0;
+    for (int i = 0; i < rows; i++) {
+      r->x_min[i] = r->width + 2;
+      r->x_max[i] = -1;
+    }
+    /* the edges from above, then the ones starting here, the ones going
+     * on below are kept */
+    for (int i = 0; i < active; i++) {
+      const struct path_edge *e = &r->sorted[r->active[i]];
+      path_raster_edge(r, e, band);
+      if (e->y1 > band + PATH_BAND_ROWS)
+        r->active[kept++] = r->active[i];
+    }
+    active = kept;
+    for (int i = r->band_start[b]; i < r->band_start[b + 1]; i++) {
+      const struct path_edge *e = &r->sorted[i];
+      path_raster_edge(r, e, band);
+      if (e->y1 > band + PATH_BAND_ROWS)
+        r->active[active++] = i;
+    }
+    for (int i = 0; i < rows; i++)
+      path_raster_row(r, k, t, i, x0, y0 + band + i);
+  }
+}
+
+int path_fill(struct draw_surface *surf, const struct path *path,
+              enum path_fill_rule rule, uint32_t color) {
+  struct path_target t = {.surf = surf, .color = blend_premultiply(color)};
+  struct path_raster r;
+  struct draw_rect box;
+  int ret = 0;
+
+  path_get_bounds(path, &box);
+  box.x0 = box.x0 > surf->clip.x0 ? box.x0 : surf->clip.x0;
+  box.y0 = box.y0 > surf->clip.y0 ? box.y0 : surf->clip.y0;
+  box.x1 = box.x1 < surf->clip.x1 ? box.x1 : surf->clip.x1;
+  box.y1 = box.y1 < surf->clip.y1 ? box.y1 : surf->clip.y1;
+  if (box.x0 >= box.x1 || box.y0 >= box.y1 || !t.color)
+    return 0;
+  if (path_raster_init(&r, path, &box, rule == PATH_FILL_EVEN_ODD))
+    ret = 1;
+  else
+    path_raster_run(&r, &t, box.x0, box.y0);
+  path_raster_fini(&r);
+  return ret;
+}
+
+int path_rasterize(const struct path *path, enum path_fill_rule rule,
+                   const struct draw_rect *box, uint8_t *coverage,
+                   int stride) {
+  struct path_target t = {.coverage = coverage, .stride = stride};
+  struct path_raster r;
+  int ret = 0;
+
+  if (box->x0 >= box->x1 || box->y0 >= box->y1)
+    return 0;
+  if (path_raster_init(&r, path, box, rule == PATH_FILL_EVEN_ODD))
+    ret = 1;
+  else
+    path_raster_run(&r, &t, 0, 0);
+  path_raster_fini(&r);
+  return ret;
+}
@@ -0,0 +1,72 @@
+#ifndef _PATH_H_
+#define _PATH_H_
+
+#include <stdint.h>
+
+#include "draw.h"
+
+/*
+ * Antialiased fills of paths made of lines, quadratic and cubic curves,
+ * in pixels with y down. Curves are flattened into lines as they are
+ * added, into as few lines as keep them within a tenth of a pixel.
+ *
+ * Filling adds, for every line, the signed area it leaves right of it in
+ * each cell into a band of rows, a running sum along a row then gives the
+ * winding of every pixel, fractional at the edges. The sums are resolved
+ * into coverage by SSE2 or AVX2 kernels, picked from cpuid, and the
+ * coverage goes over the surface through the span kernels of blend.h.
+ * Past the last edge of a row the winding does not change, those pixels
+ * are filled or skipped whole.
+ */
+
+enum path_fill_rule {
+  PATH_FILL_NONZERO,
+  PATH_FILL_EVEN_ODD,
+};
+
+struct path;
+
+struct path *path_make(void);
+void path_free(struct path **ptr);
+/* drop the contours, the memory is kept */
+void path_reset(struct path *path);
+
+/*
+ * They return 1 if the path can not grow, the segment is lost then. A
+ * segment without a current point starts a contour at 0, 0. Every
+ * contour is closed for filling, path_close() matters to the stroker.
+ */
+int path_move_to(struct path *path, float x, float y);
+int path_line_to(struct path *path, float x, float y);
+/* count x y pairs, a line to each in turn */
+int path_lines_to(struct path *path, const float *points, int count);
+int path_quad_to(struct path *path, float cx, float cy, float x, float y);
+int path_cubic_to(struct path *path, float c0x, float c0y, float c1x,
+                  float c1y, float x, float y);
+void path_close(struct path *path);
+/* a closed contour, the corners rounded by radius, 0 for sharp ones */
+int path_add_rect(struct path *path, float x, float y, float width,
+                  float height, float radius);
+
+/* the pixels the path can touch, empty for a path without area */
+void path_get_bounds(const struct path *path, struct draw_rect *box);
+/* the flattened contours, x y pairs of count points each */
+int path_contour_count(const struct path *path);
+const float *path_contour(const struct path *path, int i, int *count,
+                          int *closed);
+
+/* ARGB8888 color over the surface, inside its clip */
+int path_fill(struct draw_surface *surf, const struct path *path,
+              enum path_fill_rule rule, uint32_t color);
+/*
+ * The coverage, 0 to 255, of the pixels of box into coverage, rows stride
+ * bytes apart. Returns 1 if the rows to sum can not be allocated.
+ */
+int path_rasterize(const struct path *path, enum path_fill_rule rule,
+                   const struct draw_rect *box, uint8_t *coverage,
+                   int stride);
+
+void path_kernels_select(unsigned int features);
+const char *path_kernels_name(void);
+
+#endif
@@ -0,0 +1,589 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/utils.h"
+#include "display-list.h"
+#include "scene.h"
+
+#define SCENE_LAYERS_MIN 16
+
+enum scene_content {
+  SCENE_CONTENT_NONE,
+  SCENE_CONTENT_RECT,
+  SCENE_CONTENT_CIRCLE,
+  SCENE_CONTENT_CHECKER,
+  SCENE_CONTENT_IMAGE,
+};
+
+struct scene_layer {
+  uint32_t *pixels; // NULL if none
+  struct draw_rect bounds; // of the subtree, in the coordinates of the node
+  struct damage_region damage; // of the pixels, drawn by the next render
+};
+
+struct scene_node {
+  struct scene *scene;
+  struct scene_node *parent;
+  struct scene_node *first; // children, in drawing order
+  struct scene_node *last;
+  struct scene_node *prev;
+  struct scene_node *next;
+  int x;
+  int y;
+  bool visible;
+  bool cached;
+  bool dirty; // the content changed
+  bool moved; // the position or the visibility changed
+  bool child_dirty; // something below it changed
+  enum scene_content content;
+  int width; // of the content, 2 * radius + 1 for a circle
+  int height;
+  int cell;
+  uint32_t color; // c0 of a checker
+  uint32_t color2;
+  struct blit_image image;
+  enum blit_filter filter;
+  /* as of the last render, in the coordinates of the surface or of the
+   * layer of the closest cached ancestor */
+  struct draw_rect drawn; // the content
+  struct draw_rect footprint; // the subtree, the layer if cached
+  struct scene_layer layer;
+};
+
+struct scene {
+  struct scene_node root;
+  uint32_t background;
+  int width; // of the surface of the last render, 0 before the first
+  int height;
+  struct damage_region damage; // of the surface, since the last render
+  /* the layers the render draws, inner ones first */
+  struct scene_node **layers;
+  int layers_count;
+  int layers_cap;
+  struct display_list *dl;
+  struct scene_stats stats;
+};
+
+static const struct draw_rect scene_rect_none = {0, 0, 0, 0};
+
+static bool scene_rect_empty(struct draw_rect r) {
+  return r.x0 >= r.x1 || r.y0 >= r.y1;
+}
+
+static struct draw_rect scene_rect_move(struct draw_rect r, int dx, int dy) {
+  if (scene_rect_empty(r))
+    return scene_rect_none;
+  r.x0 += dx;
+  r.y0 += dy;
+  r.x1 += dx;
+  r.y1 += dy;
+  return r;
+}
+
+static struct draw_rect scene_rect_union(struct draw_rect a,
+                                         struct draw_rect b) {
+  if (scene_rect_empty(a))
+    return b;
+  if (scene_rect_empty(b))
+    return a;
+  a.x0 = a.x0 < b.x0 ? a.x0 : b.x0;
+  a.y0 = a.y0 < b.y0 ? a.y0 : b.y0;
+  a.x1 = a.x1 > b.x1 ? a.x1 : b.x1;
+  a.y1 = a.y1 > b.y1 ? a.y1 : b.y1;
+  return a;
+}
+
+static bool scene_rect_equal(struct draw_rect a, struct draw_rect b) {
+  return a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1;
+}
+
+static bool scene_rect_overlap(struct draw_rect a, struct draw_rect b) {
+  return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+static void scene_damage(struct damage_region *damage, struct draw_rect r) {
+  if (!scene_rect_empty(r))
+    damage_region_add(damage, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+}
+
+static void scene_node_init(struct scene_node *node, struct scene *scene) {
+  memset(node, 0, sizeof(struct scene_node));
+  node->scene = scene;
+  node->visible = true;
+  /* a new node draws everything it has on the next render */
+  node->moved = true;
+  damage_region_init(&node->layer.damage, 0, 0);
+}
+
+struct scene *scene_make(uint32_t background) {
+  struct scene *new = NULL;
+  new = malloc(sizeof(struct scene));
+  if (!new)
+    return NULL;
+  memset(new, 0, sizeof(struct scene));
+  new->dl = display_list_make();
+  if (!new->dl) {
+    free(new);
+    return NULL;
+  }
+  scene_node_init(&new->root, new);
+  new->background = background;
+  damage_region_init(&new->damage, 0, 0);
+  return new;
+}
+
+static void scene_layer_free(struct scene_node *node) {
+  if (node->layer.pixels) {
+    free(node->layer.pixels);
+    node->layer.pixels = NULL;
+    node->scene->stats.layers--;
+  }
+}
+
+/* the subtree, without damaging anything */
+static void scene_node_destroy(struct scene_node *node) {
+  struct scene_node *child = node->first;
+  while (child) {
+    struct scene_node *next = child->next;
+    scene_node_destroy(child);
+    child = next;
+  }
+  scene_layer_free(node);
+  node->scene->stats.nodes--;
+  free(node);
+}
+
+void scene_free(struct scene **ptr) {
+  struct scene *scene = *ptr;
+  if (scene) {
+    struct scene_node *child = scene->root.first;
+    while (child) {
+      struct scene_node *next = child->next;
+      scene_node_destroy(child);
+      child = next;
+    }
+    display_list_free(&scene->dl);
+    free(scene->layers);
+    free(scene);
+    *ptr = NULL;
+  }
+}
+
+/* the ancestors have to walk down to it on the next render */
+static void scene_node_mark_parents(struct scene_node *node) {
+  for (struct scene_node *p = node->parent; p; p = p->parent)
+    p->child_dirty = true;
+}
+
+static void scene_node_mark(struct scene_node *node, bool moved) {
+  if (moved)
+    node->moved = true;
+  else
+    node->dirty = true;
+  scene_node_mark_parents(node);
+}
+
+struct scene_node *scene_node_make(struct scene *scene,
+                                   struct scene_node *parent) {
+  struct scene_node *new = NULL;
+  new = malloc(sizeof(struct scene_node));
+  if (!new)
+    return NULL;
+  scene_node_init(new, scene);
+  new->parent = parent ? parent : &scene->root;
+  new->prev = new->parent->last;
+  if (new->prev)
+    new->prev->next = new;
+  else
+    new->parent->first = new;
+  new->parent->last = new;
+  scene->stats.nodes++;
+  scene_node_mark_parents(new);
+  return new;
+}
+
+/*
+ * Damage what the subtree drew where it drew it, the surface or the layer
+ * of the closest cached ancestor.
+ */
+static void scene_node_detach(struct scene_node *node) {
+  struct damage_region *damage = &node->scene->damage;
+
+  for (struct scene_node *p = node->parent; p; p = p->parent) {
+    if (p->cached && p->layer.pixels) {
+      damage = &p->layer.damage;
+      break;
+    }
+  }
+  scene_damage(damage, node->footprint);
+  scene_node_mark_parents(node);
+}
+
+/* what the subtree drew is gone, cached descendants keep their layers */
+static void scene_node_forget(struct scene_node *node, bool top) {
+  node->drawn = scene_rect_none;
+  node->footprint = scene_rect_none;
+  if (node->cached && !top)
+    return;
+  for (struct scene_node *child = node->first; child; child = child->next)
+    scene_node_forget(child, false);
+}
+
+void scene_node_free(struct scene_node **ptr) {
+  struct scene_node *node = *ptr;
+  if (node) {
+    scene_node_detach(node);
+    if (node->prev)
+      node->prev->next = node->next;
+    else
+      node->parent->first = node->next;
+    if (node->next)
+      node->next->prev = node->prev;
+    else
+      node->parent->last = node->prev;
+    scene_node_destroy(node);
+    *ptr = NULL;
+  }
+}
+
+void scene_node_set_position(struct scene_node *node, int x, int y) {
+  if (node->x == x && node->y == y)
+    return;
+  node->x = x;
+  node->y = y;
+  scene_node_mark(node, true);
+}
+
+void scene_node_set_visible(struct scene_node *node, bool visible) {
+  if (node->visible == visible)
+    return;
+  node->visible = visible;
+  scene_node_mark(node, true);
+}
+
+/* the subtree moves to another target, it draws there anew */
+void scene_node_set_cached(struct scene_node *node, bool cached) {
+  if (node->cached == cached)
+    return;
+  scene_node_detach(node);
+  scene_node_forget(node, true);
+  scene_layer_free(node);
+  node->cached = cached;
+  scene_node_mark(node, true);
+}
+
+static void scene_node_set_content(struct scene_node *node,
+                                   enum scene_content content, int width,
+                                   int height, int cell, uint32_t color,
+                                   uint32_t color2) {
+  if (width <= 0 || height <= 0)
+    content = SCENE_CONTENT_NONE;
+  if (content == SCENE_CONTENT_NONE)
+    width = height = cell = color = color2 = 0;
+  if (node->content == content && node->width == width &&
+      node->height == height && node->cell == cell && node->color == color &&
+      node->color2 == color2 && content != SCENE_CONTENT_IMAGE)
+    return;
+  node->content = content;
+  node->width = width;
+  node->height = height;
+  node->cell = cell;
+  node->color = color;
+  node->color2 = color2;
+  scene_node_mark(node, false);
+}
+
+void scene_node_set_rect(struct scene_node *node, int width, int height,
+                         uint32_t color) {
+  scene_node_set_content(node, SCENE_CONTENT_RECT, width, height, 0, color,
+                         0);
+}
+
+void scene_node_set_circle(struct scene_node *node, int radius,
+                           uint32_t color) {
+  scene_node_set_content(node, SCENE_CONTENT_CIRCLE, 2 * radius + 1,
+                         2 * radius + 1, 0, color, 0);
+}
+
+void scene_node_set_checker(struct scene_node *node, int width, int height,
+                            int cell, uint32_t c0, uint32_t c1) {
+  scene_node_set_content(node, cell > 0 ? SCENE_CONTENT_CHECKER
+                                        : SCENE_CONTENT_NONE,
+                         width, height, cell, c0, c1);
+}
+
+void scene_node_set_image(struct scene_node *node, int width, int height,
+                          const struct blit_image *image,
+                          enum blit_filter filter) {
+  node->image = *image;
+  node->filter = filter;
+  scene_node_set_content(node, SCENE_CONTENT_IMAGE, width, height, 0, 0, 0);
+}
+
+void scene_node_invalidate(struct scene_node *node) {
+  scene_node_mark(node, false);
+}
+
+/* the content in the coordinates of the node */
+static struct draw_rect scene_node_content(const struct scene_node *node) {
+  struct draw_rect r = {0, 0, node->width, node->height};
+  return node->content == SCENE_CONTENT_NONE ? scene_rect_none : r;
+}
+
+/* what the visible part of the subtree covers, in its coordinates */
+static struct draw_rect scene_node_bounds(const struct scene_node *node) {
+  struct draw_rect bounds = scene_node_content(node);
+  for (struct scene_node *child = node->first; child; child = child->next) {
+    if (child->visible)
+      bounds = scene_rect_union(
+        bounds, scene_rect_move(scene_node_bounds(child), child->x, child->y));
+  }
+  return bounds;
+}
+
+static void scene_node_update(struct scene *scene, struct scene_node *node,
+                              struct damage_region *damage, int dx, int dy,
+                              bool visible, bool force);
+
+/* the children draw into the layer, the layer into the target */
+static void scene_node_update_layer(struct scene *scene,
+                                    struct scene_node *node,
+                                    struct damage_region *damage, int dx,
+                                    int dy, bool visible, bool force) {
+  struct scene_layer *layer = &node->layer;
+  struct draw_rect bounds = visible ? scene_node_bounds(node) : scene_rect_none;
+  struct draw_rect footprint = scene_rect_move(bounds, dx, dy);
+  struct draw_rect drawn;
+  int width = bounds.x1 - bounds.x0;
+  int height = bounds.y1 - bounds.y0;
+  bool fresh = false;
+
+  /* hidden, the layer waits for the node to show again */
+  if (scene_rect_empty(bounds)) {
+    if (!visible && !force)
+      return;
+    scene_damage(damage, node->footprint);
+    node->footprint = scene_rect_none;
+    if (visible)
+      scene_layer_free(node);
+    return;
+  }
+  if (!layer->pixels || !scene_rect_equal(bounds, layer->bounds)) {
+    int old_width = layer->bounds.x1 - layer->bounds.x0;
+    int old_height = layer->bounds.y1 - layer->bounds.y0;
+    if (!layer->pixels || width != old_width || height != old_height) {
+      scene_layer_free(node);
+      layer->pixels = malloc((size_t)width * height * 4);
+      if (!layer->pixels) {
+        err_log("%s: no enough memory\n", __func__);
+        scene_damage(damage, node->footprint);
+        node->footprint = scene_rect_none;
+        return;
+      }
+      scene->stats.layers++;
+    }
+    layer->bounds = bounds;
+    damage_region_init(&layer->damage, width, height);
+    damage_region_add_all(&layer->damage);
+    fresh = true;
+  }
+  drawn = scene_rect_move(scene_node_content(node), -bounds.x0, -bounds.y0);
+  if (fresh || node->dirty) {
+    scene_damage(&layer->damage, node->drawn);
+    scene_damage(&layer->damage, drawn);
+    node->drawn = drawn;
+  }
+  for (struct scene_node *child = node->first; child; child = child->next)
+    scene_node_update(scene, child, &layer->damage, -bounds.x0, -bounds.y0,
+                      true, fresh);
+  if (fresh || force) {
+    scene_damage(damage, node->footprint);
+    scene_damage(damage, footprint);
+  } else {
+    for (int i = 0; i < layer->damage.count; i++) {
+      struct damage_rect *r = &layer->damage.rects[i];
+      damage_region_add(damage, footprint.x0 + r->x, footprint.y0 + r->y,
+                        r->width, r->height);
+    }
+  }
+  node->footprint = footprint;
+  if (damage_region_empty(&layer->damage))
+    return;
+  if (scene->layers_count == scene->layers_cap) {
+    int cap = scene->layers_cap ? scene->layers_cap * 2 : SCENE_LAYERS_MIN;
+    struct scene_node **layers =
+      realloc(scene->layers, cap * sizeof(struct scene_node *));
+    if (!layers) {
+      err_log("%s: no enough memory\n", __func__);
+      return;
+    }
+    scene->layers = layers;
+    scene->layers_cap = cap;
+  }
+  scene->layers[scene->layers_count++] = node;
+}
+
+/*
+ * Damage where the changed nodes were and are now. (dx, dy) takes the
+ * coordinates of the parent to the target, force is set below a node that
+ * moved, everything there moved with it.
+ */
+static void scene_node_update(struct scene *scene, struct scene_node *node,
+                              struct damage_region *damage, int dx, int dy,
+                              bool visible, bool force) {
+  struct draw_rect drawn;
+  struct draw_rect footprint;
+
+  if (!force && !node->dirty && !node->moved && !node->child_dirty)
+    return;
+  visible = visible && node->visible;
+  dx += node->x;
+  dy += node->y;
+  if (node->cached) {
+    scene_node_update_layer(scene, node, damage, dx, dy, visible,
+                            force || node->moved);
+  } else {
+    force = force || node->moved;
+    if (force || node->dirty) {
+      drawn = visible ? scene_rect_move(scene_node_content(node), dx, dy)
+                      : scene_rect_none;
+      scene_damage(damage, node->drawn);
+      scene_damage(damage, drawn);
+      node->drawn = drawn;
+    }
+    footprint = node->drawn;
+    for (struct scene_node *child = node->first; child; child = child->next) {
+      scene_node_update(scene, child, damage, dx, dy, visible, force);
+      footprint = scene_rect_union(footprint, child->footprint);
+    }
+    node->footprint = footprint;
+  }
+  node->dirty = false;
+  node->moved = false;
+  node->child_dirty = false;
+}
+
+static int scene_record_content(struct display_list *dl,
+                                const struct scene_node *node, int x, int y) {
+  int radius = (node->width - 1) / 2;
+
+  switch (node->content) {
+  case SCENE_CONTENT_NONE:
+    break;
+  case SCENE_CONTENT_RECT:
+    return display_list_fill_rect(dl, x, y, node->width, node->height,
+                                  node->color);
+  case SCENE_CONTENT_CIRCLE:
+    return display_list_fill_circle(dl, x + radius, y + radius, radius,
+                                    node->color);
+  case SCENE_CONTENT_CHECKER:
+    return display_list_fill_checker(dl, x, y, node->width, node->height,
+                                     node->cell, node->color, node->color2);
+  case SCENE_CONTENT_IMAGE:
+    return display_list_blit(dl, x, y, node->width, node->height,
+                             &node->image, 0, 0, node->image.width,
+                             node->image.height, node->filter,
+                             BLEND_OP_SRC_OVER);
+  }
+  return 0;
+}
+
+/* the subtree with the node at (x, y) of the target, what is inside clip */
+static int scene_record(struct display_list *dl, const struct scene_node *node,
+                        int x, int y, struct draw_rect clip, bool layer) {
+  int ret = 0;
+
+  if (node->cached && node->layer.pixels && !layer) {
+    const struct draw_rect *b = &node->layer.bounds;
+    int width = b->x1 - b->x0;
+    int height = b->y1 - b->y0;
+    struct blit_image image = {node->layer.pixels, width * 4, width, height,
+                               PIXEL_FORMAT_ARGB8888};
+    return display_list_blit(dl, x + b->x0, y + b->y0, width, height, &image,
+                             0, 0, width, height, BLIT_FILTER_NEAREST,
+                             BLEND_OP_SRC_OVER);
+  }
+  ret |= scene_record_content(dl, node, x, y);
+  for (struct scene_node *child = node->first; child; child = child->next) {
+    if (child->visible && scene_rect_overlap(child->footprint, clip))
+      ret |= scene_record(dl, child, x + child->x, y + child->y, clip, false);
+  }
+  return ret;
+}
+
+/* the rect around all the rects of a region */
+static struct draw_rect scene_damage_bounds(const struct damage_region *damage) {
+  struct draw_rect bounds = scene_rect_none;
+  for (int i = 0; i < damage->count; i++) {
+    const struct damage_rect *r = &damage->rects[i];
+    struct draw_rect rect = {r->x, r->y, r->x + r->width, r->y + r->height};
+    bounds = scene_rect_union(bounds, rect);
+  }
+  return bounds;
+}
+
+static int scene_draw_layer(struct scene *scene, struct tile_renderer *tr,
+                            struct scene_node *node) {
+  struct scene_layer *layer = &node->layer;
+  struct draw_rect clip = scene_damage_bounds(&layer->damage);
+  int width = layer->bounds.x1 - layer->bounds.x0;
+  int height = layer->bounds.y1 - layer->bounds.y0;
+  struct draw_surface surf;
+  int ret = 0;
+
+  display_list_reset(scene->dl);
+  display_list_set_clip(scene->dl, clip.x0, clip.y0, clip.x1 - clip.x0,
+                        clip.y1 - clip.y0);
+  /* transparent where the subtree draws nothing */
+  ret |= display_list_fill_rect(scene->dl, 0, 0, width, height, 0);
+  ret |= scene_record(scene->dl, node, -layer->bounds.x0, -layer->bounds.y0,
+                      clip, true);
+  draw_surface_init(&surf, layer->pixels, width * 4, width, height);
+  draw_surface_set_format(&surf, PIXEL_FORMAT_ARGB8888, 0);
+  ret |= display_list_replay(scene->dl, tr, &surf, &layer->damage);
+  damage_region_clear(&layer->damage);
+  scene->stats.layers_drawn++;
+  return ret;
+}
+
+int scene_render(struct scene *scene, struct tile_renderer *tr,
+                 const struct draw_surface *surf,
+                 struct damage_region *damage) {
+  struct draw_rect clip;
+  int ret = 0;
+
+  if (surf->width != scene->width || surf->height != scene->height) {
+    scene->width = surf->width;
+    scene->height = surf->height;
+    damage_region_init(&scene->damage, surf->width, surf->height);
+    damage_region_add_all(&scene->damage);
+  }
+  scene->layers_count = 0;
+  scene->stats.layers_drawn = 0;
+  scene_node_update(scene, &scene->root, &scene->damage, 0, 0, true, false);
+  /* the layers are blitted below, they are drawn first */
+  for (int i = 0; i < scene->layers_count; i++)
+    ret |= scene_draw_layer(scene, tr, scene->layers[i]);
+  scene->stats.damage_rects = scene->damage.count;
+  scene->stats.damage_area = damage_region_area(&scene->damage);
+  if (!damage_region_empty(&scene->damage)) {
+    clip = scene_damage_bounds(&scene->damage);
+    display_list_reset(scene->dl);
+    display_list_set_clip(scene->dl, clip.x0, clip.y0, clip.x1 - clip.x0,
+                          clip.y1 - clip.y0);
+    ret |= display_list_fill_rect(scene->dl, 0, 0, scene->width,
+                                  scene->height, scene->background);
+    ret |= scene_record(scene->dl, &scene->root, 0, 0, clip, false);
+    ret |= display_list_replay(scene->dl, tr, surf, &scene->damage);
+  }
+  damage_region_union(damage, &scene->damage);
+  damage_region_clear(&scene->damage);
+  return ret;
+}
+
+void scene_get_stats(struct scene *scene, struct scene_stats *stats) {
+  *stats = scene->stats;
+}
@@ -0,0 +1,82 @@
+#ifndef _SCENE_H_
+#define _SCENE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "blit.h"
+#include "damage.h"
+#include "draw.h"
+#include "tile.h"
+
+/*
+ * A retained tree of nodes drawn over a background color. A node sits at
+ * an offset from its parent and draws its content under its children, the
+ * children in order. Changing a node marks it dirty, a render only redraws
+ * where the dirty nodes were and are now, and reports that as damage.
+ *
+ * A cached node rasterizes itself and its subtree into a layer once, later
+ * renders blit the layer and only redraw the parts of it below dirty
+ * nodes. Moving a cached node moves the layer without drawing it again.
+ * Layers are premultiplied ARGB8888 whatever the surface is.
+ *
+ * Contents are opaque, a layer shows what is below it only where nothing
+ * of its subtree is. The cells of a checker keep to the surface or the
+ * layer they are drawn into, like pixels_fill_checker(), they suit
+ * backgrounds that do not move.
+ */
+
+struct scene_stats {
+  int nodes;
+  int layers; // cached nodes with a layer
+  int layers_drawn; // rasterized by the last render, all of it or a part
+  int damage_rects; // of the last render
+  uint64_t damage_area;
+};
+
+struct scene;
+struct scene_node;
+
+struct scene *scene_make(uint32_t background);
+/* frees the nodes too */
+void scene_free(struct scene **ptr);
+
+/* a node without content, the last child of parent or of the root if NULL */
+struct scene_node *scene_node_make(struct scene *scene,
+                                   struct scene_node *parent);
+/* frees the subtree, what it drew is damaged */
+void scene_node_free(struct scene_node **ptr);
+
+/* relative to the parent, a change is not a change if the value is equal */
+void scene_node_set_position(struct scene_node *node, int x, int y);
+void scene_node_set_visible(struct scene_node *node, bool visible);
+void scene_node_set_cached(struct scene_node *node, bool cached);
+
+/* the contents, at the position of the node */
+void scene_node_set_rect(struct scene_node *node, int width, int height,
+                         uint32_t color);
+/* its center is at (radius, radius) */
+void scene_node_set_circle(struct scene_node *node, int radius,
+                           uint32_t color);
+void scene_node_set_checker(struct scene_node *node, int width, int height,
+                            int cell, uint32_t c0, uint32_t c1);
+/* the whole image stretched over the rect, composited with SRC_OVER. The
+ * pixels are read at render, they must live as long as the node */
+void scene_node_set_image(struct scene_node *node, int width, int height,
+                          const struct blit_image *image,
+                          enum blit_filter filter);
+/* the pixels of the image changed */
+void scene_node_invalidate(struct scene_node *node);
+
+/*
+ * Redraw what changed since the last render into surf and add it to
+ * damage. The surface must keep its pixels between renders, the first
+ * render and one into a surface of another size draw everything.
+ */
+int scene_render(struct scene *scene, struct tile_renderer *tr,
+                 const struct draw_surface *surf,
+                 struct damage_region *damage);
+
+void scene_get_stats(struct scene *scene, struct scene_stats *stats);
+
+#endif
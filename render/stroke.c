@@ -0,0 +1,671 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "../utils/utils.h"
+#include "blend.h"
+#include "format.h"
+#include "stroke.h"
+
+/* how far, in pixels, the sides of round joins and caps may be off */
+#define STROKE_TOLERANCE 0.1f
+/* steps of a half turn of a round cap at most */
+#define STROKE_ARC_MAX 64
+/* shorter segments have no direction and are skipped */
+#define STROKE_EPSILON 1e-4f
+/* points this close to a line on from the previous one are merged into
+ * it, at most STROKE_MERGE_MAX segments at a time */
+#define STROKE_MERGE (STROKE_TOLERANCE / 2)
+#define STROKE_MERGE_MAX 8
+/* how far, in pixels, the points of an outline are moved up or down to
+ * make the lines between them flat */
+#define STROKE_FLAT (1.0f / 64)
+
+/* x y pairs growing as they are added, or from the end down */
+struct stroke_points {
+  float *points;
+  int count;
+  int cap;
+};
+
+struct stroker {
+  struct path *out;
+  const struct stroke_style *style;
+  float hw; // half the width
+  float arc_cos; // a step of the round caps
+  float arc_sin;
+  int arc_steps; // of a half turn
+  float corner_cos; // the first corner of a round join off its side
+  float corner_sin;
+  float join_cos; // a step between the corners after it
+  float join_sin;
+  float merge; // 1 + cos of the sharpest round or bevel join drawn as a miter
+  struct stroke_points left; // the sides of the line, the right one is
+  struct stroke_points right; // prepended, it is walked back that way
+};
+
+struct stroke_vec {
+  float x;
+  float y;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+/* no libm: the estimate of rsqrtss, good to 12 bits, then a Newton step */
+__attribute__((target("sse")))
+static float stroke_rsqrt(float v) {
+  float g = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(v)));
+
+  return g * (1.5f - 0.5f * v * g * g);
+}
+#else
+/* no libm: a guess from the exponent halved, then Newton steps */
+static float stroke_rsqrt(float v) {
+  union {
+    float f;
+    uint32_t u;
+  } g = {v};
+
+  g.u = 0x5F3759DF - (g.u >> 1);
+  for (int i = 0; i < 3; i++)
+    g.f *= 1.5f - 0.5f * v * g.f * g.f;
+  return g.f;
+}
+#endif
+
+static float stroke_sqrt(float v) {
+  return v > 0 ? v * stroke_rsqrt(v) : 0;
+}
+
+void stroke_style_init(struct stroke_style *style, float width) {
+  memset(style, 0, sizeof(struct stroke_style));
+  style->width = width;
+  style->join = STROKE_JOIN_MITER;
+  style->cap = STROKE_CAP_BUTT;
+  style->miter_limit = 4;
+}
+
+static void stroker_init(struct stroker *s, struct path *out,
+                         const struct stroke_style *style) {
+  float t, t2, c;
+  int steps;
+
+  memset(s, 0, sizeof(struct stroker));
+  s->out = out;
+  s->style = style;
+  s->hw = style->width / 2;
+  /* a chord of angle t is off its arc by r t^2 / 8, the steps are cut to
+   * whole ones of a half turn */
+  for (steps = 4; steps < STROKE_ARC_MAX; steps++) {
+    t = 3.1415927f / steps;
+    if (s->hw * t * t / 8 <= STROKE_TOLERANCE)
+      break;
+  }
+  t = 3.1415927f / steps;
+  t2 = t * t;
+  s->arc_cos = 1 - t2 / 2 + t2 * t2 / 24 - t2 * t2 * t2 / 720;
+  s->arc_sin = t * (1 - t2 / 6 + t2 * t2 / 120 - t2 * t2 * t2 / 5040);
+  s->arc_steps = steps;
+  /* the miter of a turn of cos(angle / 2) = c is hw / c from the pivot,
+   * hw / c - hw past a round join and hw / c - hw c past a bevel */
+  t = STROKE_TOLERANCE / s->hw;
+  c = 1 / (1 + t);
+  s->corner_cos = c;
+  s->corner_sin = stroke_sqrt(1 - c * c);
+  /* the corners of round joins are hw + tolerance from the pivot, the
+   * middle of a step hw - tolerance at the least */
+  c = t < 1 ? (1 - t) / (1 + t) : 0;
+  s->join_cos = 2 * c * c - 1;
+  s->join_sin = stroke_sqrt(1 - s->join_cos * s->join_cos);
+  if (style->join == STROKE_JOIN_ROUND)
+    c = s->corner_cos;
+  else
+    c = (stroke_sqrt(t * t + 4) - t) / 2;
+  s->merge = 2 * c * c;
+}
+
+/* the points of a list filled by stroke_points_prepend() stay at its end */
+static int stroke_points_reserve(struct stroke_points *list, int cap,
+                                 bool back) {
+  float *points;
+
+  if (cap <= list->cap)
+    return 0;
+  points = realloc(list->points, (size_t)cap * 2 * sizeof(float));
+  if (!points) {
+    err_log("%s: no enough memory\n", __func__);
+    return 1;
+  }
+  if (back)
+    memmove(points + (cap - list->count) * 2,
+            points + (list->cap - list->count) * 2,
+            (size_t)list->count * 2 * sizeof(float));
+  list->points = points;
+  list->cap = cap;
+  return 0;
+}
+
+static inline int stroke_points_add(struct stroke_points *list, float x,
+                                    float y) {
+  float *p;
+
+  if (list->count == list->cap &&
+      stroke_points_reserve(list, list->cap ? list->cap * 2 : 64, false))
+    return 1;
+  p = list->points + list->count++ * 2;
+  p[0] = x;
+  p[1] = y;
+  return 0;
+}
+
+/* the first points[(cap - count) * 2] on are in the reverse order */
+static inline int stroke_points_prepend(struct stroke_points *list, float x,
+                                        float y) {
+  float *p;
+
+  if (list->count == list->cap &&
+      stroke_points_reserve(list, list->cap ? list->cap * 2 : 64, true))
+    return 1;
+  p = list->points + (list->cap - ++list->count) * 2;
+  p[0] = x;
+  p[1] = y;
+  return 0;
+}
+
+/* the next point of the left side (1) or the right one (-1) */
+static int stroke_side(struct stroker *s, float side, float x, float y) {
+  if (side < 0)
+    return stroke_points_prepend(&s->right, x, y);
+  return stroke_points_add(&s->left, x, y);
+}
+
+/* u turned by the angle of cos c and sin s, in dir (1 or -1) */
+static struct stroke_vec stroke_turn(struct stroke_vec u, float c, float s,
+                                     int dir) {
+  struct stroke_vec v = {u.x * c - dir * u.y * s, dir * u.x * s + u.y * c};
+  return v;
+}
+
+/* the points of the arc around pivot between u and v, both unit, turning
+ * dir (1 or -1), not the ends */
+static int stroke_arc(struct stroker *s, float side, struct stroke_vec pivot,
+                      struct stroke_vec u, struct stroke_vec v, int dir) {
+  for (int i = 0; i < s->arc_steps * 2; i++) {
+    if (u.x * v.x + u.y * v.y >= s->arc_cos)
+      break;
+    u = stroke_turn(u, s->arc_cos, s->arc_sin, dir);
+    if (stroke_side(s, side, pivot.x + u.x * s->hw, pivot.y + u.y * s->hw))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * The corners of a round join around pivot from u to v, both unit,
+ * turning dir. The first and the last are on the sides of the segments
+ * going on, the tolerance away from the arc; the ones between are as far
+ * out, the sides between them as far in at their middle.
+ */
+static int stroke_round(struct stroker *s, float side, struct stroke_vec pivot,
+                        struct stroke_vec u, struct stroke_vec v, int dir) {
+  float r = s->hw + STROKE_TOLERANCE;
+  struct stroke_vec end = stroke_turn(v, s->corner_cos, s->corner_sin, -dir);
+
+  u = stroke_turn(u, s->corner_cos, s->corner_sin, dir);
+  for (int i = 0; i < STROKE_ARC_MAX; i++) {
+    if (stroke_side(s, side, pivot.x + u.x * r, pivot.y + u.y * r))
+      return 1;
+    if (u.x * end.x + u.y * end.y >= s->join_cos)
+      break;
+    u = stroke_turn(u, s->join_cos, s->join_sin, dir);
+  }
+  return stroke_side(s, side, pivot.x + end.x * r, pivot.y + end.y * r);
+}
+
+/* d the unit direction of the line where it ends at e, the points from
+ * its left side around to its right */
+static int stroke_cap(struct stroker *s, struct stroke_vec e,
+                      struct stroke_vec d) {
+  struct stroke_vec n = {-d.y, d.x};
+  float hw = s->hw;
+
+  switch (s->style->cap) {
+  case STROKE_CAP_BUTT:
+    break;
+  case STROKE_CAP_SQUARE:
+    return stroke_side(s, 1, e.x + (n.x + d.x) * hw, e.y + (n.y + d.y) * hw) ||
+           stroke_side(s, 1, e.x + (d.x - n.x) * hw, e.y + (d.y - n.y) * hw);
+  case STROKE_CAP_ROUND: {
+    struct stroke_vec back = {-n.x, -n.y};
+    /* n turned back by a quarter is d */
+    return stroke_arc(s, 1, e, n, back, -1);
+  }
+  }
+  return 0;
+}
+
+/*
+ * The turn at pivot from direction a to b, la and lb long. Outside the
+ * sides are joined by the style, joins turning less than the tolerance
+ * shows take the miter. Inside they end where they cross, or are cut
+ * straight across if that is past the end of a segment; the part cut
+ * off has to be under both segments, if it is not they go around the
+ * pivot. The loops this makes only add to the winding of the overlap.
+ */
+static int stroke_join(struct stroker *s, struct stroke_vec pivot,
+                       struct stroke_vec a, float la, struct stroke_vec b,
+                       float lb) {
+  float cross = a.x * b.y - a.y * b.x;
+  float dot = a.x * b.x + a.y * b.y;
+  float k = 1 + dot;
+  float side = cross > 0 ? -1.0f : 1.0f; // the outside
+  struct stroke_vec na = {-a.y * side, a.x * side};
+  struct stroke_vec nb = {-b.y * side, b.x * side};
+  struct stroke_vec m = {0, 0};
+  float hw = s->hw, limit = s->style->miter_limit;
+  float shortest = la < lb ? la : lb, inside;
+  bool miter;
+
+  if (cross > -STROKE_EPSILON && cross < STROKE_EPSILON && dot > 0)
+    return 0;
+  /* the miter is 1 / cos(angle / 2) = sqrt(2 / (1 + dot)) widths long,
+   * inside the sides cross tan(angle / 2) widths before the pivot */
+  if (k > STROKE_EPSILON) {
+    float f = hw / k;
+    m.x = (na.x + nb.x) * f;
+    m.y = (na.y + nb.y) * f;
+  }
+  inside = hw * (cross < 0 ? -cross : cross);
+  if (k > STROKE_EPSILON && inside <= shortest * (k < 1 ? k : 1)) {
+    if (stroke_side(s, -side, pivot.x - m.x, pivot.y - m.y))
+      return 1;
+  } else if (stroke_side(s, -side, pivot.x - na.x * hw, pivot.y - na.y * hw) ||
+             (inside > shortest && stroke_side(s, -side, pivot.x, pivot.y)) ||
+             stroke_side(s, -side, pivot.x - nb.x * hw, pivot.y - nb.y * hw)) {
+    return 1;
+  }
+  if (s->style->join == STROKE_JOIN_MITER)
+    miter = k > STROKE_EPSILON && 2 <= limit * limit * k;
+  else
+    miter = k >= s->merge;
+  if (miter)
+    return stroke_side(s, side, pivot.x + m.x, pivot.y + m.y);
+  if (s->style->join == STROKE_JOIN_ROUND)
+    return stroke_round(s, side, pivot, na, nb, cross > 0 ? 1 : -1);
+  return stroke_side(s, side, pivot.x + na.x * hw, pivot.y + na.y * hw) ||
+         stroke_side(s, side, pivot.x + nb.x * hw, pivot.y + nb.y * hw);
+}
+
+/*
+ * The point the segment from point i goes to, at most end: the points
+ * after i are passed over as long as they stay within STROKE_MERGE of
+ * the line from i, each a step further along it, and every segment on
+ * the way is off the line by less than a join drawn as a miter turns.
+ * Dense lines, many segments to a pixel, turn little over such runs and
+ * are stroked across them as one segment.
+ */
+static int stroke_merge(const struct stroker *s, const float *p, int count,
+                        int i, int end) {
+  const float *a = p + i * 2;
+  int j = i + 1;
+
+  for (; j < end && j - i < STROKE_MERGE_MAX; j++) {
+    const float *q = p + (j + 1 < count ? j + 1 : 0) * 2;
+    float cx = q[0] - a[0], cy = q[1] - a[1];
+    float cc = cx * cx + cy * cy, last = 0;
+    for (int k = i + 1; k <= j + 1; k++) {
+      const float *m = k <= j ? p + k * 2 : q;
+      const float *n = p + (k - 1) * 2;
+      float vx = m[0] - a[0], vy = m[1] - a[1];
+      float sx = m[0] - n[0], sy = m[1] - n[1];
+      float cross = cx * vy - cy * vx, dot = cx * vx + cy * vy;
+      /* cos^2 of the half turn is merge / 2 */
+      if (cross * cross > STROKE_MERGE * STROKE_MERGE * cc || dot <= last ||
+          dot > cc ||
+          2 * (dot - last) * (dot - last) < s->merge * (sx * sx + sy * sy) * cc)
+        return j;
+      last = dot;
+    }
+  }
+  return j;
+}
+
+/* the unit direction from point i to j of the line in d, the length, 0
+ * if there is none */
+static float stroke_segment(const float *p, int count, int i, int j,
+                            struct stroke_vec *d) {
+  const float *q = p + (j < count ? j : 0) * 2;
+  float dx = q[0] - p[i * 2], dy = q[1] - p[i * 2 + 1];
+  float v = dx * dx + dy * dy, r;
+
+  if (v < STROKE_EPSILON * STROKE_EPSILON)
+    return 0;
+  r = stroke_rsqrt(v);
+  d->x = dx * r;
+  d->y = dy * r;
+  return v * r;
+}
+
+/*
+ * The points after y take its height while they stay less than
+ * STROKE_FLAT above or below it. Where thick lines turn back, the joins
+ * make many lines of next to no height, the filler leaves flat ones out
+ * instead of walking their cells for next to no area.
+ */
+static void stroke_flatten(float *p, int count, float *y) {
+  for (int i = 0; i < count; i++) {
+    float d = p[i * 2 + 1] - *y;
+    if (d < STROKE_FLAT && d > -STROKE_FLAT)
+      p[i * 2 + 1] = *y;
+    else
+      *y = p[i * 2 + 1];
+  }
+}
+
+/* the left side on to the right one, as a closed contour of out, both
+ * emptied */
+static int stroke_contour(struct stroker *s) {
+  float *left = s->left.points;
+  float *right = s->right.points + (s->right.cap - s->right.count) * 2;
+  int count = s->left.count, back = s->right.count;
+  float y;
+
+  s->left.count = 0;
+  s->right.count = 0;
+  if (!count && !back)
+    return 0;
+  if (!count) {
+    left = right;
+    count = back;
+    back = 0;
+  }
+  y = left[1];
+  stroke_flatten(left + 2, count - 1, &y);
+  stroke_flatten(right, back, &y);
+  if (path_move_to(s->out, left[0], left[1]) ||
+      path_lines_to(s->out, left + 2, count - 1) ||
+      path_lines_to(s->out, right, back))
+    return 1;
+  path_close(s->out);
+  return 0;
+}
+
+/*
+ * A line without dashes, count points from p, as one outline: the start
+ * cap, the left side forward, the end cap, the right side back. A closed
+ * line is two, the right one turning the other way.
+ */
+static int stroke_solid(struct stroker *s, const float *p, int count,
+                        bool closed) {
+  struct stroke_vec first = {0}, prev = {0}, origin = {0}, d;
+  int segments = closed ? count : count - 1;
+  float len, first_len = 0, prev_len = 0;
+
+  /* a point or two a side for every segment, more for round joins */
+  s->left.count = 0;
+  s->right.count = 0;
+  if (stroke_points_reserve(&s->left, count * 2 + 64, false) ||
+      stroke_points_reserve(&s->right, count * 2 + 64, true))
+    return 1;
+  for (int i = 0, j; i < segments; i = j) {
+    struct stroke_vec a = {p[i * 2], p[i * 2 + 1]};
+    j = stroke_merge(s, p, count, i, segments);
+    len = stroke_segment(p, count, i, j, &d);
+    if (!len)
+      continue;
+    if (!first_len) {
+      struct stroke_vec back = {-d.x, -d.y};
+      origin = a;
+      first = d;
+      first_len = len;
+      if (!closed &&
+          (stroke_cap(s, a, back) ||
+           stroke_side(s, 1, a.x - d.y * s->hw, a.y + d.x * s->hw) ||
+           stroke_side(s, -1, a.x + d.y * s->hw, a.y - d.x * s->hw)))
+        return 1;
+    } else if (stroke_join(s, a, prev, prev_len, d, len)) {
+      return 1;
+    }
+    prev = d;
+    prev_len = len;
+  }
+  if (!first_len) {
+    /* a point, round and square caps still make a dot of it */
+    struct stroke_vec e = {p[0], p[1]}, right = {1, 0}, left = {-1, 0};
+    if (!count || closed || s->style->cap == STROKE_CAP_BUTT)
+      return 0;
+    return stroke_side(s, 1, e.x, e.y + s->hw) || stroke_cap(s, e, right) ||
+           stroke_side(s, 1, e.x, e.y - s->hw) || stroke_cap(s, e, left) ||
+           stroke_contour(s);
+  }
+  if (closed) {
+    int back;
+    if (stroke_join(s, origin, prev, prev_len, first, first_len))
+      return 1;
+    /* the left side alone, then the right one */
+    back = s->right.count;
+    s->right.count = 0;
+    if (stroke_contour(s))
+      return 1;
+    s->right.count = back;
+    return stroke_contour(s);
+  }
+  {
+    struct stroke_vec e = {p[count * 2 - 2], p[count * 2 - 1]};
+    return stroke_side(s, 1, e.x - prev.y * s->hw, e.y + prev.x * s->hw) ||
+           stroke_side(s, -1, e.x + prev.y * s->hw, e.y - prev.x * s->hw) ||
+           stroke_cap(s, e, prev) || stroke_contour(s);
+  }
+}
+
+/*
+ * The line walked along its length, every dash on is stroked as a line
+ * of its own. A pattern of an odd count is repeated to make it even.
+ */
+static int stroke_dashed(struct stroker *s, const float *p, int count,
+                         bool closed) {
+  const struct stroke_style *style = s->style;
+  int pattern = style->dash_count % 2 ? style->dash_count * 2
+                                      : style->dash_count;
+  struct stroke_points dash = {0};
+  float total = 0, offset, left;
+  int segments = closed ? count : count - 1;
+  int index = 0, ret = 0;
+  bool on;
+
+  for (int i = 0; i < pattern; i++)
+    total += style->dashes[i % style->dash_count];
+  if (total <= 0)
+    return stroke_solid(s, p, count, closed);
+  offset = style->dash_offset - (int)(style->dash_offset / total) * total;
+  if (offset < 0)
+    offset += total;
+  while (offset >= style->dashes[index % style->dash_count]) {
+    offset -= style->dashes[index % style->dash_count];
+    index = (index + 1) % pattern;
+  }
+  left = style->dashes[index % style->dash_count] - offset;
+  on = index % 2 == 0;
+  if (on && count)
+    ret = stroke_points_add(&dash, p[0], p[1]);
+  for (int i = 0; i < segments && !ret; i++) {
+    const float *q = p + (i + 1) % count * 2;
+    float dx = q[0] - p[i * 2], dy = q[1] - p[i * 2 + 1];
+    float len = stroke_sqrt(dx * dx + dy * dy);
+    float t = 0;
+    while (len - t > left && !ret) {
+      float x, y;
+      t += left;
+      x = p[i * 2] + dx * t / len;
+      y = p[i * 2 + 1] + dy * t / len;
+      if (on) {
+        ret = stroke_points_add(&dash, x, y) ||
+              stroke_solid(s, dash.points, dash.count, false);
+        dash.count = 0;
+      } else {
+        ret = stroke_points_add(&dash, x, y);
+      }
+      on = !on;
+      index = (index + 1) % pattern;
+      left = style->dashes[index % style->dash_count];
+    }
+    left -= len - t;
+    if (on && !ret)
+      ret = stroke_points_add(&dash, q[0], q[1]);
+  }
+  if (on && !ret && dash.count > 1)
+    ret = stroke_solid(s, dash.points, dash.count, false);
+  free(dash.points);
+  return ret;
+}
+
+int stroke_polyline(struct path *out, const float *points, int count,
+                    bool closed, const struct stroke_style *style) {
+  struct stroker s;
+  int ret;
+
+  if (count < 1 || style->width <= 0)
+    return 0;
+  stroker_init(&s, out, style);
+  if (style->dash_count > 0 && style->dash_count <= STROKE_DASH_MAX) {
+    for (int i = 0; i < style->dash_count; i++) {
+      if (style->dashes[i] < 0) {
+        err_log("%s: dash %d is %f long\n", __func__, i, style->dashes[i]);
+        return 1;
+      }
+    }
+    ret = stroke_dashed(&s, points, count, closed);
+  } else {
+    ret = stroke_solid(&s, points, count, closed);
+  }
+  free(s.left.points);
+  free(s.right.points);
+  return ret;
+}
+
+int stroke_path(struct path *out, const struct path *path,
+                const struct stroke_style *style) {
+  for (int i = 0; i < path_contour_count(path); i++) {
+    int count, closed;
+    const float *points = path_contour(path, i, &count, &closed);
+    if (stroke_polyline(out, points, count, closed, style))
+      return 1;
+  }
+  return 0;
+}
+
+/* c * a / 255 on every channel, two at a time, rounded as blend.h does */
+static inline uint32_t stroke_scale(uint32_t c, uint32_t a) {
+  uint32_t rb = (c & 0x00FF00FF) * a + 0x00800080;
+  uint32_t ag = ((c >> 8) & 0x00FF00FF) * a + 0x00800080;
+  rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+  ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+  return rb | ag;
+}
+
+static void stroke_plot(struct draw_surface *surf, int x, int y,
+                        uint32_t color, float coverage) {
+  uint8_t *row;
+  uint32_t s, d;
+  int m = (int)(coverage * 255 + 0.5f);
+
+  if (m <= 0 || x < surf->clip.x0 || x >= surf->clip.x1 ||
+      y < surf->clip.y0 || y >= surf->clip.y1)
+    return;
+  s = stroke_scale(color, m > 255 ? 255 : m);
+  row = (uint8_t *)surf->pixels + (size_t)y * surf->stride;
+  if (surf->format == PIXEL_FORMAT_RGB565) {
+    uint16_t *p = (uint16_t *)row + x;
+    d = pixel_unpack_rgb565(*p);
+    d = s + stroke_scale(d, 255 - (s >> 24));
+    *p = surf->dither ? pixel_pack_rgb565_dither(d, x, y)
+                      : pixel_pack_rgb565(d);
+    return;
+  }
+  d = ((uint32_t *)row)[x];
+  ((uint32_t *)row)[x] = s + stroke_scale(d, 255 - (s >> 24));
+}
+
+/*
+ * Along the major axis every pixel takes the part of the segment over
+ * it, across it the two pixels around the middle of that part share it
+ * by their distance. Pixels of the major axis are half open, the pixel
+ * where two segments meet is drawn by both.
+ */
+static void stroke_wu(struct draw_surface *surf, float x0, float y0, float x1,
+                      float y1, uint32_t color) {
+  float dx = x1 - x0, dy = y1 - y0;
+  bool steep = (dy < 0 ? -dy : dy) > (dx < 0 ? -dx : dx);
+  float lo, hi, slope, start, end;
+  int i0, i1;
+
+  if (steep) {
+    float t;
+    t = x0, x0 = y0, y0 = t;
+    t = x1, x1 = y1, y1 = t;
+    t = dx, dx = dy, dy = t;
+  }
+  if (x0 > x1) {
+    float t;
+    t = x0, x0 = x1, x1 = t;
+    t = y0, y0 = y1, y1 = t;
+  }
+  if (x1 - x0 < STROKE_EPSILON)
+    return;
+  slope = (y1 - y0) / (x1 - x0);
+  /* the columns of the clip the segment is over, skipped whole outside */
+  lo = steep ? surf->clip.y0 : surf->clip.x0;
+  hi = steep ? surf->clip.y1 : surf->clip.x1;
+  start = x0 > lo ? x0 : lo;
+  end = x1 < hi ? x1 : hi;
+  if (start >= end)
+    return;
+  i0 = (int)start;
+  i1 = (int)end + ((float)(int)end < end);
+  for (int i = i0; i < i1; i++) {
+    float a = i > x0 ? i : x0;
+    float b = i + 1 < x1 ? i + 1 : x1;
+    float yc = y0 + ((a + b) / 2 - x0) * slope - 0.5f;
+    int j = (int)yc - (yc < (int)yc);
+    float f = yc - j;
+    if (steep) {
+      stroke_plot(surf, j, i, color, (b - a) * (1 - f));
+      stroke_plot(surf, j + 1, i, color, (b - a) * f);
+    } else {
+      stroke_plot(surf, i, j, color, (b - a) * (1 - f));
+      stroke_plot(surf, i, j + 1, color, (b - a) * f);
+    }
+  }
+}
+
+void stroke_hairline(struct draw_surface *surf, const float *points,
+                     int count, bool closed, float width, uint32_t color) {
+  int segments = closed ? count : count - 1;
+
+  if (width <= 0 || count < 2)
+    return;
+  color = blend_premultiply(color);
+  if (width < 1)
+    color = stroke_scale(color, (uint32_t)(width * 255 + 0.5f));
+  for (int i = 0; i < segments; i++) {
+    const float *q = points + (i + 1) % count * 2;
+    stroke_wu(surf, points[i * 2], points[i * 2 + 1], q[0], q[1], color);
+  }
+}
+
+int stroke_draw(struct draw_surface *surf, struct path *scratch,
+                const float *points, int count, bool closed,
+                const struct stroke_style *style, uint32_t color) {
+  if (!style->dash_count && style->width <= 1) {
+    stroke_hairline(surf, points, count, closed, style->width, color);
+    return 0;
+  }
+  path_reset(scratch);
+  if (stroke_polyline(scratch, points, count, closed, style))
+    return 1;
+  return path_fill(surf, scratch, PATH_FILL_NONZERO, color);
+}
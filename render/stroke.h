@@ -0,0 +1,78 @@
+#ifndef _STROKE_H_
+#define _STROKE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "draw.h"
+#include "path.h"
+
+/*
+ * Thick lines turned into fill geometry: a line becomes one outline, its
+ * left side forward and its right side back, the joins and caps in it.
+ * Where the line turns back on itself the outline crosses over, filled
+ * nonzero such loops only add to the winding, so no union of the pieces
+ * has to be found. Points a segment goes through within a twentieth of a
+ * pixel of a straight line on, as dense lines have many of, are not
+ * joined but stroked across.
+ *
+ * Lines of a pixel or less go around that: they are drawn straight into
+ * the surface as Wu lines, two pixels across per step, weighted by the
+ * distance of the line to their centers. Points are in pixels, the pixel
+ * x, y has its center at x + 0.5, y + 0.5.
+ */
+
+enum stroke_join {
+  STROKE_JOIN_MITER, // cut to a bevel past the miter limit
+  STROKE_JOIN_ROUND,
+  STROKE_JOIN_BEVEL,
+};
+
+enum stroke_cap {
+  STROKE_CAP_BUTT,
+  STROKE_CAP_ROUND,
+  STROKE_CAP_SQUARE, // half the width past the end
+};
+
+#define STROKE_DASH_MAX 8
+
+struct stroke_style {
+  float width;
+  enum stroke_join join;
+  enum stroke_cap cap;
+  float miter_limit; // of the miter length over the width
+  int dash_count; // 0 for a solid line
+  float dashes[STROKE_DASH_MAX]; // lengths on, off, on ..., in pixels
+  float dash_offset; // into the pattern where the line starts
+};
+
+/* solid, miter joins up to 4, butt caps */
+void stroke_style_init(struct stroke_style *style, float width);
+
+/*
+ * The outline of a stroke along count x y pairs appended to out, to be
+ * filled with PATH_FILL_NONZERO, one for every dash. A closed line joins
+ * its last point to its first and has two, inside and outside, and no
+ * caps; a dash across its start is cut in two. Returns 1 if out can not
+ * grow or a dash is shorter than 0.
+ */
+int stroke_polyline(struct path *out, const float *points, int count,
+                    bool closed, const struct stroke_style *style);
+/* every contour of path, the ones path_close() ended as closed lines */
+int stroke_path(struct path *out, const struct path *path,
+                const struct stroke_style *style);
+
+/* Wu lines, their color fainter for widths below one pixel */
+void stroke_hairline(struct draw_surface *surf, const float *points,
+                     int count, bool closed, float width, uint32_t color);
+
+/*
+ * A polyline in straight ARGB8888 color over the surface: solid lines
+ * of a pixel or less as hairlines, the others filled from their pieces
+ * in scratch, which is reset first.
+ */
+int stroke_draw(struct draw_surface *surf, struct path *scratch,
+                const float *points, int count, bool closed,
+                const struct stroke_style *style, uint32_t color);
+
+#endif
@@ -0,0 +1,349 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/utils.h"
+#include "blend.h"
+#include "format.h"
+#include "text.h"
+
+/* free pixels right of and below each glyph, filtering never bleeds */
+#define TEXT_PAD 1
+/* a slot per this many pixels of atlas, half of them used at most */
+#define TEXT_SLOT_AREA 64
+#define TEXT_SLOTS_MIN 256
+
+struct text_glyph {
+  const struct font *font; // NULL if the slot is free
+  int glyph;
+  int size;
+  int step; // of the pen between two pixels
+  int x; // in the atlas
+  int y;
+  int width; // 0 if nothing is drawn
+  int height;
+  int left; // of the box, from the pen on the baseline
+  int top;
+};
+
+/* the top of the packed glyphs from x on, up to the next node */
+struct text_skyline {
+  int x;
+  int y;
+  int width;
+};
+
+struct text_cache {
+  uint8_t *atlas;
+  int width;
+  int height;
+  struct text_skyline *skyline;
+  int skyline_count;
+  struct text_glyph *slots;
+  int slot_mask;
+  struct text_cache_stats stats;
+};
+
+void text_cache_clear(struct text_cache *cache) {
+  memset(cache->slots, 0, (cache->slot_mask + 1) * sizeof(struct text_glyph));
+  cache->skyline[0].x = 0;
+  cache->skyline[0].y = 0;
+  cache->skyline[0].width = cache->width;
+  cache->skyline_count = 1;
+  cache->stats.glyphs = 0;
+  cache->stats.used_area = 0;
+}
+
+struct text_cache *text_cache_make(int width, int height) {
+  struct text_cache *new = NULL;
+  int slots = TEXT_SLOTS_MIN;
+
+  if (width <= 0 || height <= 0)
+    return NULL;
+  while (slots < (int64_t)width * height / TEXT_SLOT_AREA * 2)
+    slots *= 2;
+  new = malloc(sizeof(struct text_cache));
+  if (!new)
+    return NULL;
+  memset(new, 0, sizeof(struct text_cache));
+  new->atlas = calloc((size_t)width * height, 1);
+  new->skyline = malloc((width + 1) * sizeof(struct text_skyline));
+  new->slots = malloc(slots * sizeof(struct text_glyph));
+  if (!new->atlas || !new->skyline || !new->slots) {
+    free(new->atlas);
+    free(new->skyline);
+    free(new->slots);
+    free(new);
+    return NULL;
+  }
+  new->width = width;
+  new->height = height;
+  new->slot_mask = slots - 1;
+  new->stats.width = width;
+  new->stats.height = height;
+  text_cache_clear(new);
+  return new;
+}
+
+void text_cache_free(struct text_cache **ptr) {
+  struct text_cache *cache = *ptr;
+  if (cache) {
+    free(cache->atlas);
+    free(cache->skyline);
+    free(cache->slots);
+    free(cache);
+    *ptr = NULL;
+  }
+}
+
+/* the top a width wide rect at node i would sit on, -1 if it does not fit */
+static int text_skyline_fits(struct text_cache *cache, int i, int width,
+                             int height) {
+  int x = cache->skyline[i].x;
+  int y = cache->skyline[i].y;
+  int left = width;
+
+  if (x + width > cache->width)
+    return -1;
+  while (left > 0) {
+    if (i == cache->skyline_count)
+      return -1;
+    if (cache->skyline[i].y > y)
+      y = cache->skyline[i].y;
+    if (y + height > cache->height)
+      return -1;
+    left -= cache->skyline[i].width;
+    i++;
+  }
+  return y;
+}
+
+/* raise the skyline under a rect put at node i */
+static void text_skyline_add(struct text_cache *cache, int i, int x, int y,
+                             int width, int height) {
+  struct text_skyline *s = cache->skyline;
+
+  memmove(s + i + 1, s + i, (cache->skyline_count - i) * sizeof(*s));
+  s[i].x = x;
+  s[i].y = y + height;
+  s[i].width = width;
+  cache->skyline_count++;
+  /* the nodes under the rect shrink or go */
+  for (int k = i + 1; k < cache->skyline_count; k++) {
+    int shrink = s[k - 1].x + s[k - 1].width - s[k].x;
+    if (shrink <= 0)
+      break;
+    s[k].x += shrink;
+    s[k].width -= shrink;
+    if (s[k].width > 0)
+      break;
+    memmove(s + k, s + k + 1, (cache->skyline_count - k - 1) * sizeof(*s));
+    cache->skyline_count--;
+    k--;
+  }
+  /* neighbours at the same height are one node */
+  for (int k = 0; k + 1 < cache->skyline_count; k++) {
+    if (s[k].y == s[k + 1].y) {
+      s[k].width += s[k + 1].width;
+      memmove(s + k + 1, s + k + 2,
+              (cache->skyline_count - k - 2) * sizeof(*s));
+      cache->skyline_count--;
+      k--;
+    }
+  }
+}
+
+/* the lowest spot, the narrowest node on a tie, false if the atlas is full */
+static bool text_skyline_pack(struct text_cache *cache, int width, int height,
+                              int *x, int *y) {
+  int best = -1, best_top = cache->height + 1, best_width = 0;
+
+  for (int i = 0; i < cache->skyline_count; i++) {
+    int top = text_skyline_fits(cache, i, width, height);
+    if (top < 0)
+      continue;
+    if (top + height < best_top ||
+        (top + height == best_top && cache->skyline[i].width < best_width)) {
+      best = i;
+      best_top = top + height;
+      best_width = cache->skyline[i].width;
+      *x = cache->skyline[i].x;
+      *y = top;
+    }
+  }
+  if (best < 0)
+    return false;
+  text_skyline_add(cache, best, *x, *y, width, height);
+  cache->stats.used_area += (uint64_t)width * height;
+  return true;
+}
+
+static struct text_glyph *text_cache_slot(struct text_cache *cache,
+                                          const struct font *font, int glyph,
+                                          int size, int step) {
+  uint32_t h = (uint32_t)((uintptr_t)font >> 4) * 0x9E3779B1u;
+  uint32_t i;
+
+  h ^= (uint32_t)glyph * 0x85EBCA6Bu ^ (uint32_t)size * 0xC2B2AE35u ^
+       (uint32_t)step;
+  h ^= h >> 15;
+  for (i = h & cache->slot_mask;; i = (i + 1) & cache->slot_mask) {
+    struct text_glyph *g = &cache->slots[i];
+    if (!g->font || (g->font == font && g->glyph == glyph &&
+                     g->size == size && g->step == step))
+      return g;
+  }
+}
+
+/* the glyph in the atlas, rasterized on a miss, NULL if that failed */
+static const struct text_glyph *text_cache_get(struct text_cache *cache,
+                                               struct font *font, int glyph,
+                                               int size, int step,
+                                               float scale) {
+  struct text_glyph *g = text_cache_slot(cache, font, glyph, size, step);
+  struct draw_rect box;
+  int width, height, x = 0, y = 0;
+
+  cache->stats.lookups++;
+  if (g->font) {
+    cache->stats.hits++;
+    return g;
+  }
+  cache->stats.misses++;
+  font_glyph_box(font, glyph, scale, (float)step / TEXT_SUBPIXEL_STEPS,
+                 &box);
+  width = box.x1 - box.x0;
+  height = box.y1 - box.y0;
+  if (width > TEXT_GLYPH_MAX || height > TEXT_GLYPH_MAX)
+    width = height = 0;
+  if (cache->stats.glyphs >= (cache->slot_mask + 1) / 2 ||
+      (width && !text_skyline_pack(cache, width + TEXT_PAD,
+                                   height + TEXT_PAD, &x, &y))) {
+    cache->stats.resets++;
+    text_cache_clear(cache);
+    if (width && !text_skyline_pack(cache, width + TEXT_PAD,
+                                    height + TEXT_PAD, &x, &y))
+      width = height = 0; // larger than the atlas
+    g = text_cache_slot(cache, font, glyph, size, step);
+  }
+  if (width) {
+    uint8_t *dst = cache->atlas + (size_t)y * cache->width + x;
+    for (int row = 0; row < height + TEXT_PAD; row++)
+      memset(dst + (size_t)row * cache->width, 0, width + TEXT_PAD);
+    if (font_glyph_rasterize(font, glyph, scale,
+                             (float)step / TEXT_SUBPIXEL_STEPS, &box, dst,
+                             cache->width))
+      return NULL;
+  }
+  g->font = font;
+  g->glyph = glyph;
+  g->size = size;
+  g->step = step;
+  g->x = x;
+  g->y = y;
+  g->width = width;
+  g->height = height;
+  g->left = box.x0;
+  g->top = box.y0;
+  cache->stats.glyphs++;
+  return g;
+}
+
+/* coverage rows through the blend kernels, a 565 row in a converted copy */
+static void text_blit(struct draw_surface *surf, const uint8_t *coverage,
+                      int stride, int x, int y, int width, int height,
+                      uint32_t color) {
+  int x0 = x > surf->clip.x0 ? x : surf->clip.x0;
+  int y0 = y > surf->clip.y0 ? y : surf->clip.y0;
+  int x1 = x + width < surf->clip.x1 ? x + width : surf->clip.x1;
+  int y1 = y + height < surf->clip.y1 ? y + height : surf->clip.y1;
+  uint32_t tmp[TEXT_GLYPH_MAX];
+  int n = x1 - x0;
+
+  for (int row = y0; row < y1; row++) {
+    uint8_t *base = (uint8_t *)surf->pixels + (size_t)row * surf->stride;
+    const uint8_t *mask = coverage + (size_t)(row - y) * stride + (x0 - x);
+    if (surf->format != PIXEL_FORMAT_RGB565) {
+      blend_span_solid(BLEND_OP_SRC_OVER, (uint32_t *)base + x0, color, mask,
+                       n);
+      continue;
+    }
+    pixels_unpack_rgb565(tmp, (uint16_t *)base + x0, n);
+    blend_span_solid(BLEND_OP_SRC_OVER, tmp, color, mask, n);
+    pixels_pack_rgb565((uint16_t *)base + x0, tmp, n, x0, row, surf->dither);
+  }
+}
+
+/* the next code point, U+FFFD for a broken sequence */
+static uint32_t text_next(const char **text) {
+  static const uint8_t lead_bits[5] = {0, 0x7F, 0x1F, 0x0F, 0x07};
+  const uint8_t *s = (const uint8_t *)*text;
+  uint32_t c = s[0];
+  int len = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+
+  if (!len || c > 0xF4) {
+    *text += 1;
+    return 0xFFFD;
+  }
+  c &= lead_bits[len];
+  for (int i = 1; i < len; i++) {
+    if ((s[i] & 0xC0) != 0x80) {
+      *text += i;
+      return 0xFFFD;
+    }
+    c = c << 6 | (s[i] & 0x3F);
+  }
+  *text += len;
+  return c;
+}
+
+static float text_scale(struct font *font, int size) {
+  struct font_metrics metrics;
+  font_get_metrics(font, &metrics);
+  return (float)size / metrics.units_per_em;
+}
+
+float text_draw(struct text_cache *cache, struct draw_surface *surf,
+                struct font *font, int size, float x, int baseline,
+                const char *utf8, uint32_t color) {
+  float scale = text_scale(font, size);
+
+  color = blend_premultiply(color);
+  while (*utf8) {
+    int glyph = font_glyph_index(font, text_next(&utf8));
+    int pen = (int)x - (x < (int)x);
+    int step = (int)((x - pen) * TEXT_SUBPIXEL_STEPS);
+    const struct text_glyph *g;
+
+    if (step >= TEXT_SUBPIXEL_STEPS)
+      step = TEXT_SUBPIXEL_STEPS - 1;
+    g = text_cache_get(cache, font, glyph, size, step, scale);
+    if (g && g->width)
+      text_blit(surf, cache->atlas + (size_t)g->y * cache->width + g->x,
+                cache->width, pen + g->left, baseline + g->top, g->width,
+                g->height, color);
+    x += font_glyph_advance(font, glyph) * scale;
+  }
+  return x;
+}
+
+float text_measure(struct font *font, int size, const char *utf8) {
+  float scale = text_scale(font, size);
+  float width = 0;
+
+  while (*utf8)
+    width += font_glyph_advance(font, font_glyph_index(font, text_next(&utf8))) *
+             scale;
+  return width;
+}
+
+void text_cache_get_stats(struct text_cache *cache,
+                          struct text_cache_stats *stats) {
+  cache->stats.skyline_max = 0;
+  for (int i = 0; i < cache->skyline_count; i++)
+    if (cache->skyline[i].y > cache->stats.skyline_max)
+      cache->stats.skyline_max = cache->skyline[i].y;
+  *stats = cache->stats;
+}
@@ -0,0 +1,57 @@
+#ifndef _TEXT_H_
+#define _TEXT_H_
+
+#include <stdint.h>
+
+#include "draw.h"
+#include "font.h"
+
+/* the positions of a glyph between two pixels that are rasterized apart */
+#define TEXT_SUBPIXEL_STEPS 4
+/* glyphs larger than this, either way, are not drawn */
+#define TEXT_GLYPH_MAX 256
+
+/*
+ * Glyph coverage rasterized once into an 8 bit atlas and drawn from there.
+ * Glyphs are keyed by font, glyph, size and the subpixel step of the pen,
+ * and packed skyline style, each one on the lowest free spot it fits. When
+ * the atlas is full it is cleared and filled again by what is drawn next.
+ *
+ * A row of coverage is composited by the span kernels of blend.h, color
+ * is straight ARGB8888 and goes over the surface. A cache is used by one
+ * thread at a time, do not draw text from tile callbacks.
+ */
+
+struct text_cache_stats {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t misses; // rasterized
+  uint64_t resets; // the atlas was full
+  int glyphs; // in the atlas
+  int width; // of the atlas
+  int height;
+  uint64_t used_area; // of the glyphs, with their padding
+  int skyline_max; // the highest the packed glyphs reach
+};
+
+struct text_cache;
+
+struct text_cache *text_cache_make(int width, int height);
+void text_cache_free(struct text_cache **ptr);
+/* drops every glyph, the atlas is packed again from the top */
+void text_cache_clear(struct text_cache *cache);
+
+/*
+ * utf8 with the pen starting at x on the baseline, size in pixels per em.
+ * Returns where the pen ends, the next text goes on from there.
+ */
+float text_draw(struct text_cache *cache, struct draw_surface *surf,
+                struct font *font, int size, float x, int baseline,
+                const char *utf8, uint32_t color);
+/* how far text_draw() would move the pen */
+float text_measure(struct font *font, int size, const char *utf8);
+
+void text_cache_get_stats(struct text_cache *cache,
+                          struct text_cache_stats *stats);
+
+#endif
@@ -0,0 +1,296 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/utils.h"
+#include "tile.h"
+
+#define TILE_THREADS_MAX 256
+
+struct tile_job {
+  uint32_t *pixels;
+  int width;
+  int height;
+  int stride;
+  const struct damage_region *clip;
+  tile_render_fn fn;
+  void *data;
+  int tiles_x;
+  int tiles_y;
+  int tile_count;
+};
+
+struct tile_renderer {
+  int thread_count;
+  int tile_size;
+  struct job_system *jobs; // runs the tiles if set, there are no workers
+  pthread_t *workers;
+  int worker_count;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond; // a new job or quit
+  pthread_cond_t done_cond; // the last tile is done or a worker went idle
+  uint64_t generation; // bumped for every job
+  int active; // workers inside tile_renderer_work
+  bool quit;
+  struct tile_job job;
+  int next_tile; // atomic
+  int done_tiles; // atomic
+  uint64_t *timings;
+  int timings_cap;
+  struct tile_stats stats;
+};
+
+static uint64_t tile_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void tile_render(struct tile_renderer *tr, int tile) {
+  struct tile_job *job = &tr->job;
+  int x0 = tile % job->tiles_x * tr->tile_size;
+  int y0 = tile / job->tiles_x * tr->tile_size;
+  int x1 = x0 + tr->tile_size < job->width ? x0 + tr->tile_size : job->width;
+  int y1 = y0 + tr->tile_size < job->height ? y0 + tr->tile_size : job->height;
+  uint64_t start = tile_now_ns();
+  bool touched = false;
+
+  if (!job->clip) {
+    job->fn(job->data, job->pixels, job->stride, x0, y0, x1 - x0, y1 - y0);
+    touched = true;
+  } else {
+    for (int i = 0; i < job->clip->count; i++) {
+      const struct damage_rect *r = &job->clip->rects[i];
+      int cx0 = r->x > x0 ? r->x : x0;
+      int cy0 = r->y > y0 ? r->y : y0;
+      int cx1 = r->x + r->width < x1 ? r->x + r->width : x1;
+      int cy1 = r->y + r->height < y1 ? r->y + r->height : y1;
+      if (cx1 <= cx0 || cy1 <= cy0)
+        continue;
+      job->fn(job->data, job->pixels, job->stride, cx0, cy0, cx1 - cx0,
+              cy1 - cy0);
+      touched = true;
+    }
+  }
+  tr->timings[tile] = touched ? tile_now_ns() - start : 0;
+}
+
+/* grab tiles till there is none left */
+static void tile_renderer_work(struct tile_renderer *tr) {
+  int count = tr->job.tile_count;
+  for (;;) {
+    int tile = __atomic_fetch_add(&tr->next_tile, 1, __ATOMIC_RELAXED);
+    if (tile >= count)
+      break;
+    tile_render(tr, tile);
+    if (__atomic_add_fetch(&tr->done_tiles, 1, __ATOMIC_ACQ_REL) == count) {
+      pthread_mutex_lock(&tr->lock);
+      pthread_cond_broadcast(&tr->done_cond);
+      pthread_mutex_unlock(&tr->lock);
+    }
+  }
+}
+
+static void tile_renderer_range(void *data, int begin, int end) {
+  struct tile_renderer *tr = (struct tile_renderer *)data;
+  for (int tile = begin; tile < end; tile++)
+    tile_render(tr, tile);
+}
+
+static void *tile_worker_main(void *arg) {
+  struct tile_renderer *tr = (struct tile_renderer *)arg;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&tr->lock);
+  for (;;) {
+    while (!tr->quit && seen == tr->generation)
+      pthread_cond_wait(&tr->work_cond, &tr->lock);
+    if (tr->quit)
+      break;
+    seen = tr->generation;
+    tr->active++;
+    pthread_mutex_unlock(&tr->lock);
+    tile_renderer_work(tr);
+    pthread_mutex_lock(&tr->lock);
+    if (--tr->active == 0)
+      pthread_cond_broadcast(&tr->done_cond);
+  }
+  pthread_mutex_unlock(&tr->lock);
+  return NULL;
+}
+
+static int env_to_int(const char *name, int def) {
+  const char *val = getenv(name);
+  if (!val || !*val)
+    return def;
+  return atoi(val);
+}
+
+void tile_renderer_config_default(struct tile_renderer_config *cfg) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cfg->thread_count = env_to_int("DRAW_ENGINE_THREADS", cpus > 0 ? (int)cpus : 1);
+  cfg->tile_size = env_to_int("DRAW_ENGINE_TILE_SIZE", TILE_SIZE_DEFAULT);
+  cfg->jobs = NULL;
+}
+
+struct tile_renderer *tile_renderer_make(const struct tile_renderer_config *cfg) {
+  struct tile_renderer *new = NULL;
+
+  if ((!cfg->jobs &&
+       (cfg->thread_count < 1 || cfg->thread_count > TILE_THREADS_MAX)) ||
+      cfg->tile_size < 8) {
+    err_log("%s: invalid config, threads: %d, tile size: %d\n", __func__,
+            cfg->thread_count, cfg->tile_size);
+    return NULL;
+  }
+  new = malloc(sizeof(struct tile_renderer));
+  if (!new)
+    return NULL;
+  memset(new, 0, sizeof(struct tile_renderer));
+  new->thread_count = cfg->jobs ? job_system_thread_count(cfg->jobs)
+                                : cfg->thread_count;
+  new->tile_size = cfg->tile_size;
+  new->jobs = cfg->jobs;
+  pthread_mutex_init(&new->lock, NULL);
+  pthread_cond_init(&new->work_cond, NULL);
+  pthread_cond_init(&new->done_cond, NULL);
+  new->workers = calloc(new->thread_count, sizeof(pthread_t));
+  if (!new->workers) {
+    tile_renderer_free(&new);
+    return NULL;
+  }
+  for (int i = 0; !new->jobs && i < new->thread_count - 1; i++) {
+    if (pthread_create(&new->workers[i], NULL, tile_worker_main, new)) {
+      err_log("%s: failed to create worker %d\n", __func__, i);
+      break;
+    }
+    new->worker_count++;
+  }
+  return new;
+}
+
+void tile_renderer_free(struct tile_renderer **ptr) {
+  struct tile_renderer *tr = *ptr;
+  if (tr) {
+    pthread_mutex_lock(&tr->lock);
+    tr->quit = true;
+    pthread_cond_broadcast(&tr->work_cond);
+    pthread_mutex_unlock(&tr->lock);
+    for (int i = 0; i < tr->worker_count; i++)
+      pthread_join(tr->workers[i], NULL);
+    pthread_cond_destroy(&tr->done_cond);
+    pthread_cond_destroy(&tr->work_cond);
+    pthread_mutex_destroy(&tr->lock);
+    free(tr->workers);
+    free(tr->timings);
+    free(tr);
+    *ptr = NULL;
+  }
+}
+
+static struct tile_renderer *g_tile_renderer = NULL;
+static pthread_once_t g_tile_renderer_once = PTHREAD_ONCE_INIT;
+
+static void tile_renderer_default_init(void) {
+  struct tile_renderer_config cfg;
+  tile_renderer_config_default(&cfg);
+  g_tile_renderer = tile_renderer_make(&cfg);
+  if (!g_tile_renderer) {
+    /* fall back to rendering on the calling thread only */
+    cfg.thread_count = 1;
+    cfg.tile_size = TILE_SIZE_DEFAULT;
+    g_tile_renderer = tile_renderer_make(&cfg);
+  }
+}
+
+struct tile_renderer *tile_renderer_default(void) {
+  pthread_once(&g_tile_renderer_once, tile_renderer_default_init);
+  return g_tile_renderer;
+}
+
+int tile_renderer_tile_size(struct tile_renderer *tr) { return tr->tile_size; }
+
+static void tile_renderer_collect_stats(struct tile_renderer *tr, uint64_t wall) {
+  struct tile_stats *stats = &tr->stats;
+  memset(stats, 0, sizeof(struct tile_stats));
+  stats->wall_ns = wall;
+  for (int i = 0; i < tr->job.tile_count; i++) {
+    uint64_t t = tr->timings[i];
+    if (!t)
+      continue;
+    if (!stats->tile_count || t < stats->min_ns)
+      stats->min_ns = t;
+    if (t > stats->max_ns)
+      stats->max_ns = t;
+    stats->total_ns += t;
+    stats->tile_count++;
+  }
+}
+
+int tile_renderer_run(struct tile_renderer *tr, uint32_t *pixels, int width,
+                      int height, int stride, const struct damage_region *clip,
+                      tile_render_fn fn, void *data) {
+  int tiles_x = (width + tr->tile_size - 1) / tr->tile_size;
+  int tiles_y = (height + tr->tile_size - 1) / tr->tile_size;
+  int count = tiles_x * tiles_y;
+  struct tile_job job = {pixels, width, height, stride, clip, fn, data,
+                         tiles_x, tiles_y, count};
+  uint64_t start = tile_now_ns();
+
+  if (width <= 0 || height <= 0)
+    return 0;
+  if (count > tr->timings_cap) {
+    uint64_t *timings = realloc(tr->timings, count * sizeof(uint64_t));
+    if (!timings) {
+      err_log("%s: no enough memory\n", __func__);
+      return 1;
+    }
+    tr->timings = timings;
+    tr->timings_cap = count;
+  }
+
+  if (tr->jobs) {
+    tr->job = job;
+    /* a tile a range, thieves split them like any other range */
+    job_parallel_for(tr->jobs, count, 1, tile_renderer_range, tr);
+    tile_renderer_collect_stats(tr, tile_now_ns() - start);
+    return 0;
+  }
+
+  pthread_mutex_lock(&tr->lock);
+  /* a worker late for the previous job may still be looking at it */
+  while (tr->active > 0)
+    pthread_cond_wait(&tr->done_cond, &tr->lock);
+  tr->job = job;
+  __atomic_store_n(&tr->next_tile, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&tr->done_tiles, 0, __ATOMIC_RELAXED);
+  tr->generation++;
+  if (tr->worker_count)
+    pthread_cond_broadcast(&tr->work_cond);
+  pthread_mutex_unlock(&tr->lock);
+
+  tile_renderer_work(tr);
+
+  /* the join: every tile is in the buffer once this returns */
+  pthread_mutex_lock(&tr->lock);
+  while (__atomic_load_n(&tr->done_tiles, __ATOMIC_ACQUIRE) < count)
+    pthread_cond_wait(&tr->done_cond, &tr->lock);
+  pthread_mutex_unlock(&tr->lock);
+  tile_renderer_collect_stats(tr, tile_now_ns() - start);
+  return 0;
+}
+
+void tile_renderer_get_stats(struct tile_renderer *tr, struct tile_stats *stats) {
+  *stats = tr->stats;
+}
+
+const uint64_t *tile_renderer_timings(struct tile_renderer *tr, int *tiles_x,
+                                      int *tiles_y) {
+  *tiles_x = tr->job.tiles_x;
+  *tiles_y = tr->job.tiles_y;
+  return tr->timings;
+}
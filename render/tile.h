@@ -0,0 +1,62 @@
+#ifndef _TILE_H_
+#define _TILE_H_
+
+#include <stdint.h>
+
+#include "../core/job.h"
+#include "damage.h"
+
+#define TILE_SIZE_DEFAULT 64
+
+/*
+ * Engine settings of the tile renderer. thread_count counts the calling
+ * thread, which renders tiles too, so 1 means no worker threads. With
+ * jobs the tiles run on that job system instead and no thread is made,
+ * thread_count is ignored then.
+ */
+struct tile_renderer_config {
+  int thread_count;
+  int tile_size;
+  struct job_system *jobs; // NULL for threads of its own
+};
+
+/* renders the (x, y, width, height) part of the buffer starting at pixels */
+typedef void (*tile_render_fn)(void *data, uint32_t *pixels, int stride,
+                               int x, int y, int width, int height);
+
+struct tile_stats {
+  int tile_count; // tiles rendered by the last run
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t total_ns; // the sum over tiles, i.e. the cpu time
+  uint64_t wall_ns;  // from the start of the run to the join
+};
+
+struct tile_renderer;
+
+/* the online cpus and TILE_SIZE_DEFAULT, overridden by DRAW_ENGINE_THREADS
+ * and DRAW_ENGINE_TILE_SIZE, no job system */
+void tile_renderer_config_default(struct tile_renderer_config *cfg);
+
+struct tile_renderer *tile_renderer_make(const struct tile_renderer_config *cfg);
+void tile_renderer_free(struct tile_renderer **ptr);
+/* a process wide renderer with the default config, made on first use */
+struct tile_renderer *tile_renderer_default(void);
+/* tiles start at multiples of it */
+int tile_renderer_tile_size(struct tile_renderer *tr);
+
+/*
+ * Split the buffer into tiles and render them on the pool, returns once
+ * every tile is done. With a clip region only the parts of the tiles
+ * inside its rects are rendered and tiles outside it cost nothing.
+ */
+int tile_renderer_run(struct tile_renderer *tr, uint32_t *pixels, int width,
+                      int height, int stride, const struct damage_region *clip,
+                      tile_render_fn fn, void *data);
+
+void tile_renderer_get_stats(struct tile_renderer *tr, struct tile_stats *stats);
+/* per tile timings of the last run in ns, row major, 0 for skipped tiles */
+const uint64_t *tile_renderer_timings(struct tile_renderer *tr, int *tiles_x,
+                                      int *tiles_y);
+
+#endif
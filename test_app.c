@@ -1,28 +1,994 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "utils/utils.h"
 #include "core/app.h"
+#include "core/buddy.h"
+#include "core/frame.h"
+#include "core/timing.h"
+#include "core/trace.h"
+#include "render/blend.h"
+#include "render/blit.h"
+#include "render/cpu.h"
+#include "render/display-list.h"
+#include "render/draw.h"
+#include "render/fill.h"
+#include "render/format.h"
+#include "render/path.h"
+#include "render/scene.h"
+#include "render/stroke.h"
+#include "render/text.h"
 
-void test_app_init_render()
+void test_app_init_render(struct app* app)
 {
+  (void)app;
   log("%s: begin\n", __func__);
   log("%s: end\n", __func__);
 }
 
-void test_app_init_display()
+void test_app_init_display(struct app* app)
 {
+  (void)app;
   log("%s: begin\n", __func__);
   log("%s: end\n", __func__);
 }
 
-void test_app_run_main_loop()
+#define TEST_APP_ITEMS 100000
+
+static int test_app_failed = 0;
+
+static void test_app_sum_range(void *data, int begin, int end)
+{
+  uint64_t *sums = (uint64_t *)data;
+  for (int i = begin; i < end; i++)
+    sums[i] = (uint64_t)i * i;
+}
+
+struct test_app_stage {
+  int *order;
+  int *next;
+  int stage;
+};
+
+static void test_app_run_stage(struct job_system *js, void *data)
+{
+  struct test_app_stage *stage = (struct test_app_stage *)data;
+  (void)js;
+  stage->order[stage->stage] = __atomic_fetch_add(stage->next, 1,
+                                                  __ATOMIC_RELAXED);
+}
+
+#define TEST_APP_REFRESH_NS 16666667ull
+#define TEST_APP_RENDER_NS 3000000ull
+
+/* a 60 Hz display fed frame callbacks, the third to last frame is late */
+static void test_app_frame_pacing(void)
+{
+  struct frame_scheduler_config cfg = {
+    .target_fps = 0.0,
+    .margin_ns = FRAME_DEFAULT_MARGIN_NS,
+  };
+  struct frame_scheduler *fs = frame_scheduler_make(&cfg);
+  struct frame_scheduler_stats stats;
+  uint64_t vblank = 1000000000ull;
+  int frames = 120;
+
+  if (!fs) {
+    test_app_failed = 1;
+    return;
+  }
+  for (int i = 0; i < frames; i++) {
+    uint64_t now = vblank + 300000;
+    uint64_t start;
+    int64_t error;
+
+    frame_scheduler_frame_done(fs, (uint32_t)(vblank / 1000000), now);
+    start = frame_scheduler_next_start(fs, now);
+    frame_scheduler_get_stats(fs, &stats);
+    error = (int64_t)(start + stats.render_budget_ns) -
+            (int64_t)(vblank + TEST_APP_REFRESH_NS);
+    if (i > 8 && (start < now || error > 1000000 || error < -1000000)) {
+      err_log("%s: frame %d aimed %ld ns off the vblank\n", __func__, i,
+              (long)error);
+      test_app_failed = 1;
+      break;
+    }
+    frame_scheduler_render_begin(fs, start);
+    frame_scheduler_render_end(fs, start + TEST_APP_RENDER_NS);
+    vblank += TEST_APP_REFRESH_NS;
+    if (i == frames - 3)
+      vblank += TEST_APP_REFRESH_NS;
+  }
+  frame_scheduler_get_stats(fs, &stats);
+  if (stats.refresh_ns + 100000 < TEST_APP_REFRESH_NS ||
+      stats.refresh_ns > TEST_APP_REFRESH_NS + 100000 || stats.missed != 1) {
+    err_log("%s: refresh %lu ns, missed %lu\n", __func__,
+            (unsigned long)stats.refresh_ns, (unsigned long)stats.missed);
+    test_app_failed = 1;
+  }
+  log("%s: refresh: %lu ns, jitter: %lu ns, frames: %lu, missed: %lu\n",
+      __func__, (unsigned long)stats.refresh_ns, (unsigned long)stats.jitter_ns,
+      (unsigned long)stats.frames, (unsigned long)stats.missed);
+  frame_scheduler_free(&fs);
+}
+
+/* 1..1000 us recorded from the workers, percentiles are within a bucket */
+static void test_app_record_range(void *data, int begin, int end)
+{
+  struct timing_histogram *h = (struct timing_histogram *)data;
+  for (int i = begin; i < end; i++)
+    timing_histogram_record(h, (uint64_t)(i + 1) * 1000);
+}
+
+static void test_app_histogram(struct app *app)
+{
+  struct timing_histogram *h = calloc(1, sizeof(struct timing_histogram));
+  struct timing_summary s;
+
+  if (!h) {
+    test_app_failed = 1;
+    return;
+  }
+  job_parallel_for(app->jobs, 1000, 16, test_app_record_range, h);
+  timing_histogram_summary(h, &s);
+  if (s.count != 1000 || s.max_ns != 1000000 ||
+      s.p50_ns < 500000 || s.p50_ns > 500000 + 500000 / 8 ||
+      s.p99_ns < 990000 || s.p99_ns > 1000000) {
+    err_log("%s: n %lu, p50 %lu, p99 %lu, max %lu\n", __func__,
+            (unsigned long)s.count, (unsigned long)s.p50_ns,
+            (unsigned long)s.p99_ns, (unsigned long)s.max_ns);
+    test_app_failed = 1;
+  }
+  free(h);
+}
+
+/* mixed sizes split the arena, freeing them merges it back whole */
+static void test_app_buddy(void)
+{
+  static const size_t sizes[] = {4096, 100, 20000, 65536, 8192, 1, 300000};
+  struct buddy_allocator *ba = buddy_allocator_make(1 << 20, 4096);
+  long offsets[sizeof(sizes) / sizeof(sizes[0])];
+  struct buddy_stats stats;
+  int n = (int)(sizeof(sizes) / sizeof(sizes[0]));
+
+  if (!ba) {
+    test_app_failed = 1;
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    offsets[i] = buddy_alloc(ba, sizes[i]);
+    if (offsets[i] < 0 || buddy_block_size(ba, offsets[i]) < sizes[i] ||
+        offsets[i] % buddy_block_size(ba, offsets[i])) {
+      err_log("%s: %zu got %ld\n", __func__, sizes[i], offsets[i]);
+      test_app_failed = 1;
+    }
+  }
+  /* no room left for 1 MiB until the arena doubles */
+  if (buddy_alloc(ba, 1 << 20) >= 0 || buddy_allocator_grow(ba) ||
+      buddy_alloc(ba, 1 << 20) != 1 << 20) {
+    err_log("%s: growing the arena failed\n", __func__);
+    test_app_failed = 1;
+  }
+  buddy_release(ba, 1 << 20);
+  for (int i = n - 1; i >= 0; i -= 2)
+    buddy_release(ba, offsets[i]);
+  for (int i = n - 2; i >= 0; i -= 2)
+    buddy_release(ba, offsets[i]);
+  buddy_get_stats(ba, &stats);
+  if (stats.allocations || stats.used || stats.largest_free != 2 << 20) {
+    err_log("%s: %d allocations, %zu used, largest free %zu\n", __func__,
+            stats.allocations, stats.used, stats.largest_free);
+    test_app_failed = 1;
+  }
+  buddy_allocator_free(&ba);
+}
+
+#define TEST_APP_DRAW_SIZE 32
+
+static int test_app_count(const uint32_t *pixels, uint32_t color)
+{
+  int count = 0;
+  for (int i = 0; i < TEST_APP_DRAW_SIZE * TEST_APP_DRAW_SIZE; i++)
+    count += pixels[i] == color;
+  return count;
+}
+
+/* the halves of a square share their diagonal, each pixel is filled once */
+static void test_app_draw(void)
+{
+  uint32_t pixels[TEST_APP_DRAW_SIZE * TEST_APP_DRAW_SIZE];
+  uint32_t wide[300];
+  struct draw_surface surf;
+  int halves = 0;
+  int diagonal = 1;
+
+  draw_surface_init(&surf, pixels, TEST_APP_DRAW_SIZE * 4, TEST_APP_DRAW_SIZE,
+                    TEST_APP_DRAW_SIZE);
+  memset(pixels, 0, sizeof(pixels));
+  draw_fill_triangle(&surf, 4, 4, 20, 4, 20, 20, 1);
+  halves += test_app_count(pixels, 1);
+  memset(pixels, 0, sizeof(pixels));
+  draw_fill_triangle(&surf, 4, 4, 4, 20, 20, 20, 1);
+  halves += test_app_count(pixels, 1);
+  if (halves != 16 * 16) {
+    err_log("%s: the halves of a 16x16 square filled %d pixels\n", __func__,
+            halves);
+    test_app_failed = 1;
+  }
+  /* a line from outside the surface keeps to the diagonal */
+  memset(pixels, 0, sizeof(pixels));
+  draw_set_clip(&surf, 0, 0, 16, TEST_APP_DRAW_SIZE);
+  draw_line(&surf, -10, -10, 100, 100, 2);
+  draw_reset_clip(&surf);
+  for (int i = 0; i < 16; i++)
+    diagonal &= pixels[i * TEST_APP_DRAW_SIZE + i] == 2;
+  if (!diagonal || test_app_count(pixels, 2) != 16) {
+    err_log("%s: clipped line drew %d pixels\n", __func__,
+            test_app_count(pixels, 2));
+    test_app_failed = 1;
+  }
+  /* cells wider than a span period still alternate */
+  pixels_fill_checker_rect(wide, sizeof(wide), 0, 0, 300, 1, 129, 1, 2);
+  if (wide[128] != 1 || wide[129] != 2 || wide[257] != 2 || wide[258] != 1) {
+    err_log("%s: a checker of 129 pixel cells is wrong\n", __func__);
+    test_app_failed = 1;
+  }
+}
+
+#define TEST_APP_BLEND_SIZE 67 // vector bodies and a scalar tail
+
+/* the vector kernels round like the scalar ones, every op, with a mask */
+static void test_app_blend(void)
+{
+  uint32_t src[TEST_APP_BLEND_SIZE];
+  uint32_t dst[TEST_APP_BLEND_SIZE];
+  uint32_t ref[TEST_APP_BLEND_SIZE];
+  uint32_t out[TEST_APP_BLEND_SIZE];
+  uint8_t mask[TEST_APP_BLEND_SIZE];
+  uint32_t color = blend_premultiply(0x80336699);
+
+  for (int i = 0; i < TEST_APP_BLEND_SIZE; i++) {
+    src[i] = blend_premultiply(0x01234567u * (i + 1) + (uint32_t)i * 40503u);
+    dst[i] = 0x9E3779B9u * (i + 1);
+    mask[i] = (uint8_t)(i * 37);
+  }
+  for (int op = BLEND_OP_SRC; op <= BLEND_OP_ADD; op++) {
+    for (int solid = 0; solid < 2; solid++) {
+      blend_kernels_select(0);
+      memcpy(ref, dst, sizeof(ref));
+      if (solid)
+        blend_span_solid(op, ref, color, mask, TEST_APP_BLEND_SIZE);
+      else
+        blend_span(op, ref, src, TEST_APP_BLEND_SIZE);
+      blend_kernels_select(cpu_features());
+      memcpy(out, dst, sizeof(out));
+      if (solid)
+        blend_span_solid(op, out, color, mask, TEST_APP_BLEND_SIZE);
+      else
+        blend_span(op, out, src, TEST_APP_BLEND_SIZE);
+      if (memcmp(out, ref, sizeof(out))) {
+        err_log("%s: %s %s differs from scalar\n", __func__,
+                blend_kernels_name(), blend_op_name(op));
+        test_app_failed = 1;
+      }
+    }
+  }
+  /* half white over black is mid gray */
+  out[0] = 0xFF000000;
+  blend_span_solid(BLEND_OP_SRC_OVER, out, blend_premultiply(0x80FFFFFF),
+                   NULL, 1);
+  if (out[0] != 0xFF808080) {
+    err_log("%s: src over gave %08x\n", __func__, out[0]);
+    test_app_failed = 1;
+  }
+}
+
+/* a two pixel ramp stretched fourfold, samples at the pixel centers */
+static void test_app_blit(void)
+{
+  static const uint32_t expected[8] = {
+    0xFF000000, 0xFF000000, 0xFF202020, 0xFF606060,
+    0xFF9F9F9F, 0xFFDFDFDF, 0xFFFFFFFF, 0xFFFFFFFF,
+  };
+  uint16_t ramp[2] = {0x0000, 0xFFFF}; // black and white RGB565
+  struct blit_image image = {ramp, sizeof(ramp), 2, 1, PIXEL_FORMAT_RGB565};
+  uint32_t pixels[8];
+  struct draw_surface surf;
+
+  draw_surface_init(&surf, pixels, sizeof(pixels), 8, 1);
+  blit_image(&surf, 0, 0, 8, 1, &image, 0, 0, 2, 1, BLIT_FILTER_BILINEAR,
+             BLEND_OP_SRC);
+  if (memcmp(pixels, expected, sizeof(pixels))) {
+    err_log("%s: got %08x %08x %08x %08x %08x %08x %08x %08x\n", __func__,
+            pixels[0], pixels[1], pixels[2], pixels[3], pixels[4], pixels[5],
+            pixels[6], pixels[7]);
+    test_app_failed = 1;
+  }
+}
+
+#define TEST_APP_DL_SIZE 50 // tiles of 8, a partial one at the edges
+
+/* tiles replayed on the job system give the pixels of drawing straight */
+static void test_app_display_list(struct app *app)
+{
+  static uint32_t direct[TEST_APP_DL_SIZE * TEST_APP_DL_SIZE];
+  static uint32_t tiled[TEST_APP_DL_SIZE * TEST_APP_DL_SIZE];
+  uint32_t ramp[4] = {0xFF0000FF, 0x80008000, 0xFFFF0000, 0x40404040};
+  struct blit_image image = {ramp, 8, 2, 2, PIXEL_FORMAT_ARGB8888};
+  struct tile_renderer_config cfg = {0, 8, app->jobs};
+  struct tile_renderer *tiles = tile_renderer_make(&cfg);
+  struct display_list *dl = display_list_make();
+  struct display_list_stats stats;
+  struct draw_surface surf;
+
+  if (!tiles || !dl) {
+    test_app_failed = 1;
+    goto out;
+  }
+  memset(direct, 0, sizeof(direct));
+  memset(tiled, 0, sizeof(tiled));
+  draw_surface_init(&surf, direct, TEST_APP_DL_SIZE * 4, TEST_APP_DL_SIZE,
+                    TEST_APP_DL_SIZE);
+  draw_fill_rect(&surf, 3, 5, 30, 20, 0xFF102030);
+  draw_line(&surf, -5, 2, 60, 41, 0xFFFFFFFF);
+  draw_fill_circle(&surf, 25, 25, 11, 0xFF00FF00);
+  draw_set_clip(&surf, 10, 10, 20, 30);
+  draw_fill_triangle(&surf, 0, 0, 49, 12, 7, 45, 0xFFFF00FF);
+  draw_reset_clip(&surf);
+  blit_image(&surf, 13, 29, 31, 17, &image, 0, 0, 2, 2, BLIT_FILTER_BILINEAR,
+             BLEND_OP_SRC_OVER);
+
+  display_list_fill_rect(dl, 3, 5, 30, 20, 0xFF102030);
+  display_list_line(dl, -5, 2, 60, 41, 0xFFFFFFFF);
+  display_list_fill_circle(dl, 25, 25, 11, 0xFF00FF00);
+  display_list_set_clip(dl, 10, 10, 20, 30);
+  display_list_fill_triangle(dl, 0, 0, 49, 12, 7, 45, 0xFFFF00FF);
+  display_list_fill_rect(dl, 40, 40, 5, 5, 0xFFFFFFFF); // outside the clip
+  display_list_reset_clip(dl);
+  display_list_blit(dl, 13, 29, 31, 17, &image, 0, 0, 2, 2,
+                    BLIT_FILTER_BILINEAR, BLEND_OP_SRC_OVER);
+  surf.pixels = tiled;
+  display_list_replay(dl, tiles, &surf, NULL);
+  display_list_get_stats(dl, &stats);
+  if (memcmp(direct, tiled, sizeof(direct)) || stats.commands != 5 ||
+      stats.culled != 1) {
+    err_log("%s: replay differs, %d commands, %d culled\n", __func__,
+            stats.commands, stats.culled);
+    test_app_failed = 1;
+  }
+out:
+  display_list_free(&dl);
+  tile_renderer_free(&tiles);
+}
+
+#define TEST_APP_SCENE_SIZE 64
+#define TEST_APP_SCENE_STEPS 6
+
+struct test_app_scene {
+  struct scene *scene;
+  struct scene_node *card; // cached, with the rect and the circle
+  struct scene_node *rect;
+  struct scene_node *circle;
+  struct scene_node *dot;
+};
+
+static int test_app_scene_make(struct test_app_scene *s)
+{
+  struct scene_node *checker;
+
+  memset(s, 0, sizeof(*s));
+  s->scene = scene_make(0xFF202020);
+  if (!s->scene)
+    return 1;
+  checker = scene_node_make(s->scene, NULL);
+  s->card = scene_node_make(s->scene, NULL);
+  s->rect = scene_node_make(s->scene, s->card);
+  s->circle = scene_node_make(s->scene, s->card);
+  s->dot = scene_node_make(s->scene, NULL);
+  if (!checker || !s->card || !s->rect || !s->circle || !s->dot)
+    return 1;
+  scene_node_set_checker(checker, 48, 48, 4, 0xFF000000, 0xFFFFFFFF);
+  return 0;
+}
+
+/* the nodes as of a step, setting what did not change changes nothing */
+static void test_app_scene_set(struct test_app_scene *s, int step)
+{
+  scene_node_set_position(s->card, step >= 1 ? 17 : 8, 10);
+  scene_node_set_cached(s->card, step < 4);
+  scene_node_set_rect(s->rect, 20, 14, step >= 2 ? 0xFFFF0000 : 0xFF0000FF);
+  scene_node_set_position(s->circle, 12, 6);
+  scene_node_set_circle(s->circle, 5, 0xFF00FF00);
+  scene_node_set_visible(s->circle, step < 3);
+  if (step >= 5)
+    scene_node_free(&s->dot);
+  if (s->dot) {
+    scene_node_set_position(s->dot, step * 5, 40);
+    scene_node_set_circle(s->dot, 3, 0xFFFFFF00);
+  }
+}
+
+/*
+ * Every step renders what a new scene would, changes nothing outside the
+ * damage, and moving a cached node does not draw its layer again.
+ */
+static void test_app_scene(void)
+{
+  static const int layers_drawn[TEST_APP_SCENE_STEPS] = {1, 0, 1, 1, 0, 0};
+  static uint32_t kept[TEST_APP_SCENE_SIZE * TEST_APP_SCENE_SIZE];
+  static uint32_t before[TEST_APP_SCENE_SIZE * TEST_APP_SCENE_SIZE];
+  static uint32_t fresh[TEST_APP_SCENE_SIZE * TEST_APP_SCENE_SIZE];
+  struct tile_renderer_config cfg = {2, 16, NULL};
+  struct tile_renderer *tiles = tile_renderer_make(&cfg);
+  struct test_app_scene s, ref;
+  struct draw_surface surf;
+  struct damage_region damage;
+  struct scene_stats stats;
+
+  if (!tiles || test_app_scene_make(&s)) {
+    test_app_failed = 1;
+    goto out;
+  }
+  draw_surface_init(&surf, kept, TEST_APP_SCENE_SIZE * 4,
+                    TEST_APP_SCENE_SIZE, TEST_APP_SCENE_SIZE);
+  for (int step = 0; step < TEST_APP_SCENE_STEPS; step++) {
+    int outside = 0;
+    test_app_scene_set(&s, step);
+    memcpy(before, kept, sizeof(kept));
+    damage_region_init(&damage, TEST_APP_SCENE_SIZE, TEST_APP_SCENE_SIZE);
+    scene_render(s.scene, tiles, &surf, &damage);
+    scene_get_stats(s.scene, &stats);
+    for (int y = 0; y < TEST_APP_SCENE_SIZE; y++) {
+      for (int x = 0; x < TEST_APP_SCENE_SIZE; x++) {
+        int in = 0;
+        for (int i = 0; i < damage.count; i++) {
+          struct damage_rect *r = &damage.rects[i];
+          in |= x >= r->x && x < r->x + r->width && y >= r->y &&
+                y < r->y + r->height;
+        }
+        outside += !in && kept[y * TEST_APP_SCENE_SIZE + x] !=
+                            before[y * TEST_APP_SCENE_SIZE + x];
+      }
+    }
+
+    if (test_app_scene_make(&ref)) {
+      test_app_failed = 1;
+      scene_free(&ref.scene);
+      goto out;
+    }
+    test_app_scene_set(&ref, step);
+    memset(fresh, 0, sizeof(fresh));
+    surf.pixels = fresh;
+    damage_region_init(&damage, TEST_APP_SCENE_SIZE, TEST_APP_SCENE_SIZE);
+    scene_render(ref.scene, tiles, &surf, &damage);
+    surf.pixels = kept;
+    scene_free(&ref.scene);
+    if (memcmp(kept, fresh, sizeof(kept)) || outside ||
+        stats.layers_drawn != layers_drawn[step] ||
+        (step && stats.damage_area >= TEST_APP_SCENE_SIZE * 40)) {
+      err_log("%s: step %d differs, %d pixels outside the damage, %d layers "
+              "drawn, %lu damaged\n", __func__, step, outside,
+              stats.layers_drawn, (unsigned long)stats.damage_area);
+      test_app_failed = 1;
+    }
+  }
+out:
+  scene_free(&s.scene);
+  tile_renderer_free(&tiles);
+}
+
+#define TEST_APP_TEXT_WIDTH 128
+#define TEST_APP_TEXT_HEIGHT 64
+
+static void test_app_put16(uint8_t *p, int v)
+{
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+/*
+ * A TrueType font of 64 units per em with two glyphs: 'A' a 48 unit
+ * square, 'B' the same corners off the curve, a rounded square of
+ * 10 / 3 * 24 * 24 units. Returns the size of the file.
+ */
+static size_t test_app_make_font(uint8_t *font)
+{
+  static const char *tags[] = {"cmap", "glyf", "head", "hhea", "hmtx",
+                               "loca", "maxp"};
+  static const int corners[4][2] = {{8, 0}, {8, 48}, {56, 48}, {56, 0}};
+  uint8_t tables[7][80];
+  size_t lengths[7] = {44, 72, 54, 36, 12, 8, 6};
+  size_t off = 12 + 7 * 16;
+
+  memset(tables, 0, sizeof(tables));
+  /* cmap: a format 4 subtable mapping 'A' and 'B' to glyphs 1 and 2 */
+  test_app_put16(tables[0] + 2, 1);
+  test_app_put16(tables[0] + 4, 3);
+  test_app_put16(tables[0] + 6, 1);
+  tables[0][11] = 12;
+  test_app_put16(tables[0] + 12, 4);
+  test_app_put16(tables[0] + 14, 32);
+  test_app_put16(tables[0] + 18, 4); // two segments
+  test_app_put16(tables[0] + 26, 'B');
+  test_app_put16(tables[0] + 28, 0xFFFF);
+  test_app_put16(tables[0] + 32, 'A');
+  test_app_put16(tables[0] + 34, 0xFFFF);
+  test_app_put16(tables[0] + 36, 1 - 'A');
+  test_app_put16(tables[0] + 38, 1);
+  /* glyf: one contour of four points each */
+  for (int g = 0; g < 2; g++) {
+    uint8_t *p = tables[1] + g * 36;
+    test_app_put16(p, 1);
+    test_app_put16(p + 2, 8);
+    test_app_put16(p + 6, 56);
+    test_app_put16(p + 8, 48);
+    test_app_put16(p + 10, 3);
+    for (int i = 0; i < 4; i++) {
+      p[14 + i] = g == 0; // on the curve
+      test_app_put16(p + 18 + i * 2, corners[i][0] - (i ? corners[i - 1][0] : 0));
+      test_app_put16(p + 26 + i * 2, corners[i][1] - (i ? corners[i - 1][1] : 0));
+    }
+  }
+  test_app_put16(tables[2] + 18, 64); // units per em
+  test_app_put16(tables[3] + 4, 56); // ascent
+  test_app_put16(tables[3] + 6, -8);
+  test_app_put16(tables[3] + 34, 3);
+  for (int g = 0; g < 3; g++)
+    test_app_put16(tables[4] + g * 4, 64);
+  test_app_put16(tables[5] + 4, 18);
+  test_app_put16(tables[5] + 6, 36);
+  test_app_put16(tables[6] + 4, 3);
+
+  memset(font, 0, 12);
+  font[1] = 1; // version 1.0
+  test_app_put16(font + 4, 7);
+  for (int t = 0; t < 7; t++) {
+    uint8_t *rec = font + 12 + t * 16;
+    memcpy(rec, tags[t], 4);
+    memset(rec + 4, 0, 12);
+    test_app_put16(rec + 10, (int)off);
+    test_app_put16(rec + 14, (int)lengths[t]);
+    memcpy(font + off, tables[t], lengths[t]);
+    off += (lengths[t] + 3) & ~(size_t)3;
+  }
+  return off;
+}
+
+static uint64_t test_app_text_draw(struct text_cache *cache,
+                                   struct draw_surface *surf,
+                                   struct font *font, float x,
+                                   const char *text, int *full)
+{
+  uint64_t coverage = 0;
+
+  for (int i = 0; i < TEST_APP_TEXT_WIDTH * TEST_APP_TEXT_HEIGHT; i++)
+    surf->pixels[i] = 0xFF000000;
+  text_draw(cache, surf, font, 64, x, 56, text, 0xFFFFFFFF);
+  *full = 0;
+  for (int i = 0; i < TEST_APP_TEXT_WIDTH * TEST_APP_TEXT_HEIGHT; i++) {
+    coverage += surf->pixels[i] & 0xFF;
+    *full += surf->pixels[i] == 0xFFFFFFFF;
+  }
+  return coverage;
+}
+
+/* a square covers its pixels exactly, on a pixel boundary or half way */
+static void test_app_text(void)
+{
+  static uint8_t data[512];
+  static uint32_t pixels[TEST_APP_TEXT_WIDTH * TEST_APP_TEXT_HEIGHT];
+  struct font *font = font_make(data, test_app_make_font(data));
+  struct text_cache *cache = text_cache_make(128, 128);
+  struct text_cache_stats stats;
+  struct draw_surface surf;
+  uint64_t coverage;
+  int full;
+
+  if (!font || !cache) {
+    test_app_failed = 1;
+    goto out;
+  }
+  draw_surface_init(&surf, pixels, TEST_APP_TEXT_WIDTH * 4,
+                    TEST_APP_TEXT_WIDTH, TEST_APP_TEXT_HEIGHT);
+  coverage = test_app_text_draw(cache, &surf, font, 0, "AA", &full);
+  if (font_glyph_index(font, 'B') != 2 || font_glyph_index(font, 'C') != 0 ||
+      full != 2 * 48 * 48 || coverage != 2 * 48 * 48 * 255) {
+    err_log("%s: squares filled %d pixels, %lu coverage\n", __func__, full,
+            (unsigned long)coverage);
+    test_app_failed = 1;
+  }
+  test_app_text_draw(cache, &surf, font, 0.5f, "A", &full);
+  if (full != 47 * 48 || pixels[20 * TEST_APP_TEXT_WIDTH + 8] != 0xFF808080 ||
+      pixels[20 * TEST_APP_TEXT_WIDTH + 56] != 0xFF808080) {
+    err_log("%s: the half pixel square filled %d pixels\n", __func__, full);
+    test_app_failed = 1;
+  }
+  /* the area of the curve within a percent, flattening cuts it short */
+  coverage = test_app_text_draw(cache, &surf, font, 0, "B", &full);
+  if (coverage < 1900 * 255 || coverage > 1940 * 255) {
+    err_log("%s: the rounded square covers %lu\n", __func__,
+            (unsigned long)(coverage / 255));
+    test_app_failed = 1;
+  }
+  text_cache_get_stats(cache, &stats);
+  if (stats.lookups != 4 || stats.hits != 1 || stats.glyphs != 3) {
+    err_log("%s: %lu lookups, %lu hits, %d glyphs\n", __func__,
+            (unsigned long)stats.lookups, (unsigned long)stats.hits,
+            stats.glyphs);
+    test_app_failed = 1;
+  }
+out:
+  text_cache_free(&cache);
+  font_free(&font);
+}
+
+#define TEST_APP_PATH_SIZE 64
+
+/* the sum of the coverage of a path over the whole test box */
+static uint64_t test_app_path_area(const struct path *path,
+                                   enum path_fill_rule rule, uint8_t *cov) {
+  struct draw_rect box = {0, 0, TEST_APP_PATH_SIZE, TEST_APP_PATH_SIZE};
+  uint64_t sum = 0;
+
+  if (path_rasterize(path, rule, &box, cov, TEST_APP_PATH_SIZE))
+    return 0;
+  for (int i = 0; i < TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE; i++)
+    sum += cov[i];
+  return sum;
+}
+
+/*
+ * Rects on pixel boundaries cover whole pixels, the rules differ on a
+ * rect inside another, a circle covers its area, the vector kernels give
+ * the scalar coverage and a clipped fill the pixels of an unclipped one,
+ * all of them give or take one in 255.
+ */
+static void test_app_path(void)
+{
+  static uint8_t cov[TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE];
+  static uint8_t ref[TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE];
+  static uint32_t pixels[2][TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE];
+  struct path *path = path_make();
+  struct draw_surface surf;
+  uint64_t nonzero, even_odd, circle;
+
+  if (!path || path_add_rect(path, 8, 8, 48, 48, 0) ||
+      path_add_rect(path, 24, 24, 16, 16, 0)) {
+    test_app_failed = 1;
+    goto out;
+  }
+  nonzero = test_app_path_area(path, PATH_FILL_NONZERO, cov);
+  even_odd = test_app_path_area(path, PATH_FILL_EVEN_ODD, cov);
+  if (nonzero != 48 * 48 * 255 || even_odd != (48 * 48 - 16 * 16) * 255) {
+    err_log("%s: nested rects cover %lu and %lu\n", __func__,
+            (unsigned long)(nonzero / 255), (unsigned long)(even_odd / 255));
+    test_app_failed = 1;
+  }
+  /* pi r^2 is 1809.6, within half a percent */
+  path_reset(path);
+  path_add_rect(path, 7.5f, 8.25f, 48, 48, 24);
+  path_kernels_select(0);
+  circle = test_app_path_area(path, PATH_FILL_NONZERO, ref);
+  path_kernels_select(cpu_features());
+  test_app_path_area(path, PATH_FILL_NONZERO, cov);
+  if (circle < 1800 * 255 || circle > 1819 * 255) {
+    err_log("%s: the circle covers %lu\n", __func__,
+            (unsigned long)(circle / 255));
+    test_app_failed = 1;
+  }
+  for (int i = 0; i < TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE; i++) {
+    if (cov[i] - ref[i] > 1 || ref[i] - cov[i] > 1) {
+      err_log("%s: %s coverage %d, scalar %d\n", __func__,
+              path_kernels_name(), cov[i], ref[i]);
+      test_app_failed = 1;
+      break;
+    }
+  }
+  /* a star crossing the clip, the lines are cut at both of its sides */
+  path_reset(path);
+  path_move_to(path, -10, 30);
+  path_line_to(path, 70, 5);
+  path_line_to(path, 20, 62);
+  path_line_to(path, 33, -4);
+  path_line_to(path, 60, 58);
+  path_close(path);
+  for (int n = 0; n < 2; n++) {
+    for (int i = 0; i < TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE; i++)
+      pixels[n][i] = 0xFF000000;
+    draw_surface_init(&surf, pixels[n], TEST_APP_PATH_SIZE * 4,
+                      TEST_APP_PATH_SIZE, TEST_APP_PATH_SIZE);
+    if (n)
+      draw_set_clip(&surf, 13, 3, 30, 50);
+    path_fill(&surf, path, PATH_FILL_EVEN_ODD, 0xFFFFFFFF);
+  }
+  for (int y = 0; y < TEST_APP_PATH_SIZE; y++) {
+    for (int x = 0; x < TEST_APP_PATH_SIZE; x++) {
+      int inside = x >= 13 && x < 43 && y >= 3 && y < 53;
+      uint32_t want = inside ? pixels[0][y * TEST_APP_PATH_SIZE + x]
+                             : 0xFF000000;
+      int diff = (int)(pixels[1][y * TEST_APP_PATH_SIZE + x] & 0xFF) -
+                 (int)(want & 0xFF);
+      /* cut lines round a little differently */
+      if (diff > 1 || diff < -1) {
+        err_log("%s: clipped pixel %d,%d is %08x, not %08x\n", __func__, x,
+                y, pixels[1][y * TEST_APP_PATH_SIZE + x], want);
+        test_app_failed = 1;
+        goto out;
+      }
+    }
+  }
+out:
+  path_free(&path);
+}
+
+/* the area a stroke covers, in pixels, -1 if it could not be made */
+static float test_app_stroke_area(struct path *path, const float *points,
+                                  int count, bool closed,
+                                  const struct stroke_style *style,
+                                  uint8_t *cov) {
+  path_reset(path);
+  if (stroke_polyline(path, points, count, closed, style))
+    return -1;
+  return test_app_path_area(path, PATH_FILL_NONZERO, cov) / 255.0f;
+}
+
+/*
+ * Strokes cover what their width, caps and joins add up to, the seams
+ * and overlaps of their pieces left out. A hairline on the middle of a
+ * row covers that row only.
+ */
+static void test_app_stroke(void)
+{
+  static const float line[] = {8, 32, 56, 32};
+  static const float corner[] = {8, 8, 40, 8, 40, 40};
+  static const float square[] = {16, 16, 48, 16, 48, 48, 16, 48};
+  static const float dashed[] = {0, 32, 64, 32};
+  static const float hair[] = {4.5f, 20.5f, 60.5f, 20.5f};
+  /* 8 x 48, the caps add 8 x 8 or a circle of 4 */
+  static const float caps[] = {384, 434.27f, 448};
+  /* the corner square, half of it or a quarter circle of 2 */
+  static const float joins[] = {256, 255.14f, 254};
+  static uint8_t cov[TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE];
+  static uint32_t pixels[TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE];
+  struct path *path = path_make();
+  struct stroke_style style;
+  struct draw_surface surf;
+  float area;
+
+  if (!path) {
+    test_app_failed = 1;
+    return;
+  }
+  stroke_style_init(&style, 8);
+  for (int cap = STROKE_CAP_BUTT; cap <= STROKE_CAP_SQUARE; cap++) {
+    style.cap = cap;
+    area = test_app_stroke_area(path, line, 2, false, &style, cov);
+    /* the chords of round caps cut off a pixel and a half */
+    if (area < caps[cap] - 2 || area > caps[cap] + 1) {
+      err_log("%s: cap %d covers %f, not %f\n", __func__, cap, area,
+              caps[cap]);
+      test_app_failed = 1;
+    }
+  }
+  stroke_style_init(&style, 4);
+  for (int join = STROKE_JOIN_MITER; join <= STROKE_JOIN_BEVEL; join++) {
+    style.join = join;
+    area = test_app_stroke_area(path, corner, 3, false, &style, cov);
+    if (area < joins[join] - 0.5f || area > joins[join] + 0.5f) {
+      err_log("%s: join %d covers %f, not %f\n", __func__, join, area,
+              joins[join]);
+      test_app_failed = 1;
+    }
+  }
+  /* a ring of 34 x 34 around a hole of 30 x 30 */
+  stroke_style_init(&style, 2);
+  area = test_app_stroke_area(path, square, 4, true, &style, cov);
+  if (area < 255.5f || area > 256.5f) {
+    err_log("%s: the closed square covers %f\n", __func__, area);
+    test_app_failed = 1;
+  }
+  /* 8 dashes of 4 x 2 */
+  style.dash_count = 2;
+  style.dashes[0] = 4;
+  style.dashes[1] = 4;
+  area = test_app_stroke_area(path, dashed, 2, false, &style, cov);
+  if (area < 63.5f || area > 64.5f ||
+      cov[32 * TEST_APP_PATH_SIZE + 2] != 255 ||
+      cov[32 * TEST_APP_PATH_SIZE + 6] != 0) {
+    err_log("%s: the dashes cover %f\n", __func__, area);
+    test_app_failed = 1;
+  }
+  /* a dash going back is refused */
+  style.dashes[1] = -4;
+  if (test_app_stroke_area(path, dashed, 2, false, &style, cov) != -1) {
+    err_log("%s: a dash of -4 is stroked\n", __func__);
+    test_app_failed = 1;
+  }
+  for (int i = 0; i < TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE; i++)
+    pixels[i] = 0xFF000000;
+  draw_surface_init(&surf, pixels, TEST_APP_PATH_SIZE * 4,
+                    TEST_APP_PATH_SIZE, TEST_APP_PATH_SIZE);
+  stroke_style_init(&style, 1);
+  stroke_draw(&surf, path, hair, 2, false, &style, 0xFFFFFFFF);
+  for (int i = 0; i < TEST_APP_PATH_SIZE * TEST_APP_PATH_SIZE; i++) {
+    int x = i % TEST_APP_PATH_SIZE, y = i / TEST_APP_PATH_SIZE;
+    uint32_t want = 0xFF000000;
+    if (y == 20 && x > 4 && x < 60)
+      want = 0xFFFFFFFF;
+    else if (y == 20 && (x == 4 || x == 60))
+      want = 0xFF808080;
+    if (pixels[i] != want) {
+      err_log("%s: hairline pixel %d,%d is %08x, not %08x\n", __func__, x,
+              y, pixels[i], want);
+      test_app_failed = 1;
+      break;
+    }
+  }
+  path_free(&path);
+}
+
+#define TEST_APP_RGB565_SIZE 37 // vector bodies and a scalar tail
+
+/* packing takes every RGB565 pixel back to itself, dithered or not */
+static void test_app_rgb565(void)
+{
+  uint32_t argb[TEST_APP_RGB565_SIZE];
+  uint16_t packed[TEST_APP_RGB565_SIZE];
+  uint16_t span[TEST_APP_RGB565_SIZE + 1];
+  uint16_t wide[300];
+  static const uint16_t period[4] = {1, 2, 3, 4};
+
+  for (int p = 0; p < 65536; p += TEST_APP_RGB565_SIZE) {
+    for (int i = 0; i < TEST_APP_RGB565_SIZE; i++)
+      argb[i] = pixel_unpack_rgb565((uint16_t)(p + i));
+    for (int dither = 0; dither < 2; dither++) {
+      pixels_pack_rgb565(packed, argb, TEST_APP_RGB565_SIZE, p, p / 3,
+                         dither);
+      for (int i = 0; i < TEST_APP_RGB565_SIZE; i++) {
+        if (packed[i] != (uint16_t)(p + i)) {
+          err_log("%s: %04x packed to %04x\n", __func__, (p + i) & 0xFFFF,
+                  packed[i]);
+          test_app_failed = 1;
+          return;
+        }
+      }
+    }
+  }
+  /* a span at an odd address keeps the phase of its period */
+  memset(span, 0, sizeof(span));
+  span_fill16_periodic(span + 1, TEST_APP_RGB565_SIZE, period, 4, 3);
+  for (int i = 0; i < TEST_APP_RGB565_SIZE; i++) {
+    if (span[i + 1] != period[(i + 3) % 4]) {
+      err_log("%s: periodic span pixel %d is %u\n", __func__, i,
+              span[i + 1]);
+      test_app_failed = 1;
+      return;
+    }
+  }
+  /* cells too wide for a period, odd dithered ones sooner */
+  for (int dither = 0; dither < 2; dither++) {
+    int cell = dither ? 65 : 129;
+    pixels_fill_checker_rect_format(wide, sizeof(wide), PIXEL_FORMAT_RGB565,
+                                    dither, 0, 0, 300, 1, cell, 0xFF000000,
+                                    0xFFFFFFFF);
+    if (wide[cell - 1] != 0 || wide[cell] != 0xFFFF ||
+        wide[2 * cell - 1] != 0xFFFF || wide[2 * cell] != 0) {
+      err_log("%s: a checker of %d pixel cells is wrong\n", __func__, cell);
+      test_app_failed = 1;
+    }
+  }
+  if (!pixels_fill_rect_format(wide, sizeof(wide), PIXEL_FORMAT_RGBA8888, 0,
+                               0, 0, 1, 1, 0xFFFFFFFF)) {
+    err_log("%s: filling RGBA8888 did not fail\n", __func__);
+    test_app_failed = 1;
+  }
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+static void test_app_trace_range(void *data, int begin, int end)
+{
+  (void)data;
+  for (int i = begin; i < end; i++)
+    trace("item %d of %lu, %x %s\n", i, 1000ul, 0x2a, "done");
+}
+
+/* every record from the workers comes out formatted once */
+static void test_app_trace(struct app *app)
 {
+  FILE *out = tmpfile();
+  struct trace_stats stats;
+  char line[256];
+  int lines = 0;
+  bool found = false;
+
+  if (!out || trace_start(out)) {
+    test_app_failed = 1;
+    return;
+  }
+  job_parallel_for(app->jobs, 1000, 16, test_app_trace_range, NULL);
+  trace_stop();
+  trace_get_stats(&stats);
+  rewind(out);
+  while (fgets(line, sizeof(line), out)) {
+    lines++;
+    if (strstr(line, "test_app_trace_range: item 999 of 1000, 2a done\n"))
+      found = true;
+  }
+  fclose(out);
+  if (lines != 1000 || !found || stats.records != 1000 || stats.dropped) {
+    err_log("%s: %d lines, %lu records, %lu dropped\n", __func__, lines,
+            (unsigned long)stats.records, (unsigned long)stats.dropped);
+    test_app_failed = 1;
+  }
+}
+#endif
+
+void test_app_run_main_loop(struct app* app)
+{
+  uint64_t *sums = calloc(TEST_APP_ITEMS, sizeof(uint64_t));
+  uint64_t total = 0;
+  uint64_t expected = 0;
+  struct job_counter first = JOB_COUNTER_INIT;
+  struct job_counter second = JOB_COUNTER_INIT;
+  struct test_app_stage stages[2];
+  int order[2] = {-1, -1};
+  int next = 0;
+
   log("%s: begin\n", __func__);
+  if (!sums) {
+    test_app_failed = 1;
+    return;
+  }
+  /* fan out across the job system */
+  job_parallel_for(app->jobs, TEST_APP_ITEMS, 1024, test_app_sum_range, sums);
+  for (int i = 0; i < TEST_APP_ITEMS; i++) {
+    total += sums[i];
+    expected += (uint64_t)i * i;
+  }
+  if (total != expected) {
+    err_log("%s: parallel sum %lu, expected %lu\n", __func__,
+            (unsigned long)total, (unsigned long)expected);
+    test_app_failed = 1;
+  }
+  free(sums);
+
+  /* the second stage only runs once the first is done */
+  for (int i = 0; i < 2; i++) {
+    stages[i].order = order;
+    stages[i].next = &next;
+    stages[i].stage = i;
+  }
+  job_run(app->jobs, test_app_run_stage, &stages[0], &first);
+  job_run_after(app->jobs, &first, test_app_run_stage, &stages[1], &second);
+  job_wait(app->jobs, &second);
+  if (order[0] != 0 || order[1] != 1) {
+    err_log("%s: stages ran as %d, %d\n", __func__, order[0], order[1]);
+    test_app_failed = 1;
+  }
+  log("%s: %d threads\n", __func__, job_system_thread_count(app->jobs));
+  test_app_frame_pacing();
+  test_app_histogram(app);
+  test_app_buddy();
+  test_app_draw();
+  test_app_blend();
+  test_app_blit();
+  test_app_rgb565();
+  test_app_display_list(app);
+  test_app_scene();
+  test_app_text();
+  test_app_path();
+  test_app_stroke();
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+  test_app_trace(app);
+#endif
   log("%s: end\n", __func__);
 }
 
-void test_app_cleanup()
+void test_app_cleanup(struct app* app)
 {
+  (void)app;
   log("%s: begin\n", __func__);
   log("%s: end\n", __func__);
 }
@@ -36,11 +1002,12 @@ static struct app_ops test_app_ops = {
 };
 
 
-int main(int argc, char **argv) {
+int main(void) {
   struct app* test_app = NULL;
   int ret = 0;
   struct app_config test_cfg = {
     .name = "test app",
+    .thread_count = 4, // workers even on a single cpu box
   };
   test_app = app_make(&test_cfg, &test_app_ops);
   ret = app_run(test_app);
@@ -49,5 +1016,5 @@ int main(int argc, char **argv) {
   }
 
   app_free(&test_app);
-  return 0;
+  return ret || test_app_failed;
 }
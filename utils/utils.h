@@ -5,11 +5,36 @@
 #include <errno.h>
 #include <string.h>
 
+/*
+ * Compile time log levels, e.g. -DLOG_LEVEL=LOG_LEVEL_ERROR. What is
+ * below the level is compiled out, err_log() always stays:
+ *   LOG_LEVEL_INFO   log(), formatted to stdout right away
+ *   LOG_LEVEL_TRACE  trace() from core/trace.h, binary records formatted
+ *                    off the hot path
+ */
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_TRACE 2
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_TRACE
+#endif
+
 #define err_log(fmt, ...)                                                      \
   do {                                                                         \
     fprintf(stderr, "err msg: %s. ", strerror(errno));                         \
     fprintf(stderr, fmt, ##__VA_ARGS__);                                       \
   } while(0)
+
+/* still type checked when compiled out */
+#if LOG_LEVEL >= LOG_LEVEL_INFO
 #define log(fmt, ...) fprintf(stdout, fmt, ##__VA_ARGS__)
+#else
+#define log(fmt, ...)                                                          \
+  do {                                                                         \
+    if (0)                                                                     \
+      fprintf(stdout, fmt, ##__VA_ARGS__);                                     \
+  } while(0)
+#endif
 
 #endif